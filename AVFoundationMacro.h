@@ -14,6 +14,8 @@
 
 /*
  * サンプルバッファを画像としてカメラロールに保存する。
+ * 先に #import "JPEGPhotoWriter.h" しておくと、JPEGを再エンコードせずにそのまま保存する。
+ * (保存待ちが一杯の場合は、これまで通りUIImageで保存する)
  */
 NS_INLINE UIImage*
 CMSampleBufferWriteToSavedPhotosAlbum(CMSampleBufferRef imageDataSampleBuffer){
@@ -22,6 +24,11 @@ CMSampleBufferWriteToSavedPhotosAlbum(CMSampleBufferRef imageDataSampleBuffer){
     // UIImage作成
     UIImage* image = [UIImage imageWithData:jpeg_data];
     // カメラロールへ保存
+#ifdef TYABUTA_JPEG_PHOTO_WRITER_H
+    if ([[JPEGPhotoWriter sharedWriter] writeJPEGData:jpeg_data orientation:0 completion:nil]) {
+        return image;
+    }
+#endif
     UIImageWriteToSavedPhotosAlbum(image, nil, nil, nil);
     return image;
 }
@@ -58,6 +65,29 @@ NS_INLINE void AVCaptureStillImageWriteToSavedPhotosAlbum(AVCaptureStillImageOut
      });
 }
 
+#ifdef TYABUTA_BURST_CAPTURE_PIPELINE_H
+/*
+ * キャプチャから静止画を取得し、連写用のパイプラインに投入する。
+ * 先に #import "BurstCapturePipeline.h" しておくと使える。
+ * stillImageOutputのoutputSettingsは[BurstCapturePipeline stillImageOutputSettings]にしておく。
+ * 変換、エンコード、保存は撮影の完了ブロックの外で行うので、すぐに次の撮影ができる。
+ */
+NS_INLINE void
+AVCaptureStillImageSubmitToBurstPipeline(AVCaptureStillImageOutput* stillImageOutput,
+                                         BurstCapturePipeline* pipeline, int orientation) {
+    AVCaptureStillImageAsynchronously
+    (stillImageOutput, ^(CMSampleBufferRef imageDataSampleBuffer, NSError* error)
+     {
+         if (error){
+             dmsg(@"Take picture failed %@", error);
+         }
+         else if (![pipeline submitSampleBuffer:imageDataSampleBuffer orientation:orientation]) {
+             dmsg(@"連写が保存に追いつかないので、捨てました。");
+         }
+     });
+}
+#endif
+
 /*
  * キャプチャセッションにビデオの入力デバイスを追加する。
  * 入力デバイスの追加に成功した場合、YESを返す。
@@ -149,6 +179,104 @@ AVCaptureVideoPreviewLayerAddToLayer
 }
 
 
+#ifdef TYABUTA_YUV_CONVERTER_H
+/*
+ * キャプチャしたYUV420(kCVPixelFormatType_420YpCbCr8BiPlanar~)のフレームを、
+ * UIImageを経由せずにRGBA/BGRAへ変換する。
+ * 先に #import "YUVConverter.h" しておくと使える。
+ * レンジはフォーマットから、色空間はバッファの添付情報から決める。
+ * dstの大きさはYUVConvertOutputSizeで求めておく。
+ * 変換できた場合、YESを返す。
+ */
+NS_INLINE BOOL
+CVPixelBufferConvertToRGBA(CVPixelBufferRef pixelBuffer, uint8_t* dst, size_t dstStride,
+                           YUVConvertOptions* options){
+    OSType format = CVPixelBufferGetPixelFormatType(pixelBuffer);
+    if (kCVPixelFormatType_420YpCbCr8BiPlanarFullRange  != format &&
+        kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange != format) {
+        dmsg(@"対応していないフォーマットです。");
+        return NO;
+    }
+    options->range = (kCVPixelFormatType_420YpCbCr8BiPlanarFullRange == format)? YUVRangeFull : YUVRangeVideo;
+
+    CFTypeRef matrix = CVBufferGetAttachment(pixelBuffer, kCVImageBufferYCbCrMatrixKey, NULL);
+    if (matrix && CFEqual(matrix, kCVImageBufferYCbCrMatrix_ITU_R_709_2)) {
+        options->colorSpace = YUVColorSpaceBT709;
+    } else {
+        options->colorSpace = YUVColorSpaceBT601;
+    }
+
+    CVPixelBufferLockBaseAddress(pixelBuffer, kCVPixelBufferLock_ReadOnly);
+    YUVImage image = {
+        (const uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 0),
+        CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, 0),
+        (const uint8_t*)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 1),
+        CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, 1),
+        NULL, 0,
+        (int)CVPixelBufferGetWidth(pixelBuffer),
+        (int)CVPixelBufferGetHeight(pixelBuffer),
+    };
+    int result = YUVConvert(&image, dst, dstStride, options);
+    CVPixelBufferUnlockBaseAddress(pixelBuffer, kCVPixelBufferLock_ReadOnly);
+    return (0 == result);
+}
+#endif
+
+
+#ifdef TYABUTA_FRAME_POOL_H
+/*
+ * ビデオ出力のサンプルバッファを、プールのバッファにコピーする。
+ * 先に #import "FramePool.h" しておくと使える。
+ * captureOutput:didOutputSampleBuffer:fromConnection: の中で呼び、
+ * 戻り値をFrameQueuePushで処理のスレッドに渡す。
+ * 空いているバッファが無いか、大きさが足りない場合はNULLを返す。(そのフレームは捨てる)
+ */
+NS_INLINE FramePoolBuffer*
+CMSampleBufferCopyToFramePool(CMSampleBufferRef sampleBuffer, FramePool* pool){
+    CVPixelBufferRef pixelBuffer = CMSampleBufferGetImageBuffer(sampleBuffer);
+    if (NULL == pixelBuffer) return NULL;
+
+    FramePoolBuffer* buffer = FramePoolAcquire(pool);
+    if (NULL == buffer) return NULL;
+
+    CVPixelBufferLockBaseAddress(pixelBuffer, kCVPixelBufferLock_ReadOnly);
+    BOOL   planar = CVPixelBufferIsPlanar(pixelBuffer);
+    size_t count  = planar? CVPixelBufferGetPlaneCount(pixelBuffer) : 1;
+    size_t length = 0;
+    if (count > FRAME_POOL_MAX_PLANES) count = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* base   = planar? CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, i)
+                                      : CVPixelBufferGetBaseAddress(pixelBuffer);
+        size_t         stride = planar? CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, i)
+                                      : CVPixelBufferGetBytesPerRow(pixelBuffer);
+        size_t         rows   = planar? CVPixelBufferGetHeightOfPlane(pixelBuffer, i)
+                                      : CVPixelBufferGetHeight(pixelBuffer);
+        if (length + stride * rows > buffer->capacity) {
+            count = 0;
+            break;
+        }
+        memcpy(buffer->data + length, base, stride * rows);
+        buffer->planeOffset[i] = length;
+        buffer->bytesPerRow[i] = stride;
+        length += stride * rows;
+    }
+    CVPixelBufferUnlockBaseAddress(pixelBuffer, kCVPixelBufferLock_ReadOnly);
+
+    if (0 == count) {
+        dmsg(@"フレームがバッファに入りません。");
+        FramePoolRelease(pool, buffer);
+        return NULL;
+    }
+    buffer->length     = length;
+    buffer->planeCount = (int)count;
+    buffer->width      = (int)CVPixelBufferGetWidth(pixelBuffer);
+    buffer->height     = (int)CVPixelBufferGetHeight(pixelBuffer);
+    buffer->timestamp  = CMTimeGetSeconds(CMSampleBufferGetPresentationTimeStamp(sampleBuffer));
+    return buffer;
+}
+#endif
+
+
 
 #endif // TYABUTA_IOS_AVFOUNDATION_H
 
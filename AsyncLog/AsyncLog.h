@@ -0,0 +1,126 @@
+/*******************************************************************************
+  AsyncLog 1.0.0.0
+
+                         呼び出し元をブロックしない非同期ログ
+
+   NSLogのように呼び出したスレッドで文字列を組み立てて書き込む事はせず、
+   フォーマット文字列の位置と引数の生の値だけをスレッド毎のリングバッファに
+   積んで、すぐに戻る。(ロックもメモリ確保もシステムコールも行わない)
+   文字列の組み立てとファイルへの書き込みは、専用スレッドがまとめて行う。
+
+   リングバッファが一杯の場合、そのログは捨てられ、捨てた数が数えられる。
+   出力先は初期状態では標準エラー出力。AsyncLogOpenでファイルに切り替えると、
+   指定サイズを超えた時に path.1, path.2 ... へローテーションする。
+
+   使い方:
+       AsyncLog(@"frame %d took %.2fms (%@)", frame, ms, name);
+
+   引数は最大8個まで。整数、浮動小数点数、C文字列、オブジェクト(%@)、
+   ポインタ(%p)、unichar(%C)に対応する。幅と精度の"*"も引数として数える。
+   文字列とオブジェクトのdescriptionは呼び出し時にコピーされる。(長い物は切り詰められる)
+   ※ %@にNSString以外のオブジェクトを渡すと、呼び出したスレッドでdescriptionを
+      作るのでメモリ確保が起きる。%S(unichar*)はポインタの値を出力する。
+
+   リングバッファと整形はFoundationに依存しないAsyncLogRing.cにあり、
+   Linux上のaltestで検査と計測ができる。(AsyncLogRing.hを参照)
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_ASYNC_LOG_H
+#define TYABUTA_ASYNC_LOG_H
+
+#import <Foundation/Foundation.h>
+#import "AsyncLogRing.h"
+
+
+/*
+ * ログを呼び出している箇所毎の情報(静的に確保される)
+ * フォーマットの解析結果はログスレッドがここに保持する。
+ */
+typedef struct {
+    __unsafe_unretained NSString* format;
+    const char*                   cformat;
+} AsyncLogSite;
+
+
+/*
+ * 引数を型毎にAsyncLogArgへ変換する関数
+ * オブジェクトのポインタを他のポインタと区別する為、clangのoverloadableを使う。
+ */
+#define ASYNC_LOG_OVERLOAD static inline __attribute__((overloadable, always_inline))
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(int v)                { AsyncLogArg a = {AsyncLogArgTypeInteger};  a.i = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(long v)               { AsyncLogArg a = {AsyncLogArgTypeInteger};  a.i = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(long long v)          { AsyncLogArg a = {AsyncLogArgTypeInteger};  a.i = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(unsigned int v)       { AsyncLogArg a = {AsyncLogArgTypeUnsigned}; a.u = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(unsigned long v)      { AsyncLogArg a = {AsyncLogArgTypeUnsigned}; a.u = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(unsigned long long v) { AsyncLogArg a = {AsyncLogArgTypeUnsigned}; a.u = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(double v)             { AsyncLogArg a = {AsyncLogArgTypeDouble};   a.d = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(const char* v)        { AsyncLogArg a = {AsyncLogArgTypeString};   a.s = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(id v)                 { AsyncLogArg a = {AsyncLogArgTypeObject};   a.o = v; return a; }
+ASYNC_LOG_OVERLOAD AsyncLogArg AsyncLogArgMake(const void* v)        { AsyncLogArg a = {AsyncLogArgTypePointer};  a.p = v; return a; }
+
+/*
+ * 可変長引数のそれぞれにAsyncLogArgMakeを適用するマクロ
+ */
+#define ASYNC_LOG_CAT_(a, b) a##b
+#define ASYNC_LOG_CAT(a, b)  ASYNC_LOG_CAT_(a, b)
+#define ASYNC_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define ASYNC_LOG_NARGS(...) ASYNC_LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define ASYNC_LOG_MAP_0()
+#define ASYNC_LOG_MAP_1(a)                      AsyncLogArgMake(a)
+#define ASYNC_LOG_MAP_2(a, b)                   ASYNC_LOG_MAP_1(a), AsyncLogArgMake(b)
+#define ASYNC_LOG_MAP_3(a, b, c)                ASYNC_LOG_MAP_2(a, b), AsyncLogArgMake(c)
+#define ASYNC_LOG_MAP_4(a, b, c, d)             ASYNC_LOG_MAP_3(a, b, c), AsyncLogArgMake(d)
+#define ASYNC_LOG_MAP_5(a, b, c, d, e)          ASYNC_LOG_MAP_4(a, b, c, d), AsyncLogArgMake(e)
+#define ASYNC_LOG_MAP_6(a, b, c, d, e, f)       ASYNC_LOG_MAP_5(a, b, c, d, e), AsyncLogArgMake(f)
+#define ASYNC_LOG_MAP_7(a, b, c, d, e, f, g)    ASYNC_LOG_MAP_6(a, b, c, d, e, f), AsyncLogArgMake(g)
+#define ASYNC_LOG_MAP_8(a, b, c, d, e, f, g, h) ASYNC_LOG_MAP_7(a, b, c, d, e, f, g), AsyncLogArgMake(h)
+#define ASYNC_LOG_MAP(...) ASYNC_LOG_CAT(ASYNC_LOG_MAP_, ASYNC_LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+/*
+ * ログを書き込む。
+ * fmtはNSStringのリテラルである事。(呼び出し箇所毎に静的に保持する為)
+ * 引数の配列は呼び出しの式の中で作る。([obj description]のような一時オブジェクトは
+ * 式の終わりまで解放されないので、AsyncLogWriteの中で安全に参照できる)
+ */
+#define AsyncLog(fmt, ...) do {                                                 \
+    static AsyncLogSite _alog_site = { fmt, NULL };                             \
+    AsyncLogWrite(&_alog_site,                                                  \
+                  (AsyncLogArg[]){ {AsyncLogArgTypeInteger}, ASYNC_LOG_MAP(__VA_ARGS__) } + 1, \
+                  ASYNC_LOG_NARGS(__VA_ARGS__));                                \
+} while (0)
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ログをリングバッファに積む。通常はAsyncLogマクロから呼ぶ。
+ */
+void AsyncLogWrite(AsyncLogSite* site, const AsyncLogArg* args, int count);
+
+/*
+ * 出力先をファイルに切り替える。(追記モードで開く)
+ * maxFileSizeを超えるとローテーションし、backupCount世代まで残す。
+ * maxFileSizeに0を指定するとローテーションしない。
+ */
+BOOL AsyncLogOpen(const char* path, size_t maxFileSize, int backupCount);
+
+/*
+ * 積まれているログを全て書き込むまで待つ。
+ */
+void AsyncLogFlush(void);
+
+/*
+ * リングバッファが一杯で捨てられたログの数
+ */
+uint64_t AsyncLogDroppedCount(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_ASYNC_LOG_H
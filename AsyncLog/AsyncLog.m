@@ -0,0 +1,395 @@
+//
+//  AsyncLog
+//
+//  Created by tyabuta on 2014/06/12.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "AsyncLog.h"
+#import <mach/mach.h>
+#import <mach/mach_time.h>
+#import <pthread.h>
+#import <sys/stat.h>
+#import <sys/time.h>
+
+
+// ログスレッドの書き込みバッファのサイズ
+#define ASYNC_LOG_WRITE_BUFFER_SIZE (64 * 1024)
+
+// ログが無い時にログスレッドが待つ時間[usec]
+#define ASYNC_LOG_IDLE_INTERVAL 10000
+
+
+
+
+/*------------------------------------------------------------------------------
+ Ring buffer
+ -----------------------------------------------------------------------------*/
+#pragma mark - Ring buffer
+
+// スロットとリングバッファの定義はAsyncLogRing.hにある。
+
+static __thread AsyncLogRing* AsyncLogThreadRing = NULL;
+
+static pthread_mutex_t AsyncLogRingsLock = PTHREAD_MUTEX_INITIALIZER;
+static AsyncLogRing*   AsyncLogRings     = NULL;
+static pthread_key_t   AsyncLogRingKey;
+static pthread_once_t  AsyncLogOnce      = PTHREAD_ONCE_INIT;
+
+// 終了したスレッドのリングを解放した時に、捨てた数を引き継ぐ。
+static uint64_t        AsyncLogDroppedOfClosedRings = 0;
+
+
+/*------------------------------------------------------------------------------
+ Output
+ -----------------------------------------------------------------------------*/
+
+// 以下はログスレッドだけが操作する。
+static int      AsyncLogFD          = STDERR_FILENO;
+static char*    AsyncLogPath        = NULL;
+static size_t   AsyncLogMaxFileSize = 0;
+static int      AsyncLogBackupCount = 0;
+static size_t   AsyncLogFileSize    = 0;
+
+// AsyncLogOpenで指定された出力先。ログスレッドが次の周回で切り替える。
+static pthread_mutex_t AsyncLogOutputLock = PTHREAD_MUTEX_INITIALIZER;
+static int      AsyncLogPendingFD          = -1;
+static char*    AsyncLogPendingPath        = NULL;
+static size_t   AsyncLogPendingMaxFileSize = 0;
+static int      AsyncLogPendingBackupCount = 0;
+
+// AsyncLogFlushの要求と完了の世代
+static uint32_t AsyncLogFlushRequested = 0;
+static uint32_t AsyncLogFlushCompleted = 0;
+
+// 時刻の変換用(mach_absolute_timeとgettimeofdayの対応)
+static mach_timebase_info_data_t AsyncLogTimebase;
+static uint64_t                  AsyncLogBaseTicks;
+static double                    AsyncLogBaseTime;
+
+
+
+
+/*------------------------------------------------------------------------------
+ Formatting (log thread)
+ -----------------------------------------------------------------------------*/
+#pragma mark - Formatting (log thread)
+
+/*
+ * 書き込みバッファ
+ */
+typedef struct {
+    char   bytes[ASYNC_LOG_WRITE_BUFFER_SIZE];
+    size_t length;
+} AsyncLogBuffer;
+
+static void AsyncLogBufferAppend(AsyncLogBuffer* buf, const char* str, size_t length){
+    size_t n = MIN(length, sizeof(buf->bytes) - buf->length);
+    memcpy(buf->bytes + buf->length, str, n);
+    buf->length += n;
+}
+
+/*
+ * スロットを一行のログに整形する。
+ * 行頭には時刻とスレッドを付ける。(NSLogと同じ形式)
+ */
+static void AsyncLogFormatLine(AsyncLogBuffer* buf, const AsyncLogRing* ring, const AsyncLogSlot* slot){
+    AsyncLogSite* site = (AsyncLogSite*)slot->site;
+    if (NULL == site->cformat) {
+        site->cformat = strdup([site->format UTF8String] ?: "");
+    }
+
+    // 時刻
+    double elapsed = (double)(slot->time - AsyncLogBaseTicks)
+    * AsyncLogTimebase.numer / AsyncLogTimebase.denom / 1e9;
+    double    now  = AsyncLogBaseTime + elapsed;
+    time_t    sec  = (time_t)now;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    char header[64];
+    int  length = snprintf(header, sizeof(header), "%04d-%02d-%02d %02d:%02d:%02d.%03d [%x] ",
+                           tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                           tm.tm_hour, tm.tm_min, tm.tm_sec,
+                           (int)((now - sec) * 1000), ring->thread);
+    AsyncLogBufferAppend(buf, header, length);
+
+    // 本文
+    buf->length += AsyncLogFormatSlot(buf->bytes + buf->length, sizeof(buf->bytes) - buf->length,
+                                      site->cformat, slot);
+    AsyncLogBufferAppend(buf, "\n", 1);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Output (log thread)
+ -----------------------------------------------------------------------------*/
+#pragma mark - Output (log thread)
+
+/*
+ * ファイルをpath.1, path.2 ...へずらし、新しいファイルを開く。
+ */
+static void AsyncLogRotate(void){
+    if (NULL == AsyncLogPath) return;
+
+    size_t length = strlen(AsyncLogPath) + 16;
+    char   from[length], to[length];
+    for (int i = AsyncLogBackupCount - 1; i >= 1; i--) {
+        snprintf(from, length, "%s.%d", AsyncLogPath, i);
+        snprintf(to,   length, "%s.%d", AsyncLogPath, i + 1);
+        rename(from, to);
+    }
+    if (AsyncLogBackupCount > 0) {
+        snprintf(to, length, "%s.1", AsyncLogPath);
+        rename(AsyncLogPath, to);
+    }
+    else {
+        unlink(AsyncLogPath);
+    }
+
+    int fd = open(AsyncLogPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) {
+        close(AsyncLogFD);
+        AsyncLogFD = fd;
+    }
+    AsyncLogFileSize = 0;
+}
+
+/*
+ * AsyncLogOpenで指定された出力先に切り替える。
+ */
+static void AsyncLogApplyPendingOutput(void){
+    pthread_mutex_lock(&AsyncLogOutputLock);
+    if (AsyncLogPendingFD >= 0) {
+        struct stat st;
+        fstat(AsyncLogPendingFD, &st);
+        if (AsyncLogFD != STDERR_FILENO) close(AsyncLogFD);
+        free(AsyncLogPath);
+        AsyncLogFD          = AsyncLogPendingFD;
+        AsyncLogPath        = AsyncLogPendingPath;
+        AsyncLogMaxFileSize = AsyncLogPendingMaxFileSize;
+        AsyncLogBackupCount = AsyncLogPendingBackupCount;
+        AsyncLogFileSize    = (size_t)st.st_size;
+        AsyncLogPendingFD   = -1;
+        AsyncLogPendingPath = NULL;
+    }
+    pthread_mutex_unlock(&AsyncLogOutputLock);
+}
+
+static void AsyncLogBufferWrite(AsyncLogBuffer* buf){
+    size_t written = 0;
+    while (written < buf->length) {
+        ssize_t n = write(AsyncLogFD, buf->bytes + written, buf->length - written);
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            break;
+        }
+        written += n;
+    }
+    AsyncLogFileSize += buf->length;
+    buf->length = 0;
+
+    if (AsyncLogMaxFileSize > 0 && AsyncLogFileSize >= AsyncLogMaxFileSize) {
+        AsyncLogRotate();
+    }
+}
+
+/*
+ * AsyncLogRingDrainから一つずつ受け取って整形する。
+ */
+typedef struct {
+    AsyncLogBuffer*     buf;
+    const AsyncLogRing* ring;
+} AsyncLogDrainContext;
+
+static void AsyncLogDrainSlot(const AsyncLogSlot* slot, void* context){
+    AsyncLogDrainContext* drain = (AsyncLogDrainContext*)context;
+    // 一行の最大サイズ分の空きが無ければ先に書き出す。
+    if (drain->buf->length + 1024 > sizeof(drain->buf->bytes)) AsyncLogBufferWrite(drain->buf);
+    AsyncLogFormatLine(drain->buf, drain->ring, slot);
+}
+
+/*
+ * 全てのリングからログを取り出して書き込む。
+ * 書き込んだログがあればYESを返す。
+ */
+static BOOL AsyncLogDrain(AsyncLogBuffer* buf){
+    BOOL found = NO;
+
+    pthread_mutex_lock(&AsyncLogRingsLock);
+    AsyncLogRing* ring = AsyncLogRings;
+    pthread_mutex_unlock(&AsyncLogRingsLock);
+
+    // リストへの追加は先頭にしか行わないので、ロックの外で辿ってよい。
+    AsyncLogRing* prev = NULL;
+    while (ring) {
+        uint32_t closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+        AsyncLogDrainContext drain = { buf, ring };
+        if (AsyncLogRingDrain(ring, AsyncLogDrainSlot, &drain) > 0) found = YES;
+
+        // 終了したスレッドのリングは、空になったら外して解放する。
+        AsyncLogRing* next = ring->next;
+        if (closed) {
+            pthread_mutex_lock(&AsyncLogRingsLock);
+            if (prev) prev->next = next;
+            else if (AsyncLogRings == ring) AsyncLogRings = next;
+            else {
+                // 先頭に新しいリングが追加されていた。
+                AsyncLogRing* r = AsyncLogRings;
+                while (r->next != ring) r = r->next;
+                r->next = next;
+            }
+            AsyncLogDroppedOfClosedRings += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&AsyncLogRingsLock);
+            free(ring);
+        }
+        else {
+            prev = ring;
+        }
+        ring = next;
+    }
+
+    if (buf->length > 0) AsyncLogBufferWrite(buf);
+    return found;
+}
+
+static void* AsyncLogThreadMain(void* arg){
+    pthread_setname_np("AsyncLog");
+    AsyncLogBuffer* buf = (AsyncLogBuffer*)malloc(sizeof(AsyncLogBuffer));
+    buf->length = 0;
+
+    for (;;) {
+        @autoreleasepool {
+            uint32_t requested = __atomic_load_n(&AsyncLogFlushRequested, __ATOMIC_ACQUIRE);
+            AsyncLogApplyPendingOutput();
+            BOOL found = AsyncLogDrain(buf);
+            if (requested != AsyncLogFlushCompleted) {
+                __atomic_store_n(&AsyncLogFlushCompleted, requested, __ATOMIC_RELEASE);
+            }
+            if (NO == found) usleep(ASYNC_LOG_IDLE_INTERVAL);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * スレッド終了時に、そのスレッドのリングを解放待ちにする。
+ */
+static void AsyncLogRingDestructor(void* value){
+    AsyncLogRing* ring = (AsyncLogRing*)value;
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+static void AsyncLogInitialize(void){
+    mach_timebase_info(&AsyncLogTimebase);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    AsyncLogBaseTicks = mach_absolute_time();
+    AsyncLogBaseTime  = tv.tv_sec + tv.tv_usec / 1e6;
+
+    pthread_key_create(&AsyncLogRingKey, AsyncLogRingDestructor);
+
+    pthread_t      thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, AsyncLogThreadMain, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public functions
+ -----------------------------------------------------------------------------*/
+#pragma mark - Public functions
+
+/*
+ * スレッドの初回の書き込み時に、そのスレッドのリングを作成して登録する。
+ */
+static AsyncLogRing* AsyncLogCreateRing(void){
+    pthread_once(&AsyncLogOnce, AsyncLogInitialize);
+
+    AsyncLogRing* ring = (AsyncLogRing*)calloc(1, sizeof(AsyncLogRing));
+    ring->thread = pthread_mach_thread_np(pthread_self());
+    pthread_setspecific(AsyncLogRingKey, ring);
+
+    pthread_mutex_lock(&AsyncLogRingsLock);
+    ring->next    = AsyncLogRings;
+    AsyncLogRings = ring;
+    pthread_mutex_unlock(&AsyncLogRingsLock);
+
+    AsyncLogThreadRing = ring;
+    return ring;
+}
+
+/*
+ * %@のオブジェクトを文字列にしてスロットへ書く。
+ */
+static size_t AsyncLogWriteObject(const void* object, char* out, size_t max){
+    id value = (__bridge id)object;
+    if ([value isKindOfClass:[NSString class]]) {
+        // NSStringはdescriptionを作らずにスロットへ直接書き出す。
+        CFStringRef string = (__bridge CFStringRef)value;
+        CFIndex     used   = 0;
+        CFStringGetBytes(string, CFRangeMake(0, CFStringGetLength(string)),
+                         kCFStringEncodingUTF8, '?', false, (UInt8*)out, (CFIndex)max, &used);
+        return (size_t)used;
+    }
+    const char* str = [[value description] UTF8String];
+    if (NULL == str) str = "(null)";
+    size_t n = strnlen(str, max);
+    memcpy(out, str, n);
+    return n;
+}
+
+void AsyncLogWrite(AsyncLogSite* site, const AsyncLogArg* args, int count){
+    AsyncLogRing* ring = AsyncLogThreadRing;
+    if (__builtin_expect(NULL == ring, 0)) ring = AsyncLogCreateRing();
+
+    AsyncLogRingWrite(ring, site, mach_absolute_time(), args, count, AsyncLogWriteObject);
+}
+
+BOOL AsyncLogOpen(const char* path, size_t maxFileSize, int backupCount){
+    pthread_once(&AsyncLogOnce, AsyncLogInitialize);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return NO;
+
+    // 書き込み中のファイルを閉じないよう、切り替えはログスレッドに任せる。
+    pthread_mutex_lock(&AsyncLogOutputLock);
+    if (AsyncLogPendingFD >= 0) close(AsyncLogPendingFD);
+    free(AsyncLogPendingPath);
+    AsyncLogPendingFD          = fd;
+    AsyncLogPendingPath        = strdup(path);
+    AsyncLogPendingMaxFileSize = maxFileSize;
+    AsyncLogPendingBackupCount = backupCount;
+    pthread_mutex_unlock(&AsyncLogOutputLock);
+
+    // 切り替えが終わるまで待つ。
+    AsyncLogFlush();
+    return YES;
+}
+
+void AsyncLogFlush(void){
+    pthread_once(&AsyncLogOnce, AsyncLogInitialize);
+
+    // 要求した世代をログスレッドが一周処理し終わるまで待つ。
+    uint32_t generation = __atomic_add_fetch(&AsyncLogFlushRequested, 1, __ATOMIC_ACQ_REL);
+    while ((int32_t)(__atomic_load_n(&AsyncLogFlushCompleted, __ATOMIC_ACQUIRE) - generation) < 0) {
+        usleep(1000);
+    }
+}
+
+uint64_t AsyncLogDroppedCount(void){
+    uint64_t count = 0;
+    pthread_mutex_lock(&AsyncLogRingsLock);
+    count += AsyncLogDroppedOfClosedRings;
+    for (AsyncLogRing* ring = AsyncLogRings; ring; ring = ring->next) {
+        count += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&AsyncLogRingsLock);
+    return count;
+}
@@ -0,0 +1,243 @@
+/*
+ *  AsyncLogRing
+ *
+ *  Created by tyabuta on 2014/06/12.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "AsyncLogRing.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b)? (a) : (b))
+#endif
+
+
+/*------------------------------------------------------------------------------
+ Ring buffer
+ -----------------------------------------------------------------------------*/
+
+int AsyncLogRingWrite(AsyncLogRing* ring, void* site, uint64_t time,
+                      const AsyncLogArg* args, int count, AsyncLogObjectWriter objectWriter){
+    // 一杯なら捨てる。(書き込むスレッドを待たせない)
+    uint32_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= ASYNC_LOG_RING_SIZE) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    AsyncLogSlot* slot = &ring->slots[tail & (ASYNC_LOG_RING_SIZE - 1)];
+    slot->site  = site;
+    slot->time  = time;
+    slot->count = (uint8_t)MIN(count, ASYNC_LOG_MAX_ARGS);
+
+    uint32_t text = 0;
+    for (int i = 0; i < slot->count; i++) {
+        const AsyncLogArg* arg = &args[i];
+        slot->types[i] = (uint8_t)arg->type;
+        switch (arg->type) {
+            case AsyncLogArgTypeString:
+            case AsyncLogArgTypeObject: {
+                // 文字列は呼び出し元が解放しても良いようにコピーする。
+                size_t max = ASYNC_LOG_TEXT_SIZE - 1 - text;
+                size_t n   = 0;
+                if (AsyncLogArgTypeObject == arg->type && arg->p && objectWriter) {
+                    n = MIN(objectWriter(arg->p, slot->text + text, max), max);
+                }
+                else {
+                    const char* str = (AsyncLogArgTypeString == arg->type)? arg->s : NULL;
+                    if (NULL == str) str = "(null)";
+                    n = strnlen(str, max);
+                    memcpy(slot->text + text, str, n);
+                }
+                slot->text[text + n] = '\0';
+                slot->values[i].text = text;
+                text = (uint32_t)MIN(text + n + 1, ASYNC_LOG_TEXT_SIZE - 1);
+                break;
+            }
+            case AsyncLogArgTypeDouble:
+                slot->values[i].d = arg->d;
+                break;
+            case AsyncLogArgTypePointer:
+                slot->values[i].u = (uintptr_t)arg->p;
+                break;
+            default:
+                slot->values[i].i = arg->i;
+                break;
+        }
+    }
+
+    // スロットを書き終えてから公開する。
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+uint32_t AsyncLogRingDrain(AsyncLogRing* ring, AsyncLogSlotHandler handler, void* context){
+    uint32_t tail  = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t head  = ring->head;
+    uint32_t count = tail - head;
+    for (; head != tail; head++) {
+        handler(&ring->slots[head & (ASYNC_LOG_RING_SIZE - 1)], context);
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Formatting
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 整形先のバッファ
+ */
+typedef struct {
+    char*  bytes;
+    size_t size;
+    size_t length;
+} AsyncLogBuffer;
+
+static void AsyncLogBufferAppend(AsyncLogBuffer* buf, const char* str, size_t length){
+    size_t n = MIN(length, buf->size - buf->length);
+    memcpy(buf->bytes + buf->length, str, n);
+    buf->length += n;
+}
+
+/*
+ * unichar一文字をUTF-8にする。(サロゲートはU+FFFDにする)
+ */
+static size_t AsyncLogUnicharToUTF8(uint32_t c, char* out){
+    if (c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = (char)(0xC0 | (c >> 6));
+        out[1] = (char)(0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (0xD800 <= c && c < 0xE000) c = 0xFFFD;
+    out[0] = (char)(0xE0 | (c >> 12));
+    out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (c & 0x3F));
+    return 3;
+}
+
+/*
+ * 一つの変換指定(%...)を整形して追加する。
+ * 長さ修飾子は取り除き、値の型に合わせたものに付け替える。
+ * 幅と精度の"*"は引数を一つずつ取り出して数字に置き換える。(indexを進める)
+ */
+static void AsyncLogAppendSpec(AsyncLogBuffer* buf, const char* spec, size_t specLength,
+                               char conversion, const AsyncLogSlot* slot, int* index){
+    char format[64];
+    size_t n = 0;
+    for (size_t i = 0; i < specLength && n < sizeof(format) - 24; i++) {
+        char c = spec[i];
+        if ('l' == c || 'h' == c || 'q' == c || 'z' == c || 't' == c || 'j' == c || 'L' == c) continue;
+        if ('*' == c) {
+            long long v = (*index < slot->count)? slot->values[*index].i : 0;
+            (*index)++;
+            if (n > 0 && '.' == format[n - 1] && v < 0) {
+                n--;    // 負の精度は指定なしと同じ
+                continue;
+            }
+            n += snprintf(format + n, sizeof(format) - n, "%lld", v);
+            continue;
+        }
+        format[n++] = c;
+    }
+
+    char*  out  = buf->bytes + buf->length;
+    size_t room = buf->size - buf->length;
+    int    written = 0;
+
+    if (*index >= slot->count) {
+        AsyncLogBufferAppend(buf, "(null)", 6);
+        return;
+    }
+
+    int     i    = (*index)++;
+    uint8_t type = slot->types[i];
+    if ('C' == conversion) {
+        // unicharはUTF-8の文字列として書く。
+        char text[4];
+        text[AsyncLogUnicharToUTF8((uint32_t)(uint16_t)slot->values[i].i, text)] = '\0';
+        format[n++] = 's';
+        format[n]   = '\0';
+        written = snprintf(out, room, format, text);
+    }
+    else if ('S' == conversion) {
+        // unichar*の文字列はコピーしていないので、ポインタとして書く。
+        written = snprintf(out, room, "%p", (void*)(uintptr_t)slot->values[i].u);
+    }
+    else if (AsyncLogArgTypeString == type || AsyncLogArgTypeObject == type) {
+        const char* text = slot->text + slot->values[i].text;
+        format[n++] = 's';
+        format[n]   = '\0';
+        written = snprintf(out, room, format, text);
+    }
+    else if ('f' == conversion || 'F' == conversion || 'e' == conversion || 'E' == conversion ||
+             'g' == conversion || 'G' == conversion || 'a' == conversion || 'A' == conversion) {
+        format[n++] = conversion;
+        format[n]   = '\0';
+        double d = (AsyncLogArgTypeDouble == type)? slot->values[i].d : (double)slot->values[i].i;
+        written = snprintf(out, room, format, d);
+    }
+    else if ('c' == conversion) {
+        format[n++] = 'c';
+        format[n]   = '\0';
+        written = snprintf(out, room, format, (int)slot->values[i].i);
+    }
+    else if ('p' == conversion || AsyncLogArgTypePointer == type) {
+        written = snprintf(out, room, "%p", (void*)(uintptr_t)slot->values[i].u);
+    }
+    else {
+        format[n++] = 'l';
+        format[n++] = 'l';
+        format[n++] = ('@' == conversion || 's' == conversion)? 'd' : conversion;
+        format[n]   = '\0';
+        if (AsyncLogArgTypeDouble == type) {
+            written = snprintf(out, room, format, (long long)slot->values[i].d);
+        }
+        else {
+            written = snprintf(out, room, format, slot->values[i].i);
+        }
+    }
+    if (written > 0) buf->length += MIN((size_t)written, room > 0? room - 1 : 0);
+}
+
+size_t AsyncLogFormatSlot(char* out, size_t size, const char* format, const AsyncLogSlot* slot){
+    AsyncLogBuffer buf = { out, size, 0 };
+    const char*    p   = format;
+    int          index = 0;
+    while (*p) {
+        const char* percent = strchr(p, '%');
+        if (NULL == percent) {
+            AsyncLogBufferAppend(&buf, p, strlen(p));
+            break;
+        }
+        AsyncLogBufferAppend(&buf, p, percent - p);
+
+        if ('%' == percent[1]) {
+            AsyncLogBufferAppend(&buf, "%", 1);
+            p = percent + 2;
+            continue;
+        }
+
+        // 変換文字までを一つの指定として切り出す。
+        const char* end = percent + 1;
+        while (*end && NULL == strchr("diouxXcsSpfFeEgGaAC@", *end)) end++;
+        if ('\0' == *end) {
+            AsyncLogBufferAppend(&buf, percent, end - percent);
+            break;
+        }
+        AsyncLogAppendSpec(&buf, percent, end - percent, *end, slot, &index);
+        p = end + 1;
+    }
+    return buf.length;
+}
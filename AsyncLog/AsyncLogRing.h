@@ -0,0 +1,143 @@
+/*******************************************************************************
+  AsyncLogRing 1.0.0.0
+
+                         AsyncLogのリングバッファと整形
+
+   AsyncLog.mからFoundationに依存しない部分を切り出したもの。
+   書き込むスレッド毎のリングバッファ(1対1)へ引数の生の値を積む処理と、
+   積まれた値をフォーマット文字列に従って整形する処理を持つ。
+   オブジェクト(%@)の文字列化だけは、呼び出し側が渡す関数で行う。
+
+   Linux上でもそのままコンパイルできる。検査と計測はaltestで行う。
+
+       $ cc -O2 -pthread -o altest altest.c AsyncLogRing.c
+       $ ./altest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_ASYNC_LOG_RING_H
+#define TYABUTA_ASYNC_LOG_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * 一つのログの引数の最大数
+ */
+#define ASYNC_LOG_MAX_ARGS 8
+
+// スレッド毎のリングバッファのスロット数(2の累乗)
+#define ASYNC_LOG_RING_SIZE 256
+
+// 一つのログにコピーできる文字列の合計サイズ
+#define ASYNC_LOG_TEXT_SIZE 160
+
+/*
+ * 引数の種類
+ */
+typedef enum {
+    AsyncLogArgTypeInteger,
+    AsyncLogArgTypeUnsigned,
+    AsyncLogArgTypeDouble,
+    AsyncLogArgTypeString,
+    AsyncLogArgTypeObject,
+    AsyncLogArgTypePointer,
+} AsyncLogArgType;
+
+/*
+ * 呼び出し時に取り込む引数の値
+ * Objective-C以外からはオブジェクトもpとして見える。
+ */
+typedef struct {
+    AsyncLogArgType type;
+    union {
+        int64_t                       i;
+        uint64_t                      u;
+        double                        d;
+        const char*                   s;
+        const void*                   p;
+#ifdef __OBJC__
+        __unsafe_unretained id        o;
+#endif
+    };
+} AsyncLogArg;
+
+/*
+ * リングバッファの一つのスロット
+ * 文字列の引数はtextにコピーし、値にはtext内の位置を入れる。
+ */
+typedef struct {
+    void*         site;
+    uint64_t      time;
+    uint8_t       count;
+    uint8_t       types[ASYNC_LOG_MAX_ARGS];
+    union {
+        int64_t   i;
+        uint64_t  u;
+        double    d;
+        uint32_t  text;
+    }             values[ASYNC_LOG_MAX_ARGS];
+    char          text[ASYNC_LOG_TEXT_SIZE];
+} AsyncLogSlot;
+
+/*
+ * スレッド毎のリングバッファ(書き込むスレッドとログスレッドの1対1)
+ * tailは書き込むスレッドだけが、headはログスレッドだけが進める。
+ * thread, nextは持ち主(AsyncLog.m)が使う。
+ */
+typedef struct AsyncLogRing {
+    uint32_t             head;
+    uint32_t             tail;
+    uint64_t             dropped;
+    uint32_t             closed;  // スレッドが終了した
+    uint32_t             thread;
+    struct AsyncLogRing* next;
+    AsyncLogSlot         slots[ASYNC_LOG_RING_SIZE];
+} AsyncLogRing;
+
+
+/*
+ * オブジェクトの文字列(UTF-8)をoutへ最大maxバイト書き、書いたバイト数を返す。
+ * 終端の'\0'は書かなくてよい。
+ */
+typedef size_t (*AsyncLogObjectWriter)(const void* object, char* out, size_t max);
+
+/*
+ * 取り出したスロットを処理する関数
+ */
+typedef void (*AsyncLogSlotHandler)(const AsyncLogSlot* slot, void* context);
+
+
+/*
+ * 引数をスロットに積んで公開する。書き込むスレッドから呼ぶ。
+ * 一杯ならdroppedを数えて0を返す。(待たない)
+ * objectWriterがNULLなら、オブジェクトは"(null)"になる。
+ */
+int AsyncLogRingWrite(AsyncLogRing* ring, void* site, uint64_t time,
+                      const AsyncLogArg* args, int count, AsyncLogObjectWriter objectWriter);
+
+/*
+ * 積まれているスロットを順にhandlerへ渡し、取り出した数を返す。
+ * ログスレッドから呼ぶ。
+ */
+uint32_t AsyncLogRingDrain(AsyncLogRing* ring, AsyncLogSlotHandler handler, void* context);
+
+/*
+ * スロットの値をformat(printf形式、%@を含む)に従って整形し、outに書く。
+ * 長さ修飾子は値の型に合わせて付け替える。'\0'は付けない。
+ * 書いたバイト数(size以下)を返す。
+ */
+size_t AsyncLogFormatSlot(char* out, size_t size, const char* format, const AsyncLogSlot* slot);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TYABUTA_ASYNC_LOG_RING_H
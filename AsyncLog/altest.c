@@ -0,0 +1,320 @@
+/*
+ *  altest
+ *
+ *  AsyncLogのリングバッファと整形(AsyncLogRing.c)をPC(Linux)上で検査し、
+ *  書き込むスレッドの一回のログにかかる時間を、その場で整形して
+ *  write(2)する方法(NSLogと同じ)と比べる。
+ *
+ *      $ cc -O2 -pthread -o altest altest.c AsyncLogRing.c
+ *      $ ./altest
+ *
+ *      -n count  計測するログの数 (初期値は1000000)
+ *
+ *  -fsanitize=thread を付けてビルドすると、データ競合も検査できる。
+ *
+ *  Created by tyabuta on 2014/06/12.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "AsyncLogRing.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static AsyncLogArg argInt(int64_t v)        { AsyncLogArg a = {AsyncLogArgTypeInteger};  a.i = v; return a; }
+static AsyncLogArg argUnsigned(uint64_t v)  { AsyncLogArg a = {AsyncLogArgTypeUnsigned}; a.u = v; return a; }
+static AsyncLogArg argDouble(double v)      { AsyncLogArg a = {AsyncLogArgTypeDouble};   a.d = v; return a; }
+static AsyncLogArg argString(const char* v) { AsyncLogArg a = {AsyncLogArgTypeString};   a.s = v; return a; }
+static AsyncLogArg argObject(const void* v) { AsyncLogArg a = {AsyncLogArgTypeObject};   a.p = v; return a; }
+static AsyncLogArg argPointer(const void* v){ AsyncLogArg a = {AsyncLogArgTypePointer};  a.p = v; return a; }
+
+/*
+ * テスト用のオブジェクトは、C文字列をそのまま文字列として書く。
+ */
+static size_t writeObject(const void* object, char* out, size_t max){
+    size_t n = strnlen((const char*)object, max);
+    memcpy(out, object, n);
+    return n;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Formatting
+ -----------------------------------------------------------------------------*/
+
+static AsyncLogRing formatRing;
+
+/*
+ * 一つのログを積んで取り出し、整形した結果をoutに入れる。
+ */
+static void formatOne(char* out, size_t size, const char* format, const AsyncLogArg* args, int count){
+    CHECK(AsyncLogRingWrite(&formatRing, (void*)format, 0, args, count, writeObject));
+    const AsyncLogSlot* slot = &formatRing.slots[formatRing.head & (ASYNC_LOG_RING_SIZE - 1)];
+    size_t length = AsyncLogFormatSlot(out, size - 1, format, slot);
+    out[length] = '\0';
+    formatRing.head++;
+}
+
+static void expect(const char* expected, const char* format, const AsyncLogArg* args, int count){
+    char out[512];
+    formatOne(out, sizeof(out), format, args, count);
+    if (strcmp(out, expected)) {
+        fprintf(stderr, "FAIL format \"%s\": got \"%s\", expected \"%s\"\n", format, out, expected);
+        exit(1);
+    }
+}
+
+static void testFormat(void){
+    static int object;
+    char pointer[32];
+    snprintf(pointer, sizeof(pointer), "%p", (void*)&object);
+
+    expect("plain 100%", "plain 100%%", NULL, 0);
+    expect("frame 42 took 16.67ms (main)", "frame %d took %.2fms (%@)",
+           (AsyncLogArg[]){ argInt(42), argDouble(16.6667), argObject("main") }, 3);
+    expect("-1 18446744073709551615 ff", "%lld %llu %zx",
+           (AsyncLogArg[]){ argInt(-1), argUnsigned(UINT64_MAX), argUnsigned(255) }, 3);
+    expect("[  3.14]", "[%*.*f]", (AsyncLogArg[]){ argInt(6), argInt(2), argDouble(3.14159) }, 3);
+    expect("[3.141590]", "[%.*f]", (AsyncLogArg[]){ argInt(-1), argDouble(3.14159) }, 2);
+    expect("[   42]", "[%*ld]", (AsyncLogArg[]){ argInt(5), argInt(42) }, 2);
+    expect("\xE3\x81\x82 [  A]", "%C [%3C]", (AsyncLogArg[]){ argInt(0x3042), argInt('A') }, 2);
+    expect("\xEF\xBF\xBD", "%C", (AsyncLogArg[]){ argInt(0xD800) }, 1);
+    expect("[ab   ]", "[%-5s]", (AsyncLogArg[]){ argString("ab") }, 1);
+    expect("(null) (null)", "%s %@", (AsyncLogArg[]){ argString(NULL), argObject(NULL) }, 2);
+    expect(pointer, "%p", (AsyncLogArg[]){ argPointer(&object) }, 1);
+    expect("7 x", "%d %c", (AsyncLogArg[]){ argDouble(7.9), argInt('x') }, 2);
+    expect("2.000000", "%f", (AsyncLogArg[]){ argInt(2) }, 1);
+    expect("1 (null)", "%d %d", (AsyncLogArg[]){ argInt(1) }, 1);
+    expect("unterminated %5", "unterminated %5", NULL, 0);
+
+    // 文字列は合わせてASYNC_LOG_TEXT_SIZEまでコピーされ、残りは切り詰められる。
+    char longText[400], out[512];
+    memset(longText, 'x', sizeof(longText) - 1);
+    longText[sizeof(longText) - 1] = '\0';
+    formatOne(out, sizeof(out), "%s|%s|%@",
+              (AsyncLogArg[]){ argString(longText), argString("tail"), argObject("object") }, 3);
+    CHECK(strlen(out) == (ASYNC_LOG_TEXT_SIZE - 1) + 2);
+    CHECK(0 == strncmp(out, longText, ASYNC_LOG_TEXT_SIZE - 1));
+
+    // 引数はASYNC_LOG_MAX_ARGSまで。
+    AsyncLogArg many[ASYNC_LOG_MAX_ARGS + 2];
+    for (int i = 0; i < ASYNC_LOG_MAX_ARGS + 2; i++) many[i] = argInt(i);
+    expect("0 1 2 3 4 5 6 7 (null)", "%d %d %d %d %d %d %d %d %d", many, ASYNC_LOG_MAX_ARGS + 2);
+
+    // 出力先が小さくても溢れない。
+    char small[16 + 8];
+    memset(small, '#', sizeof(small));
+    CHECK(AsyncLogRingWrite(&formatRing, NULL, 0,
+                            (AsyncLogArg[]){ argString(longText), argDouble(1e300) }, 2, writeObject));
+    size_t length = AsyncLogFormatSlot(small, 16, "head %s %f %s",
+                                       &formatRing.slots[formatRing.head++ & (ASYNC_LOG_RING_SIZE - 1)]);
+    CHECK(length <= 16);
+    for (size_t i = 16; i < sizeof(small); i++) CHECK('#' == small[i]);
+
+    printf("format: ok\n");
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Ring buffer
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 書き込むスレッドと取り出すスレッドを同時に動かし、
+ * 取り出したログが順序通りで、取り出した数と捨てた数の合計が書いた数になる事を確かめる。
+ */
+typedef struct {
+    AsyncLogRing* ring;
+    long          count;
+    int           done;
+    long          drained;
+    int64_t       last;
+    char          text[32];
+} RingTest;
+
+static void checkSlot(const AsyncLogSlot* slot, void* context){
+    RingTest* test = (RingTest*)context;
+    CHECK(2 == slot->count && AsyncLogArgTypeInteger == slot->types[0]);
+    CHECK(slot->values[0].i > test->last);
+    test->last = slot->values[0].i;
+
+    snprintf(test->text, sizeof(test->text), "seq %lld", (long long)test->last);
+    CHECK(0 == strcmp(slot->text + slot->values[1].text, test->text));
+    test->drained++;
+}
+
+static void* ringProducer(void* arg){
+    RingTest* test = (RingTest*)arg;
+    char      text[32];
+    for (long i = 1; i <= test->count; i++) {
+        snprintf(text, sizeof(text), "seq %ld", i);
+        AsyncLogArg args[2] = { argInt(i), argString(text) };
+        AsyncLogRingWrite(test->ring, NULL, (uint64_t)i, args, 2, NULL);
+        if (0 == (i & 1023)) sched_yield();
+    }
+    __atomic_store_n(&test->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void testRing(long count){
+    RingTest test = { 0 };
+    test.ring  = calloc(1, sizeof(AsyncLogRing));
+    test.count = count;
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, ringProducer, &test);
+    while (0 == __atomic_load_n(&test.done, __ATOMIC_ACQUIRE)) {
+        if (0 == AsyncLogRingDrain(test.ring, checkSlot, &test)) sched_yield();
+    }
+    pthread_join(producer, NULL);
+    AsyncLogRingDrain(test.ring, checkSlot, &test);
+
+    uint64_t dropped = __atomic_load_n(&test.ring->dropped, __ATOMIC_RELAXED);
+    CHECK((uint64_t)test.drained + dropped == (uint64_t)count);
+    CHECK(test.drained > 0);
+    printf("ring: ok (%ld written, %ld drained, %llu dropped)\n",
+           count, test.drained, (unsigned long long)dropped);
+    free(test.ring);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+static const char* benchFormat = "frame %d took %.2fms (%s) queue %u";
+
+typedef struct {
+    AsyncLogRing* ring;
+    int           stop;
+    int           fd;
+    char          bytes[64 * 1024];
+    size_t        length;
+} BenchConsumer;
+
+static void benchFormatSlot(const AsyncLogSlot* slot, void* context){
+    BenchConsumer* consumer = (BenchConsumer*)context;
+    if (consumer->length + 1024 > sizeof(consumer->bytes)) {
+        if (write(consumer->fd, consumer->bytes, consumer->length) < 0) perror("write");
+        consumer->length = 0;
+    }
+    consumer->length += AsyncLogFormatSlot(consumer->bytes + consumer->length,
+                                           sizeof(consumer->bytes) - consumer->length,
+                                           (const char*)slot->site, slot);
+    consumer->bytes[consumer->length++] = '\n';
+}
+
+/*
+ * ログスレッドの代わり。取り出して整形し、まとめてwriteする。
+ */
+static void* benchLogThread(void* arg){
+    BenchConsumer* consumer = (BenchConsumer*)arg;
+    while (0 == __atomic_load_n(&consumer->stop, __ATOMIC_ACQUIRE)) {
+        if (0 == AsyncLogRingDrain(consumer->ring, benchFormatSlot, consumer)) sched_yield();
+    }
+    AsyncLogRingDrain(consumer->ring, benchFormatSlot, consumer);
+    if (consumer->length && write(consumer->fd, consumer->bytes, consumer->length) < 0) perror("write");
+    return NULL;
+}
+
+static void bench(long count){
+    int fd = open("/dev/null", O_WRONLY);
+    CHECK(fd >= 0);
+
+    // 呼び出したスレッドで整形してwriteする。(NSLogと同じ)
+    char   line[256];
+    double start = nowSec();
+    for (long i = 0; i < count; i++) {
+        int length = snprintf(line, sizeof(line), "frame %d took %.2fms (%s) queue %u\n",
+                              (int)i, i * 0.001, "main", (unsigned)(i & 7));
+        if (write(fd, line, length) < 0) perror("write");
+    }
+    double direct = (nowSec() - start) * 1e9 / count;
+
+    // リングに積むだけ。(ログスレッドが別に整形して書き込む)
+    // 捨てる速さを測らないよう、リングの半分ずつ積んで空くのを待つ。(待つ時間は含めない)
+    BenchConsumer* consumer = calloc(1, sizeof(BenchConsumer));
+    consumer->ring = calloc(1, sizeof(AsyncLogRing));
+    consumer->fd   = fd;
+    pthread_t thread;
+    pthread_create(&thread, NULL, benchLogThread, consumer);
+
+    double elapsed = 0.0;
+    for (long i = 0; i < count; ) {
+        long end = i + ASYNC_LOG_RING_SIZE / 2;
+        if (end > count) end = count;
+        start = nowSec();
+        for (; i < end; i++) {
+            AsyncLogArg args[4] = { argInt(i), argDouble(i * 0.001), argString("main"), argUnsigned(i & 7) };
+            AsyncLogRingWrite(consumer->ring, (void*)benchFormat, (uint64_t)i, args, 4, NULL);
+        }
+        elapsed += nowSec() - start;
+        while (__atomic_load_n(&consumer->ring->head, __ATOMIC_ACQUIRE) != consumer->ring->tail) sched_yield();
+    }
+    double ring = elapsed * 1e9 / count;
+
+    __atomic_store_n(&consumer->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    CHECK(0 == consumer->ring->dropped);
+
+    printf("%ld logs (4 args)\n", count);
+    printf("  snprintf + write on the caller : %7.1f ns/log\n", direct);
+    printf("  AsyncLogRingWrite              : %7.1f ns/log (%.0fx)\n", ring, direct / ring);
+
+    free(consumer->ring);
+    free(consumer);
+    close(fd);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: altest [-n count]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    long count = 1000000;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': count = atol(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || count <= 0) usage();
+
+    testFormat();
+    testRing(2000000);
+    bench(count);
+    return 0;
+}
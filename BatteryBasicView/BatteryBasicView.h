@@ -1,6 +1,7 @@
 /*******************************************************************************
 
                           BatteryBasicView 1.2.0.3
+        ※ EventBus(EventBus, DeviceEvents)が追加されていれば、変更はDeviceEventsで受け取る。
 
                                                              (c) 2013 tyabuta.
  ******************************************************************************/
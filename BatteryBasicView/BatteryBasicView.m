@@ -1,4 +1,14 @@
 
+// EventBus, FastNumberは、追加されている場合だけ使う。
+#if defined(__has_include)
+#if __has_include("DeviceEvents.h")
+#import "DeviceEvents.h"
+#endif
+#if __has_include("FastNumber.h")
+#import "FastNumber.h"
+#endif
+#endif
+
 #import "BatteryBasicView.h"
 #import <QuartzCore/QuartzCore.h>
 
@@ -97,36 +107,7 @@ NS_INLINE void CGContextEnd(CGContextRef context) {
 
 
 
-/*
- * バッテリステートを取得します。
- * 関数内でbatteryMonitoringEnabledをYESに設定します。
- */
-NS_INLINE UIDeviceBatteryState UIDeviceBatteryGetState(){
-    UIDevice* device = [UIDevice currentDevice];
-    device.batteryMonitoringEnabled = YES;
-    return device.batteryState;
-}
-
-/*
- * UIDeviceBatteryState定数から、文字列に変換します。
- */
-NS_INLINE NSString* UIDeviceBatteryStateToString(UIDeviceBatteryState state){
-    NSString* stateText = nil;
-    switch (state) {
-        case UIDeviceBatteryStateCharging:
-            stateText = @"Charging";
-            break;
-        case UIDeviceBatteryStateFull:
-            stateText = @"Full";
-            break;
-        case UIDeviceBatteryStateUnplugged:
-            stateText = @"Unplugged";
-            break;
-        default:
-            stateText = @"Unknown";
-    }
-    return stateText;
-}
+#ifndef TYABUTA_DEVICE_EVENTS_H
 
 /*
  * バッテリレベルを取得します。
@@ -172,9 +153,35 @@ NS_INLINE void NSNotificationCenterRemoveObserver(id observer){
     [[NSNotificationCenter defaultCenter] removeObserver:observer];
 }
 
+#endif // TYABUTA_DEVICE_EVENTS_H
+
 #endif // macro
 
 
+/*
+ * バッテリーの割合(0~100)を "%3d%%" と同じ書式の文字列にする。
+ * stringWithFormat:の書式解析を通さずに、固定幅で直接組み立てる。
+ * (FastNumberが追加されていればFastFormatInt64Paddedで書き込む)
+ */
+static NSString* BatteryLevelStringFromPercent(int percent){
+    percent = MAX(0, MIN(percent, 100));
+#ifdef TYABUTA_FAST_NUMBER_H
+    char   buf[FAST_NUMBER_INT64_LENGTH + 1];
+    size_t length = FastFormatInt64Padded(percent, 3, ' ', buf);
+    buf[length++] = '%';
+    return [[NSString alloc] initWithBytes:buf length:length encoding:NSASCIIStringEncoding];
+#else
+    char  buf[4] = {' ', ' ', ' ', '%'};
+    char* p      = buf + 3;
+    do {
+        *--p = (char)('0' + percent % 10);
+        percent /= 10;
+    } while (percent > 0);
+    return [[NSString alloc] initWithBytes:buf length:sizeof(buf) encoding:NSASCIIStringEncoding];
+#endif
+}
+
+
 
 
 
@@ -190,6 +197,9 @@ NS_INLINE void NSNotificationCenterRemoveObserver(id observer){
     // パーセンテージを表す文字列
     NSString* _levelString;
 
+    // _levelStringの元になった値(無効値の場合は-1)
+    int _levelPercent;
+
     // バッテリーの割合を表す値(無効値の場合は1.0fにしています)
     CGFloat _level;
     
@@ -198,6 +208,11 @@ NS_INLINE void NSNotificationCenterRemoveObserver(id observer){
     
     // バッテリーゲージ描画用のエリア矩形
     CGRect _gaugeArea;
+
+#ifdef TYABUTA_DEVICE_EVENTS_H
+    // バッテリーの変更の購読(解放で解除される)
+    DeviceEventsSubscription* _batterySubscription;
+#endif
 }
 
 
@@ -220,41 +235,55 @@ NS_INLINE void NSNotificationCenterRemoveObserver(id observer){
         UILabelSetShadow(_levelLabel);
         
         
+#ifdef TYABUTA_DEVICE_EVENTS_H
+        // バッテリーの変更を購読(登録時に一度呼ばれるのが初回更新になる)
+        __weak BatteryBasicView* weakSelf = self;
+        _batterySubscription = [[DeviceEvents sharedEvents] subscribeBattery:^(DeviceBatteryEvent event) {
+            [weakSelf updateLevel:event.level];
+        }];
+#else
         // バッテリー通知の登録
         UIDeviceBatteryRegisterStateAndLevelDidChangeNotification
-        (self, @selector(update));
+        (self, @selector(batteryDidChange:));
 
         // 初回更新
-        [self update];
+        [self updateLevel:UIDeviceBatteryGetLevel()];
+#endif
     }
     return self;
 }
 
+#ifndef TYABUTA_DEVICE_EVENTS_H
 - (void)dealloc
 {
     // バッテリー通知登録の抹消
     NSNotificationCenterRemoveObserver(self);
 }
 
+/*
+ * バッテリーの変更通知
+ */
+- (void)batteryDidChange:(NSNotification*)notification
+{
+    [self updateLevel:UIDeviceBatteryGetLevel()];
+}
+#endif
 
-- (void)update
+
+- (void)updateLevel:(float)fLevel
 {
-    // バッテリーレベル取得
-    float fLevel = UIDeviceBatteryGetLevel();
-    
     //　メンバー変数更新
     _level = (fLevel<0.0f)? 1.0f : fLevel;
     
-    // パーセンテージ文字列の更新
-    if (fLevel > 0.0f){
-        _levelString = [NSString stringWithFormat:@"%3d%%", (int)(fLevel*100.0f)];
+    // パーセンテージ文字列の更新(値が変わった時のみ)
+    int percent = (fLevel > 0.0f)? (int)(fLevel*100.0f) : -1;
+    if (nil == _levelString || _levelPercent != percent){
+        _levelPercent = percent;
+        _levelString  = (percent >= 0)? BatteryLevelStringFromPercent(percent) : @"---%";
+
+        // パーセンテージ表示用ラベルの更新
+        _levelLabel.text = _levelString;
     }
-    else {
-        _levelString = @"---%";
-    }
-    
-    // パーセンテージ表示用ラベルの更新
-    _levelLabel.text = _levelString;
     
     // 描画要請
     [self setNeedsDisplay];
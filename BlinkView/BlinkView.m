@@ -1,5 +1,6 @@
 
 #import "BlinkView.h"
+#import "TimerWheel.h"
 
 
 /*------------------------------------------------------------------------------
@@ -8,24 +9,23 @@
 #pragma mark - Macro functions
 
 /*
- * 繰り返しタイマーをセットする。
- * - (void)tick:(NSTimer*)timer
+ * 繰り返しタイマーをTimerWheelに登録する。
+ * 間隔の1割までの遅れを許容し、他のタイマーと起床をまとめる。
+ * (macro.hのTimerWheelStartと重ならない名前にしている)
+ * - (void)tick:(id)timer
  */
-NS_INLINE NSTimer* NSTimerStart(double interval, id target, SEL action){
-    NSTimer* timer =
-    [NSTimer scheduledTimerWithTimeInterval:interval
-                                     target:target
-                                   selector:action
-                                   userInfo:nil
-                                    repeats:YES];
-    return timer;
+NS_INLINE id BlinkTimerStart(double interval, id target, SEL action){
+    return [[TimerWheel sharedWheel] addTimerWithInterval:interval
+                                                tolerance:interval * 0.1
+                                                   target:target
+                                                 selector:action];
 }
 
 /*
  * タイマーを停止させる。
  */
-NS_INLINE void NSTimerStop(NSTimer* timer){
-    [timer invalidate];
+NS_INLINE void BlinkTimerStop(id timer){
+    [[TimerWheel sharedWheel] cancelTimer:timer];
 }
 
 
@@ -37,7 +37,7 @@ NS_INLINE void NSTimerStop(NSTimer* timer){
 #pragma mark - Implementation BlinkView
 
 @implementation BlinkView {
-    NSTimer* _timer;
+    id _timer;
 }
 
 - (id)initWithImage:(UIImage*)image frame:(CGRect)frame
@@ -60,7 +60,13 @@ NS_INLINE void NSTimerStop(NSTimer* timer){
     _imageView.frame = self.bounds;
 }
 
-- (void)tick:(NSTimer*)timer{
+- (void)dealloc {
+    if (_timer){
+        BlinkTimerStop(_timer);
+    }
+}
+
+- (void)tick:(id)timer{
     self.hidden = !self.hidden;    
 }
 
@@ -95,7 +101,7 @@ NS_INLINE void NSTimerStop(NSTimer* timer){
  */
 - (void)startBlink {
     if (nil == _timer){
-        _timer = NSTimerStart(_interval, self, @selector(tick:));
+        _timer = BlinkTimerStart(_interval, self, @selector(tick:));
     }
 }
 
@@ -104,7 +110,7 @@ NS_INLINE void NSTimerStop(NSTimer* timer){
  */
 - (void)stopBlink {
     if (_timer){
-        NSTimerStop(_timer);
+        BlinkTimerStop(_timer);
     }
     _timer = nil;
     self.hidden = YES;
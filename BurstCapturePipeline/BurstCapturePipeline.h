@@ -0,0 +1,72 @@
+/*******************************************************************************
+  BurstCapturePipeline 1.0.0.0
+
+                         連写した静止画を並列に変換、エンコード、保存する
+        ※ AssetsLibrary.framework, ImageIO.framework, CoreMedia.framework を
+           追加する必要がある。
+
+   AVCaptureStillImageWriteToSavedPhotosAlbumは撮影の完了ブロックの中で
+   一枚ずつJPEGにして保存するので、連写すると次の撮影が前の保存を待つことになる。
+   BurstCapturePipelineはYUVのままフレームを受け取り、BurstPipelineで
+     変換(YUVConverterでBGRAへ) → エンコード(ImageIOでJPEG) → 保存(JPEGPhotoWriter)
+   の三段に流す。変換とエンコードは複数のスレッドで並列に行い、保存は撮影順に行う。
+   キューが一杯の場合、撮影したフレームは捨てる。(撮影のスレッドを止めない)
+
+   撮影の出力はstillImageOutputSettingsで420YpCbCr8BiPlanarFullRangeにしておく。
+
+       stillImageOutput.outputSettings = [BurstCapturePipeline stillImageOutputSettings];
+       pipeline = [[BurstCapturePipeline alloc] initWithQueueCapacity:4 quality:0.9f handler:nil];
+       ...
+       [pipeline submitSampleBuffer:imageDataSampleBuffer orientation:6];
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_BURST_CAPTURE_PIPELINE_H
+#define TYABUTA_BURST_CAPTURE_PIPELINE_H
+
+#import <Foundation/Foundation.h>
+#import <CoreMedia/CoreMedia.h>
+#import "BurstPipeline.h"
+
+/*
+ * 保存が終わった時に呼ばれる。(メインスレッド)
+ * sequenceは投入した順の通し番号
+ */
+typedef void (^BurstCapturePipelineHandler)(uint64_t sequence, NSURL* assetURL, NSError* error);
+
+@interface BurstCapturePipeline : NSObject
+
+/*
+ * AVCaptureStillImageOutputのoutputSettingsに設定する。
+ */
++ (NSDictionary*)stillImageOutputSettings;
+
+/*
+ * capacityは段と段の間のキューの長さ、qualityはJPEGの画質(0.0~1.0)
+ */
+- (id)initWithQueueCapacity:(NSUInteger)capacity
+                    quality:(float)quality
+                    handler:(BurstCapturePipelineHandler)handler;
+
+/*
+ * 撮影したフレームを投入する。orientationはExifの向き(1~8, 0は1と同じ)
+ * キューが一杯か、YUV420のフレームでない場合はNOを返す。
+ */
+- (BOOL)submitSampleBuffer:(CMSampleBufferRef)sampleBuffer orientation:(int)orientation;
+
+/*
+ * 投入した数と、保存まで終わった数
+ */
+@property (nonatomic, readonly) uint64_t submitted;
+@property (nonatomic, readonly) uint64_t completed;
+
+/*
+ * 段毎の待ち時間と処理時間、投入から保存までの時間を吐き出す。
+ */
+- (void)dumpStats;
+
+@end
+
+
+#endif // TYABUTA_BURST_CAPTURE_PIPELINE_H
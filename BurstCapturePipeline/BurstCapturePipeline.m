@@ -0,0 +1,252 @@
+//
+//  BurstCapturePipeline
+//
+//  Created by tyabuta on 2014/07/24.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "BurstCapturePipeline.h"
+#import <ImageIO/ImageIO.h>
+#import "YUVConverter.h"
+#import "JPEGPhotoWriter.h"
+#import "AVFoundationMacro.h"     // dmsg, CVPixelBufferConvertToRGBA
+
+
+// 保存待ちが一杯の時に、もう一度試すまでの時間(マイクロ秒)
+#define BURST_CAPTURE_WRITE_RETRY 10000
+
+
+/*
+ * パイプラインを流れる一枚の静止画
+ */
+typedef struct {
+    CVPixelBufferRef pixelBuffer;   // 撮影したフレーム(変換まで)
+    CGImageRef       image;         // 変換したBGRA(エンコードまで)
+    CFDataRef        jpeg;          // エンコードしたJPEG(保存まで)
+    int              orientation;
+} BurstCaptureStill;
+
+/*
+ * 各段の共有情報
+ * パイプラインは破棄の時に別のキューで終わりを待つので、selfではなくこちらを渡す。
+ */
+typedef struct {
+    float     quality;
+    CFTypeRef handler;              // BurstCapturePipelineHandler
+} BurstCaptureContext;
+
+
+static void BurstCaptureStillFree(BurstCaptureStill* still){
+    if (still->pixelBuffer) CVPixelBufferRelease(still->pixelBuffer);
+    if (still->image)       CGImageRelease(still->image);
+    if (still->jpeg)        CFRelease(still->jpeg);
+    free(still);
+}
+
+static void BurstCaptureReleasePixels(void* info, const void* data, size_t size){
+    free((void*)data);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Stages
+ -----------------------------------------------------------------------------*/
+
+/*
+ * YUVからBGRAのCGImageを作る。
+ */
+static void* BurstCaptureConvert(void* item, uint64_t sequence, void* context){
+    BurstCaptureStill* still  = (BurstCaptureStill*)item;
+    size_t             width  = CVPixelBufferGetWidth(still->pixelBuffer);
+    size_t             height = CVPixelBufferGetHeight(still->pixelBuffer);
+    size_t             stride = width * 4;
+    uint8_t*           pixels = (uint8_t*)malloc(stride * height);
+
+    // フレームごとに並列にするので、一枚の変換は一つのスレッドで行う。
+    YUVConvertOptions options;
+    YUVConvertOptionsInit(&options);
+    options.order   = YUVPixelBGRA;
+    options.threads = 1;
+    if (NULL == pixels || !CVPixelBufferConvertToRGBA(still->pixelBuffer, pixels, stride, &options)) {
+        dmsg(@"%llu: 変換できません。", sequence);
+        free(pixels);
+        BurstCaptureStillFree(still);
+        return NULL;
+    }
+    CVPixelBufferRelease(still->pixelBuffer);
+    still->pixelBuffer = NULL;
+
+    CGDataProviderRef provider   = CGDataProviderCreateWithData(NULL, pixels, stride * height,
+                                                                BurstCaptureReleasePixels);
+    CGColorSpaceRef   colorSpace = CGColorSpaceCreateDeviceRGB();
+    still->image = CGImageCreate(width, height, 8, 32, stride, colorSpace,
+                                 kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst,
+                                 provider, NULL, false, kCGRenderingIntentDefault);
+    CGColorSpaceRelease(colorSpace);
+    CGDataProviderRelease(provider);
+    if (NULL == still->image) {
+        BurstCaptureStillFree(still);
+        return NULL;
+    }
+    return still;
+}
+
+/*
+ * ImageIOでJPEGにする。向きはExifに書く。
+ */
+static void* BurstCaptureEncode(void* item, uint64_t sequence, void* context){
+    BurstCaptureStill*   still   = (BurstCaptureStill*)item;
+    BurstCaptureContext* capture = (BurstCaptureContext*)context;
+
+    @autoreleasepool {
+        CFMutableDataRef        data        = CFDataCreateMutable(NULL, 0);
+        CGImageDestinationRef   destination = CGImageDestinationCreateWithData(data, CFSTR("public.jpeg"), 1, NULL);
+        NSDictionary*           properties  = @{
+            (__bridge id)kCGImageDestinationLossyCompressionQuality: @(capture->quality),
+            (__bridge id)kCGImagePropertyOrientation: @((still->orientation >= 1 && still->orientation <= 8)? still->orientation : 1),
+        };
+        BOOL encoded = NO;
+        if (destination) {
+            CGImageDestinationAddImage(destination, still->image, (__bridge CFDictionaryRef)properties);
+            encoded = CGImageDestinationFinalize(destination);
+            CFRelease(destination);
+        }
+        CGImageRelease(still->image);
+        still->image = NULL;
+        still->jpeg  = data;
+        if (!encoded) {
+            dmsg(@"%llu: エンコードできません。", sequence);
+            BurstCaptureStillFree(still);
+            return NULL;
+        }
+    }
+    return still;
+}
+
+/*
+ * カメラロールに保存する。撮影順に一枚ずつ呼ばれる。
+ */
+static void* BurstCaptureWrite(void* item, uint64_t sequence, void* context){
+    BurstCaptureStill*          still   = (BurstCaptureStill*)item;
+    BurstCaptureContext*        capture = (BurstCaptureContext*)context;
+    BurstCapturePipelineHandler handler = (__bridge BurstCapturePipelineHandler)capture->handler;
+
+    @autoreleasepool {
+        NSData* jpeg = (__bridge NSData*)still->jpeg;
+        JPEGPhotoWriterCompletion completion = ^(NSURL* assetURL, NSError* error) {
+            if (handler) handler(sequence, assetURL, error);
+        };
+        // 保存待ちが一杯なら空くまで待つ。(この段が待つと、前の段も順に待つ)
+        while (![[JPEGPhotoWriter sharedWriter] writeJPEGData:jpeg orientation:0 completion:completion]) {
+            usleep(BURST_CAPTURE_WRITE_RETRY);
+        }
+    }
+    BurstCaptureStillFree(still);
+    return NULL;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ BurstCapturePipeline
+ -----------------------------------------------------------------------------*/
+
+@implementation BurstCapturePipeline
+{
+    BurstPipeline*       _pipeline;
+    BurstCaptureContext* _context;
+}
+
++ (NSDictionary*)stillImageOutputSettings {
+    return @{ (__bridge id)kCVPixelBufferPixelFormatTypeKey: @(kCVPixelFormatType_420YpCbCr8BiPlanarFullRange) };
+}
+
+- (id)initWithQueueCapacity:(NSUInteger)capacity
+                    quality:(float)quality
+                    handler:(BurstCapturePipelineHandler)handler {
+    self = [super init];
+    if (self) {
+        _context = (BurstCaptureContext*)calloc(1, sizeof(BurstCaptureContext));
+        if (NULL == _context) return nil;
+        _context->quality = (quality < 0.0f)? 0.0f : (quality > 1.0f)? 1.0f : quality;
+        _context->handler = handler? CFBridgingRetain([handler copy]) : NULL;
+
+        // 変換とエンコードはCPUの数だけ並列にし、保存は撮影順に一つずつ行う。
+        int workers = (int)[[NSProcessInfo processInfo] activeProcessorCount];
+        if (workers < 1) workers = 1;
+        BurstPipelineStage stages[] = {
+            { "convert", BurstCaptureConvert, _context, workers },
+            { "encode",  BurstCaptureEncode,  _context, workers },
+            { "write",   BurstCaptureWrite,   _context, 1       },
+        };
+        _pipeline = BurstPipelineCreate(stages, 3, (capacity > 0)? capacity : 1);
+        if (NULL == _pipeline) {
+            if (_context->handler) CFRelease(_context->handler);
+            free(_context);
+            _context = NULL;
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    // 保存の完了はメインスレッドに届くので、残りのフレームは別のキューで待つ。
+    BurstPipeline*       pipeline = _pipeline;
+    BurstCaptureContext* context  = _context;
+    if (NULL == pipeline) return;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        BurstPipelineDestroy(pipeline);
+        if (context->handler) CFRelease(context->handler);
+        free(context);
+    });
+}
+
+- (BOOL)submitSampleBuffer:(CMSampleBufferRef)sampleBuffer orientation:(int)orientation {
+    CVPixelBufferRef pixelBuffer = CMSampleBufferGetImageBuffer(sampleBuffer);
+    if (NULL == pixelBuffer) return NO;
+    OSType format = CVPixelBufferGetPixelFormatType(pixelBuffer);
+    if (kCVPixelFormatType_420YpCbCr8BiPlanarFullRange  != format &&
+        kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange != format) {
+        dmsg(@"YUV420のフレームではありません。");
+        return NO;
+    }
+
+    BurstCaptureStill* still = (BurstCaptureStill*)calloc(1, sizeof(BurstCaptureStill));
+    if (NULL == still) return NO;
+    still->pixelBuffer = CVPixelBufferRetain(pixelBuffer);
+    still->orientation = orientation;
+    if (!BurstPipelineSubmit(_pipeline, still, 0)) {
+        dmsg(@"キューが一杯なので捨てます。");
+        BurstCaptureStillFree(still);
+        return NO;
+    }
+    return YES;
+}
+
+- (uint64_t)submitted {
+    return BurstPipelineSubmitted(_pipeline);
+}
+
+- (uint64_t)completed {
+    return BurstPipelineCompleted(_pipeline);
+}
+
+- (void)dumpStats {
+    static const char* const names[] = { "convert", "encode", "write" };
+    NSLog(@"--- BurstCapturePipeline %llu/%llu ---", self.completed, self.submitted);
+    for (int i = 0; i < 3; i++) {
+        BurstPipelineStageStats stats;
+        BurstPipelineGetStageStats(_pipeline, i, &stats);
+        NSLog(@"%-8s wait %.1f/%.1fms process %.1f/%.1fms (avg/max)", names[i],
+              stats.wait.average * 1e3, stats.wait.maximum * 1e3,
+              stats.process.average * 1e3, stats.process.maximum * 1e3);
+    }
+    BurstPipelineTiming latency = BurstPipelineGetLatency(_pipeline);
+    NSLog(@"latency  %.1f/%.1fms (avg/max)", latency.average * 1e3, latency.maximum * 1e3);
+}
+
+@end
@@ -0,0 +1,372 @@
+/*
+ *  BurstPipeline
+ *
+ *  Created by tyabuta on 2014/07/24.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "BurstPipeline.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+
+/*
+ * パイプラインを流れる一つのフレーム
+ * 途中の段で捨てられた場合もitemをNULLにして最後まで流し、番号を詰める。
+ */
+typedef struct {
+    void*    item;
+    uint64_t sequence;
+    double   submitted;
+    double   enqueued;      // 今のキューに入った時刻
+} BurstPipelineJob;
+
+/*
+ * 番号順にしか取り出せないキュー
+ * 番号sequenceのフレームはslots[sequence & mask]に入り、next + 長さ より先の番号は入るまで待つ。
+ */
+typedef struct {
+    pthread_mutex_t    mutex;
+    pthread_cond_t     readable;
+    pthread_cond_t     writable;
+    BurstPipelineJob** slots;
+    uint64_t           capacity;
+    uint64_t           mask;
+    uint64_t           next;        // 次に取り出す番号
+    uint64_t           end;         // 締め切った時の投入数(それまではUINT64_MAX)
+    uint64_t           tail;        // 次に投入する番号(最初の段のみ)
+} BurstPipelineQueue;
+
+typedef struct BurstPipelineStep {
+    BurstPipeline*          pipeline;
+    int                     index;
+    BurstPipelineStage      stage;
+    BurstPipelineQueue      input;
+    pthread_t*              threads;
+    int                     started;
+    int                     running;    // input.mutexで守る
+    BurstPipelineStageStats stats;      // input.mutexで守る
+} BurstPipelineStep;
+
+struct BurstPipeline {
+    int                 stageCount;
+    BurstPipelineStep   steps[BURST_PIPELINE_MAX_STAGES];
+    uint64_t            completed;
+    pthread_mutex_t     latencyMutex;
+    BurstPipelineTiming latency;
+};
+
+
+
+
+/*------------------------------------------------------------------------------
+ Time
+ -----------------------------------------------------------------------------*/
+
+static double BurstPipelineNow(void){
+#if defined(__APPLE__)
+    static double secondsPerTick = 0.0;
+    if (0.0 == secondsPerTick) {
+        mach_timebase_info_data_t info;
+        mach_timebase_info(&info);
+        secondsPerTick = (double)info.numer / info.denom * 1e-9;
+    }
+    return mach_absolute_time() * secondsPerTick;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static void BurstPipelineTimingAdd(BurstPipelineTiming* timing, double seconds){
+    timing->count++;
+    timing->average += (seconds - timing->average) / (double)timing->count;
+    if (seconds > timing->maximum) timing->maximum = seconds;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Queue
+ -----------------------------------------------------------------------------*/
+
+static int BurstPipelineQueueInit(BurstPipelineQueue* queue, size_t capacity){
+    uint64_t length = 1;
+    while (length < capacity) length <<= 1;
+
+    memset(queue, 0, sizeof(*queue));
+    queue->slots = (BurstPipelineJob**)calloc((size_t)length, sizeof(BurstPipelineJob*));
+    if (NULL == queue->slots) return -1;
+    queue->capacity = length;
+    queue->mask     = length - 1;
+    queue->end      = UINT64_MAX;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->readable, NULL);
+    pthread_cond_init(&queue->writable, NULL);
+    return 0;
+}
+
+static void BurstPipelineQueueDestroy(BurstPipelineQueue* queue){
+    if (NULL == queue->slots) return;
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->readable);
+    pthread_cond_destroy(&queue->writable);
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+/*
+ * 番号の位置に入れる。(mutexをロックして呼ぶ)
+ */
+static void BurstPipelineQueueStore(BurstPipelineQueue* queue, BurstPipelineJob* job){
+    job->enqueued = BurstPipelineNow();
+    queue->slots[job->sequence & queue->mask] = job;
+    if (job->sequence == queue->next) pthread_cond_broadcast(&queue->readable);
+}
+
+static void BurstPipelineQueuePut(BurstPipelineQueue* queue, BurstPipelineJob* job){
+    pthread_mutex_lock(&queue->mutex);
+    while (job->sequence >= queue->next + queue->capacity) {
+        pthread_cond_wait(&queue->writable, &queue->mutex);
+    }
+    BurstPipelineQueueStore(queue, job);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/*
+ * 次の番号のフレームを取り出す。締め切られて空になったらNULL
+ */
+static BurstPipelineJob* BurstPipelineQueueTake(BurstPipelineQueue* queue){
+    pthread_mutex_lock(&queue->mutex);
+    BurstPipelineJob* job;
+    for (;;) {
+        if (queue->next == queue->end) {
+            pthread_mutex_unlock(&queue->mutex);
+            return NULL;
+        }
+        job = queue->slots[queue->next & queue->mask];
+        if (job) break;
+        pthread_cond_wait(&queue->readable, &queue->mutex);
+    }
+    queue->slots[queue->next & queue->mask] = NULL;
+    queue->next++;
+    pthread_cond_broadcast(&queue->writable);
+
+    // 次の番号が届いていれば(または終わりなら)、他のワーカーを起こす。
+    if (queue->next == queue->end || queue->slots[queue->next & queue->mask]) {
+        pthread_cond_broadcast(&queue->readable);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return job;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Workers
+ -----------------------------------------------------------------------------*/
+
+/*
+ * index段目のキューを、end個で締め切る。
+ * ワーカーがいない段は、そのまま次の段も締め切る。
+ */
+static void BurstPipelineClose(BurstPipeline* pipeline, int index, uint64_t end){
+    for (; index < pipeline->stageCount; index++) {
+        BurstPipelineStep* step = &pipeline->steps[index];
+        pthread_mutex_lock(&step->input.mutex);
+        step->input.end = end;
+        int running     = step->running;
+        pthread_cond_broadcast(&step->input.readable);
+        pthread_cond_broadcast(&step->input.writable);
+        pthread_mutex_unlock(&step->input.mutex);
+        if (running > 0) break;
+    }
+}
+
+static void BurstPipelineComplete(BurstPipeline* pipeline, BurstPipelineJob* job){
+    if (job->item) {
+        double now = BurstPipelineNow();
+        pthread_mutex_lock(&pipeline->latencyMutex);
+        BurstPipelineTimingAdd(&pipeline->latency, now - job->submitted);
+        pthread_mutex_unlock(&pipeline->latencyMutex);
+        __atomic_fetch_add(&pipeline->completed, 1, __ATOMIC_RELAXED);
+    }
+    free(job);
+}
+
+static void* BurstPipelineWorker(void* context){
+    BurstPipelineStep* step     = (BurstPipelineStep*)context;
+    BurstPipeline*     pipeline = step->pipeline;
+    int                last     = (step->index + 1 == pipeline->stageCount);
+
+    BurstPipelineJob* job;
+    while (NULL != (job = BurstPipelineQueueTake(&step->input))) {
+        if (job->item) {
+            double start = BurstPipelineNow();
+            void*  item  = step->stage.function(job->item, job->sequence, step->stage.context);
+            double end   = BurstPipelineNow();
+
+            pthread_mutex_lock(&step->input.mutex);
+            BurstPipelineTimingAdd(&step->stats.wait,    start - job->enqueued);
+            BurstPipelineTimingAdd(&step->stats.process, end - start);
+            pthread_mutex_unlock(&step->input.mutex);
+
+            // 最後の段の戻り値は使わない。
+            job->item = last? job->item : item;
+        }
+        if (last) {
+            BurstPipelineComplete(pipeline, job);
+        } else {
+            BurstPipelineQueuePut(&pipeline->steps[step->index + 1].input, job);
+        }
+    }
+
+    // 最後に抜けたワーカーが次の段を締め切る。
+    pthread_mutex_lock(&step->input.mutex);
+    int remaining = --step->running;
+    uint64_t end  = step->input.end;
+    pthread_mutex_unlock(&step->input.mutex);
+    if (0 == remaining && !last) BurstPipelineClose(pipeline, step->index + 1, end);
+    return NULL;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+static void BurstPipelineFree(BurstPipeline* pipeline){
+    for (int i = 0; i < pipeline->stageCount; i++) {
+        BurstPipelineQueueDestroy(&pipeline->steps[i].input);
+        free(pipeline->steps[i].threads);
+    }
+    pthread_mutex_destroy(&pipeline->latencyMutex);
+    free(pipeline);
+}
+
+BurstPipeline* BurstPipelineCreate(const BurstPipelineStage* stages, int stageCount, size_t queueCapacity){
+    if (stageCount < 1 || stageCount > BURST_PIPELINE_MAX_STAGES || 0 == queueCapacity) return NULL;
+    for (int i = 0; i < stageCount; i++) {
+        if (NULL == stages[i].function || stages[i].workers < 1) return NULL;
+    }
+
+    BurstPipeline* pipeline = (BurstPipeline*)calloc(1, sizeof(BurstPipeline));
+    if (NULL == pipeline) return NULL;
+    pipeline->stageCount = stageCount;
+    pthread_mutex_init(&pipeline->latencyMutex, NULL);
+
+    for (int i = 0; i < stageCount; i++) {
+        BurstPipelineStep* step = &pipeline->steps[i];
+        step->pipeline = pipeline;
+        step->index    = i;
+        step->stage    = stages[i];
+        step->threads  = (pthread_t*)calloc((size_t)stages[i].workers, sizeof(pthread_t));
+        if (NULL == step->threads || BurstPipelineQueueInit(&step->input, queueCapacity)) {
+            BurstPipelineFree(pipeline);
+            return NULL;
+        }
+    }
+
+    // ワーカーを起動する。一つも起動できない段があれば、起動した分を締め切って終わる。
+    int failed = 0;
+    for (int i = 0; i < stageCount && !failed; i++) {
+        BurstPipelineStep* step = &pipeline->steps[i];
+        pthread_mutex_lock(&step->input.mutex);
+        for (int w = 0; w < step->stage.workers; w++) {
+            if (0 == pthread_create(&step->threads[step->started], NULL, BurstPipelineWorker, step)) {
+                step->started++;
+                step->running++;
+            }
+        }
+        pthread_mutex_unlock(&step->input.mutex);
+        if (0 == step->started) failed = 1;
+    }
+    if (failed) {
+        BurstPipelineDestroy(pipeline);
+        return NULL;
+    }
+    return pipeline;
+}
+
+void BurstPipelineDestroy(BurstPipeline* pipeline){
+    if (NULL == pipeline) return;
+    BurstPipelineFinish(pipeline);
+    BurstPipelineFree(pipeline);
+}
+
+int BurstPipelineSubmit(BurstPipeline* pipeline, void* item, int wait){
+    if (NULL == item) return 0;
+    BurstPipelineJob* job = (BurstPipelineJob*)malloc(sizeof(BurstPipelineJob));
+    if (NULL == job) return 0;
+
+    BurstPipelineQueue* queue = &pipeline->steps[0].input;
+    pthread_mutex_lock(&queue->mutex);
+    while (UINT64_MAX == queue->end && queue->tail >= queue->next + queue->capacity && wait) {
+        pthread_cond_wait(&queue->writable, &queue->mutex);
+    }
+    if (UINT64_MAX != queue->end || queue->tail >= queue->next + queue->capacity) {
+        pthread_mutex_unlock(&queue->mutex);
+        free(job);
+        return 0;
+    }
+    job->item      = item;
+    job->sequence  = queue->tail++;
+    job->submitted = BurstPipelineNow();
+    BurstPipelineQueueStore(queue, job);
+    pthread_mutex_unlock(&queue->mutex);
+    return 1;
+}
+
+void BurstPipelineFinish(BurstPipeline* pipeline){
+    BurstPipelineQueue* queue = &pipeline->steps[0].input;
+    pthread_mutex_lock(&queue->mutex);
+    uint64_t end = queue->tail;
+    int      open = (UINT64_MAX == queue->end);
+    pthread_mutex_unlock(&queue->mutex);
+    if (open) BurstPipelineClose(pipeline, 0, end);
+
+    for (int i = 0; i < pipeline->stageCount; i++) {
+        BurstPipelineStep* step = &pipeline->steps[i];
+        for (int w = 0; w < step->started; w++) pthread_join(step->threads[w], NULL);
+        step->started = 0;
+    }
+}
+
+uint64_t BurstPipelineSubmitted(const BurstPipeline* pipeline){
+    BurstPipelineQueue* queue = (BurstPipelineQueue*)&pipeline->steps[0].input;
+    pthread_mutex_lock(&queue->mutex);
+    uint64_t submitted = queue->tail;
+    pthread_mutex_unlock(&queue->mutex);
+    return submitted;
+}
+
+uint64_t BurstPipelineCompleted(const BurstPipeline* pipeline){
+    return __atomic_load_n(&pipeline->completed, __ATOMIC_RELAXED);
+}
+
+int BurstPipelineGetStageStats(BurstPipeline* pipeline, int stage, BurstPipelineStageStats* stats){
+    if (stage < 0 || stage >= pipeline->stageCount) return -1;
+    BurstPipelineStep* step = &pipeline->steps[stage];
+    pthread_mutex_lock(&step->input.mutex);
+    *stats = step->stats;
+    pthread_mutex_unlock(&step->input.mutex);
+    return 0;
+}
+
+BurstPipelineTiming BurstPipelineGetLatency(BurstPipeline* pipeline){
+    pthread_mutex_lock(&pipeline->latencyMutex);
+    BurstPipelineTiming latency = pipeline->latency;
+    pthread_mutex_unlock(&pipeline->latencyMutex);
+    return latency;
+}
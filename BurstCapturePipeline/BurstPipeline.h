@@ -0,0 +1,126 @@
+/*******************************************************************************
+  BurstPipeline 1.0.0.0
+
+                         連写用の多段パイプライン
+
+   撮影したフレームを 変換 → エンコード → 保存 のような段に順に通す。
+   各段はそれぞれのワーカースレッドで動き、段と段の間は長さの決まったキューでつなぐ。
+   後ろの段が詰まると前の段が待ち、最後は投入(BurstPipelineSubmit)が待つか失敗するので、
+   連写が保存より速くても、溜まるフレームの数はキューの長さまでに収まる。
+
+   キューは投入した順番(通し番号)でしか取り出さない。
+   ワーカーが複数の段では処理の終わる順番が前後するが、次の段には撮影順で渡るので、
+   workersが1の段(保存など)は必ず撮影順に呼ばれる。
+   (順番待ちのフレームもキューの長さに数えるので、待ちが際限なく増えることはない)
+
+   段の関数がNULLを返すと、そのフレームは以降の段を飛ばす。(順番は詰める)
+   段毎に、キューで待った時間と処理にかかった時間の平均と最大を記録する。
+
+   UIKitに依存しないので、Linux上でもそのままコンパイルできる。
+   (カメラからの連写はBurstCapturePipelineを参照)
+
+       BurstPipelineStage stages[] = {
+           { "convert", Convert, NULL, 2 },
+           { "encode",  Encode,  NULL, 2 },
+           { "write",   Write,   NULL, 1 },
+       };
+       BurstPipeline* pipeline = BurstPipelineCreate(stages, 3, 4);
+       BurstPipelineSubmit(pipeline, frame, 0);
+       ...
+       BurstPipelineDestroy(pipeline);
+
+   検査と計測はbptestで行う。(エンコードにlibjpegを使う場合は-DBPTEST_LIBJPEG -ljpeg)
+
+       $ cc -O2 -pthread -I../YUVConverter -o bptest bptest.c BurstPipeline.c ../YUVConverter/YUVConverter.c -lm
+       $ ./bptest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_BURST_PIPELINE_H
+#define TYABUTA_BURST_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 段の数の上限
+#define BURST_PIPELINE_MAX_STAGES 8
+
+typedef struct BurstPipeline BurstPipeline;
+
+/*
+ * 段の処理。itemを処理して次の段に渡すものを返す。
+ * NULLを返すと以降の段を飛ばす。(itemの後始末は関数が行う)
+ */
+typedef void* (*BurstPipelineFunction)(void* item, uint64_t sequence, void* context);
+
+typedef struct {
+    const char*           name;
+    BurstPipelineFunction function;
+    void*                 context;
+    int                   workers;      // スレッドの数(1以上)
+} BurstPipelineStage;
+
+/*
+ * 時間の平均と最大(秒)
+ */
+typedef struct {
+    uint64_t count;
+    double   average;
+    double   maximum;
+} BurstPipelineTiming;
+
+typedef struct {
+    BurstPipelineTiming wait;       // 前のキューで待った時間
+    BurstPipelineTiming process;    // 段の関数の時間
+} BurstPipelineStageStats;
+
+/*
+ * 作成してワーカースレッドを起動する。stagesはコピーされる。
+ * queueCapacityは各段の前のキューの長さ(2の累乗に切り上げる)
+ */
+BurstPipeline* BurstPipelineCreate(const BurstPipelineStage* stages, int stageCount, size_t queueCapacity);
+
+/*
+ * 投入を締め切り、全てのフレームが最後の段を抜けるまで待ってから破棄する。
+ */
+void BurstPipelineDestroy(BurstPipeline* pipeline);
+
+/*
+ * フレームを投入する。成功時は1を返す。
+ * 最初のキューが一杯の場合、waitが0なら待たずに0を返す。(フレームは呼び出し側で捨てる)
+ */
+int BurstPipelineSubmit(BurstPipeline* pipeline, void* item, int wait);
+
+/*
+ * 投入を締め切り、全てのフレームが最後の段を抜けるまで待つ。
+ * 以降のBurstPipelineSubmitは0を返す。
+ */
+void BurstPipelineFinish(BurstPipeline* pipeline);
+
+/*
+ * 投入した数と、最後の段を抜けた数
+ */
+uint64_t BurstPipelineSubmitted(const BurstPipeline* pipeline);
+uint64_t BurstPipelineCompleted(const BurstPipeline* pipeline);
+
+/*
+ * 段毎の時間。stageが範囲外なら-1を返す。
+ */
+int BurstPipelineGetStageStats(BurstPipeline* pipeline, int stage, BurstPipelineStageStats* stats);
+
+/*
+ * 投入から最後の段を抜けるまでの時間
+ */
+BurstPipelineTiming BurstPipelineGetLatency(BurstPipeline* pipeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_BURST_PIPELINE_H
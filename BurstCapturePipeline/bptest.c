@@ -0,0 +1,439 @@
+/*
+ *  bptest
+ *
+ *  BurstPipelineをPC(Linux)上で検査し、1080pの連写を 変換 → エンコード → 保存 の
+ *  パイプラインに通した時の一秒あたりの枚数を、一つのスレッドで順に行う場合と比べる。
+ *  変換はYUVConverter、保存は/dev/nullへの書き込みとI/Oの待ちで模す。
+ *  エンコードは既定ではCPU時間を使うだけの代役で、BPTEST_LIBJPEGを定義すると
+ *  libjpegでJPEGにする。
+ *
+ *      $ cc -O2 -pthread -I../YUVConverter -o bptest bptest.c BurstPipeline.c ../YUVConverter/YUVConverter.c -lm
+ *      $ cc -O2 -pthread -I../YUVConverter -DBPTEST_LIBJPEG -o bptest bptest.c BurstPipeline.c ../YUVConverter/YUVConverter.c -lm -ljpeg
+ *      $ ./bptest
+ *
+ *      -n stills  計測で撮る枚数 (初期値は40)
+ *      -e msec    代役のエンコードにかけるCPU時間 (初期値は15)
+ *      -w msec    保存一枚あたりのI/Oの待ち (初期値は25)
+ *
+ *  -fsanitize=thread を付けてビルドすると、段と段の受け渡しの競合も検査できる。
+ *
+ *  Created by tyabuta on 2014/07/24.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "BurstPipeline.h"
+#include "YUVConverter.h"
+#ifdef BPTEST_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+#define STILL_WIDTH  1920
+#define STILL_HEIGHT 1080
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 検査で流すフレーム
+ */
+typedef struct {
+    uint64_t value;     // 投入した順番
+    int      stages;    // 通った段の数
+} Item;
+
+/*
+ * 段の関数。stagesを数え、少し待って処理の終わる順番を入れ替える。
+ * contextが0でなければ、その数で割り切れる番号のフレームを捨てる。
+ */
+static void* shuffleStage(void* item, uint64_t sequence, void* context){
+    Item* it = (Item*)item;
+    CHECK(sequence == it->value);
+    it->stages++;
+    usleep((useconds_t)(sequence * 7919 % 5) * 100);
+
+    uintptr_t drop = (uintptr_t)context;
+    if (drop && 0 == sequence % drop) {
+        free(it);
+        return NULL;
+    }
+    return it;
+}
+
+/*
+ * 最後の段。順番に呼ばれることを確かめる。(ワーカーは1なので排他は要らない)
+ */
+typedef struct {
+    uint64_t next;
+    uint64_t seen;
+    int      stages;
+    uint64_t drop;
+} Sink;
+
+static void* sinkStage(void* item, uint64_t sequence, void* context){
+    Sink* sink = (Sink*)context;
+    Item* it   = (Item*)item;
+    CHECK(sequence == it->value && sequence >= sink->next);
+    CHECK(it->stages == sink->stages);
+    // 飛ばしてよいのは捨てられた番号だけ
+    for (uint64_t s = sink->next; s < sequence; s++) CHECK(sink->drop && 0 == s % sink->drop);
+    sink->next = sequence + 1;
+    sink->seen++;
+    free(it);
+    return NULL;
+}
+
+static void testCreate(void){
+    BurstPipelineStage stage = { "stage", shuffleStage, NULL, 1 };
+    CHECK(NULL == BurstPipelineCreate(&stage, 0, 4));
+    CHECK(NULL == BurstPipelineCreate(&stage, BURST_PIPELINE_MAX_STAGES + 1, 4));
+    CHECK(NULL == BurstPipelineCreate(&stage, 1, 0));
+    stage.workers = 0;
+    CHECK(NULL == BurstPipelineCreate(&stage, 1, 4));
+    stage.workers  = 1;
+    stage.function = NULL;
+    CHECK(NULL == BurstPipelineCreate(&stage, 1, 4));
+
+    // 何も投入せずに破棄できる。
+    stage.function = shuffleStage;
+    BurstPipeline* pipeline = BurstPipelineCreate(&stage, 1, 4);
+    CHECK(pipeline && 0 == BurstPipelineSubmit(pipeline, NULL, 1));
+    BurstPipelineStageStats stats;
+    CHECK(0 == BurstPipelineGetStageStats(pipeline, 0, &stats) && 0 == stats.process.count);
+    CHECK(-1 == BurstPipelineGetStageStats(pipeline, 1, &stats));
+    CHECK(-1 == BurstPipelineGetStageStats(pipeline, -1, &stats));
+    BurstPipelineDestroy(pipeline);
+    printf("create: ok\n");
+}
+
+/*
+ * 複数のワーカーの段で終わる順番が入れ替わっても、最後の段には投入した順に届く。
+ * 途中で捨てたフレームは飛ばし、残りの順番は変わらない。
+ */
+static void runOrder(uint64_t drop){
+    enum { COUNT = 2000 };
+    Sink sink = { 0, 0, 2, drop };
+    BurstPipelineStage stages[] = {
+        { "first",  shuffleStage, (void*)(uintptr_t)drop, 3 },
+        { "second", shuffleStage, NULL,                   4 },
+        { "sink",   sinkStage,    &sink,                  1 },
+    };
+    BurstPipeline* pipeline = BurstPipelineCreate(stages, 3, 4);
+    for (uint64_t i = 0; i < COUNT; i++) {
+        Item* it = (Item*)calloc(1, sizeof(Item));
+        it->value = i;
+        CHECK(BurstPipelineSubmit(pipeline, it, 1));
+    }
+    BurstPipelineFinish(pipeline);
+
+    uint64_t expected = drop? COUNT - (COUNT + drop - 1) / drop : COUNT;
+    CHECK(COUNT == BurstPipelineSubmitted(pipeline));
+    CHECK(expected == BurstPipelineCompleted(pipeline) && expected == sink.seen);
+
+    BurstPipelineStageStats stats;
+    BurstPipelineGetStageStats(pipeline, 0, &stats);
+    CHECK(COUNT == stats.process.count && COUNT == stats.wait.count);
+    BurstPipelineGetStageStats(pipeline, 2, &stats);
+    CHECK(expected == stats.process.count);
+    CHECK(expected == BurstPipelineGetLatency(pipeline).count);
+    BurstPipelineDestroy(pipeline);
+}
+
+static void testOrder(void){
+    runOrder(0);
+    runOrder(7);
+    printf("order, drop: ok\n");
+}
+
+/*
+ * 段が詰まると、溜まるフレームはキューの長さまでで、wait=0の投入は失敗する。
+ * 締め切った後の投入も失敗する。
+ */
+static int gateOpen;
+static int gateEntered;
+
+static void* gateStage(void* item, uint64_t sequence, void* context){
+    __atomic_store_n(&gateEntered, 1, __ATOMIC_RELEASE);
+    while (0 == __atomic_load_n(&gateOpen, __ATOMIC_ACQUIRE)) usleep(100);
+    return item;
+}
+
+static void* freeStage(void* item, uint64_t sequence, void* context){
+    free(item);
+    return NULL;
+}
+
+static void testBackpressure(void){
+    BurstPipelineStage stages[] = {
+        { "gate", gateStage, NULL, 1 },
+        { "free", freeStage, NULL, 1 },
+    };
+    BurstPipeline* pipeline = BurstPipelineCreate(stages, 2, 3);    // 長さは4になる
+
+    CHECK(BurstPipelineSubmit(pipeline, malloc(1), 0));
+    while (0 == __atomic_load_n(&gateEntered, __ATOMIC_ACQUIRE)) usleep(100);
+
+    // 一つは段の中、4つがキューに入る。
+    int accepted = 1;
+    for (int i = 0; i < 10; i++) {
+        void* item = malloc(1);
+        if (BurstPipelineSubmit(pipeline, item, 0)) {
+            accepted++;
+        } else {
+            free(item);
+        }
+    }
+    CHECK(5 == accepted && 5 == BurstPipelineSubmitted(pipeline) && 0 == BurstPipelineCompleted(pipeline));
+
+    __atomic_store_n(&gateOpen, 1, __ATOMIC_RELEASE);
+    BurstPipelineFinish(pipeline);
+    CHECK(5 == BurstPipelineCompleted(pipeline));
+    void* item = malloc(1);
+    CHECK(0 == BurstPipelineSubmit(pipeline, item, 1));
+    free(item);
+
+    // 待ちの時間は記録される。
+    BurstPipelineStageStats stats;
+    BurstPipelineGetStageStats(pipeline, 0, &stats);
+    CHECK(5 == stats.process.count && stats.process.maximum > 0.0 && stats.wait.maximum > 0.0);
+    CHECK(stats.wait.average <= stats.wait.maximum && stats.process.average <= stats.process.maximum);
+    BurstPipelineDestroy(pipeline);
+    printf("backpressure: ok\n");
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+typedef struct {
+    uint64_t sequence;
+    uint8_t* rgba;
+    uint8_t* encoded;
+    size_t   length;
+} Still;
+
+typedef struct {
+    YUVImage image;
+    double   encodeTime;
+    double   writeTime;
+    FILE*    output;
+    uint64_t next;
+} Bench;
+
+static void* convertStill(void* item, uint64_t sequence, void* context){
+    Bench* bench = (Bench*)context;
+    Still* still = (Still*)item;
+    still->sequence = sequence;
+    still->rgba     = malloc((size_t)STILL_WIDTH * STILL_HEIGHT * 4);
+
+    YUVConvertOptions options;
+    YUVConvertOptionsInit(&options);
+    options.order   = YUVPixelRGBA;
+    options.threads = 1;
+    CHECK(0 == YUVConvert(&bench->image, still->rgba, STILL_WIDTH * 4, &options));
+    return still;
+}
+
+#ifdef BPTEST_LIBJPEG
+static void* encodeStill(void* item, uint64_t sequence, void* context){
+    Still* still = (Still*)item;
+    unsigned char* encoded = NULL;
+    unsigned long  length  = 0;
+
+    struct jpeg_compress_struct jpeg;
+    struct jpeg_error_mgr       error;
+    jpeg.err = jpeg_std_error(&error);
+    jpeg_create_compress(&jpeg);
+    jpeg_mem_dest(&jpeg, &encoded, &length);
+    jpeg.image_width      = STILL_WIDTH;
+    jpeg.image_height     = STILL_HEIGHT;
+    jpeg.input_components = 4;
+    jpeg.in_color_space   = JCS_EXT_RGBA;
+    jpeg_set_defaults(&jpeg);
+    jpeg_set_quality(&jpeg, 90, TRUE);
+    jpeg_start_compress(&jpeg, TRUE);
+    while (jpeg.next_scanline < STILL_HEIGHT) {
+        JSAMPROW row = still->rgba + (size_t)jpeg.next_scanline * STILL_WIDTH * 4;
+        jpeg_write_scanlines(&jpeg, &row, 1);
+    }
+    jpeg_finish_compress(&jpeg);
+    jpeg_destroy_compress(&jpeg);
+
+    free(still->rgba);
+    still->rgba    = NULL;
+    still->encoded = encoded;
+    still->length  = length;
+    return still;
+}
+#else
+static double threadSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * エンコードの代役。encodeTimeだけCPUを使い、1/10の大きさのデータにする。
+ */
+static void* encodeStill(void* item, uint64_t sequence, void* context){
+    Bench* bench = (Bench*)context;
+    Still* still = (Still*)item;
+    size_t size  = (size_t)STILL_WIDTH * STILL_HEIGHT * 4;
+
+    still->length  = size / 10;
+    still->encoded = malloc(still->length);
+    double   end   = threadSec() + bench->encodeTime;
+    uint32_t hash  = 2166136261u;
+    size_t   i     = 0;
+    while (threadSec() < end) {
+        for (size_t n = 0; n < 65536; n++, i = (i + 1) % size) hash = (hash ^ still->rgba[i]) * 16777619u;
+    }
+    for (size_t n = 0; n < still->length; n++) still->encoded[n] = still->rgba[n * 10] ^ (uint8_t)hash;
+
+    free(still->rgba);
+    still->rgba = NULL;
+    return still;
+}
+#endif
+
+static void* writeStill(void* item, uint64_t sequence, void* context){
+    Bench* bench = (Bench*)context;
+    Still* still = (Still*)item;
+    CHECK(sequence == still->sequence && sequence >= bench->next);
+    bench->next = sequence + 1;
+
+    CHECK(still->length == fwrite(still->encoded, 1, still->length, bench->output));
+    fflush(bench->output);
+    usleep((useconds_t)(bench->writeTime * 1e6));
+    free(still->encoded);
+    free(still);
+    return NULL;
+}
+
+/*
+ * 三つをまとめて一つの段で順に行う。(比較用)
+ */
+static void* serialStill(void* item, uint64_t sequence, void* context){
+    item = convertStill(item, sequence, context);
+    item = encodeStill(item, sequence, context);
+    return writeStill(item, sequence, context);
+}
+
+static void benchRun(Bench* bench, const char* name, const BurstPipelineStage* stages, int stageCount, int stills){
+    bench->next = 0;
+    BurstPipeline* pipeline = BurstPipelineCreate(stages, stageCount, 4);
+    double start = nowSec();
+    for (int i = 0; i < stills; i++) CHECK(BurstPipelineSubmit(pipeline, calloc(1, sizeof(Still)), 1));
+    BurstPipelineFinish(pipeline);
+    double elapsed = nowSec() - start;
+    CHECK((uint64_t)stills == BurstPipelineCompleted(pipeline));
+
+    BurstPipelineTiming latency = BurstPipelineGetLatency(pipeline);
+    printf("  %-16s: %5.1f stills/s, latency avg %4.0f ms, max %4.0f ms\n",
+           name, stills / elapsed, latency.average * 1e3, latency.maximum * 1e3);
+    for (int i = 0; i < stageCount; i++) {
+        BurstPipelineStageStats stats;
+        BurstPipelineGetStageStats(pipeline, i, &stats);
+        printf("      %-8s x%d: wait avg %6.1f ms, max %6.1f ms, process avg %5.1f ms, max %5.1f ms\n",
+               stages[i].name, stages[i].workers, stats.wait.average * 1e3, stats.wait.maximum * 1e3,
+               stats.process.average * 1e3, stats.process.maximum * 1e3);
+    }
+    BurstPipelineDestroy(pipeline);
+}
+
+static void bench(int stills, double encodeTime, double writeTime){
+    size_t   pixels = (size_t)STILL_WIDTH * STILL_HEIGHT;
+    uint8_t* y      = malloc(pixels);
+    uint8_t* uv     = malloc(pixels / 2);
+    srand(1);
+    for (size_t i = 0; i < pixels; i++) y[i] = (uint8_t)((i % STILL_WIDTH) * 255 / STILL_WIDTH ^ (rand() & 15));
+    for (size_t i = 0; i < pixels / 2; i++) uv[i] = (uint8_t)(128 + i % 97 - 48);
+
+    Bench context;
+    YUVImage image = { y, STILL_WIDTH, uv, STILL_WIDTH, NULL, 0, STILL_WIDTH, STILL_HEIGHT };
+    context.image      = image;
+    context.encodeTime = encodeTime;
+    context.writeTime  = writeTime;
+    context.output     = fopen("/dev/null", "wb");
+    CHECK(context.output);
+
+    BurstPipelineStage serial[] = {
+        { "serial",  serialStill,  &context, 1 },
+    };
+    BurstPipelineStage stages[] = {
+        { "convert", convertStill, &context, 2 },
+        { "encode",  encodeStill,  &context, 2 },
+        { "write",   writeStill,   &context, 1 },
+    };
+#ifdef BPTEST_LIBJPEG
+    printf("%d stills of %dx%d NV12, libjpeg, %.0f ms write I/O\n", stills, STILL_WIDTH, STILL_HEIGHT, writeTime * 1e3);
+#else
+    printf("%d stills of %dx%d NV12, %.0f ms encode stand-in, %.0f ms write I/O\n",
+           stills, STILL_WIDTH, STILL_HEIGHT, encodeTime * 1e3, writeTime * 1e3);
+#endif
+    benchRun(&context, "serial", serial, 1, stills);
+    benchRun(&context, "pipeline 2/2/1", stages, 3, stills);
+
+    fclose(context.output);
+    free(y);
+    free(uv);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: bptest [-n stills] [-e msec] [-w msec]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    int    stills     = 40;
+    double encodeTime = 0.015;
+    double writeTime  = 0.025;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:e:w:"))) {
+        switch (opt) {
+            case 'n': stills     = atoi(optarg);        break;
+            case 'e': encodeTime = atof(optarg) * 1e-3; break;
+            case 'w': writeTime  = atof(optarg) * 1e-3; break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || stills <= 0 || encodeTime < 0.0 || writeTime < 0.0) usage();
+
+    testCreate();
+    testOrder();
+    testBackpressure();
+    bench(stills, encodeTime, writeTime);
+    return 0;
+}
@@ -6,12 +6,14 @@
 //
 
 #import "ClockView.h"
+#import "TimerWheel.h"
 
 @implementation ClockView
 {
     UILabel*         _label;
     NSDateFormatter* _formatter;
     int              _count;
+    id               _timer;
 }
 
 - (id)initWithFrame:(CGRect)frame
@@ -37,12 +39,11 @@
         _label.shadowColor     = [UIColor blackColor];
         [self addSubview:_label];
         
-        // タイマーセット
-        [NSTimer scheduledTimerWithTimeInterval:1.0f
-                                         target:self
-                                       selector:@selector(tick:)
-                                       userInfo:nil
-                                        repeats:YES];
+        // タイマーセット(他のビューと起床をまとめる為、0.1secの遅れを許容する)
+        _timer = [[TimerWheel sharedWheel] addTimerWithInterval:1.0f
+                                                      tolerance:0.1f
+                                                         target:self
+                                                       selector:@selector(tick:)];
         // 初回更新
         _count = 0;
         [self tick:nil];
@@ -50,7 +51,12 @@
     return self;
 }
 
-- (void)tick:(NSTimer*)sender
+- (void)dealloc
+{
+    [[TimerWheel sharedWheel] cancelTimer:_timer];
+}
+
+- (void)tick:(id)sender
 {
     _formatter.dateFormat = (_count++ % 2)? @"HH:mm" : @"HH mm";
     _label.text = [_formatter stringFromDate:[NSDate date]];
@@ -0,0 +1,96 @@
+/*******************************************************************************
+  DeviceEvents 1.0.0.0
+
+                         バッテリーと音量の変更をEventBusで配る
+        ※ MediaPlayer.framework, QuartzCore.framework を追加する必要がある。
+
+   ビュー毎にNSNotificationCenterへオブザーバを登録する代わりに、
+   DeviceEventsがアプリ全体で一つだけ通知を受け、型付きのイベントにして
+   EventBusにPostする。購読者には画面の更新毎(CADisplayLink)に
+   最後の値だけが一回届く。音量のボタンを押し続けても更新は一フレームに一回になる。
+
+   購読はブロックで行い、戻り値のDeviceEventsSubscriptionを持っている間だけ有効。
+   (解放すると解除されるので、deallocで解除する必要はない)
+
+       _subscription = [[DeviceEvents sharedEvents] subscribeVolume:^(DeviceVolumeEvent event) {
+           [weakSelf updateVolume:event.volume];
+       }];
+
+   ※ メインスレッド専用。ブロックもメインスレッドで呼ばれる。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_DEVICE_EVENTS_H
+#define TYABUTA_DEVICE_EVENTS_H
+
+#import <UIKit/UIKit.h>
+#import "EventBus.h"
+
+/*
+ * イベントの種類
+ */
+typedef enum {
+    DeviceEventBattery = 0,
+    DeviceEventVolume,
+    DeviceEventCount,
+} DeviceEventType;
+
+/*
+ * バッテリーの変更(levelは0~1, 不明な場合は-1)
+ */
+typedef struct {
+    float                level;
+    UIDeviceBatteryState state;
+} DeviceBatteryEvent;
+
+/*
+ * システムボリュームの変更(0~1)
+ */
+typedef struct {
+    float volume;
+} DeviceVolumeEvent;
+
+EVENT_BUS_DECLARE(DeviceBattery, DeviceBatteryEvent, DeviceEventBattery)
+EVENT_BUS_DECLARE(DeviceVolume,  DeviceVolumeEvent,  DeviceEventVolume)
+
+typedef void (^DeviceBatteryBlock)(DeviceBatteryEvent event);
+typedef void (^DeviceVolumeBlock)(DeviceVolumeEvent event);
+
+
+/*
+ * 購読。解放すると購読を解除する。
+ */
+@interface DeviceEventsSubscription : NSObject
+- (void)cancel;
+@end
+
+
+@interface DeviceEvents : NSObject
+
+/*
+ * アプリケーション共通のインスタンスを取得する。
+ */
++ (DeviceEvents*)sharedEvents;
+
+/*
+ * イベントを配るバス(DeviceBatteryPublishなどで独自に発行してもよい)
+ */
+@property (nonatomic, readonly) EventBus* bus;
+
+/*
+ * 購読する。最初の購読で通知の受け取りを始め、購読が無くなると止める。
+ * 登録した時点の値でブロックを一度呼ぶ。
+ */
+- (DeviceEventsSubscription*)subscribeBattery:(DeviceBatteryBlock)block;
+- (DeviceEventsSubscription*)subscribeVolume:(DeviceVolumeBlock)block;
+
+/*
+ * Postしたイベントを次の画面の更新を待たずに配る。
+ */
+- (void)flush;
+
+@end
+
+
+#endif // TYABUTA_DEVICE_EVENTS_H
@@ -0,0 +1,204 @@
+//
+//  DeviceEvents
+//
+//  Created by tyabuta on 2014/07/26.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "DeviceEvents.h"
+#import <QuartzCore/QuartzCore.h>
+#import <MediaPlayer/MediaPlayer.h>
+
+
+@interface DeviceEvents ()
+- (void)subscriptionDidCancel:(DeviceEventType)type;
+@end
+
+
+/*
+ * 購読者の関数。contextはコピーしたブロック
+ */
+static void DeviceEventsBattery(const DeviceBatteryEvent* event, void* context){
+    ((__bridge DeviceBatteryBlock)context)(*event);
+}
+
+static void DeviceEventsVolume(const DeviceVolumeEvent* event, void* context){
+    ((__bridge DeviceVolumeBlock)context)(*event);
+}
+
+static void DeviceEventsReleaseBlock(void* context){
+    CFRelease(context);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ DeviceEventsSubscription
+ -----------------------------------------------------------------------------*/
+
+@implementation DeviceEventsSubscription
+{
+    DeviceEvents*   _events;
+    DeviceEventType _type;
+    EventBusToken   _token;
+}
+
+- (id)initWithEvents:(DeviceEvents*)events type:(DeviceEventType)type token:(EventBusToken)token {
+    self = [super init];
+    if (self) {
+        _events = events;
+        _type   = type;
+        _token  = token;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self cancel];
+}
+
+- (void)cancel {
+    if (0 == _token) return;
+    EventBusUnsubscribe(_events.bus, _token);
+    _token = 0;
+    [_events subscriptionDidCancel:_type];
+}
+
+@end
+
+
+
+
+/*------------------------------------------------------------------------------
+ DeviceEvents
+ -----------------------------------------------------------------------------*/
+
+@implementation DeviceEvents
+{
+    CADisplayLink* _displayLink;                    // Postがある間だけ動かす
+    NSUInteger     _subscribers[DeviceEventCount];  // 種類毎の購読数
+}
+
++ (DeviceEvents*)sharedEvents {
+    static DeviceEvents*   sharedEvents = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedEvents = [[DeviceEvents alloc] init];
+    });
+    return sharedEvents;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        _bus = EventBusCreate(DeviceEventCount);
+        if (NULL == _bus) return nil;
+
+        _displayLink = [CADisplayLink displayLinkWithTarget:self selector:@selector(displayLinkDidFire:)];
+        _displayLink.paused = YES;
+        [_displayLink addToRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_displayLink invalidate];
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    EventBusDestroy(_bus);
+}
+
+- (DeviceEventsSubscription*)subscribeBattery:(DeviceBatteryBlock)block {
+    EventBusToken token = DeviceBatterySubscribe(_bus, DeviceEventsBattery,
+                                                 (void*)CFBridgingRetain([block copy]), DeviceEventsReleaseBlock);
+    if (0 == token) return nil;
+    if (1 == ++_subscribers[DeviceEventBattery]) {
+        UIDevice* device = [UIDevice currentDevice];
+        device.batteryMonitoringEnabled = YES;
+
+        NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
+        [center addObserver:self selector:@selector(batteryDidChange:)
+                       name:UIDeviceBatteryLevelDidChangeNotification object:nil];
+        [center addObserver:self selector:@selector(batteryDidChange:)
+                       name:UIDeviceBatteryStateDidChangeNotification object:nil];
+    }
+
+    block([self currentBattery]);
+    return [[DeviceEventsSubscription alloc] initWithEvents:self type:DeviceEventBattery token:token];
+}
+
+- (DeviceEventsSubscription*)subscribeVolume:(DeviceVolumeBlock)block {
+    EventBusToken token = DeviceVolumeSubscribe(_bus, DeviceEventsVolume,
+                                                (void*)CFBridgingRetain([block copy]), DeviceEventsReleaseBlock);
+    if (0 == token) return nil;
+    if (1 == ++_subscribers[DeviceEventVolume]) {
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(volumeDidChange:)
+                                                     name:MPMusicPlayerControllerVolumeDidChangeNotification
+                                                   object:nil];
+        [[MPMusicPlayerController applicationMusicPlayer] beginGeneratingPlaybackNotifications];
+    }
+
+    block([self currentVolume]);
+    return [[DeviceEventsSubscription alloc] initWithEvents:self type:DeviceEventVolume token:token];
+}
+
+- (void)flush {
+    // 先に止める。配っている間にPostされた場合は、postが動かし直す。
+    _displayLink.paused = YES;
+    EventBusFlush(_bus);
+}
+
+
+#pragma mark Private
+
+- (void)subscriptionDidCancel:(DeviceEventType)type {
+    if (0 == _subscribers[type] || 0 != --_subscribers[type]) return;
+
+    // 購読が無くなった種類は通知の受け取りを止める。
+    NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
+    if (DeviceEventBattery == type) {
+        [center removeObserver:self name:UIDeviceBatteryLevelDidChangeNotification object:nil];
+        [center removeObserver:self name:UIDeviceBatteryStateDidChangeNotification object:nil];
+    }
+    else {
+        [center removeObserver:self name:MPMusicPlayerControllerVolumeDidChangeNotification object:nil];
+        [[MPMusicPlayerController applicationMusicPlayer] endGeneratingPlaybackNotifications];
+    }
+}
+
+- (DeviceBatteryEvent)currentBattery {
+    UIDevice*          device = [UIDevice currentDevice];
+    DeviceBatteryEvent event  = { device.batteryLevel, device.batteryState };
+    return event;
+}
+
+- (DeviceVolumeEvent)currentVolume {
+    DeviceVolumeEvent event = { [MPMusicPlayerController applicationMusicPlayer].volume };
+    return event;
+}
+
+/*
+ * Postでバスが配る状態になったら、次の画面の更新で配る。
+ */
+- (void)post:(int)posted {
+    if (posted) _displayLink.paused = NO;
+}
+
+
+#pragma mark Events
+
+- (void)batteryDidChange:(NSNotification*)notification {
+    DeviceBatteryEvent event = [self currentBattery];
+    [self post:DeviceBatteryPost(_bus, &event)];
+}
+
+- (void)volumeDidChange:(NSNotification*)notification {
+    DeviceVolumeEvent event = [self currentVolume];
+    [self post:DeviceVolumePost(_bus, &event)];
+}
+
+- (void)displayLinkDidFire:(CADisplayLink*)displayLink {
+    [self flush];
+}
+
+@end
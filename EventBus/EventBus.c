@@ -0,0 +1,343 @@
+/*
+ *  EventBus
+ *
+ *  Created by tyabuta on 2014/07/26.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "EventBus.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// 購読の番号の下位ビットに種類を入れる。
+#define EVENT_BUS_TYPE_BITS 16
+#define EVENT_BUS_TYPE_MASK ((1u << EVENT_BUS_TYPE_BITS) - 1)
+
+#define EVENT_BUS_WORDS (EVENT_BUS_MAX_EVENT_SIZE / sizeof(uint64_t))
+
+
+typedef struct EventBusSubscriber {
+    EventBusToken              token;
+    EventBusInvoke             invoke;
+    EventBusFunction           function;
+    void*                      context;
+    EventBusRelease            release;
+    struct EventBusSubscriber* retired;     // 解放待ちの連結
+} EventBusSubscriber;
+
+/*
+ * 購読者の配列。一度公開したら書き換えない。
+ */
+typedef struct EventBusList {
+    struct EventBusList* retired;           // 解放待ちの連結
+    size_t               count;
+    EventBusSubscriber*  subscribers[];
+} EventBusList;
+
+/*
+ * EventBusPostの枠
+ * sequenceが奇数の間は書き込み中。読む側は前後でsequenceが同じなら採用する。
+ */
+typedef struct {
+    uint32_t sequence;
+    uint32_t pending;
+    uint64_t words[EVENT_BUS_WORDS];
+} EventBusSlot;
+
+struct EventBus {
+    int                 typeCount;
+    EventBusList**      lists;              // 種類毎の購読者(アトミックに差し替える)
+    EventBusSlot*       slots;
+    uint32_t            readers;            // 発行中のスレッドの数
+    uint32_t            scheduled;          // Postが1を返してから、Flushが取り掛かるまで1
+
+    pthread_mutex_t     mutex;              // 以下は購読と解除の時だけ使う
+    uint64_t            serial;
+    EventBusList*       retiredLists;
+    EventBusSubscriber* retiredSubscribers;
+    uint32_t            hasRetired;
+};
+
+
+
+
+/*------------------------------------------------------------------------------
+ Subscribers
+ -----------------------------------------------------------------------------*/
+
+static EventBusList* EventBusListCreate(size_t count){
+    EventBusList* list = (EventBusList*)malloc(sizeof(EventBusList) + count * sizeof(EventBusSubscriber*));
+    if (list) {
+        list->retired = NULL;
+        list->count   = count;
+    }
+    return list;
+}
+
+/*
+ * バスから外した解放待ちの連結
+ */
+typedef struct {
+    EventBusList*       lists;
+    EventBusSubscriber* subscribers;
+} EventBusRetired;
+
+/*
+ * 発行中のスレッドが無ければ、解放待ちの配列と購読者をバスから外す。(mutexをロックして呼ぶ)
+ * 配列を差し替えてからreadersを見るので、0なら古い配列を読んでいるスレッドは無い。
+ */
+static EventBusRetired EventBusDetach(EventBus* bus){
+    EventBusRetired retired = { NULL, NULL };
+    if (0 != __atomic_load_n(&bus->readers, __ATOMIC_SEQ_CST)) return retired;
+
+    retired.lists           = bus->retiredLists;
+    retired.subscribers     = bus->retiredSubscribers;
+    bus->retiredLists       = NULL;
+    bus->retiredSubscribers = NULL;
+    __atomic_store_n(&bus->hasRetired, 0, __ATOMIC_RELAXED);
+    return retired;
+}
+
+/*
+ * 外した配列と購読者を解放する。(mutexのロックを外してから呼ぶ)
+ * releaseの中で購読や解除をしてもよい。
+ */
+static void EventBusReclaim(EventBusRetired retired){
+    while (retired.lists) {
+        EventBusList* list = retired.lists;
+        retired.lists      = list->retired;
+        free(list);
+    }
+    while (retired.subscribers) {
+        EventBusSubscriber* subscriber = retired.subscribers;
+        retired.subscribers            = subscriber->retired;
+        if (subscriber->release) subscriber->release(subscriber->context);
+        free(subscriber);
+    }
+}
+
+/*
+ * 配列を差し替え、古い配列を解放待ちにする。(mutexをロックして呼ぶ)
+ */
+static void EventBusReplace(EventBus* bus, int type, EventBusList* list){
+    EventBusList* old = bus->lists[type];
+    __atomic_store_n(&bus->lists[type], list, __ATOMIC_SEQ_CST);
+    if (old) {
+        old->retired      = bus->retiredLists;
+        bus->retiredLists = old;
+        __atomic_store_n(&bus->hasRetired, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Slots
+ -----------------------------------------------------------------------------*/
+
+static void EventBusSlotWrite(EventBusSlot* slot, const void* event, size_t size){
+    uint64_t words[EVENT_BUS_WORDS] = { 0 };
+    memcpy(words, event, size);
+
+    // 他のPostと重なった場合は、先に書き始めた方が終わるのを待つ。
+    uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    for (;;) {
+        if (!(sequence & 1) &&
+            __atomic_compare_exchange_n(&slot->sequence, &sequence, sequence + 1,
+                                        1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i < EVENT_BUS_WORDS; i++) {
+        __atomic_store_n(&slot->words[i], words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void EventBusSlotRead(EventBusSlot* slot, uint64_t* words){
+    for (;;) {
+        uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        for (size_t i = 0; i < EVENT_BUS_WORDS; i++) {
+            words[i] = __atomic_load_n(&slot->words[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (before == __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED)) return;
+    }
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+EventBus* EventBusCreate(int typeCount){
+    if (typeCount < 1 || (uint32_t)typeCount > EVENT_BUS_TYPE_MASK) return NULL;
+
+    EventBus* bus = (EventBus*)calloc(1, sizeof(EventBus));
+    if (NULL == bus) return NULL;
+    bus->typeCount = typeCount;
+    bus->lists     = (EventBusList**)calloc((size_t)typeCount, sizeof(EventBusList*));
+    bus->slots     = (EventBusSlot*)calloc((size_t)typeCount, sizeof(EventBusSlot));
+    if (NULL == bus->lists || NULL == bus->slots) {
+        free(bus->lists);
+        free(bus->slots);
+        free(bus);
+        return NULL;
+    }
+    pthread_mutex_init(&bus->mutex, NULL);
+    return bus;
+}
+
+void EventBusDestroy(EventBus* bus){
+    if (NULL == bus) return;
+    pthread_mutex_lock(&bus->mutex);
+    for (int type = 0; type < bus->typeCount; type++) {
+        EventBusList* list = bus->lists[type];
+        if (NULL == list) continue;
+        for (size_t i = 0; i < list->count; i++) {
+            list->subscribers[i]->retired = bus->retiredSubscribers;
+            bus->retiredSubscribers       = list->subscribers[i];
+        }
+        EventBusReplace(bus, type, NULL);
+    }
+    EventBusRetired retired = EventBusDetach(bus);
+    pthread_mutex_unlock(&bus->mutex);
+    EventBusReclaim(retired);
+
+    pthread_mutex_destroy(&bus->mutex);
+    free(bus->lists);
+    free(bus->slots);
+    free(bus);
+}
+
+EventBusToken EventBusSubscribe(EventBus* bus, int type, EventBusInvoke invoke, EventBusFunction function,
+                                void* context, EventBusRelease release){
+    if (type < 0 || type >= bus->typeCount || NULL == invoke || NULL == function) return 0;
+
+    EventBusSubscriber* subscriber = (EventBusSubscriber*)calloc(1, sizeof(EventBusSubscriber));
+    if (NULL == subscriber) return 0;
+    subscriber->invoke   = invoke;
+    subscriber->function = function;
+    subscriber->context  = context;
+    subscriber->release  = release;
+
+    pthread_mutex_lock(&bus->mutex);
+    EventBusList* old   = bus->lists[type];
+    size_t        count = old? old->count : 0;
+    EventBusList* list  = EventBusListCreate(count + 1);
+    if (NULL == list) {
+        pthread_mutex_unlock(&bus->mutex);
+        free(subscriber);
+        return 0;
+    }
+    if (count) memcpy(list->subscribers, old->subscribers, count * sizeof(EventBusSubscriber*));
+    list->subscribers[count] = subscriber;
+    subscriber->token        = (++bus->serial << EVENT_BUS_TYPE_BITS) | (uint32_t)type;
+
+    EventBusToken token = subscriber->token;
+    EventBusReplace(bus, type, list);
+    EventBusRetired retired = EventBusDetach(bus);
+    pthread_mutex_unlock(&bus->mutex);
+    EventBusReclaim(retired);
+    return token;
+}
+
+void EventBusUnsubscribe(EventBus* bus, EventBusToken token){
+    int type = (int)(token & EVENT_BUS_TYPE_MASK);
+    if (0 == token || type >= bus->typeCount) return;
+
+    pthread_mutex_lock(&bus->mutex);
+    EventBusList* old   = bus->lists[type];
+    size_t        count = old? old->count : 0;
+    size_t        index = 0;
+    while (index < count && old->subscribers[index]->token != token) index++;
+    if (index == count) {
+        pthread_mutex_unlock(&bus->mutex);
+        return;
+    }
+
+    // 配列を作れない場合は、購読者を空の関数に差し替えることもできないので、そのままにする。
+    EventBusList* list = NULL;
+    if (count > 1) {
+        list = EventBusListCreate(count - 1);
+        if (NULL == list) {
+            pthread_mutex_unlock(&bus->mutex);
+            return;
+        }
+        memcpy(list->subscribers, old->subscribers, index * sizeof(EventBusSubscriber*));
+        memcpy(list->subscribers + index, old->subscribers + index + 1,
+               (count - index - 1) * sizeof(EventBusSubscriber*));
+    }
+    EventBusSubscriber* subscriber = old->subscribers[index];
+    subscriber->retired            = bus->retiredSubscribers;
+    bus->retiredSubscribers        = subscriber;
+    EventBusReplace(bus, type, list);
+    EventBusRetired retired = EventBusDetach(bus);
+    pthread_mutex_unlock(&bus->mutex);
+    EventBusReclaim(retired);
+}
+
+void EventBusPublish(EventBus* bus, int type, const void* event){
+    if (type < 0 || type >= bus->typeCount) return;
+
+    __atomic_fetch_add(&bus->readers, 1, __ATOMIC_SEQ_CST);
+    EventBusList* list = __atomic_load_n(&bus->lists[type], __ATOMIC_SEQ_CST);
+    if (list) {
+        for (size_t i = 0; i < list->count; i++) {
+            EventBusSubscriber* subscriber = list->subscribers[i];
+            subscriber->invoke(subscriber->function, event, subscriber->context);
+        }
+    }
+
+    // 最後に抜けたスレッドは、解放待ちがあれば(ロックが取れる場合だけ)片付ける。
+    if (1 == __atomic_fetch_sub(&bus->readers, 1, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&bus->hasRetired, __ATOMIC_RELAXED) &&
+        0 == pthread_mutex_trylock(&bus->mutex)) {
+        EventBusRetired retired = EventBusDetach(bus);
+        pthread_mutex_unlock(&bus->mutex);
+        EventBusReclaim(retired);
+    }
+}
+
+int EventBusPost(EventBus* bus, int type, const void* event, size_t size){
+    if (type < 0 || type >= bus->typeCount || size > EVENT_BUS_MAX_EVENT_SIZE) return 0;
+
+    // 枠に印を付けてから予約する。Flushは予約を外してから枠を見るので、
+    // Flushが見落とした枠は、必ずここで予約が外れているのを見て1を返す。
+    EventBusSlot* slot = &bus->slots[type];
+    EventBusSlotWrite(slot, event, size);
+    __atomic_store_n(&slot->pending, 1, __ATOMIC_SEQ_CST);
+    return (0 == __atomic_exchange_n(&bus->scheduled, 1, __ATOMIC_SEQ_CST))? 1 : 0;
+}
+
+int EventBusFlush(EventBus* bus){
+    if (0 == __atomic_exchange_n(&bus->scheduled, 0, __ATOMIC_SEQ_CST)) return 0;
+
+    int delivered = 0;
+    for (int type = 0; type < bus->typeCount; type++) {
+        EventBusSlot* slot = &bus->slots[type];
+        if (0 == __atomic_exchange_n(&slot->pending, 0, __ATOMIC_SEQ_CST)) continue;
+
+        uint64_t words[EVENT_BUS_WORDS];
+        EventBusSlotRead(slot, words);
+        EventBusPublish(bus, type, words);
+        delivered++;
+    }
+    return delivered;
+}
+
+size_t EventBusSubscriberCount(EventBus* bus, int type){
+    if (type < 0 || type >= bus->typeCount) return 0;
+    pthread_mutex_lock(&bus->mutex);
+    size_t count = bus->lists[type]? bus->lists[type]->count : 0;
+    pthread_mutex_unlock(&bus->mutex);
+    return count;
+}
@@ -0,0 +1,150 @@
+/*******************************************************************************
+  EventBus 1.0.0.0
+
+                         型付きのイベントバス
+
+   NSNotificationCenterは通知を名前の文字列で探し、オブザーバ毎にセレクタを
+   ObjCのランタイム経由で呼ぶ。EventBusはイベントの種類を番号で持ち、
+   購読者の配列を直接辿ってC関数を呼ぶ。
+
+   購読者の配列は書き換えずに作り直して差し替える(コピーオンライト)ので、
+   発行はロックを取らずに配列を読むだけで済む。
+   購読と解除はmutexで一つずつ行い、古い配列は発行中のスレッドが無くなってから解放する。
+
+   EventBusPostはイベントを種類毎の枠に上書きするだけで、EventBusFlushで配る。
+   画面の更新毎にFlushすると、一フレームの間に何度変わっても最後の値だけが一回届く。
+   EventBusPublishはその場で全ての購読者を呼ぶ。
+
+   EVENT_BUS_DECLAREでイベントの型を宣言すると、その型の関数しか
+   購読できない発行、購読の関数ができる。(型の違いはコンパイル時にわかる)
+
+       typedef struct { float volume; } VolumeEvent;
+       EVENT_BUS_DECLARE(Volume, VolumeEvent, 0)
+
+       static void volumeDidChange(const VolumeEvent* event, void* context){ ... }
+
+       EventBus*     bus   = EventBusCreate(1);
+       EventBusToken token = VolumeSubscribe(bus, volumeDidChange, NULL, NULL);
+       VolumeEvent   event = { 0.5f };
+       VolumePost(bus, &event);
+       EventBusFlush(bus);
+       EventBusUnsubscribe(bus, token);
+
+   UIKitに依存しないので、Linux上でもそのままコンパイルできる。
+   (端末のイベントはDeviceEventsを参照)
+   検査と計測はebtestで行う。
+
+       $ cc -O2 -pthread -o ebtest ebtest.c EventBus.c
+       $ ./ebtest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_EVENT_BUS_H
+#define TYABUTA_EVENT_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// EventBusPostで枠に持てるイベントの大きさ
+#define EVENT_BUS_MAX_EVENT_SIZE 64
+
+typedef struct EventBus EventBus;
+
+/*
+ * 購読の番号(0は無効)
+ */
+typedef uint64_t EventBusToken;
+
+/*
+ * 購読者の関数。型はEVENT_BUS_DECLAREで作る関数が元に戻して呼ぶ。
+ */
+typedef void (*EventBusFunction)(void);
+typedef void (*EventBusInvoke)(EventBusFunction function, const void* event, void* context);
+
+/*
+ * 購読を解除した後、どのスレッドからも呼ばれなくなった時にcontextを渡して呼ばれる。
+ * ロックの外で呼ぶので、中で同じバスの購読や解除をしてもよい。
+ */
+typedef void (*EventBusRelease)(void* context);
+
+/*
+ * typeCount種類(0~typeCount-1)のイベントを扱うバスを作成する。
+ */
+EventBus* EventBusCreate(int typeCount);
+
+/*
+ * 破棄する。発行中のスレッドが無いこと。残っている購読のreleaseも呼ぶ。
+ */
+void EventBusDestroy(EventBus* bus);
+
+/*
+ * 購読する。失敗時は0を返す。(どのスレッドからでも可)
+ * 通常はEVENT_BUS_DECLAREで作る関数から呼ぶ。
+ */
+EventBusToken EventBusSubscribe(EventBus* bus, int type, EventBusInvoke invoke, EventBusFunction function,
+                                void* context, EventBusRelease release);
+
+/*
+ * 購読を解除する。(どのスレッドからでも可)
+ * 別のスレッドで発行中の場合、解除した後に一度呼ばれることがある。
+ */
+void EventBusUnsubscribe(EventBus* bus, EventBusToken token);
+
+/*
+ * 購読者を呼び出したスレッドですぐに呼ぶ。購読者の関数の中で購読、解除、発行をしてもよい。
+ */
+void EventBusPublish(EventBus* bus, int type, const void* event);
+
+/*
+ * イベントを種類毎の枠に上書きする。次のEventBusFlushで最後の値だけを配る。
+ * バスのFlushが予約されていない状態から、予約された状態になった場合に1を返す。
+ * (Flushを予約するきっかけに使う。Flush中にPostされた場合も、配り漏れがあれば1を返す)
+ * 1を返した後は、Flushが呼ばれるまで0を返す。
+ */
+int EventBusPost(EventBus* bus, int type, const void* event, size_t size);
+
+/*
+ * Postされたイベントを配り、配った種類の数を返す。
+ * 呼ぶのは一つのスレッド(通常はメインスレッド)に決めておく。
+ */
+int EventBusFlush(EventBus* bus);
+
+/*
+ * 購読者の数
+ */
+size_t EventBusSubscriberCount(EventBus* bus, int type);
+
+
+/*
+ * Name##Subscribe, Name##Publish, Name##Post を作る。
+ * Name##Handler は void (*)(const Payload* event, void* context)
+ */
+#define EVENT_BUS_DECLARE(Name, Payload, type)                                                      \
+    typedef void (*Name##Handler)(const Payload* event, void* context);                             \
+    typedef char Name##SizeCheck[(sizeof(Payload) <= EVENT_BUS_MAX_EVENT_SIZE)? 1 : -1];            \
+    static inline void Name##Invoke(EventBusFunction function, const void* event, void* context){   \
+        ((Name##Handler)function)((const Payload*)event, context);                                  \
+    }                                                                                               \
+    static inline EventBusToken Name##Subscribe(EventBus* bus, Name##Handler handler,               \
+                                                void* context, EventBusRelease release){            \
+        return EventBusSubscribe(bus, (type), Name##Invoke, (EventBusFunction)handler,              \
+                                 context, release);                                                 \
+    }                                                                                               \
+    static inline void Name##Publish(EventBus* bus, const Payload* event){                          \
+        EventBusPublish(bus, (type), event);                                                        \
+    }                                                                                               \
+    static inline int Name##Post(EventBus* bus, const Payload* event){                              \
+        return EventBusPost(bus, (type), event, sizeof(Payload));                                   \
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_EVENT_BUS_H
@@ -0,0 +1,335 @@
+/*
+ *  ebtest
+ *
+ *  EventBusをPC(Linux)上で検査し、発行の速度を計測する。
+ *
+ *      $ cc -O2 -pthread -o ebtest ebtest.c EventBus.c
+ *      $ ./ebtest                       (検査と計測)
+ *      $ ./ebtest -n 200000 -p 8 -s 64  (計測の条件を変える)
+ *
+ *      -n count  発行するスレッド毎の発行回数 (初期値は1000000)
+ *      -p num    発行するスレッドの数 (初期値は4、最大64)
+ *      -s num    購読者の数 (初期値は8、最大64)
+ *      -c        計測中に別のスレッドで購読と解除を繰り返す
+ *
+ *  -fsanitize=thread を付けてビルドすると、データ競合も検査できる。
+ *
+ *  Created by tyabuta on 2014/07/26.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "EventBus.h"
+
+
+typedef struct { uint64_t value; } TickEvent;
+typedef struct { float level; int state; } LevelEvent;
+
+EVENT_BUS_DECLARE(Tick,  TickEvent,  0)
+EVENT_BUS_DECLARE(Level, LevelEvent, 1)
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void onLevel(const LevelEvent* event, void* context){
+    *(float*)context = event->level;
+}
+
+static void onTick(const TickEvent* event, void* context){
+    __atomic_fetch_add((uint64_t*)context, event->value, __ATOMIC_RELAXED);
+}
+
+static int releasedCount;
+
+static void countRelease(void* context){
+    __atomic_fetch_add(&releasedCount, 1, __ATOMIC_RELAXED);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Coalescing
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 一度のFlushで最後の値だけが一回届く。
+ */
+static void testCoalesce(void){
+    EventBus* bus   = EventBusCreate(2);
+    float     level = 0.0f;
+    LevelSubscribe(bus, onLevel, &level, NULL);
+
+    LevelEvent event = { 0.25f, 1 };
+    CHECK(1 == LevelPost(bus, &event));
+    event.level = 0.5f;
+    CHECK(0 == LevelPost(bus, &event));
+    CHECK(1 == EventBusFlush(bus));
+    CHECK(0.5f == level);
+    CHECK(0 == EventBusFlush(bus));
+
+    CHECK(1 == LevelPost(bus, &event));
+    CHECK(1 == EventBusFlush(bus));
+    EventBusDestroy(bus);
+    printf("coalesce: ok\n");
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Post / Flush wakeup
+ -----------------------------------------------------------------------------*/
+
+/*
+ * Postが1を返した時だけFlushする消費者(DeviceEventsのCADisplayLinkと同じ)で、
+ * 発行中にFlushが重なっても起床を取りこぼさず、最後の値まで届くことを確かめる。
+ */
+typedef struct {
+    EventBus*       bus;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             wakeups;   // 未処理の起床要求
+    int             done;
+    long            count;
+    float           level;     // 消費者が受け取った値
+} WakeupTest;
+
+static void* wakeupProducer(void* arg){
+    WakeupTest* test = (WakeupTest*)arg;
+    LevelEvent event = { 0.0f, 0 };
+    for (long i = 1; i <= test->count; i++) {
+        event.level = (float)i;
+        if (LevelPost(test->bus, &event)) {
+            pthread_mutex_lock(&test->mutex);
+            test->wakeups++;
+            pthread_cond_signal(&test->cond);
+            pthread_mutex_unlock(&test->mutex);
+        }
+        if (0 == (i & 63)) sched_yield();
+    }
+    pthread_mutex_lock(&test->mutex);
+    test->done = 1;
+    pthread_cond_signal(&test->cond);
+    pthread_mutex_unlock(&test->mutex);
+    return NULL;
+}
+
+static void testWakeup(long count){
+    WakeupTest test = { 0 };
+    test.bus   = EventBusCreate(2);
+    test.count = count;
+    pthread_mutex_init(&test.mutex, NULL);
+    pthread_cond_init(&test.cond, NULL);
+    LevelSubscribe(test.bus, onLevel, &test.level, NULL);
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, wakeupProducer, &test);
+
+    long flushes = 0;
+    pthread_mutex_lock(&test.mutex);
+    for (;;) {
+        while (0 == test.wakeups && !test.done) pthread_cond_wait(&test.cond, &test.mutex);
+        if (0 == test.wakeups) break;
+        test.wakeups--;
+        pthread_mutex_unlock(&test.mutex);
+        EventBusFlush(test.bus);
+        flushes++;
+        pthread_mutex_lock(&test.mutex);
+    }
+    // 発行が終わった後に残っている起床要求も処理する。
+    while (test.wakeups) {
+        test.wakeups--;
+        EventBusFlush(test.bus);
+        flushes++;
+    }
+    pthread_mutex_unlock(&test.mutex);
+    pthread_join(producer, NULL);
+
+    if ((float)count != test.level) {
+        fprintf(stderr, "FAIL wakeup lost: last delivered %.0f of %ld after %ld flushes\n",
+                test.level, count, flushes);
+        exit(1);
+    }
+    EventBusDestroy(test.bus);
+    pthread_cond_destroy(&test.cond);
+    pthread_mutex_destroy(&test.mutex);
+    printf("post/flush wakeup: ok (%ld posts, %ld flushes)\n", count, flushes);
+}
+
+/*
+ * 複数の発行スレッドとFlushが重なっても、最後には最後の値が届く。
+ */
+static EventBus* concurrentBus;
+
+static void* concurrentPoster(void* arg){
+    LevelEvent event = { 0.0f, 0 };
+    for (int i = 1; i <= 100000; i++) {
+        event.level = (float)i;
+        event.state = i;
+        LevelPost(concurrentBus, &event);
+    }
+    return NULL;
+}
+
+static void testConcurrentPost(void){
+    concurrentBus = EventBusCreate(2);
+    float level   = 0.0f;
+    LevelSubscribe(concurrentBus, onLevel, &level, NULL);
+
+    pthread_t posters[2];
+    for (int i = 0; i < 2; i++) pthread_create(&posters[i], NULL, concurrentPoster, NULL);
+    for (int i = 0; i < 1000; i++) EventBusFlush(concurrentBus);
+    for (int i = 0; i < 2; i++) pthread_join(posters[i], NULL);
+    EventBusFlush(concurrentBus);
+    CHECK(100000.0f == level);
+
+    EventBusDestroy(concurrentBus);
+    printf("concurrent post: ok\n");
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Release
+ -----------------------------------------------------------------------------*/
+
+/*
+ * releaseの中で同じバスの購読、解除をしてもデッドロックしない。
+ * (DeviceEventsSubscriptionを持ったブロックが解放される場合)
+ */
+static EventBus*     reentrantBus;
+static EventBusToken reentrantToken;
+static int           reentrantCalls;
+
+static void reentrantRelease(void* context){
+    reentrantCalls++;
+    if (0 == reentrantToken) return;
+    EventBusToken token = reentrantToken;
+    reentrantToken = 0;
+    EventBusUnsubscribe(reentrantBus, token);
+    EventBusUnsubscribe(reentrantBus, TickSubscribe(reentrantBus, onTick, NULL, NULL));
+}
+
+static void testReentrantRelease(void){
+    reentrantBus = EventBusCreate(2);
+    EventBusToken token = TickSubscribe(reentrantBus, onTick, NULL, reentrantRelease);
+    reentrantToken      = LevelSubscribe(reentrantBus, onLevel, NULL, reentrantRelease);
+
+    EventBusUnsubscribe(reentrantBus, token);
+    CHECK(2 == reentrantCalls);
+    CHECK(0 == EventBusSubscriberCount(reentrantBus, 0));
+    CHECK(0 == EventBusSubscriberCount(reentrantBus, 1));
+
+    TickSubscribe(reentrantBus, onTick, NULL, reentrantRelease);
+    EventBusDestroy(reentrantBus);
+    CHECK(3 == reentrantCalls);
+    printf("reentrant release: ok\n");
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+static EventBus* benchBus;
+static int       benchStop;
+static uint64_t  churnTotal;
+
+static void* benchPublisher(void* arg){
+    long      count = *(long*)arg;
+    TickEvent event = { 1 };
+    for (long i = 0; i < count; i++) TickPublish(benchBus, &event);
+    return NULL;
+}
+
+static void* benchChurn(void* arg){
+    while (0 == __atomic_load_n(&benchStop, __ATOMIC_RELAXED)) {
+        EventBusToken token = TickSubscribe(benchBus, onTick, &churnTotal, countRelease);
+        EventBusUnsubscribe(benchBus, token);
+    }
+    return NULL;
+}
+
+static void benchPublish(long count, int publishers, int subscribers, int churn){
+    uint64_t  counts[64] = { 0 };
+    pthread_t threads[64];
+    pthread_t churner;
+
+    benchBus = EventBusCreate(2);
+    for (int i = 0; i < subscribers; i++) TickSubscribe(benchBus, onTick, &counts[i], countRelease);
+    CHECK((size_t)subscribers == EventBusSubscriberCount(benchBus, 0));
+    if (churn) pthread_create(&churner, NULL, benchChurn, NULL);
+
+    double start = nowSec();
+    for (int i = 0; i < publishers; i++) pthread_create(&threads[i], NULL, benchPublisher, &count);
+    for (int i = 0; i < publishers; i++) pthread_join(threads[i], NULL);
+    double elapsed = nowSec() - start;
+
+    __atomic_store_n(&benchStop, 1, __ATOMIC_RELAXED);
+    if (churn) pthread_join(churner, NULL);
+    for (int i = 0; i < subscribers; i++) CHECK(counts[i] == (uint64_t)count * publishers);
+
+    double publishes = (double)count * publishers;
+    printf("%d publishers x %ld, %d subscribers%s: %.1f ns/publish, %.2f ns/dispatch\n",
+           publishers, count, subscribers, churn? " (+churn)" : "",
+           elapsed * 1e9 / publishes, elapsed * 1e9 / (publishes * subscribers));
+
+    int released = __atomic_load_n(&releasedCount, __ATOMIC_RELAXED);
+    EventBusDestroy(benchBus);
+    CHECK(releasedCount == released + subscribers);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: ebtest [-c] [-n count] [-p publishers] [-s subscribers]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    long count       = 1000000;
+    int  publishers  = 4;
+    int  subscribers = 8;
+    int  churn       = 0;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "cn:p:s:"))) {
+        switch (opt) {
+            case 'c': churn       = 1; break;
+            case 'n': count       = atol(optarg); break;
+            case 'p': publishers  = atoi(optarg); break;
+            case 's': subscribers = atoi(optarg); break;
+            default:  usage();
+        }
+    }
+    if (count <= 0 || publishers < 1 || publishers > 64 || subscribers < 1 || subscribers > 64) usage();
+
+    testCoalesce();
+    testWakeup(200000);
+    testConcurrentPost();
+    testReentrantRelease();
+    benchPublish(count, publishers, subscribers, churn);
+    return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ *  FastNumber
+ *
+ *  Created by tyabuta on 2014/07/02.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#if !defined(__APPLE__)
+#define _GNU_SOURCE
+#endif
+
+#include "FastNumber.h"
+#include <locale.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+
+
+
+
+/*------------------------------------------------------------------------------
+ Parse integer
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 8文字が全て数字か。
+ * 各バイトの上位4bitが3で、+6しても桁上がりしない(0~9)事を確認する。
+ */
+static inline int FastIsEightDigits(uint64_t chunk){
+    return 0 == (((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+                  (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+                 ^ 0x3333333333333333ULL);
+}
+
+/*
+ * 8桁の数字を変換する。隣り合う桁を 2桁 → 4桁 → 8桁 とまとめる。
+ */
+static inline uint32_t FastParseEightDigits(uint64_t chunk){
+    chunk = (chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+    chunk = (chunk & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+    return (uint32_t)((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32);
+}
+
+static inline uint64_t FastLoad64(const char* str){
+    uint64_t chunk;
+    memcpy(&chunk, str, sizeof(chunk));
+    return chunk;
+}
+
+static inline int FastIsDigit(char c){
+    return (unsigned)(c - '0') < 10;
+}
+
+size_t FastParseInt64(const char* str, size_t length, int64_t* value){
+    size_t i        = 0;
+    int    negative = 0;
+    if (i < length && ('-' == str[i] || '+' == str[i])) {
+        negative = ('-' == str[i]);
+        i++;
+    }
+
+    size_t   start    = i;
+    uint64_t result   = 0;
+    int      overflow = 0;
+
+    // 19桁までは64bitに収まるので、溢れを確認せずに8桁ずつ進める。
+    while (length - i >= 8 && i - start + 8 <= 19 && FastIsEightDigits(FastLoad64(str + i))) {
+        result = result * 100000000 + FastParseEightDigits(FastLoad64(str + i));
+        i += 8;
+    }
+    for (; i < length && FastIsDigit(str[i]); i++) {
+        uint64_t digit = (uint64_t)(str[i] - '0');
+        if (result > (UINT64_MAX - digit) / 10) overflow = 1;
+        else result = result * 10 + digit;
+    }
+    if (i == start) return 0;
+
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    if (overflow || result > limit) result = limit;
+    *value = negative ? (int64_t)(0 - result) : (int64_t)result;
+    return i;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Parse double
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 倍精度で正確に表せる10の累乗
+ */
+static const double FastPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static locale_t       FastCLocale     = (locale_t)0;
+static pthread_once_t FastCLocaleOnce = PTHREAD_ONCE_INIT;
+
+static void FastCreateCLocale(void){
+    FastCLocale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+}
+
+/*
+ * 高速に求められない場合は、strtod_lで正確に丸める。
+ */
+static double FastParseDoubleSlow(const char* str, size_t length){
+    char  stack[128];
+    char* buf = (length < sizeof(stack))? stack : (char*)malloc(length + 1);
+    memcpy(buf, str, length);
+    buf[length] = '\0';
+
+    pthread_once(&FastCLocaleOnce, FastCreateCLocale);
+    double result = strtod_l(buf, NULL, FastCLocale);
+
+    if (buf != stack) free(buf);
+    return result;
+}
+
+size_t FastParseDouble(const char* str, size_t length, double* value){
+    size_t i        = 0;
+    int    negative = 0;
+    if (i < length && ('-' == str[i] || '+' == str[i])) {
+        negative = ('-' == str[i]);
+        i++;
+    }
+
+    uint64_t mantissa  = 0;
+    int      digits    = 0;   // 仮数に取り込んだ有効桁数
+    int      exponent  = 0;   // 10の指数の補正
+    int      truncated = 0;   // 19桁を超えて切り捨てた
+    size_t   count     = 0;   // 数字の数
+
+    for (; i < length && FastIsDigit(str[i]); i++, count++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(str[i] - '0');
+            if (mantissa) digits++;
+        }
+        else {
+            exponent++;
+            truncated |= ('0' != str[i]);
+        }
+    }
+    if (i < length && '.' == str[i]) {
+        size_t dot = i++;
+        for (; i < length && FastIsDigit(str[i]); i++, count++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(str[i] - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+            else {
+                truncated |= ('0' != str[i]);
+            }
+        }
+        // 数字の無い "." だけなら読まない。
+        if (0 == count) i = dot;
+    }
+    if (0 == count) return 0;
+
+    if (i < length && ('e' == str[i] || 'E' == str[i])) {
+        size_t  mark = i++;
+        int     expNegative = 0;
+        if (i < length && ('-' == str[i] || '+' == str[i])) {
+            expNegative = ('-' == str[i]);
+            i++;
+        }
+        if (i < length && FastIsDigit(str[i])) {
+            int e = 0;
+            for (; i < length && FastIsDigit(str[i]); i++) {
+                if (e < 100000) e = e * 10 + (str[i] - '0');
+            }
+            exponent += expNegative ? -e : e;
+        }
+        else {
+            // 指数部の数字が無い "1e" は "1" として読む。
+            i = mark;
+        }
+    }
+
+    double result;
+    if (0 == mantissa) {
+        result = 0.0;
+    }
+    else if (!truncated && mantissa <= (1ULL << 53) && -22 <= exponent && exponent <= 22) {
+        // 仮数と10の累乗がどちらも正確に表せるので、丸めは一度だけになる。
+        result = (double)mantissa;
+        result = (exponent < 0)? result / FastPowersOfTen[-exponent] : result * FastPowersOfTen[exponent];
+    }
+    else {
+        *value = FastParseDoubleSlow(str, i);
+        return i;
+    }
+    *value = negative ? -result : result;
+    return i;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Format integer
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 00~99の2文字の表
+ */
+static const char FastDigitPairs[200] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/*
+ * 符号なしの値を、末尾がendになるように後ろから書き込む。先頭の位置を返す。
+ */
+static char* FastFormatUInt64Backward(uint64_t value, char* end){
+    char* p = end;
+    while (value >= 100) {
+        uint64_t pair = value % 100;
+        value /= 100;
+        p -= 2;
+        memcpy(p, FastDigitPairs + pair * 2, 2);
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, FastDigitPairs + value * 2, 2);
+    }
+    else {
+        *--p = (char)('0' + value);
+    }
+    return p;
+}
+
+size_t FastFormatInt64(int64_t value, char* buf){
+    char     tmp[FAST_NUMBER_INT64_LENGTH];
+    char*    end      = tmp + sizeof(tmp);
+    uint64_t absolute = (value < 0)? 0 - (uint64_t)value : (uint64_t)value;
+    char*    p        = FastFormatUInt64Backward(absolute, end);
+    if (value < 0) *--p = '-';
+
+    size_t length = (size_t)(end - p);
+    memcpy(buf, p, length);
+    return length;
+}
+
+size_t FastFormatInt64Padded(int64_t value, size_t width, char pad, char* buf){
+    char     tmp[FAST_NUMBER_INT64_LENGTH];
+    char*    end      = tmp + sizeof(tmp);
+    uint64_t absolute = (value < 0)? 0 - (uint64_t)value : (uint64_t)value;
+    char*    p        = FastFormatUInt64Backward(absolute, end);
+    size_t   digits   = (size_t)(end - p);
+    size_t   length   = digits + (value < 0);
+    size_t   fill     = (width > length)? width - length : 0;
+    char*    out      = buf;
+
+    if ('0' == pad) {
+        // "%05d" と同じく、符号は0の前に付ける。
+        if (value < 0) *out++ = '-';
+        memset(out, '0', fill);
+        out += fill;
+    }
+    else {
+        memset(out, pad, fill);
+        out += fill;
+        if (value < 0) *out++ = '-';
+    }
+    memcpy(out, p, digits);
+    return (size_t)(out + digits - buf);
+}
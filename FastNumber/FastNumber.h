@@ -0,0 +1,68 @@
+/*******************************************************************************
+  FastNumber 1.0.0.0
+
+                         数値と文字列の高速な相互変換
+
+   ロケールに依存せず、メモリの確保も行わない。
+   文字列は終端文字を必要とせず、長さで範囲を指定する。
+   (フィードの取り込み等で、受信したバッファを直接解析する為)
+
+   整数の解析   : 8桁ずつSWAR(64bit整数1つで8文字を並列に処理)で変換する。
+   小数の解析   : 仮数が53bitに収まり、指数が22以内であれば
+                  倍精度の乗除算一回で正確に求める。(Clingerの方法)
+                  それ以外はstrtod_l(Cロケール)に任せる。
+                  10進数の表記のみを扱う。(inf, nan, 16進数は解析しない)
+   整数の書式化 : 2桁ずつ表を引いて書き込む。幅の指定と埋める文字を選べる。
+
+   素のCで書いてあるので、Linux上でもそのままコンパイルできる。
+   リトルエンディアンの環境でのみ動作する。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_FAST_NUMBER_H
+#define TYABUTA_FAST_NUMBER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * int64_tを書式化した際の最大文字数 "-9223372036854775808"
+ */
+#define FAST_NUMBER_INT64_LENGTH 20
+
+/*
+ * 整数を解析する。 [+-]digits
+ * 解析した文字数を返す。数字が無ければ0を返す。
+ * 範囲を超える場合は、INT64_MAX / INT64_MIN に丸める。(数字は全て読み進める)
+ */
+size_t FastParseInt64(const char* str, size_t length, int64_t* value);
+
+/*
+ * 小数を解析する。 [+-]digits[.digits][(e|E)[+-]digits]
+ * 解析した文字数を返す。数字が無ければ0を返す。
+ */
+size_t FastParseDouble(const char* str, size_t length, double* value);
+
+/*
+ * 整数を10進数で書き込む。終端文字は付けない。
+ * bufにはFAST_NUMBER_INT64_LENGTH以上の領域が必要。書き込んだ文字数を返す。
+ */
+size_t FastFormatInt64(int64_t value, char* buf);
+
+/*
+ * 幅を指定して右詰めで書き込む。printfの "%*d"(pad=' ') "%0*d"(pad='0') と同じ。
+ * bufにはwidthとFAST_NUMBER_INT64_LENGTHの大きい方以上の領域が必要。
+ */
+size_t FastFormatInt64Padded(int64_t value, size_t width, char pad, char* buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_FAST_NUMBER_H
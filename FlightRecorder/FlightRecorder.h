@@ -0,0 +1,81 @@
+/*******************************************************************************
+  FlightRecorder 1.0.0.0
+
+                         強制終了しても残る直近のイベントの記録
+
+   mmap(MAP_SHARED)したファイルをリングバッファとして、ログ、フレーム時間、
+   通信、テクスチャ読み込みを固定長のレコードで記録する。
+   書き込んだページはカーネルが管理するので、プロセスが強制終了されても
+   内容はファイルに残る。(端末自体が落ちた場合は除く)
+
+   書き込みはアトミックな加算で位置を確保するだけで、ロックも待ちも無い。
+   (wait-free) リリースビルドでも常に有効にしておける。
+
+   FlightRecorderOpenを呼ぶ前の記録関数は何もしない。
+   前回のファイルは path.prev に残されるので、frdecodeで読み出す。
+
+       $ cc -o frdecode frdecode.c
+       $ ./frdecode FlightRecorder.bin.prev
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_FLIGHT_RECORDER_H
+#define TYABUTA_FLIGHT_RECORDER_H
+
+#import <Foundation/Foundation.h>
+#import "FlightRecorderFormat.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 記録を開始する。capacityはレコード数(2の累乗に切り上げられる)
+ * 既にファイルがあれば path.prev にリネームしてから新しく作成する。
+ */
+BOOL FlightRecorderOpen(NSString* path, uint32_t capacity);
+
+/*
+ * Library/Caches/FlightRecorder.bin に4096レコード(256KB)で記録を開始する。
+ */
+BOOL FlightRecorderOpenDefault(void);
+
+/*
+ * レコードを書き込む。lengthはFR_PAYLOAD_SIZEに切り詰められる。
+ */
+void FlightRecorderWrite(FRRecordType type, const void* payload, size_t length);
+
+/*
+ * ログを記録する。(FR_PAYLOAD_SIZEを超える部分は切り捨てられる)
+ */
+void FlightRecorderLog(const char* text);
+
+/*
+ * フレームにかかった時間を記録する。
+ */
+void FlightRecorderFrame(uint32_t frame, float duration);
+
+/*
+ * 通信の結果を記録する。URLは末尾が残るように切り詰められる。
+ */
+void FlightRecorderNetwork(NSURL* url, NSInteger status, NSUInteger bytes, float duration);
+
+/*
+ * テクスチャの読み込みを記録する。
+ */
+void FlightRecorderTexture(NSString* name, NSUInteger width, NSUInteger height, float duration);
+
+/*
+ * 経過時間の計測用に、現在のticksをミリ秒に変換できる値で返す。
+ * FlightRecorderElapsed(start) で開始からの経過時間[ms]を得る。
+ */
+uint64_t FlightRecorderNow(void);
+float    FlightRecorderElapsed(uint64_t start);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_FLIGHT_RECORDER_H
@@ -0,0 +1,182 @@
+//
+//  FlightRecorder
+//
+//  Created by tyabuta on 2014/06/14.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "FlightRecorder.h"
+#import <mach/mach.h>
+#import <mach/mach_time.h>
+#import <pthread.h>
+#import <sys/mman.h>
+#import <sys/time.h>
+
+
+// 記録中のファイル(開く前はNULL)
+static FRFileHeader* FlightRecorderHeader  = NULL;
+static FRRecord*     FlightRecorderRecords = NULL;
+static uint64_t      FlightRecorderMask    = 0;
+
+static mach_timebase_info_data_t FlightRecorderTimebase;
+
+// スレッド毎にキャッシュするスレッドID
+static __thread uint32_t FlightRecorderThread = 0;
+
+
+
+
+/*------------------------------------------------------------------------------
+ Open
+ -----------------------------------------------------------------------------*/
+#pragma mark - Open
+
+BOOL FlightRecorderOpen(NSString* path, uint32_t capacity){
+    if (FlightRecorderHeader) return YES;
+
+    // 2の累乗に切り上げる。
+    uint32_t count = 1;
+    while (count < capacity) count <<= 1;
+
+    // 前回の記録を残しておく。
+    const char* file = [path fileSystemRepresentation];
+    NSString*   prev = [path stringByAppendingPathExtension:@"prev"];
+    rename(file, [prev fileSystemRepresentation]);
+
+    int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return NO;
+
+    size_t size = sizeof(FRFileHeader) + sizeof(FRRecord) * (size_t)count;
+    if (0 != ftruncate(fd, (off_t)size)) {
+        close(fd);
+        return NO;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) return NO;
+
+    mach_timebase_info(&FlightRecorderTimebase);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    FRFileHeader* header  = (FRFileHeader*)map;
+    header->version       = FR_VERSION;
+    header->recordSize    = FR_RECORD_SIZE;
+    header->capacity      = count;
+    header->writeIndex    = 0;
+    header->startTime     = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    header->startTicks    = mach_absolute_time();
+    header->timebaseNumer = FlightRecorderTimebase.numer;
+    header->timebaseDenom = FlightRecorderTimebase.denom;
+    header->pid           = (uint32_t)getpid();
+
+    // magicを最後に書き、ヘッダが揃ったファイルだけを有効とする。
+    __atomic_store_n(&header->magic, FR_MAGIC, __ATOMIC_RELEASE);
+
+    FlightRecorderRecords = (FRRecord*)(header + 1);
+    FlightRecorderMask    = count - 1;
+    __atomic_store_n(&FlightRecorderHeader, header, __ATOMIC_RELEASE);
+    return YES;
+}
+
+BOOL FlightRecorderOpenDefault(void){
+    NSString* caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,
+                                                           NSUserDomainMask,
+                                                           YES)[0];
+    return FlightRecorderOpen([caches stringByAppendingPathComponent:@"FlightRecorder.bin"], 4096);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Write
+ -----------------------------------------------------------------------------*/
+#pragma mark - Write
+
+void FlightRecorderWrite(FRRecordType type, const void* payload, size_t length){
+    FRFileHeader* header = __atomic_load_n(&FlightRecorderHeader, __ATOMIC_ACQUIRE);
+    if (NULL == header) return;
+
+    uint32_t thread = FlightRecorderThread;
+    if (__builtin_expect(0 == thread, 0)) {
+        thread = FlightRecorderThread = pthread_mach_thread_np(pthread_self());
+    }
+
+    // 通し番号を確保するだけで、他のスレッドを待たない。
+    uint64_t  index  = __atomic_fetch_add(&header->writeIndex, 1, __ATOMIC_RELAXED);
+    FRRecord* record = &FlightRecorderRecords[index & FlightRecorderMask];
+
+    // 書き込み中はseqを0にしておき、最後に有効な番号を書く。
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (length > FR_PAYLOAD_SIZE) length = FR_PAYLOAD_SIZE;
+    record->ticks  = mach_absolute_time();
+    record->type   = (uint16_t)type;
+    record->length = (uint16_t)length;
+    record->thread = thread;
+    memcpy(record->payload, payload, length);
+
+    __atomic_store_n(&record->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+void FlightRecorderLog(const char* text){
+    if (NULL == FlightRecorderHeader || NULL == text) return;
+    FlightRecorderWrite(FRRecordTypeLog, text, strnlen(text, FR_PAYLOAD_SIZE));
+}
+
+void FlightRecorderFrame(uint32_t frame, float duration){
+    if (NULL == FlightRecorderHeader) return;
+    FRFramePayload payload = {frame, duration};
+    FlightRecorderWrite(FRRecordTypeFrame, &payload, sizeof(payload));
+}
+
+void FlightRecorderNetwork(NSURL* url, NSInteger status, NSUInteger bytes, float duration){
+    if (NULL == FlightRecorderHeader) return;
+
+    FRNetworkPayload payload;
+    payload.status   = (int32_t)status;
+    payload.bytes    = (uint32_t)MIN(bytes, UINT32_MAX);
+    payload.duration = duration;
+
+    // ホストより末尾のパスの方が識別に役立つので、末尾を残す。
+    const char* str = [url.absoluteString UTF8String] ?: "";
+    size_t   length = strlen(str);
+    size_t        n = MIN(length, sizeof(payload.url));
+    memcpy(payload.url, str + length - n, n);
+    FlightRecorderWrite(FRRecordTypeNetwork, &payload, offsetof(FRNetworkPayload, url) + n);
+}
+
+void FlightRecorderTexture(NSString* name, NSUInteger width, NSUInteger height, float duration){
+    if (NULL == FlightRecorderHeader) return;
+
+    FRTexturePayload payload;
+    payload.width    = (uint16_t)MIN(width,  UINT16_MAX);
+    payload.height   = (uint16_t)MIN(height, UINT16_MAX);
+    payload.duration = duration;
+
+    const char* str = [name UTF8String] ?: "";
+    size_t        n = strnlen(str, sizeof(payload.name));
+    memcpy(payload.name, str, n);
+    FlightRecorderWrite(FRRecordTypeTexture, &payload, offsetof(FRTexturePayload, name) + n);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Time
+ -----------------------------------------------------------------------------*/
+#pragma mark - Time
+
+uint64_t FlightRecorderNow(void){
+    return mach_absolute_time();
+}
+
+float FlightRecorderElapsed(uint64_t start){
+    if (0 == FlightRecorderTimebase.denom) mach_timebase_info(&FlightRecorderTimebase);
+    uint64_t ticks = mach_absolute_time() - start;
+    return (float)((double)ticks * FlightRecorderTimebase.numer / FlightRecorderTimebase.denom / 1e6);
+}
@@ -0,0 +1,117 @@
+/*******************************************************************************
+  FlightRecorderFormat 1.0.0.0
+
+                         フライトレコーダーのファイル形式
+
+   アプリ(FlightRecorder.m)とデコーダ(frdecode.c)で共有する定義。
+   Objective-Cに依存しない素のCで書く事。
+
+   ファイルの構成:
+       [FRFileHeader 64byte][FRRecord 64byte x capacity]
+
+   レコードはリングバッファとして使われ、古いものから上書きされる。
+   書き込み中に強制終了した場合に備え、seqは最後に書き込む。
+   seqが0のレコードは空(または書き込み途中)として扱う。
+   数値は全て書き込んだ端末のバイトオーダー(リトルエンディアン)で保存される。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_FLIGHT_RECORDER_FORMAT_H
+#define TYABUTA_FLIGHT_RECORDER_FORMAT_H
+
+#include <stdint.h>
+
+
+/*
+ * ファイルの識別子 "FRC1"
+ */
+#define FR_MAGIC   0x31435246u
+#define FR_VERSION 1
+
+/*
+ * レコードのサイズ(キャッシュラインに合わせる)
+ */
+#define FR_RECORD_SIZE  64
+#define FR_PAYLOAD_SIZE 40
+
+/*
+ * レコードの種類
+ */
+typedef enum {
+    FRRecordTypeLog      = 1,  // FRLogPayload
+    FRRecordTypeFrame    = 2,  // FRFramePayload
+    FRRecordTypeNetwork  = 3,  // FRNetworkPayload
+    FRRecordTypeTexture  = 4,  // FRTexturePayload
+} FRRecordType;
+
+
+/*
+ * ファイルヘッダ
+ * 時刻はstartTicksを基準にしたticksの差を、timebaseでナノ秒に変換して求める。
+ *     ns = (ticks - startTicks) * timebaseNumer / timebaseDenom
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t capacity;        // レコード数(2の累乗)
+    uint64_t writeIndex;      // 次に書き込むレコードの通し番号
+    uint64_t startTime;       // 記録開始時刻(UNIX時間[usec])
+    uint64_t startTicks;      // 記録開始時のticks
+    uint32_t timebaseNumer;
+    uint32_t timebaseDenom;
+    uint32_t pid;
+    uint8_t  reserved[12];
+} FRFileHeader;
+
+/*
+ * レコード
+ * seqは通し番号+1(0は空)
+ */
+typedef struct {
+    uint64_t seq;
+    uint64_t ticks;
+    uint16_t type;
+    uint16_t length;          // payloadの有効なバイト数
+    uint32_t thread;
+    uint8_t  payload[FR_PAYLOAD_SIZE];
+} FRRecord;
+
+
+/*
+ * 種類毎のpayload
+ * 文字列は終端文字を含まない。(長さはレコードのlengthから求める)
+ */
+typedef struct {
+    char     text[FR_PAYLOAD_SIZE];
+} FRLogPayload;
+
+typedef struct {
+    uint32_t frame;           // フレーム番号
+    float    duration;        // フレームにかかった時間[ms]
+} FRFramePayload;
+
+typedef struct {
+    int32_t  status;          // HTTPステータス(通信エラーの場合は負のエラーコード)
+    uint32_t bytes;           // 受信したボディのサイズ
+    float    duration;        // リクエストにかかった時間[ms]
+    char     url[FR_PAYLOAD_SIZE - 12]; // URLの末尾
+} FRNetworkPayload;
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    float    duration;        // 読み込みにかかった時間[ms]
+    char     name[FR_PAYLOAD_SIZE - 8];
+} FRTexturePayload;
+
+
+/*
+ * 構造体のサイズをコンパイル時に確認する。
+ */
+typedef char FRFileHeaderSizeCheck[(sizeof(FRFileHeader) == FR_RECORD_SIZE)? 1 : -1];
+typedef char FRRecordSizeCheck[(sizeof(FRRecord) == FR_RECORD_SIZE)? 1 : -1];
+
+
+#endif // TYABUTA_FLIGHT_RECORDER_FORMAT_H
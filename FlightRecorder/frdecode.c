@@ -0,0 +1,139 @@
+/*
+ *  frdecode
+ *
+ *  フライトレコーダーのファイルを読み、記録されたイベントを時系列に表示する。
+ *  端末から取り出したファイルをPC(Mac, Linux)上で読む為のツール。
+ *
+ *      $ cc -O2 -o frdecode frdecode.c
+ *      $ ./frdecode FlightRecorder.bin.prev
+ *
+ *  Created by tyabuta on 2014/06/14.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FlightRecorderFormat.h"
+
+
+/*
+ * 通し番号順に並べる。
+ */
+static int compareRecord(const void* a, const void* b){
+    uint64_t x = ((const FRRecord*)a)->seq;
+    uint64_t y = ((const FRRecord*)b)->seq;
+    return (x < y)? -1 : (x > y)? 1 : 0;
+}
+
+/*
+ * レコードの経過時間[ms]
+ */
+static double elapsedMs(const FRFileHeader* header, const FRRecord* record){
+    double ticks = (double)(int64_t)(record->ticks - header->startTicks);
+    return ticks * header->timebaseNumer / header->timebaseDenom / 1e6;
+}
+
+static void printRecord(const FRFileHeader* header, const FRRecord* record){
+    double    ms = elapsedMs(header, record);
+    int   length = record->length > FR_PAYLOAD_SIZE? FR_PAYLOAD_SIZE : record->length;
+    printf("%+12.3f ms  [%5x]  ", ms, record->thread);
+
+    switch (record->type) {
+        case FRRecordTypeLog: {
+            const FRLogPayload* p = (const FRLogPayload*)record->payload;
+            printf("LOG      %.*s\n", length, p->text);
+            break;
+        }
+        case FRRecordTypeFrame: {
+            FRFramePayload p;
+            memcpy(&p, record->payload, sizeof(p));
+            printf("FRAME    #%u %.2fms\n", p.frame, p.duration);
+            break;
+        }
+        case FRRecordTypeNetwork: {
+            FRNetworkPayload p;
+            memcpy(&p, record->payload, sizeof(p));
+            int n = length - (int)offsetof(FRNetworkPayload, url);
+            printf("NETWORK  %d %uB %.1fms %s%.*s\n", p.status, p.bytes, p.duration,
+                   (n == (int)sizeof(p.url))? "..." : "", n > 0? n : 0, p.url);
+            break;
+        }
+        case FRRecordTypeTexture: {
+            FRTexturePayload p;
+            memcpy(&p, record->payload, sizeof(p));
+            int n = length - (int)offsetof(FRTexturePayload, name);
+            printf("TEXTURE  %ux%u %.1fms %.*s\n", p.width, p.height, p.duration, n > 0? n : 0, p.name);
+            break;
+        }
+        default:
+            printf("UNKNOWN  type=%u length=%u\n", record->type, record->length);
+            break;
+    }
+}
+
+int main(int argc, char* argv[]){
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <FlightRecorder.bin>\n", argv[0]);
+        return 2;
+    }
+
+    FILE* fp = fopen(argv[1], "rb");
+    if (NULL == fp) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    FRFileHeader header;
+    if (1 != fread(&header, sizeof(header), 1, fp) ||
+        FR_MAGIC != header.magic || FR_RECORD_SIZE != header.recordSize ||
+        0 == header.capacity || (header.capacity & (header.capacity - 1)) ||
+        0 == header.timebaseDenom) {
+        fprintf(stderr, "%s: not a flight recorder file\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+    if (FR_VERSION != header.version) {
+        fprintf(stderr, "%s: unsupported version %u\n", argv[1], header.version);
+        fclose(fp);
+        return 1;
+    }
+
+    FRRecord* records = (FRRecord*)calloc(header.capacity, sizeof(FRRecord));
+    size_t    count   = fread(records, sizeof(FRRecord), header.capacity, fp);
+    fclose(fp);
+
+    // 空のレコードと、書き込み途中(スロットと番号が合わない)のレコードを除く。
+    uint64_t mask  = header.capacity - 1;
+    size_t   valid = 0;
+    for (size_t i = 0; i < count; i++) {
+        const FRRecord* r = &records[i];
+        if (0 == r->seq || ((r->seq - 1) & mask) != i) continue;
+        records[valid++] = *r;
+    }
+    qsort(records, valid, sizeof(FRRecord), compareRecord);
+
+    time_t    sec = (time_t)(header.startTime / 1000000);
+    struct tm tm;
+    char      date[32];
+    localtime_r(&sec, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+    uint64_t written = header.writeIndex;
+    printf("# pid %u, started %s.%06u, capacity %u, written %llu, shown %zu",
+           header.pid, date, (unsigned)(header.startTime % 1000000), header.capacity,
+           (unsigned long long)written, valid);
+    if (written > header.capacity) {
+        printf(", overwritten %llu", (unsigned long long)(written - header.capacity));
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < valid; i++) {
+        printRecord(&header, &records[i]);
+    }
+
+    free(records);
+    return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ *  FramePool
+ *
+ *  Created by tyabuta on 2014/07/22.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "FramePool.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+// バッファの境界(キャッシュラインとSIMDの読み書きに合わせる)
+#define FRAME_POOL_ALIGNMENT 64
+
+// 生産者と消費者が書く変数を別のキャッシュラインに置く。
+#define FRAME_POOL_CACHE_LINE __attribute__((aligned(64)))
+
+
+struct FramePool {
+    size_t           capacity;
+    size_t           count;
+    uint8_t*         memory;
+    FramePoolBuffer* buffers;
+    uint32_t*        next;          // スタックで下にあるバッファの番号+1 (0は底)
+
+    uint64_t         head FRAME_POOL_CACHE_LINE;    // 上位32bitがタグ、下位32bitが先頭の番号+1
+    size_t           available;
+};
+
+/*
+ * キューの要素
+ * sequenceが自分の位置と同じなら書き込め、位置+1なら読み出せる。
+ */
+typedef struct {
+    uint32_t         sequence;
+    FramePoolBuffer* buffer;
+} FrameQueueCell;
+
+struct FrameQueue {
+    FramePool*           pool;
+    FrameQueueDropPolicy policy;
+    uint32_t             capacity;
+    uint32_t             mask;
+    FrameQueueCell*      cells;     // 長さ1の場合は使わない
+
+    uint32_t             enqueuePosition FRAME_POOL_CACHE_LINE;
+    uint64_t             pushed;
+    FramePoolBuffer*     slot;      // 長さ1の場合の郵便受け
+
+    uint32_t             dequeuePosition FRAME_POOL_CACHE_LINE;
+    uint64_t             popped;
+    uint64_t             dropped;
+};
+
+
+
+
+/*------------------------------------------------------------------------------
+ Pool
+ -----------------------------------------------------------------------------*/
+
+static inline uint64_t FramePoolHead(uint64_t head, uint32_t top){
+    return (((head >> 32) + 1) << 32) | top;
+}
+
+FramePool* FramePoolCreate(size_t capacity, size_t count){
+    if (0 == capacity || 0 == count || count >= UINT32_MAX) return NULL;
+
+    FramePool* pool = (FramePool*)calloc(1, sizeof(FramePool));
+    if (NULL == pool) return NULL;
+
+    size_t stride   = (capacity + FRAME_POOL_ALIGNMENT - 1) & ~(size_t)(FRAME_POOL_ALIGNMENT - 1);
+    pool->capacity  = capacity;
+    pool->count     = count;
+    pool->buffers   = (FramePoolBuffer*)calloc(count, sizeof(FramePoolBuffer));
+    pool->next      = (uint32_t*)calloc(count, sizeof(uint32_t));
+    if (NULL == pool->buffers || NULL == pool->next ||
+        0 != posix_memalign((void**)&pool->memory, FRAME_POOL_ALIGNMENT, stride * count)) {
+        FramePoolDestroy(pool);
+        return NULL;
+    }
+
+    // 0番が先頭に来るように積んでおく。
+    for (size_t i = 0; i < count; i++) {
+        FramePoolBuffer* buffer = &pool->buffers[i];
+        buffer->data     = pool->memory + stride * i;
+        buffer->capacity = capacity;
+        buffer->index    = (uint32_t)i;
+        pool->next[i]    = (i + 1 < count)? (uint32_t)(i + 2) : 0;
+    }
+    pool->head      = 1;
+    pool->available = count;
+    return pool;
+}
+
+void FramePoolDestroy(FramePool* pool){
+    if (NULL == pool) return;
+    free(pool->memory);
+    free(pool->next);
+    free(pool->buffers);
+    free(pool);
+}
+
+size_t FramePoolCapacity(const FramePool* pool){
+    return pool->capacity;
+}
+
+size_t FramePoolCount(const FramePool* pool){
+    return pool->count;
+}
+
+FramePoolBuffer* FramePoolAcquire(FramePool* pool){
+    uint64_t head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t top = (uint32_t)head;
+        if (0 == top) return NULL;
+
+        // 他のスレッドが先に取り出していればnextは古いが、タグが変わるのでCASが失敗する。
+        uint32_t next = __atomic_load_n(&pool->next[top - 1], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&pool->head, &head, FramePoolHead(head, next),
+                                        1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            __atomic_fetch_sub(&pool->available, 1, __ATOMIC_RELAXED);
+            return &pool->buffers[top - 1];
+        }
+    }
+}
+
+void FramePoolRelease(FramePool* pool, FramePoolBuffer* buffer){
+    if (NULL == buffer) return;
+    uint32_t index = buffer->index;
+    uint64_t head  = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&pool->next[index], (uint32_t)head, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, FramePoolHead(head, index + 1),
+                                          1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&pool->available, 1, __ATOMIC_RELAXED);
+}
+
+size_t FramePoolAvailable(const FramePool* pool){
+    return __atomic_load_n(&pool->available, __ATOMIC_RELAXED);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Queue
+ -----------------------------------------------------------------------------*/
+
+static int FrameQueueTryPush(FrameQueue* queue, FramePoolBuffer* buffer){
+    uint32_t position = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+    for (;;) {
+        FrameQueueCell* cell     = &queue->cells[position & queue->mask];
+        uint32_t        sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int32_t         diff     = (int32_t)(sequence - position);
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&queue->enqueuePosition, &position, position + 1,
+                                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->buffer = buffer;
+                __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+            // 失敗した場合はpositionが最新の値になっている。
+        } else if (diff < 0) {
+            return 0;   // 一杯
+        } else {
+            position = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static FramePoolBuffer* FrameQueueTryPop(FrameQueue* queue){
+    uint32_t position = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+    for (;;) {
+        FrameQueueCell* cell     = &queue->cells[position & queue->mask];
+        uint32_t        sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int32_t         diff     = (int32_t)(sequence - (position + 1));
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&queue->dequeuePosition, &position, position + 1,
+                                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                FramePoolBuffer* buffer = cell->buffer;
+                __atomic_store_n(&cell->sequence, position + queue->capacity, __ATOMIC_RELEASE);
+                return buffer;
+            }
+        } else if (diff < 0) {
+            return NULL;    // 空
+        } else {
+            position = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void FrameQueueDrop(FrameQueue* queue, FramePoolBuffer* buffer){
+    FramePoolRelease(queue->pool, buffer);
+    __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * 長さ1のキューは、一つの枠をアトミックに入れ替えるだけにする。
+ * (配列のキューは位置と状態を同じ数で表すので、長さ2以上が必要になる)
+ */
+static int FrameQueuePushSlot(FrameQueue* queue, FramePoolBuffer* buffer){
+    if (FrameQueueDropNewest == queue->policy) {
+        FramePoolBuffer* empty = NULL;
+        if (!__atomic_compare_exchange_n(&queue->slot, &empty, buffer,
+                                         0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            FrameQueueDrop(queue, buffer);
+            return 0;
+        }
+        return 1;
+    }
+    FramePoolBuffer* old = __atomic_exchange_n(&queue->slot, buffer, __ATOMIC_ACQ_REL);
+    if (old) {
+        FrameQueueDrop(queue, old);
+        return 0;
+    }
+    return 1;
+}
+
+FrameQueue* FrameQueueCreate(FramePool* pool, size_t capacity, FrameQueueDropPolicy policy){
+    if (NULL == pool || 0 == capacity || capacity > (1u << 30)) return NULL;
+
+    FrameQueue* queue = (FrameQueue*)calloc(1, sizeof(FrameQueue));
+    if (NULL == queue) return NULL;
+
+    uint32_t length = 1;
+    while (length < capacity) length <<= 1;
+    queue->pool     = pool;
+    queue->policy   = policy;
+    queue->capacity = length;
+    queue->mask     = length - 1;
+    if (length > 1) {
+        queue->cells = (FrameQueueCell*)calloc(length, sizeof(FrameQueueCell));
+        if (NULL == queue->cells) {
+            free(queue);
+            return NULL;
+        }
+        for (uint32_t i = 0; i < length; i++) queue->cells[i].sequence = i;
+    }
+    return queue;
+}
+
+void FrameQueueDestroy(FrameQueue* queue){
+    if (NULL == queue) return;
+    FramePoolBuffer* buffer;
+    while (NULL != (buffer = FrameQueuePop(queue))) {
+        FramePoolRelease(queue->pool, buffer);
+    }
+    free(queue->cells);
+    free(queue);
+}
+
+int FrameQueuePush(FrameQueue* queue, FramePoolBuffer* buffer){
+    if (NULL == buffer) return 0;
+    __atomic_fetch_add(&queue->pushed, 1, __ATOMIC_RELAXED);
+    if (1 == queue->capacity) return FrameQueuePushSlot(queue, buffer);
+
+    int result = 1;
+    while (!FrameQueueTryPush(queue, buffer)) {
+        if (FrameQueueDropNewest == queue->policy) {
+            FrameQueueDrop(queue, buffer);
+            return 0;
+        }
+        // 一番古いフレームを捨てて空きを作る。消費者が先に取れば、そのまま入れ直す。
+        FramePoolBuffer* old = FrameQueueTryPop(queue);
+        if (old) {
+            FrameQueueDrop(queue, old);
+            result = 0;
+        }
+    }
+    return result;
+}
+
+FramePoolBuffer* FrameQueuePop(FrameQueue* queue){
+    FramePoolBuffer* buffer;
+    if (1 == queue->capacity) {
+        buffer = __atomic_exchange_n(&queue->slot, NULL, __ATOMIC_ACQ_REL);
+    } else {
+        buffer = FrameQueueTryPop(queue);
+    }
+    if (buffer) __atomic_fetch_add(&queue->popped, 1, __ATOMIC_RELAXED);
+    return buffer;
+}
+
+size_t FrameQueueCount(const FrameQueue* queue){
+    if (1 == queue->capacity) {
+        return (NULL != __atomic_load_n(&queue->slot, __ATOMIC_RELAXED))? 1 : 0;
+    }
+    uint32_t dequeue = __atomic_load_n(&queue->dequeuePosition, __ATOMIC_RELAXED);
+    uint32_t enqueue = __atomic_load_n(&queue->enqueuePosition, __ATOMIC_RELAXED);
+    int32_t  count   = (int32_t)(enqueue - dequeue);
+    if (count < 0) return 0;
+    return ((uint32_t)count > queue->capacity)? queue->capacity : (size_t)count;
+}
+
+uint64_t FrameQueuePushed(const FrameQueue* queue){
+    return __atomic_load_n(&queue->pushed, __ATOMIC_RELAXED);
+}
+
+uint64_t FrameQueuePopped(const FrameQueue* queue){
+    return __atomic_load_n(&queue->popped, __ATOMIC_RELAXED);
+}
+
+uint64_t FrameQueueDropped(const FrameQueue* queue){
+    return __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED);
+}
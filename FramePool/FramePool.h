@@ -0,0 +1,153 @@
+/*******************************************************************************
+  FramePool 1.0.0.0
+
+                         キャプチャしたフレーム用のバッファプールとキュー
+
+   フレーム毎にバッファを確保すると、処理が遅れた時にフレームが際限なく溜まり、
+   メモリ警告まで止まらない。FramePoolは作成時に決めた数のバッファだけを使い回し、
+   FrameQueueは長さの決まったキューで、溢れたフレームを捨てて数を数える。
+   使うメモリは一定で、処理が遅れてもキューの長さ分より古いフレームは残らない。
+
+   FramePool
+     バッファの取得と返却はロックフリーのスタックで、どのスレッドからでも呼べる。
+     (先頭にタグを付けて、ABA問題を避けている)
+     空いているバッファが無ければFramePoolAcquireはNULLを返すので、
+     そのフレームは捨てる。(待たない)
+
+   FrameQueue
+     配列を使ったロックフリーのキューで、複数の生産者、複数の消費者から呼べる。
+     一杯の時は FrameQueueDropOldest(古いフレームを捨てて新しいフレームを入れる)か
+     FrameQueueDropNewest(新しいフレームを捨てる)で、捨てたバッファはプールに返す。
+     長さ1のDropOldestは、最新のフレームだけを持つ郵便受けになる。
+
+   UIKitにもAVFoundationにも依存しないので、Linux上でもそのままコンパイルできる。
+   キャプチャのCMSampleBufferからはAVFoundationMacro.hのCMSampleBufferCopyToFramePoolでコピーできる。
+
+       FramePool*  pool  = FramePoolCreate(1920 * 1080 * 3 / 2, 6);
+       FrameQueue* queue = FrameQueueCreate(pool, 1, FrameQueueDropOldest);
+
+       // キャプチャのスレッド
+       FramePoolBuffer* buffer = FramePoolAcquire(pool);
+       if (buffer) { ...; FrameQueuePush(queue, buffer); }
+
+       // 処理のスレッド
+       FramePoolBuffer* frame = FrameQueuePop(queue);
+       if (frame) { ...; FramePoolRelease(pool, frame); }
+
+   検査と計測はfptestで行う。
+
+       $ cc -O2 -pthread -o fptest fptest.c FramePool.c
+       $ ./fptest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_FRAME_POOL_H
+#define TYABUTA_FRAME_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 一つのフレームに持てる面の数(Y, Cb, Cr)
+#define FRAME_POOL_MAX_PLANES 3
+
+typedef struct FramePool  FramePool;
+typedef struct FrameQueue FrameQueue;
+
+/*
+ * プールのバッファ
+ * data以降の情報は使う側が自由に書き込む。indexは変更しないこと。
+ */
+typedef struct {
+    uint8_t* data;          // 64バイト境界に揃えてある
+    size_t   capacity;      // dataの大きさ
+    uint32_t index;         // プール内の番号
+
+    size_t   length;        // 使っている長さ
+    int      width;
+    int      height;
+    int      planeCount;
+    size_t   planeOffset[FRAME_POOL_MAX_PLANES];
+    size_t   bytesPerRow[FRAME_POOL_MAX_PLANES];
+    double   timestamp;     // 秒
+    uint64_t sequence;      // フレームの通し番号
+} FramePoolBuffer;
+
+typedef enum {
+    FrameQueueDropOldest = 0,   // 古いフレームを捨てる(最新のフレームが勝つ)
+    FrameQueueDropNewest,       // 入れようとしたフレームを捨てる
+} FrameQueueDropPolicy;
+
+/*
+ * capacityバイトのバッファをcount個持つプールを作成する。
+ */
+FramePool* FramePoolCreate(size_t capacity, size_t count);
+
+/*
+ * 破棄する。全てのバッファが返却されていること。
+ */
+void FramePoolDestroy(FramePool* pool);
+
+size_t FramePoolCapacity(const FramePool* pool);
+size_t FramePoolCount(const FramePool* pool);
+
+/*
+ * 空いているバッファを取り出す。無ければNULL(どのスレッドからでも可)
+ */
+FramePoolBuffer* FramePoolAcquire(FramePool* pool);
+
+/*
+ * バッファを返却する。(どのスレッドからでも可)
+ */
+void FramePoolRelease(FramePool* pool, FramePoolBuffer* buffer);
+
+/*
+ * 空いているバッファの数(目安)
+ */
+size_t FramePoolAvailable(const FramePool* pool);
+
+/*
+ * 長さcapacity(2の累乗に切り上げる)のキューを作成する。
+ * 捨てたフレームはpoolに返却する。
+ */
+FrameQueue* FrameQueueCreate(FramePool* pool, size_t capacity, FrameQueueDropPolicy policy);
+
+/*
+ * 破棄する。残っているフレームはプールに返却する。
+ */
+void FrameQueueDestroy(FrameQueue* queue);
+
+/*
+ * フレームを入れる。バッファの持ち主はキューに移る。(どのスレッドからでも可)
+ * 何も捨てずに入れられた場合は1、フレームを捨てた場合は0を返す。
+ */
+int FrameQueuePush(FrameQueue* queue, FramePoolBuffer* buffer);
+
+/*
+ * 一番古いフレームを取り出す。無ければNULL(どのスレッドからでも可)
+ * 使い終わったらFramePoolReleaseで返却する。
+ */
+FramePoolBuffer* FrameQueuePop(FrameQueue* queue);
+
+/*
+ * キューに入っているフレームの数(目安)
+ */
+size_t FrameQueueCount(const FrameQueue* queue);
+
+/*
+ * これまでに入れたフレーム、取り出したフレーム、捨てたフレームの数
+ */
+uint64_t FrameQueuePushed(const FrameQueue* queue);
+uint64_t FrameQueuePopped(const FrameQueue* queue);
+uint64_t FrameQueueDropped(const FrameQueue* queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_FRAME_POOL_H
@@ -0,0 +1,505 @@
+/*
+ *  fptest
+ *
+ *  FramePoolとFrameQueueをPC(Linux)上で検査し、複数の生産者、消費者で負荷をかける。
+ *  計測は240fpsの1080pキャプチャを模したもので、処理に10msかかる消費者に対して
+ *  フレームが届くまでの遅れと使うメモリを、フレーム毎にmallocして上限無く
+ *  溜める方法と比べる。
+ *
+ *      $ cc -O2 -pthread -o fptest fptest.c FramePool.c
+ *      $ ./fptest
+ *
+ *      -f frames  計測でキャプチャするフレーム数 (初期値は960で4秒)
+ *
+ *  -fsanitize=thread を付けてビルドすると、プールとキューの競合も検査できる。
+ *
+ *  Created by tyabuta on 2014/07/21.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "FramePool.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+#define FRAME_RATE   240.0
+#define FRAME_SIZE   (1920 * 1080 * 3 / 2)
+#define PROCESS_TIME 0.010
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void busyWait(double seconds){
+    double end = nowSec() + seconds;
+    while (nowSec() < end) {}
+}
+
+/*
+ * プールの全てのバッファが返却されていることを確かめる。
+ */
+static void checkAllReturned(FramePool* pool){
+    size_t            count = FramePoolCount(pool), n = 0;
+    FramePoolBuffer** got   = malloc(count * sizeof(FramePoolBuffer*));
+    CHECK(count == FramePoolAvailable(pool));
+    while (n < count && NULL != (got[n] = FramePoolAcquire(pool))) n++;
+    CHECK(count == n && NULL == FramePoolAcquire(pool));
+    for (size_t i = 0; i < n; i++) FramePoolRelease(pool, got[i]);
+    free(got);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+static void testPool(void){
+    CHECK(NULL == FramePoolCreate(0, 4));
+    CHECK(NULL == FramePoolCreate(100, 0));
+
+    FramePool* pool = FramePoolCreate(100, 4);
+    CHECK(pool && 100 == FramePoolCapacity(pool) && 4 == FramePoolCount(pool) && 4 == FramePoolAvailable(pool));
+
+    FramePoolBuffer* buffers[4];
+    for (int i = 0; i < 4; i++) {
+        buffers[i] = FramePoolAcquire(pool);
+        CHECK(buffers[i] && 0 == ((uintptr_t)buffers[i]->data & 63) && 100 == buffers[i]->capacity);
+        memset(buffers[i]->data, i, 100);
+    }
+    CHECK(NULL == FramePoolAcquire(pool) && 0 == FramePoolAvailable(pool));
+
+    // 番号は重ならず、領域も重ならない。
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 100; j++) CHECK(i == buffers[i]->data[j]);
+        for (int j = 0; j < i; j++) CHECK(buffers[i]->index != buffers[j]->index);
+    }
+
+    // 最後に返したものが最初に出てくる。
+    FramePoolRelease(pool, buffers[2]);
+    FramePoolRelease(pool, NULL);
+    CHECK(1 == FramePoolAvailable(pool));
+    CHECK(buffers[2] == FramePoolAcquire(pool));
+    for (int i = 0; i < 4; i++) FramePoolRelease(pool, buffers[i]);
+    checkAllReturned(pool);
+    FramePoolDestroy(pool);
+    printf("pool: ok\n");
+}
+
+/*
+ * 一つのスレッドでの順序と、捨て方
+ */
+static void testQueue(void){
+    FramePool* pool = FramePoolCreate(16, 8);
+    CHECK(NULL == FrameQueueCreate(NULL, 4, FrameQueueDropOldest));
+    CHECK(NULL == FrameQueueCreate(pool, 0, FrameQueueDropOldest));
+
+    for (int policy = FrameQueueDropOldest; policy <= FrameQueueDropNewest; policy++) {
+        // 長さ3は4に切り上げる。
+        FrameQueue* queue = FrameQueueCreate(pool, 3, (FrameQueueDropPolicy)policy);
+        CHECK(NULL == FrameQueuePop(queue) && 0 == FrameQueuePush(queue, NULL));
+        for (uint64_t i = 0; i < 6; i++) {
+            FramePoolBuffer* buffer = FramePoolAcquire(pool);
+            buffer->sequence = i;
+            CHECK((i < 4) == FrameQueuePush(queue, buffer));
+        }
+        CHECK(4 == FrameQueueCount(queue) && 2 == FrameQueueDropped(queue) && 4 == FramePoolAvailable(pool));
+
+        // DropOldestは2から5、DropNewestは0から3が残る。
+        uint64_t first = (FrameQueueDropOldest == policy)? 2 : 0;
+        for (uint64_t i = first; i < first + 4; i++) {
+            FramePoolBuffer* buffer = FrameQueuePop(queue);
+            CHECK(buffer && i == buffer->sequence);
+            FramePoolRelease(pool, buffer);
+        }
+        CHECK(NULL == FrameQueuePop(queue));
+        CHECK(6 == FrameQueuePushed(queue) && 4 == FrameQueuePopped(queue) && 2 == FrameQueueDropped(queue));
+
+        // 残っていれば破棄した時にプールへ返る。
+        FrameQueuePush(queue, FramePoolAcquire(pool));
+        FrameQueueDestroy(queue);
+        checkAllReturned(pool);
+    }
+
+    // 長さ1は郵便受け。DropOldestは最新が、DropNewestは最初が残る。
+    for (int policy = FrameQueueDropOldest; policy <= FrameQueueDropNewest; policy++) {
+        FrameQueue* queue = FrameQueueCreate(pool, 1, (FrameQueueDropPolicy)policy);
+        for (uint64_t i = 0; i < 3; i++) {
+            FramePoolBuffer* buffer = FramePoolAcquire(pool);
+            buffer->sequence = i;
+            CHECK((0 == i) == FrameQueuePush(queue, buffer));
+            CHECK(1 == FrameQueueCount(queue));
+        }
+        FramePoolBuffer* buffer = FrameQueuePop(queue);
+        CHECK(buffer && ((FrameQueueDropOldest == policy)? 2 : 0) == buffer->sequence);
+        CHECK(NULL == FrameQueuePop(queue) && 0 == FrameQueueCount(queue) && 2 == FrameQueueDropped(queue));
+        FramePoolRelease(pool, buffer);
+        FrameQueueDestroy(queue);
+        checkAllReturned(pool);
+    }
+
+    FramePoolDestroy(pool);
+    printf("queue: ok\n");
+}
+
+/*
+ * 3つの生産者と2つの消費者
+ * バッファを同時に二つのスレッドが持たないこと、消費者から見て生産者毎の順序が
+ * 保たれること、最後に全てのバッファが返り、数が合うことを確かめる。
+ */
+#define STRESS_PRODUCERS 3
+#define STRESS_CONSUMERS 2
+#define STRESS_FRAMES    100000
+#define STRESS_BUFFERS   8
+
+static FramePool*  stressPool;
+static FrameQueue* stressQueue;
+static int         stressOwner[STRESS_BUFFERS];
+static int         stressStop;
+
+static void own(const FramePoolBuffer* buffer){
+    CHECK(0 == __atomic_exchange_n(&stressOwner[buffer->index], 1, __ATOMIC_ACQ_REL));
+}
+
+static void disown(const FramePoolBuffer* buffer){
+    CHECK(1 == __atomic_exchange_n(&stressOwner[buffer->index], 0, __ATOMIC_ACQ_REL));
+}
+
+static void* stressProducer(void* arg){
+    int producer = (int)(intptr_t)arg;
+    for (uint64_t i = 0; i < STRESS_FRAMES; i++) {
+        FramePoolBuffer* buffer = FramePoolAcquire(stressPool);
+        if (NULL == buffer) continue;
+        own(buffer);
+        buffer->width    = producer;
+        buffer->sequence = i;
+        disown(buffer);
+        FrameQueuePush(stressQueue, buffer);
+        if (0 == i % 8) sched_yield();     // CPUが少なくても消費者が動くように
+    }
+    return NULL;
+}
+
+static void* stressConsumer(void* arg){
+    uint64_t next[STRESS_PRODUCERS] = { 0 };
+    long     popped = 0;
+    for (;;) {
+        int stop = __atomic_load_n(&stressStop, __ATOMIC_ACQUIRE);
+        FramePoolBuffer* buffer = FrameQueuePop(stressQueue);
+        if (NULL == buffer) {
+            if (stop) break;
+            sched_yield();
+            continue;
+        }
+        own(buffer);
+        CHECK(buffer->width >= 0 && buffer->width < STRESS_PRODUCERS);
+        CHECK(buffer->sequence >= next[buffer->width]);
+        next[buffer->width] = buffer->sequence + 1;
+        disown(buffer);
+        FramePoolRelease(stressPool, buffer);
+        popped++;
+    }
+    *(long*)arg = popped;
+    return NULL;
+}
+
+static void stress(size_t capacity, FrameQueueDropPolicy policy){
+    stressPool  = FramePoolCreate(64, STRESS_BUFFERS);
+    stressQueue = FrameQueueCreate(stressPool, capacity, policy);
+    stressStop  = 0;
+
+    long      popped[STRESS_CONSUMERS];
+    pthread_t producers[STRESS_PRODUCERS], consumers[STRESS_CONSUMERS];
+    for (int i = 0; i < STRESS_CONSUMERS; i++) pthread_create(&consumers[i], NULL, stressConsumer, &popped[i]);
+    for (int i = 0; i < STRESS_PRODUCERS; i++) pthread_create(&producers[i], NULL, stressProducer, (void*)(intptr_t)i);
+    for (int i = 0; i < STRESS_PRODUCERS; i++) pthread_join(producers[i], NULL);
+    __atomic_store_n(&stressStop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < STRESS_CONSUMERS; i++) pthread_join(consumers[i], NULL);
+
+    // 消費者は止める前に空にしている。
+    uint64_t pushed  = FrameQueuePushed(stressQueue);
+    uint64_t dropped = FrameQueueDropped(stressQueue);
+    CHECK(0 == FrameQueueCount(stressQueue));
+    CHECK((uint64_t)(popped[0] + popped[1]) == FrameQueuePopped(stressQueue));
+    CHECK(pushed == FrameQueuePopped(stressQueue) + dropped);
+    checkAllReturned(stressPool);
+
+    printf("stress capacity %zu, drop %s: ok (pushed %llu, dropped %llu)\n",
+           capacity, (FrameQueueDropOldest == policy)? "oldest" : "newest",
+           (unsigned long long)pushed, (unsigned long long)dropped);
+    FrameQueueDestroy(stressQueue);
+    FramePoolDestroy(stressPool);
+}
+
+static void testStress(void){
+    static const size_t capacities[] = { 1, 2, 4 };
+    for (size_t i = 0; i < 3; i++) {
+        stress(capacities[i], FrameQueueDropOldest);
+        stress(capacities[i], FrameQueueDropNewest);
+    }
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 240fpsのキャプチャ。capture()はフレームを作って渡し、nullなら捨てた数を数える。
+ */
+typedef struct {
+    long   frames;
+    void*  (*acquire)(void* context);
+    void   (*submit)(void* context, void* frame, double timestamp);
+    void*  context;
+    long   empty;       // バッファが無くて捨てた数
+    int    done;
+} Capture;
+
+static void* captureThread(void* arg){
+    Capture* capture = (Capture*)arg;
+    double   start   = nowSec();
+    for (long i = 0; i < capture->frames; i++) {
+        double wait = start + i / FRAME_RATE - nowSec();
+        if (wait > 0) usleep((useconds_t)(wait * 1e6));
+
+        void* frame = capture->acquire(capture->context);
+        if (NULL == frame) {
+            capture->empty++;
+            continue;
+        }
+        capture->submit(capture->context, frame, nowSec());
+    }
+    __atomic_store_n(&capture->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+typedef struct {
+    long   processed;
+    double total;
+    double max;
+} Latency;
+
+static void latencyAdd(Latency* latency, double timestamp){
+    double elapsed = nowSec() - timestamp;
+    latency->processed++;
+    latency->total += elapsed;
+    if (elapsed > latency->max) latency->max = elapsed;
+}
+
+
+/*
+ * FramePoolとFrameQueue
+ */
+typedef struct {
+    FramePool*  pool;
+    FrameQueue* queue;
+} PoolContext;
+
+static void* poolAcquire(void* context){
+    FramePoolBuffer* buffer = FramePoolAcquire(((PoolContext*)context)->pool);
+    if (buffer) memset(buffer->data, 0x80, buffer->capacity);
+    return buffer;
+}
+
+static void poolSubmit(void* context, void* frame, double timestamp){
+    FramePoolBuffer* buffer = (FramePoolBuffer*)frame;
+    buffer->timestamp = timestamp;
+    FrameQueuePush(((PoolContext*)context)->queue, buffer);
+}
+
+static void benchPool(long frames, size_t capacity, FrameQueueDropPolicy policy){
+    PoolContext context;
+    context.pool  = FramePoolCreate(FRAME_SIZE, capacity + 2);   // キュー + 処理中 + キャプチャ中
+    context.queue = FrameQueueCreate(context.pool, capacity, policy);
+
+    Capture   capture = { frames, poolAcquire, poolSubmit, &context, 0, 0 };
+    Latency   latency = { 0, 0.0, 0.0 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, captureThread, &capture);
+    for (;;) {
+        int              done   = __atomic_load_n(&capture.done, __ATOMIC_ACQUIRE);
+        FramePoolBuffer* buffer = FrameQueuePop(context.queue);
+        if (NULL == buffer) {
+            if (done) break;
+            usleep(200);
+            continue;
+        }
+        latencyAdd(&latency, buffer->timestamp);
+        busyWait(PROCESS_TIME);
+        FramePoolRelease(context.pool, buffer);
+    }
+    pthread_join(thread, NULL);
+
+    char name[32];
+    snprintf(name, sizeof(name), "capacity %zu, drop %s", capacity, (FrameQueueDropOldest == policy)? "oldest" : "newest");
+    printf("  %-24s: latency avg %5.1f ms, max %6.1f ms, processed %4ld, dropped %4llu, memory %2zu MB\n",
+           name, latency.total / latency.processed * 1e3, latency.max * 1e3, latency.processed,
+           (unsigned long long)(FrameQueueDropped(context.queue) + capture.empty),
+           FramePoolCount(context.pool) * FramePoolCapacity(context.pool) >> 20);
+    FrameQueueDestroy(context.queue);
+    checkAllReturned(context.pool);
+    FramePoolDestroy(context.pool);
+}
+
+
+/*
+ * フレーム毎にmallocして、上限の無いリストに溜める方法(比較用)
+ * 溜まったフレームのメモリは際限なく増えるので、MALLOC_FRAMESまでにしておく。
+ */
+#define MALLOC_FRAMES 240
+
+typedef struct MallocFrame {
+    struct MallocFrame* next;
+    double              timestamp;
+    uint8_t             data[];
+} MallocFrame;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    MallocFrame*    head;
+    MallocFrame*    tail;
+    size_t          count;
+    size_t          peak;
+} MallocContext;
+
+static void* mallocAcquire(void* context){
+    MallocFrame* frame = malloc(sizeof(MallocFrame) + FRAME_SIZE);
+    memset(frame->data, 0x80, FRAME_SIZE);
+    return frame;
+}
+
+static void mallocSubmit(void* context, void* frame, double timestamp){
+    MallocContext* list = (MallocContext*)context;
+    MallocFrame*   item = (MallocFrame*)frame;
+    item->timestamp = timestamp;
+    item->next      = NULL;
+    pthread_mutex_lock(&list->mutex);
+    if (list->tail) list->tail->next = item;
+    else            list->head       = item;
+    list->tail = item;
+    if (++list->count > list->peak) list->peak = list->count;
+    pthread_mutex_unlock(&list->mutex);
+}
+
+static MallocFrame* mallocPop(MallocContext* list){
+    pthread_mutex_lock(&list->mutex);
+    MallocFrame* item = list->head;
+    if (item) {
+        list->head = item->next;
+        if (NULL == list->head) list->tail = NULL;
+        list->count--;
+    }
+    pthread_mutex_unlock(&list->mutex);
+    return item;
+}
+
+static void benchMalloc(long frames){
+    if (frames > MALLOC_FRAMES) frames = MALLOC_FRAMES;
+    MallocContext list;
+    memset(&list, 0, sizeof(list));
+    pthread_mutex_init(&list.mutex, NULL);
+
+    Capture   capture = { frames, mallocAcquire, mallocSubmit, &list, 0, 0 };
+    Latency   latency = { 0, 0.0, 0.0 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, captureThread, &capture);
+
+    // キャプチャが終わった時点で止め、残ったフレームを数える。
+    while (0 == __atomic_load_n(&capture.done, __ATOMIC_ACQUIRE)) {
+        MallocFrame* item = mallocPop(&list);
+        if (NULL == item) {
+            usleep(200);
+            continue;
+        }
+        latencyAdd(&latency, item->timestamp);
+        busyWait(PROCESS_TIME);
+        free(item);
+    }
+    pthread_join(thread, NULL);
+
+    size_t left = list.count;
+    MallocFrame* item;
+    while (NULL != (item = mallocPop(&list))) free(item);
+    pthread_mutex_destroy(&list.mutex);
+
+    char name[32];
+    snprintf(name, sizeof(name), "malloc, %ld frames", frames);
+    printf("  %-24s: latency avg %5.1f ms, max %6.1f ms, processed %4ld, left    %4zu, memory %2zu MB (peak)\n",
+           name, latency.total / latency.processed * 1e3, latency.max * 1e3,
+           latency.processed, left, (list.peak + 1) * FRAME_SIZE >> 20);
+}
+
+/*
+ * 一つのスレッドでの取得、入れる、取り出す、返却の一巡
+ */
+static void benchRoundTrip(void){
+    FramePool*  pool   = FramePoolCreate(64, 4);
+    FrameQueue* queue  = FrameQueueCreate(pool, 4, FrameQueueDropOldest);
+    long        rounds = 10000000;
+    double      start  = nowSec();
+    for (long i = 0; i < rounds; i++) {
+        FrameQueuePush(queue, FramePoolAcquire(pool));
+        FramePoolRelease(pool, FrameQueuePop(queue));
+    }
+    double elapsed = (nowSec() - start) / rounds;
+    printf("  acquire + push + pop + release: %.1f ns\n", elapsed * 1e9);
+    FrameQueueDestroy(queue);
+    FramePoolDestroy(pool);
+}
+
+static void bench(long frames){
+    printf("%ld frames of 1080p NV12 at %.0f fps, %.0f ms per frame to process\n",
+           frames, FRAME_RATE, PROCESS_TIME * 1e3);
+    benchMalloc(frames);
+    benchPool(frames, 1, FrameQueueDropOldest);
+    benchPool(frames, 4, FrameQueueDropOldest);
+    benchPool(frames, 4, FrameQueueDropNewest);
+    benchRoundTrip();
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: fptest [-f frames]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    long frames = 960;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "f:"))) {
+        switch (opt) {
+            case 'f': frames = atol(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || frames <= 0) usage();
+
+    testPool();
+    testQueue();
+    testStress();
+    bench(frames);
+    return 0;
+}
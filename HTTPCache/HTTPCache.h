@@ -0,0 +1,112 @@
+/*******************************************************************************
+  HTTPCache 1.0.0.0
+
+                         ディスクに保存するHTTPレスポンスキャッシュ
+
+   Cache-Control/Expiresで新鮮なレスポンスは通信せずに返し、
+   期限切れのものはETag/Last-Modifiedで条件付きリクエストを行い、
+   304が返ればボディを再ダウンロードせずに使い回す。
+   ボディは内容のハッシュ値をファイル名として保存し(同じ内容は一つにまとまる)、
+   読み込みはmmapで行う。
+   合計サイズが上限を超えると、最後に使われたのが古いものから削除する。
+
+   HTTPClientのcacheプロパティに設定して使う。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_HTTP_CACHE_H
+#define TYABUTA_HTTP_CACHE_H
+
+#import <Foundation/Foundation.h>
+
+
+/*------------------------------------------------------------------------------
+ HTTPCachedResponse
+ -----------------------------------------------------------------------------*/
+
+/*
+ * キャッシュから取り出したレスポンス
+ */
+@interface HTTPCachedResponse : NSObject
+
+/*
+ * ステータスコード200として復元したレスポンス
+ */
+@property(nonatomic, readonly) NSHTTPURLResponse* response;
+
+/*
+ * ボディ(mmapで読み込まれている)
+ */
+@property(nonatomic, readonly) NSData* data;
+
+/*
+ * 通信せずにそのまま使えるならYES
+ */
+@property(nonatomic, readonly, getter=isFresh) BOOL fresh;
+
+/*
+ * 再検証用のIf-None-Match/If-Modified-Sinceヘッダをリクエストに追加する。
+ */
+- (void)addValidatorsToRequest:(NSMutableURLRequest*)request;
+
+@end
+
+
+/*------------------------------------------------------------------------------
+ HTTPCache
+ -----------------------------------------------------------------------------*/
+
+@interface HTTPCache : NSObject
+
+/*
+ * Cachesディレクトリ以下に作成する、アプリケーション共通のキャッシュ(上限20MB)
+ */
++ (HTTPCache*)defaultCache;
+
+/*
+ * 指定ディレクトリにキャッシュを作成する。
+ * capacity: ボディの合計サイズの上限[byte]
+ */
+- (id)initWithDirectory:(NSString*)directory capacity:(NSUInteger)capacity;
+
+/*
+ * ボディの合計サイズの上限[byte]
+ */
+@property(nonatomic) NSUInteger capacity;
+
+/*
+ * 現在のボディの合計サイズ[byte]
+ */
+@property(nonatomic, readonly) NSUInteger currentSize;
+
+/*
+ * リクエストに対応するキャッシュを取得する。無ければnilを返す。
+ */
+- (HTTPCachedResponse*)cachedResponseForRequest:(NSURLRequest*)request;
+
+/*
+ * レスポンスを保存する。保存できないレスポンス(no-store等)は無視する。
+ * ファイルへの書き込みはバックグラウンドで行われる。
+ */
+- (void)storeResponse:(NSHTTPURLResponse*)response
+                 data:(NSData*)data
+           forRequest:(NSURLRequest*)request;
+
+/*
+ * 304 Not Modifiedを受けて、キャッシュの期限とヘッダを更新する。
+ * 更新したキャッシュを返す。キャッシュが無くなっていればnilを返す。
+ */
+- (HTTPCachedResponse*)updateWithNotModifiedResponse:(NSHTTPURLResponse*)response
+                                          forRequest:(NSURLRequest*)request;
+
+/*
+ * キャッシュを削除する。
+ */
+- (void)removeCachedResponseForRequest:(NSURLRequest*)request;
+- (void)removeAllCachedResponses;
+
+@end
+
+
+#endif // TYABUTA_HTTP_CACHE_H
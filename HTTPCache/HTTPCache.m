@@ -0,0 +1,469 @@
+//
+//  HTTPCache
+//
+//  Created by tyabuta on 2014/06/07.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "HTTPCache.h"
+#import <CommonCrypto/CommonDigest.h>
+
+
+// インデックスファイル名
+static NSString* const HTTPCacheIndexFileName = @"index.plist";
+
+// ボディを保存するディレクトリ名
+static NSString* const HTTPCacheBodyDirectoryName = @"bodies";
+
+// インデックスの保存を遅らせる時間[sec](連続した更新をまとめる)
+static const NSTimeInterval HTTPCacheSaveDelay = 1.0;
+
+// Last-Modifiedから推定する鮮度の上限[sec]
+static const NSTimeInterval HTTPCacheMaxHeuristicLifetime = 24 * 60 * 60;
+
+// エントリのキー
+static NSString* const kURL          = @"url";
+static NSString* const kHeaders      = @"headers";
+static NSString* const kVary         = @"vary";
+static NSString* const kBody         = @"body";
+static NSString* const kSize         = @"size";
+static NSString* const kExpires      = @"expires";
+static NSString* const kNoCache      = @"noCache";
+static NSString* const kAccess       = @"access";
+
+
+
+
+/*------------------------------------------------------------------------------
+ Header functions
+ -----------------------------------------------------------------------------*/
+#pragma mark - Header functions
+
+/*
+ * ヘッダを大文字小文字を区別せずに取得する。
+ */
+static NSString* HTTPHeaderValue(NSDictionary* headers, NSString* name){
+    NSString* value = headers[name];
+    if (value) return value;
+    for (NSString* key in headers) {
+        if (NSOrderedSame == [key caseInsensitiveCompare:name]) return headers[key];
+    }
+    return nil;
+}
+
+/*
+ * Cache-Controlヘッダをディレクティブの辞書に分解する。
+ * "max-age=60, no-cache" => @{ @"max-age" : @"60", @"no-cache" : @"" }
+ */
+static NSDictionary* HTTPCacheControlParse(NSString* value){
+    NSMutableDictionary* directives = [NSMutableDictionary dictionary];
+    NSCharacterSet* whitespace = [NSCharacterSet whitespaceCharacterSet];
+    for (NSString* part in [value componentsSeparatedByString:@","]) {
+        NSString* token = [[part stringByTrimmingCharactersInSet:whitespace] lowercaseString];
+        if (0 == token.length) continue;
+        NSRange eq = [token rangeOfString:@"="];
+        if (NSNotFound == eq.location) {
+            directives[token] = @"";
+        }
+        else {
+            NSString* name = [token substringToIndex:eq.location];
+            NSString*  arg = [token substringFromIndex:eq.location + 1];
+            directives[name] = [arg stringByTrimmingCharactersInSet:
+                                [NSCharacterSet characterSetWithCharactersInString:@"\" "]];
+        }
+    }
+    return directives;
+}
+
+/*
+ * HTTP-dateを解析する。(RFC 1123形式)
+ * NSDateFormatterはスレッドセーフでない為、キャッシュのキュー上でのみ呼ぶ事。
+ */
+static NSDate* HTTPDateParse(NSString* value){
+    static NSDateFormatter* formatter = nil;
+    if (nil == formatter) {
+        formatter = [[NSDateFormatter alloc] init];
+        formatter.locale     = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone   = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+    }
+    return value? [formatter dateFromString:value] : nil;
+}
+
+/*
+ * レスポンスヘッダから、新鮮でいられる期限を求める。
+ */
+static NSDate* HTTPCacheExpiration(NSDictionary* headers, NSDictionary* cacheControl, NSDate* now){
+    NSDate*   date = HTTPDateParse(HTTPHeaderValue(headers, @"Date")) ?: now;
+    double     age = [HTTPHeaderValue(headers, @"Age") doubleValue];
+    NSTimeInterval lifetime = 0;
+
+    NSString* maxAge = cacheControl[@"max-age"];
+    NSDate*  expires = HTTPDateParse(HTTPHeaderValue(headers, @"Expires"));
+    NSDate* modified = HTTPDateParse(HTTPHeaderValue(headers, @"Last-Modified"));
+    if (maxAge) {
+        lifetime = [maxAge doubleValue];
+    }
+    else if (expires) {
+        lifetime = [expires timeIntervalSinceDate:date];
+    }
+    else if (modified) {
+        // 明示的な期限が無い場合は、更新されてからの経過時間の1割を鮮度とみなす。
+        lifetime = MIN([date timeIntervalSinceDate:modified] * 0.1, HTTPCacheMaxHeuristicLifetime);
+    }
+    return [now dateByAddingTimeInterval:MAX(0, lifetime - age)];
+}
+
+/*
+ * ボディの内容からファイル名となるハッシュ値を求める。
+ */
+static NSString* HTTPCacheBodyHash(NSData* data){
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(data.bytes, (CC_LONG)data.length, digest);
+
+    char hex[CC_SHA1_DIGEST_LENGTH * 2 + 1];
+    for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+        snprintf(hex + i*2, 3, "%02x", digest[i]);
+    }
+    return [NSString stringWithUTF8String:hex];
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation HTTPCachedResponse
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation HTTPCachedResponse
+
+@implementation HTTPCachedResponse
+{
+    NSString* _etag;
+    NSString* _lastModified;
+}
+
+- (id)initWithEntry:(NSDictionary*)entry data:(NSData*)data {
+    self = [super init];
+    if (self) {
+        NSDictionary* headers = entry[kHeaders];
+        _response = [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:entry[kURL]]
+                                                statusCode:200
+                                               HTTPVersion:@"HTTP/1.1"
+                                              headerFields:headers];
+        _data         = data;
+        _etag         = HTTPHeaderValue(headers, @"ETag");
+        _lastModified = HTTPHeaderValue(headers, @"Last-Modified");
+        _fresh        = (NO == [entry[kNoCache] boolValue] &&
+                         [entry[kExpires] timeIntervalSinceNow] > 0);
+    }
+    return self;
+}
+
+- (void)addValidatorsToRequest:(NSMutableURLRequest*)request {
+    if (_etag)         [request setValue:_etag         forHTTPHeaderField:@"If-None-Match"];
+    if (_lastModified) [request setValue:_lastModified forHTTPHeaderField:@"If-Modified-Since"];
+}
+
+@end
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation HTTPCache
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation HTTPCache
+
+@implementation HTTPCache
+{
+    NSString*            _directory;
+    NSString*            _bodyDirectory;
+    dispatch_queue_t     _queue;
+
+    NSMutableDictionary* _entries;    // キー -> エントリ
+    NSCountedSet*        _bodyRefs;   // ボディのハッシュ値の参照数
+    NSMutableDictionary* _bodySizes;  // ハッシュ値 -> サイズ
+    BOOL                 _saveScheduled;
+}
+
++ (HTTPCache*)defaultCache {
+    static HTTPCache*      defaultCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSString* caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,
+                                                               NSUserDomainMask,
+                                                               YES)[0];
+        defaultCache = [[HTTPCache alloc] initWithDirectory:[caches stringByAppendingPathComponent:@"HTTPCache"]
+                                                   capacity:20 * 1024 * 1024];
+    });
+    return defaultCache;
+}
+
+- (id)initWithDirectory:(NSString*)directory capacity:(NSUInteger)capacity {
+    self = [super init];
+    if (self) {
+        _directory     = [directory copy];
+        _bodyDirectory = [directory stringByAppendingPathComponent:HTTPCacheBodyDirectoryName];
+        _capacity      = capacity;
+        _queue         = dispatch_queue_create("HTTPCache", DISPATCH_QUEUE_SERIAL);
+        _bodyRefs      = [NSCountedSet set];
+        _bodySizes     = [NSMutableDictionary dictionary];
+
+        [[NSFileManager defaultManager] createDirectoryAtPath:_bodyDirectory
+                                  withIntermediateDirectories:YES
+                                                   attributes:nil
+                                                        error:nil];
+        [self loadIndex];
+    }
+    return self;
+}
+
+
+#pragma mark Index
+
+/*
+ * インデックスを読み込み、ボディの参照数を数え直す。
+ */
+- (void)loadIndex {
+    NSString* path = [_directory stringByAppendingPathComponent:HTTPCacheIndexFileName];
+    NSData*   data = [NSData dataWithContentsOfFile:path];
+    NSDictionary* index = nil;
+    if (data) {
+        index = [NSPropertyListSerialization propertyListWithData:data
+                                                          options:NSPropertyListMutableContainers
+                                                           format:NULL
+                                                            error:NULL];
+    }
+    _entries = [index isKindOfClass:[NSDictionary class]]?
+    [index mutableCopy] : [NSMutableDictionary dictionary];
+
+    for (NSDictionary* entry in [_entries allValues]) {
+        [self retainBody:entry[kBody] size:[entry[kSize] unsignedIntegerValue]];
+    }
+}
+
+/*
+ * インデックスの保存を予約する。短時間の更新はまとめて一回で書き込む。
+ */
+- (void)scheduleSave {
+    if (_saveScheduled) return;
+    _saveScheduled = YES;
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(HTTPCacheSaveDelay * NSEC_PER_SEC)),
+                   _queue, ^{
+                       _saveScheduled = NO;
+                       NSData* data =
+                       [NSPropertyListSerialization dataWithPropertyList:_entries
+                                                                  format:NSPropertyListBinaryFormat_v1_0
+                                                                 options:0
+                                                                   error:NULL];
+                       NSString* path = [_directory stringByAppendingPathComponent:HTTPCacheIndexFileName];
+                       [data writeToFile:path atomically:YES];
+                   });
+}
+
+/*
+ * リクエストからキャッシュのキーを作成する。
+ */
+- (NSString*)keyForRequest:(NSURLRequest*)request {
+    return request.URL.absoluteString;
+}
+
+
+#pragma mark Body
+
+- (NSString*)pathForBody:(NSString*)hash {
+    return [_bodyDirectory stringByAppendingPathComponent:hash];
+}
+
+- (void)retainBody:(NSString*)hash size:(NSUInteger)size {
+    if (0 == [_bodyRefs countForObject:hash]) {
+        _bodySizes[hash] = @(size);
+        _currentSize += size;
+    }
+    [_bodyRefs addObject:hash];
+}
+
+/*
+ * ボディの参照を外す。誰も参照しなくなったらファイルを削除する。
+ */
+- (void)releaseBody:(NSString*)hash {
+    if (nil == hash) return;
+    [_bodyRefs removeObject:hash];
+    if (0 == [_bodyRefs countForObject:hash]) {
+        _currentSize -= [_bodySizes[hash] unsignedIntegerValue];
+        [_bodySizes removeObjectForKey:hash];
+        [[NSFileManager defaultManager] removeItemAtPath:[self pathForBody:hash] error:nil];
+    }
+}
+
+/*
+ * 合計サイズが上限を下回るまで、使われていない順にエントリを削除する。
+ */
+- (void)evictIfNeeded {
+    if (_currentSize <= _capacity) return;
+
+    NSArray* keys = [_entries keysSortedByValueUsingComparator:^(NSDictionary* a, NSDictionary* b) {
+        return [a[kAccess] compare:b[kAccess]];
+    }];
+    for (NSString* key in keys) {
+        if (_currentSize <= _capacity) break;
+        [self removeEntryForKey:key];
+    }
+}
+
+- (void)removeEntryForKey:(NSString*)key {
+    NSDictionary* entry = _entries[key];
+    if (nil == entry) return;
+    [_entries removeObjectForKey:key];
+    [self releaseBody:entry[kBody]];
+    [self scheduleSave];
+}
+
+
+#pragma mark Public methods
+
+- (void)setCapacity:(NSUInteger)capacity {
+    dispatch_sync(_queue, ^{
+        _capacity = capacity;
+        [self evictIfNeeded];
+    });
+}
+
+- (HTTPCachedResponse*)cachedResponseForRequest:(NSURLRequest*)request {
+    NSString* key = [self keyForRequest:request];
+    __block HTTPCachedResponse* cached = nil;
+
+    dispatch_sync(_queue, ^{
+        NSMutableDictionary* entry = _entries[key];
+        if (nil == entry) return;
+
+        // Varyで指定されたリクエストヘッダが一致しなければ使えない。
+        NSDictionary* vary = entry[kVary];
+        for (NSString* name in vary) {
+            NSString* value = [request valueForHTTPHeaderField:name] ?: @"";
+            if (NO == [value isEqualToString:vary[name]]) return;
+        }
+
+        // ボディはmmapで読み込む。ファイルが消えていればエントリも消す。
+        NSData* data = [NSData dataWithContentsOfFile:[self pathForBody:entry[kBody]]
+                                              options:NSDataReadingMappedAlways
+                                                error:NULL];
+        if (nil == data) {
+            [self removeEntryForKey:key];
+            return;
+        }
+
+        entry[kAccess] = [NSDate date];
+        [self scheduleSave];
+        cached = [[HTTPCachedResponse alloc] initWithEntry:entry data:data];
+    });
+    return cached;
+}
+
+- (void)storeResponse:(NSHTTPURLResponse*)response
+                 data:(NSData*)data
+           forRequest:(NSURLRequest*)request
+{
+    if (200 != response.statusCode || nil == data) return;
+
+    NSString*         key = [self keyForRequest:request];
+    NSDictionary* headers = [response.allHeaderFields copy];
+    NSString*    varyList = HTTPHeaderValue(headers, @"Vary");
+
+    // リクエストヘッダはここで取り出しておく。
+    NSMutableDictionary* vary = nil;
+    if (varyList) {
+        vary = [NSMutableDictionary dictionary];
+        for (NSString* part in [varyList componentsSeparatedByString:@","]) {
+            NSString* name = [part stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+            if ([name isEqualToString:@"*"]) return;
+            if (name.length) vary[name] = [request valueForHTTPHeaderField:name] ?: @"";
+        }
+    }
+
+    dispatch_async(_queue, ^{
+        NSDictionary* cacheControl = HTTPCacheControlParse(HTTPHeaderValue(headers, @"Cache-Control"));
+        if (cacheControl[@"no-store"]) return;
+
+        // 内容が同じボディは既存のファイルを共有する。
+        NSString* hash = HTTPCacheBodyHash(data);
+        if (0 == [_bodyRefs countForObject:hash]) {
+            if (NO == [data writeToFile:[self pathForBody:hash] atomically:YES]) return;
+        }
+
+        NSDate* now = [NSDate date];
+        NSMutableDictionary* entry = [NSMutableDictionary dictionary];
+        entry[kURL]     = response.URL.absoluteString ?: key;
+        entry[kHeaders] = headers;
+        entry[kBody]    = hash;
+        entry[kSize]    = @(data.length);
+        entry[kExpires] = HTTPCacheExpiration(headers, cacheControl, now);
+        entry[kNoCache] = @(nil != cacheControl[@"no-cache"]);
+        entry[kAccess]  = now;
+        if (vary) entry[kVary] = vary;
+
+        // 参照を先に増やしてから古いエントリを外す。(同じボディの場合に消さない為)
+        [self retainBody:hash size:data.length];
+        NSDictionary* old = _entries[key];
+        _entries[key] = entry;
+        [self releaseBody:old[kBody]];
+
+        [self evictIfNeeded];
+        [self scheduleSave];
+    });
+}
+
+- (HTTPCachedResponse*)updateWithNotModifiedResponse:(NSHTTPURLResponse*)response
+                                          forRequest:(NSURLRequest*)request
+{
+    NSString* key = [self keyForRequest:request];
+    __block HTTPCachedResponse* cached = nil;
+
+    dispatch_sync(_queue, ^{
+        NSMutableDictionary* entry = _entries[key];
+        if (nil == entry) return;
+
+        // 304で返ってきたヘッダで上書きする。
+        NSMutableDictionary* headers = [entry[kHeaders] mutableCopy];
+        [headers addEntriesFromDictionary:response.allHeaderFields];
+        // 304のContent-Length等はボディと一致しないので、元の値を残す。
+        NSString* length = HTTPHeaderValue(entry[kHeaders], @"Content-Length");
+        if (length) headers[@"Content-Length"] = length;
+
+        NSDictionary* cacheControl = HTTPCacheControlParse(HTTPHeaderValue(headers, @"Cache-Control"));
+        NSDate* now = [NSDate date];
+        entry[kHeaders] = headers;
+        entry[kExpires] = HTTPCacheExpiration(headers, cacheControl, now);
+        entry[kNoCache] = @(nil != cacheControl[@"no-cache"]);
+        entry[kAccess]  = now;
+
+        NSData* data = [NSData dataWithContentsOfFile:[self pathForBody:entry[kBody]]
+                                              options:NSDataReadingMappedAlways
+                                                error:NULL];
+        if (nil == data) {
+            [self removeEntryForKey:key];
+            return;
+        }
+        [self scheduleSave];
+        cached = [[HTTPCachedResponse alloc] initWithEntry:entry data:data];
+    });
+    return cached;
+}
+
+- (void)removeCachedResponseForRequest:(NSURLRequest*)request {
+    NSString* key = [self keyForRequest:request];
+    dispatch_async(_queue, ^{
+        [self removeEntryForKey:key];
+    });
+}
+
+- (void)removeAllCachedResponses {
+    dispatch_async(_queue, ^{
+        for (NSString* key in [_entries allKeys]) {
+            [self removeEntryForKey:key];
+        }
+    });
+}
+
+@end
@@ -0,0 +1,173 @@
+/*******************************************************************************
+  HTTPClient 1.0.0.0
+
+                         非同期のHTTPリクエストを行うクライアント
+
+   sendSynchronousRequestの代わりに使う。
+   リクエストはホスト毎のキューで同時接続数を制限して実行され、
+   同じホストへの接続はkeep-aliveで使い回される。
+   完了ブロックは呼び出し元のスレッドをブロックせず、completionQueueで呼ばれる。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_HTTP_CLIENT_H
+#define TYABUTA_HTTP_CLIENT_H
+
+#import <Foundation/Foundation.h>
+
+@class HTTPCache;
+
+/*
+ * リクエスト完了時に呼ばれるブロック
+ * 失敗時はerrorにエラーが入る。HTTPステータスが4xx,5xxでもerrorはnilとなるので
+ * response.statusCodeで判定する事。
+ */
+typedef void (^HTTPClientCompletionBlock)(NSHTTPURLResponse* response,
+                                          NSData*            data,
+                                          NSError*           error);
+
+/*
+ * ボディを受信する度に呼ばれるブロック
+ * ネットワークスレッドで呼ばれるので、重い処理は別のキューで行う事。
+ * NOを返すと通信を中断する。
+ */
+typedef BOOL (^HTTPClientDataBlock)(NSData* chunk);
+
+/*
+ * ダウンロード完了時に呼ばれるブロック
+ * sha256にはファイル全体のSHA-256ハッシュ値(32byte)が入る。
+ */
+typedef void (^HTTPClientDownloadBlock)(NSHTTPURLResponse* response,
+                                        NSData*            sha256,
+                                        NSError*           error);
+
+/*
+ * 共有リクエストのボディを解析するブロック
+ * バックグラウンドのキューで一度だけ呼ばれ、戻り値が全ての呼び出し元に渡される。
+ * 戻り値は複数のスレッドから参照されるので、不変なオブジェクトを返す事。
+ */
+typedef id (^HTTPClientParseBlock)(NSData* data, NSError** error);
+
+/*
+ * 共有リクエストの解析結果を受け取るブロック
+ */
+typedef void (^HTTPClientObjectBlock)(NSHTTPURLResponse* response,
+                                      id                 object,
+                                      NSError*           error);
+
+
+/*------------------------------------------------------------------------------
+ HTTPRequestOperation
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 一つのリクエストを表すオペレーション
+ * cancelメソッドで通信を中断できる。中断した場合、完了ブロックは呼ばれない。
+ */
+@interface HTTPRequestOperation : NSOperation
+
+@property(nonatomic, readonly) NSURLRequest*      request;
+@property(nonatomic, readonly) NSHTTPURLResponse* response;
+@property(nonatomic, readonly) NSData*            responseData;
+@property(nonatomic, readonly) NSError*           error;
+
+@end
+
+
+/*------------------------------------------------------------------------------
+ HTTPClient
+ -----------------------------------------------------------------------------*/
+
+@interface HTTPClient : NSObject
+
+/*
+ * アプリケーション共通のクライアントを取得する。
+ */
++ (HTTPClient*)sharedClient;
+
+/*
+ * ホスト毎の同時接続数(初期値4)
+ */
+@property(nonatomic) NSInteger maxConnectionsPerHost;
+
+/*
+ * リクエストのタイムアウト[sec](初期値20sec)
+ */
+@property(nonatomic) NSTimeInterval timeoutInterval;
+
+/*
+ * 完了ブロックを呼ぶキュー(初期値はメインキュー)
+ */
+@property(strong, nonatomic) NSOperationQueue* completionQueue;
+
+/*
+ * GETリクエストのレスポンスを保存するキャッシュ(初期値nil)
+ * 設定すると、新鮮なキャッシュは通信せずに返し、期限切れのものは条件付きリクエストで
+ * 再検証する。304が返った場合は、キャッシュのボディがステータス200として完了ブロックに渡る。
+ * dataHandlerを指定したリクエストと、NSURLRequestReloadIgnoringLocalCacheDataの
+ * リクエストはキャッシュを使わない。
+ */
+@property(strong, nonatomic) HTTPCache* cache;
+
+/*
+ * リクエストを送信する。
+ * 戻り値のオペレーションをcancelすると通信を中断する。
+ */
+- (HTTPRequestOperation*)sendRequest:(NSURLRequest*)request
+                          completion:(HTTPClientCompletionBlock)completion;
+
+/*
+ * ボディを逐次受け取るリクエストを送信する。
+ * ボディはdataHandlerに渡され、バッファリングされない。(完了ブロックのdataはnil)
+ * dataHandlerがNOを返した場合は、NSURLErrorCancelledのエラーで完了ブロックが呼ばれる。
+ */
+- (HTTPRequestOperation*)sendRequest:(NSURLRequest*)request
+                         dataHandler:(HTTPClientDataBlock)dataHandler
+                          completion:(HTTPClientCompletionBlock)completion;
+
+/*
+ * 同時に発行された同じGETリクエストを一つの通信にまとめて送信する。
+ * URL(正規化したもの)とリクエストヘッダが一致するリクエストが通信中であれば、
+ * 新たに接続せずにその結果を受け取る。
+ * 戻り値のオペレーションをcancelしても、他に待っている呼び出し元がいれば通信は続く。
+ * GET以外のリクエストは通常のsendRequest:completion:と同じ動作となる。
+ */
+- (HTTPRequestOperation*)sendSharedRequest:(NSURLRequest*)request
+                                completion:(HTTPClientCompletionBlock)completion;
+
+/*
+ * 共有リクエストを送信し、ボディの解析結果も共有する。
+ * parserNameが異なるリクエストは、URLが同じでもまとめない。
+ * parserがエラーを返した場合は、そのエラーで完了ブロックが呼ばれる。
+ */
+- (HTTPRequestOperation*)sendSharedRequest:(NSURLRequest*)request
+                                parserName:(NSString*)parserName
+                                    parser:(HTTPClientParseBlock)parser
+                                completion:(HTTPClientObjectBlock)completion;
+
+/*
+ * ボディをメモリに溜めずに、ファイルへ書き込むリクエストを送信する。
+ * 受信中は path.download に書き込み、完了時にpathへリネームする。
+ * 中断して path.download が残っている場合は、Rangeリクエストで続きから再開する。
+ * 2xx以外のステータスはNSURLErrorBadServerResponseのエラーとなる。
+ */
+- (HTTPRequestOperation*)downloadRequest:(NSURLRequest*)request
+                                  toFile:(NSString*)path
+                              completion:(HTTPClientDownloadBlock)completion;
+
+/*
+ * 指定のURLをGETでリクエストする。
+ */
+- (HTTPRequestOperation*)getURL:(NSURL*)url
+                     completion:(HTTPClientCompletionBlock)completion;
+
+/*
+ * 全てのリクエストを中断する。
+ */
+- (void)cancelAllRequests;
+
+@end
+
+
+#endif // TYABUTA_HTTP_CLIENT_H
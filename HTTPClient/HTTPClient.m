@@ -0,0 +1,1075 @@
+//
+//  HTTPClient
+//
+//  Created by tyabuta on 2014/05/17.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "HTTPClient.h"
+#import "HTTPCache.h"
+#import <CommonCrypto/CommonDigest.h>
+#import <sys/stat.h>
+#import <sys/xattr.h>
+
+// FlightRecorderが追加されている場合だけ記録する。
+#if defined(__has_include)
+#if __has_include("FlightRecorder.h")
+#import "FlightRecorder.h"
+#endif
+#endif
+
+
+/*
+ * デバックログ用のマクロ、リリース時は何もおこらないようになる。
+ * Tips: __VA_ARGS__ の前に##を付けると、引数ゼロでもコンパイルが通る。
+ */
+#ifdef DEBUG
+#define dmsg(fmt, ...) NSLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#else
+#define dmsg(...)
+#endif
+
+
+
+
+/*------------------------------------------------------------------------------
+ Network thread
+ -----------------------------------------------------------------------------*/
+#pragma mark - Network thread
+
+/*
+ * NSURLConnectionのデリゲートを受ける専用スレッドのエントリ
+ * ランループを回し続ける。
+ */
+static void HTTPClientNetworkThreadMain(void){
+    @autoreleasepool {
+        [[NSThread currentThread] setName:@"HTTPClient"];
+        NSRunLoop* runLoop = [NSRunLoop currentRunLoop];
+        // ソースが無いとランループが即終了する為、ダミーのポートを追加しておく。
+        [runLoop addPort:[NSMachPort port] forMode:NSDefaultRunLoopMode];
+        [runLoop run];
+    }
+}
+
+@interface HTTPClientNetworkThread : NSObject
++ (NSThread*)thread;
+@end
+
+@implementation HTTPClientNetworkThread
+
++ (void)threadMain:(id)object {
+    HTTPClientNetworkThreadMain();
+}
+
+/*
+ * 全てのリクエストで共有するネットワークスレッドを取得する。
+ */
++ (NSThread*)thread {
+    static NSThread*       thread = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        thread = [[NSThread alloc] initWithTarget:self
+                                         selector:@selector(threadMain:)
+                                           object:nil];
+        [thread start];
+    });
+    return thread;
+}
+
+@end
+
+
+
+
+/*------------------------------------------------------------------------------
+ HTTPRequestFlight
+ -----------------------------------------------------------------------------*/
+#pragma mark - HTTPRequestFlight
+
+/*
+ * 共有リクエストの一回分の通信を表すオブジェクト
+ * 実際に通信するオペレーションと、結果を待っている呼び出し元(waiters)を持つ。
+ * waitersとoperationはHTTPClientのロック(_flights)の中でのみ操作する。
+ */
+@interface HTTPRequestFlight : NSObject
+@property(nonatomic, readonly)       NSString*             key;
+@property(nonatomic, readonly)       HTTPClientParseBlock  parser;
+@property(nonatomic, readonly, weak) HTTPClient*           client;
+@property(nonatomic, readonly)       NSMutableArray*       waiters;
+@property(nonatomic, strong)         HTTPRequestOperation* operation;
+@end
+
+@implementation HTTPRequestFlight
+
+- (id)initWithKey:(NSString*)key parser:(HTTPClientParseBlock)parser client:(HTTPClient*)client {
+    self = [super init];
+    if (self) {
+        _key     = [key copy];
+        _parser  = [parser copy];
+        _client  = client;
+        _waiters = [NSMutableArray array];
+    }
+    return self;
+}
+
+@end
+
+
+@interface HTTPClient()
+- (void)removeWaiter:(HTTPRequestOperation*)waiter fromFlight:(HTTPRequestFlight*)flight;
+@end
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation HTTPRequestOperation
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation HTTPRequestOperation
+
+/*
+ * レスポンスヘッダを受信した時に呼ばれるブロック
+ * エラーを返すと通信を中断し、そのエラーで完了ブロックが呼ばれる。
+ */
+typedef NSError* (^HTTPClientResponseBlock)(NSHTTPURLResponse* response);
+
+@interface HTTPRequestOperation() <NSURLConnectionDataDelegate>
+- (id)initWithRequest:(NSURLRequest*)request
+      responseHandler:(HTTPClientResponseBlock)responseHandler
+          dataHandler:(HTTPClientDataBlock)dataHandler
+           completion:(HTTPClientCompletionBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue;
+- (id)initWithRequest:(NSURLRequest*)request
+          dataHandler:(HTTPClientDataBlock)dataHandler
+           completion:(HTTPClientCompletionBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue;
+- (id)initWithRequest:(NSURLRequest*)request
+       cachedResponse:(HTTPCachedResponse*)cachedResponse
+           completion:(HTTPClientCompletionBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue;
+- (id)initWithRequest:(NSURLRequest*)request
+               flight:(HTTPRequestFlight*)flight
+           completion:(HTTPClientObjectBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue;
+- (void)deliverResponse:(NSHTTPURLResponse*)response
+                   data:(NSData*)data
+                 object:(id)object
+                  error:(NSError*)error;
+@end
+
+@implementation HTTPRequestOperation
+{
+    NSURLConnection*          _connection;
+    NSMutableData*            _buffer;
+    HTTPClientResponseBlock   _responseHandler;
+    HTTPClientDataBlock       _dataHandler;
+    HTTPClientCompletionBlock _completion;
+    NSOperationQueue*         _completionQueue;
+    HTTPCachedResponse*       _cachedResponse;
+
+    // 共有リクエストの呼び出し元として待つ場合に使う。
+    HTTPRequestFlight*        _flight;
+    HTTPClientObjectBlock     _objectCompletion;
+
+    // フライトレコーダーに記録する為の計測値
+    uint64_t                  _startTicks;
+    NSUInteger                _receivedBytes;
+
+    BOOL _executing;
+    BOOL _finished;
+}
+
+- (id)initWithRequest:(NSURLRequest*)request
+      responseHandler:(HTTPClientResponseBlock)responseHandler
+          dataHandler:(HTTPClientDataBlock)dataHandler
+           completion:(HTTPClientCompletionBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue
+{
+    self = [super init];
+    if (self) {
+        _request         = [request copy];
+        _responseHandler = [responseHandler copy];
+        _dataHandler     = [dataHandler copy];
+        _completion      = [completion copy];
+        _completionQueue = completionQueue;
+    }
+    return self;
+}
+
+- (id)initWithRequest:(NSURLRequest*)request
+          dataHandler:(HTTPClientDataBlock)dataHandler
+           completion:(HTTPClientCompletionBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue
+{
+    return [self initWithRequest:request
+                 responseHandler:nil
+                     dataHandler:dataHandler
+                      completion:completion
+                 completionQueue:completionQueue];
+}
+
+/*
+ * 通信せずにキャッシュの内容で完了するオペレーションを作成する。
+ */
+- (id)initWithRequest:(NSURLRequest*)request
+       cachedResponse:(HTTPCachedResponse*)cachedResponse
+           completion:(HTTPClientCompletionBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue
+{
+    self = [self initWithRequest:request
+                     dataHandler:nil
+                      completion:completion
+                 completionQueue:completionQueue];
+    if (self) {
+        _cachedResponse = cachedResponse;
+    }
+    return self;
+}
+
+/*
+ * 共有リクエストの結果を待つオペレーションを作成する。
+ * 自身は通信せず、flightからdeliverResponse:...で結果を受け取る。
+ */
+- (id)initWithRequest:(NSURLRequest*)request
+               flight:(HTTPRequestFlight*)flight
+           completion:(HTTPClientObjectBlock)completion
+      completionQueue:(NSOperationQueue*)completionQueue
+{
+    self = [self initWithRequest:request
+                     dataHandler:nil
+                      completion:nil
+                 completionQueue:completionQueue];
+    if (self) {
+        _flight           = flight;
+        _objectCompletion = [completion copy];
+    }
+    return self;
+}
+
+
+#pragma mark NSOperation
+
+- (BOOL)isConcurrent { return YES; }
+- (BOOL)isExecuting  { return _executing; }
+- (BOOL)isFinished   { return _finished; }
+
+- (void)start {
+    if ([self isCancelled]) {
+        [self finish];
+        return;
+    }
+
+    [self willChangeValueForKey:@"isExecuting"];
+    _executing = YES;
+    [self didChangeValueForKey:@"isExecuting"];
+
+    // 共有リクエストの結果はflightから届く。
+    if (_flight) return;
+
+    // キャッシュから返す場合はネットワークスレッドを経由しない。
+    if (_cachedResponse) {
+        _response     = _cachedResponse.response;
+        _responseData = _cachedResponse.data;
+        _cachedResponse = nil;
+        [self completeWithError:nil];
+        return;
+    }
+
+    // デリゲートはネットワークスレッドで受ける。
+    [self performSelector:@selector(startConnection)
+                 onThread:[HTTPClientNetworkThread thread]
+               withObject:nil
+            waitUntilDone:NO];
+}
+
+- (void)cancel {
+    if ([self isCancelled] || [self isFinished]) return;
+    [super cancel];
+
+    // 共有リクエストは自身が待つのをやめるだけ。最後の一人なら通信も中断される。
+    if (_flight) {
+        HTTPRequestFlight* flight = _flight;
+        [flight.client removeWaiter:self fromFlight:flight];
+        @synchronized(self) {
+            _flight           = nil;
+            _objectCompletion = nil;
+            [self finish];
+        }
+        return;
+    }
+
+    [self performSelector:@selector(cancelConnection)
+                 onThread:[HTTPClientNetworkThread thread]
+               withObject:nil
+            waitUntilDone:NO];
+}
+
+/*
+ * オペレーションを終了状態にする。
+ */
+- (void)finish {
+    if (_finished) return;
+
+    [self willChangeValueForKey:@"isExecuting"];
+    [self willChangeValueForKey:@"isFinished"];
+    _executing = NO;
+    _finished  = YES;
+    [self didChangeValueForKey:@"isExecuting"];
+    [self didChangeValueForKey:@"isFinished"];
+}
+
+
+/*
+ * 共有リクエストの結果を受け取り、完了ブロックを呼ぶ。
+ */
+- (void)deliverResponse:(NSHTTPURLResponse*)response
+                   data:(NSData*)data
+                 object:(id)object
+                  error:(NSError*)error
+{
+    @synchronized(self) {
+        if (_finished) return;
+
+        _flight       = nil;
+        _response     = response;
+        _responseData = data;
+        _error        = error;
+
+        HTTPClientObjectBlock completion = _objectCompletion;
+        _objectCompletion = nil;
+        if (completion && NO == [self isCancelled]) {
+            [_completionQueue addOperationWithBlock:^{
+                completion(response, object, error);
+            }];
+        }
+        [self finish];
+    }
+}
+
+
+#pragma mark Connection (Network thread)
+
+- (void)startConnection {
+    if (_finished) return;
+    if ([self isCancelled]) {
+        [self finish];
+        return;
+    }
+    _connection = [[NSURLConnection alloc] initWithRequest:_request
+                                                  delegate:self
+                                          startImmediately:NO];
+    [_connection scheduleInRunLoop:[NSRunLoop currentRunLoop]
+                           forMode:NSDefaultRunLoopMode];
+#ifdef TYABUTA_FLIGHT_RECORDER_H
+    _startTicks = FlightRecorderNow();
+#endif
+    [_connection start];
+}
+
+- (void)cancelConnection {
+    if (_finished) return;
+
+    [_connection cancel];
+    _connection      = nil;
+    _responseHandler = nil;
+    _dataHandler     = nil;
+    _completion  = nil;
+    if (_executing) [self finish];
+}
+
+/*
+ * 完了ブロックを呼び、オペレーションを終了させる。
+ */
+- (void)completeWithError:(NSError*)error {
+    _connection      = nil;
+    _responseHandler = nil;
+    _dataHandler     = nil;
+    _error           = error;
+    if (_buffer) _responseData = _buffer;
+    _buffer          = nil;
+
+#ifdef TYABUTA_FLIGHT_RECORDER_H
+    if (_startTicks) {
+        NSInteger status = error? error.code : _response.statusCode;
+        FlightRecorderNetwork(_request.URL, status, _receivedBytes, FlightRecorderElapsed(_startTicks));
+        _startTicks = 0;
+    }
+#endif
+
+    HTTPClientCompletionBlock completion = _completion;
+    _completion = nil;
+    if (completion && NO == [self isCancelled]) {
+        NSHTTPURLResponse* response = _response;
+        NSData*            data     = _responseData;
+        [_completionQueue addOperationWithBlock:^{
+            completion(response, data, error);
+        }];
+    }
+    [self finish];
+}
+
+
+#pragma mark NSURLConnectionDataDelegate
+
+- (void)connection:(NSURLConnection*)connection didReceiveResponse:(NSURLResponse*)response {
+    if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+        _response = (NSHTTPURLResponse*)response;
+    }
+
+    if (_responseHandler) {
+        NSError* error = _responseHandler(_response);
+        if (error) {
+            [_connection cancel];
+            [self completeWithError:error];
+            return;
+        }
+    }
+
+    // 逐次受け取る場合はバッファリングしない。
+    if (_dataHandler) return;
+
+    // 分かっていればボディのサイズ分を先に確保しておく。
+    long long length = response.expectedContentLength;
+    NSUInteger capacity = (length > 0 && length < NSUIntegerMax)? (NSUInteger)length : 0;
+    _buffer = [[NSMutableData alloc] initWithCapacity:capacity];
+}
+
+- (void)connection:(NSURLConnection*)connection didReceiveData:(NSData*)data {
+    _receivedBytes += data.length;
+    if (nil == _dataHandler) {
+        [_buffer appendData:data];
+        return;
+    }
+    if (NO == _dataHandler(data)) {
+        [_connection cancel];
+        [self completeWithError:[NSError errorWithDomain:NSURLErrorDomain
+                                                    code:NSURLErrorCancelled
+                                                userInfo:nil]];
+    }
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection*)connection {
+    [self completeWithError:nil];
+}
+
+- (void)connection:(NSURLConnection*)connection didFailWithError:(NSError*)error {
+    dmsg(@"%@ %@", _request.URL, error);
+    [self completeWithError:error];
+}
+
+- (NSCachedURLResponse*)connection:(NSURLConnection*)connection
+                 willCacheResponse:(NSCachedURLResponse*)cachedResponse {
+    // キャッシュは呼び出し側で管理する。
+    return nil;
+}
+
+@end
+
+
+
+
+/*------------------------------------------------------------------------------
+ HTTPDownloadFile
+ -----------------------------------------------------------------------------*/
+#pragma mark - HTTPDownloadFile
+
+// 受信中のファイルに付ける拡張子
+static NSString* const HTTPDownloadFileExtension = @"download";
+
+// 再開時にIf-Rangeで送る検証子(ETag, Last-Modified)を保存する拡張属性名
+static const char* HTTPDownloadValidatorAttribute = "com.tyabuta.HTTPClient.validator";
+
+// 書き込みバッファのサイズ(ダウンロード中に使うメモリはこれだけ)
+static const size_t HTTPDownloadBufferSize = 64 * 1024;
+
+static NSError* HTTPDownloadPOSIXError(void){
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+}
+
+/*
+ * ダウンロード中のファイルを表すオブジェクト
+ * 受信したボディは固定サイズのバッファを経由してファイルに書き込み、
+ * 同時にSHA-256を計算する。
+ * openWithResponse:とappendData:はネットワークスレッドで、
+ * finish:は完了処理のキューで呼ばれる。(同時には呼ばれない)
+ */
+@interface HTTPDownloadFile : NSObject
+- (id)initWithPath:(NSString*)path;
+- (void)prepareRequest:(NSMutableURLRequest*)request;
+- (NSError*)openWithResponse:(NSHTTPURLResponse*)response;
+- (BOOL)appendData:(NSData*)data;
+- (NSData*)finish:(NSError**)error;
+
+// 書き込みに失敗した場合のエラー(ENOSPCなど)
+@property (nonatomic, readonly) NSError* writeError;
+@end
+
+@implementation HTTPDownloadFile
+{
+    NSString*         _path;
+    NSString*         _tempPath;
+    off_t             _resumeOffset;  // 再開する位置(Rangeで要求した位置)
+    int               _fd;
+    uint8_t*          _buffer;
+    size_t            _buffered;
+    CC_SHA256_CTX     _sha256;
+    NSError*          _writeError;
+}
+
+- (id)initWithPath:(NSString*)path {
+    self = [super init];
+    if (self) {
+        _path     = [path copy];
+        _tempPath = [path stringByAppendingPathExtension:HTTPDownloadFileExtension];
+        _fd       = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    // 中断された場合も、書き込めた所までは残しておき次回に再開する。
+    [self close];
+}
+
+/*
+ * 前回の途中のファイルがあれば、続きからのRangeリクエストにする。
+ * 途中でリソースが更新されていた場合は、If-Rangeにより全体が返される。
+ */
+- (void)prepareRequest:(NSMutableURLRequest*)request {
+    struct stat st;
+    if (0 != stat([_tempPath fileSystemRepresentation], &st) || 0 == st.st_size) return;
+
+    char validator[512];
+    ssize_t length = getxattr([_tempPath fileSystemRepresentation], HTTPDownloadValidatorAttribute,
+                              validator, sizeof(validator), 0, 0);
+    if (length <= 0) return;
+
+    _resumeOffset = st.st_size;
+    [request setValue:[NSString stringWithFormat:@"bytes=%lld-", (long long)_resumeOffset]
+   forHTTPHeaderField:@"Range"];
+    [request setValue:[[NSString alloc] initWithBytes:validator
+                                               length:length
+                                             encoding:NSUTF8StringEncoding]
+   forHTTPHeaderField:@"If-Range"];
+}
+
+/*
+ * レスポンスのステータスに応じて、ファイルを続きから開くか作り直す。
+ */
+- (NSError*)openWithResponse:(NSHTTPURLResponse*)response {
+    const char* tempPath = [_tempPath fileSystemRepresentation];
+    NSInteger     status = response.statusCode;
+    CC_SHA256_Init(&_sha256);
+
+    if (206 == status && _resumeOffset > 0) {
+        // Content-Range: bytes <start>-<end>/<total> の開始位置が要求通りか確認する。
+        NSString* range = [response.allHeaderFields objectForKey:@"Content-Range"];
+        long long start = -1;
+        if (range) sscanf([range UTF8String], "bytes %lld-", &start);
+        if (start != _resumeOffset) {
+            return [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:nil];
+        }
+
+        _fd = open(tempPath, O_RDWR);
+        if (_fd < 0) return HTTPDownloadPOSIXError();
+        _buffer = (uint8_t*)malloc(HTTPDownloadBufferSize);
+
+        // 既に書き込まれている部分をハッシュに含める。
+        off_t offset = 0;
+        while (offset < _resumeOffset) {
+            ssize_t n = pread(_fd, _buffer, (size_t)MIN((off_t)HTTPDownloadBufferSize, _resumeOffset - offset), offset);
+            if (n <= 0) return HTTPDownloadPOSIXError();
+            CC_SHA256_Update(&_sha256, _buffer, (CC_LONG)n);
+            offset += n;
+        }
+        if (lseek(_fd, _resumeOffset, SEEK_SET) < 0) return HTTPDownloadPOSIXError();
+        return nil;
+    }
+
+    if (status < 200 || status >= 300) {
+        // 範囲外を要求した場合は、次回最初から取得し直せるよう途中のファイルを捨てる。
+        if (416 == status) unlink(tempPath);
+        return [NSError errorWithDomain:NSURLErrorDomain
+                                   code:NSURLErrorBadServerResponse
+                               userInfo:@{NSLocalizedDescriptionKey :
+                                              [NSHTTPURLResponse localizedStringForStatusCode:status]}];
+    }
+
+    // 全体が返された場合は最初から書き直す。
+    _resumeOffset = 0;
+    _fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) return HTTPDownloadPOSIXError();
+    _buffer = (uint8_t*)malloc(HTTPDownloadBufferSize);
+
+    // 再開できるよう検証子を保存しておく。無ければ再開しない。
+    NSDictionary* headers = response.allHeaderFields;
+    NSString* validator = headers[@"ETag"] ?: headers[@"Last-Modified"];
+    if (validator) {
+        const char* value = [validator UTF8String];
+        fsetxattr(_fd, HTTPDownloadValidatorAttribute, value, strlen(value), 0, 0);
+    }
+    return nil;
+}
+
+/*
+ * バッファの内容をファイルに書き込む。
+ */
+- (BOOL)flush {
+    size_t written = 0;
+    while (written < _buffered) {
+        ssize_t n = write(_fd, _buffer + written, _buffered - written);
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            _writeError = HTTPDownloadPOSIXError();
+            return NO;
+        }
+        written += n;
+    }
+    _buffered = 0;
+    return YES;
+}
+
+- (BOOL)appendData:(NSData*)data {
+    if (_fd < 0 || _writeError) return NO;
+
+    const uint8_t* bytes = data.bytes;
+    size_t        length = data.length;
+    CC_SHA256_Update(&_sha256, bytes, (CC_LONG)length);
+
+    while (length > 0) {
+        size_t n = MIN(length, HTTPDownloadBufferSize - _buffered);
+        memcpy(_buffer + _buffered, bytes, n);
+        _buffered += n;
+        bytes     += n;
+        length    -= n;
+        if (_buffered == HTTPDownloadBufferSize && NO == [self flush]) return NO;
+    }
+    return YES;
+}
+
+- (void)close {
+    if (_fd >= 0) {
+        [self flush];
+        close(_fd);
+        _fd = -1;
+    }
+    free(_buffer);
+    _buffer = NULL;
+}
+
+/*
+ * 残りを書き込んでファイルを閉じ、pathへリネームする。
+ * ファイル全体のSHA-256を返す。
+ */
+- (NSData*)finish:(NSError**)error {
+    if (_fd < 0) {
+        if (error) *error = _writeError ?: [NSError errorWithDomain:NSURLErrorDomain
+                                                               code:NSURLErrorCannotWriteToFile
+                                                           userInfo:nil];
+        return nil;
+    }
+
+    BOOL ok = [self flush] && 0 == fsync(_fd);
+    if (ok) fremovexattr(_fd, HTTPDownloadValidatorAttribute, 0);
+    [self close];
+
+    // renameは置き換えを一度に行うので、途中の状態のファイルが見えることはない。
+    if (NO == ok || 0 != rename([_tempPath fileSystemRepresentation], [_path fileSystemRepresentation])) {
+        if (error) *error = _writeError ?: HTTPDownloadPOSIXError();
+        return nil;
+    }
+
+    NSMutableData* digest = [NSMutableData dataWithLength:CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest.mutableBytes, &_sha256);
+    return digest;
+}
+
+@end
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation HTTPClient
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation HTTPClient
+
+@implementation HTTPClient
+{
+    // ホスト毎のオペレーションキュー(scheme://host:port -> NSOperationQueue)
+    NSMutableDictionary* _hostQueues;
+
+    // 通信中の共有リクエスト(キー -> HTTPRequestFlight)
+    NSMutableDictionary* _flights;
+
+    // 共有リクエストとダウンロードの完了処理を行うキュー
+    NSOperationQueue*    _backgroundQueue;
+}
+
++ (HTTPClient*)sharedClient {
+    static HTTPClient*     sharedClient = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedClient = [[HTTPClient alloc] init];
+    });
+    return sharedClient;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        _maxConnectionsPerHost = 4;
+        _timeoutInterval       = 20;
+        _completionQueue       = [NSOperationQueue mainQueue];
+        _hostQueues            = [NSMutableDictionary dictionary];
+        _flights               = [NSMutableDictionary dictionary];
+        _backgroundQueue       = [[NSOperationQueue alloc] init];
+        _backgroundQueue.name  = @"HTTPClient.background";
+    }
+    return self;
+}
+
+/*
+ * ホスト毎の同時接続数を変更する。既存のキューにも反映させる。
+ */
+- (void)setMaxConnectionsPerHost:(NSInteger)maxConnectionsPerHost {
+    @synchronized(_hostQueues) {
+        _maxConnectionsPerHost = MAX(1, maxConnectionsPerHost);
+        for (NSOperationQueue* queue in [_hostQueues allValues]) {
+            queue.maxConcurrentOperationCount = _maxConnectionsPerHost;
+        }
+    }
+}
+
+/*
+ * リクエスト先ホストのキューを取得する。無ければ作成する。
+ */
+- (NSOperationQueue*)queueForURL:(NSURL*)url {
+    NSNumber* port = url.port;
+    if (nil == port) {
+        port = [[url.scheme lowercaseString] isEqualToString:@"https"]? @443 : @80;
+    }
+    NSString* key = [NSString stringWithFormat:@"%@://%@:%@",
+                     [url.scheme lowercaseString], [url.host lowercaseString], port];
+
+    @synchronized(_hostQueues) {
+        NSOperationQueue* queue = _hostQueues[key];
+        if (nil == queue) {
+            queue = [[NSOperationQueue alloc] init];
+            queue.name = key;
+            queue.maxConcurrentOperationCount = _maxConnectionsPerHost;
+            _hostQueues[key] = queue;
+        }
+        return queue;
+    }
+}
+
+- (HTTPRequestOperation*)sendRequest:(NSURLRequest*)request
+                          completion:(HTTPClientCompletionBlock)completion
+{
+    return [self sendRequest:request dataHandler:nil completion:completion];
+}
+
+- (HTTPRequestOperation*)sendRequest:(NSURLRequest*)request
+                         dataHandler:(HTTPClientDataBlock)dataHandler
+                          completion:(HTTPClientCompletionBlock)completion
+{
+    return [self sendRequest:request
+                 dataHandler:dataHandler
+                  completion:completion
+             completionQueue:_completionQueue];
+}
+
+/*
+ * 送信するリクエストにクライアントの設定を反映する。
+ */
+- (NSMutableURLRequest*)prepareRequest:(NSURLRequest*)request {
+    NSMutableURLRequest* mutableRequest = [request mutableCopy];
+    mutableRequest.timeoutInterval = _timeoutInterval;
+
+    // 冪等なリクエストはパイプラインで同じ接続に続けて送る。
+    NSString* method = [request.HTTPMethod uppercaseString];
+    if (nil == method || [method isEqualToString:@"GET"] || [method isEqualToString:@"HEAD"]) {
+        mutableRequest.HTTPShouldUsePipelining = YES;
+    }
+    return mutableRequest;
+}
+
+- (HTTPRequestOperation*)sendRequest:(NSURLRequest*)request
+                         dataHandler:(HTTPClientDataBlock)dataHandler
+                          completion:(HTTPClientCompletionBlock)completion
+                     completionQueue:(NSOperationQueue*)completionQueue
+{
+    NSMutableURLRequest* mutableRequest = [self prepareRequest:request];
+
+    HTTPCache* cache = _cache;
+    if (cache && nil == dataHandler && [self isCacheableRequest:mutableRequest]) {
+        HTTPCachedResponse* cached = [cache cachedResponseForRequest:mutableRequest];
+
+        // 新鮮なキャッシュがあれば通信しない。
+        if (cached.isFresh) {
+            HTTPRequestOperation* operation =
+            [[HTTPRequestOperation alloc] initWithRequest:mutableRequest
+                                           cachedResponse:cached
+                                               completion:completion
+                                          completionQueue:completionQueue];
+            [operation start];
+            return operation;
+        }
+
+        // 期限切れなら条件付きリクエストで再検証する。
+        // NSURLCacheと二重に検証しないよう、ローカルキャッシュは無視させる。
+        [cached addValidatorsToRequest:mutableRequest];
+        mutableRequest.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+
+        NSURLRequest* cacheRequest = [mutableRequest copy];
+        HTTPClientCompletionBlock userCompletion = completion;
+        completion = ^(NSHTTPURLResponse* response, NSData* data, NSError* error){
+            if (nil == error && 304 == response.statusCode && cached) {
+                HTTPCachedResponse* updated = [cache updateWithNotModifiedResponse:response
+                                                                        forRequest:cacheRequest];
+                if (updated) {
+                    response = updated.response;
+                    data     = updated.data;
+                }
+            }
+            else if (nil == error && 200 == response.statusCode) {
+                [cache storeResponse:response data:data forRequest:cacheRequest];
+            }
+            if (userCompletion) userCompletion(response, data, error);
+        };
+    }
+
+    HTTPRequestOperation* operation =
+    [[HTTPRequestOperation alloc] initWithRequest:mutableRequest
+                                      dataHandler:dataHandler
+                                       completion:completion
+                                  completionQueue:completionQueue];
+    [[self queueForURL:request.URL] addOperation:operation];
+    return operation;
+}
+
+/*
+ * キャッシュを使えるリクエストか判定する。
+ */
+- (BOOL)isCacheableRequest:(NSURLRequest*)request {
+    NSString* method = [request.HTTPMethod uppercaseString];
+    if (method && NO == [method isEqualToString:@"GET"]) return NO;
+
+    switch (request.cachePolicy) {
+        case NSURLRequestReloadIgnoringLocalCacheData:
+        case NSURLRequestReloadIgnoringLocalAndRemoteCacheData:
+            return NO;
+        default:
+            return YES;
+    }
+}
+
+
+#pragma mark Shared request
+
+- (HTTPRequestOperation*)sendSharedRequest:(NSURLRequest*)request
+                                completion:(HTTPClientCompletionBlock)completion
+{
+    return [self sendSharedRequest:request
+                        parserName:nil
+                            parser:nil
+                        completion:^(NSHTTPURLResponse* response, id object, NSError* error) {
+                            if (completion) completion(response, object, error);
+                        }];
+}
+
+- (HTTPRequestOperation*)sendSharedRequest:(NSURLRequest*)request
+                                parserName:(NSString*)parserName
+                                    parser:(HTTPClientParseBlock)parser
+                                completion:(HTTPClientObjectBlock)completion
+{
+    // まとめられないリクエストは、他と一致しないキーで一人だけのflightにする。
+    NSString* key = [self sharedKeyForRequest:request parserName:parserName];
+    BOOL   shared = (nil != key);
+    if (NO == shared) key = [[NSUUID UUID] UUIDString];
+
+    @synchronized(_flights) {
+        HTTPRequestFlight* flight = shared? _flights[key] : nil;
+        BOOL isNew = (nil == flight);
+        if (isNew) {
+            flight = [[HTTPRequestFlight alloc] initWithKey:key parser:parser client:self];
+            _flights[key] = flight;
+        }
+
+        HTTPRequestOperation* waiter =
+        [[HTTPRequestOperation alloc] initWithRequest:request
+                                               flight:flight
+                                           completion:completion
+                                      completionQueue:_completionQueue];
+        [waiter start];
+        [flight.waiters addObject:waiter];
+
+        if (isNew) {
+            __weak HTTPClient* weakSelf = self;
+            flight.operation =
+            [self sendRequest:request
+                  dataHandler:nil
+                   completion:^(NSHTTPURLResponse* response, NSData* data, NSError* error) {
+                       [weakSelf completeFlight:flight response:response data:data error:error];
+                   }
+              completionQueue:_backgroundQueue];
+        }
+        return waiter;
+    }
+}
+
+/*
+ * 共有リクエストのキーを作成する。まとめられないリクエストはnilを返す。
+ * URLはスキーム、ホストを小文字にし、既定のポートとフラグメントを除いて正規化する。
+ * レスポンスが変わり得るので、リクエストヘッダも全てキーに含める。
+ */
+- (NSString*)sharedKeyForRequest:(NSURLRequest*)request parserName:(NSString*)parserName {
+    NSString* method = [request.HTTPMethod uppercaseString];
+    if (method && NO == [method isEqualToString:@"GET"]) return nil;
+    if (request.HTTPBody || request.HTTPBodyStream)     return nil;
+
+    NSURL*    url    = request.URL;
+    NSString* scheme = [url.scheme lowercaseString];
+    NSString* host   = [url.host lowercaseString];
+    if (nil == scheme || nil == host) return nil;
+
+    NSNumber* port = url.port;
+    if ((port.integerValue ==  80 && [scheme isEqualToString:@"http"]) ||
+        (port.integerValue == 443 && [scheme isEqualToString:@"https"])) {
+        port = nil;
+    }
+
+    // パーセントエスケープを保ったままのパスを取り出す。
+    NSString* path = CFBridgingRelease(CFURLCopyPath((__bridge CFURLRef)url));
+
+    NSMutableString* key = [NSMutableString stringWithCapacity:128];
+    [key appendFormat:@"%@ %@://%@", parserName ?: @"", scheme, host];
+    if (port)        [key appendFormat:@":%@", port];
+    [key appendString:path.length? path : @"/"];
+    if (url.query)   [key appendFormat:@"?%@", url.query];
+    [key appendFormat:@"\n%lu", (unsigned long)request.cachePolicy];
+
+    NSDictionary* headers = request.allHTTPHeaderFields;
+    NSArray* names = [[headers allKeys] sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
+    for (NSString* name in names) {
+        [key appendFormat:@"\n%@: %@", [name lowercaseString], headers[name]];
+    }
+    return key;
+}
+
+/*
+ * 通信が完了したflightの結果を、待っている全ての呼び出し元に配る。
+ * _backgroundQueueで呼ばれる。
+ */
+- (void)completeFlight:(HTTPRequestFlight*)flight
+              response:(NSHTTPURLResponse*)response
+                  data:(NSData*)data
+                 error:(NSError*)error
+{
+    NSArray* waiters = nil;
+    @synchronized(_flights) {
+        // 以降に来たリクエストは新しく通信させる。
+        if (_flights[flight.key] == flight) [_flights removeObjectForKey:flight.key];
+        flight.operation = nil;
+        waiters = [flight.waiters copy];
+        [flight.waiters removeAllObjects];
+    }
+    if (0 == waiters.count) return;
+
+    // 解析は一度だけ行い、結果を共有する。
+    id object = data;
+    if (flight.parser) {
+        object = nil;
+        if (nil == error && data) {
+            NSError* parseError = nil;
+            object = flight.parser(data, &parseError);
+            if (nil == object) error = parseError;
+        }
+    }
+
+    for (HTTPRequestOperation* waiter in waiters) {
+        [waiter deliverResponse:response data:data object:object error:error];
+    }
+}
+
+/*
+ * 呼び出し元が待つのをやめた。誰も待たなくなった通信は中断する。
+ */
+- (void)removeWaiter:(HTTPRequestOperation*)waiter fromFlight:(HTTPRequestFlight*)flight {
+    HTTPRequestOperation* operation = nil;
+    @synchronized(_flights) {
+        [flight.waiters removeObjectIdenticalTo:waiter];
+        if (0 == flight.waiters.count && flight.operation) {
+            operation = flight.operation;
+            flight.operation = nil;
+            if (_flights[flight.key] == flight) [_flights removeObjectForKey:flight.key];
+        }
+    }
+    [operation cancel];
+}
+
+
+#pragma mark Download
+
+- (HTTPRequestOperation*)downloadRequest:(NSURLRequest*)request
+                                  toFile:(NSString*)path
+                              completion:(HTTPClientDownloadBlock)completion
+{
+    NSMutableURLRequest* mutableRequest = [self prepareRequest:request];
+    mutableRequest.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+
+    HTTPDownloadFile* file = [[HTTPDownloadFile alloc] initWithPath:path];
+    [file prepareRequest:mutableRequest];
+
+    // ファイルの後処理はバックグラウンドで行い、完了ブロックだけcompletionQueueで呼ぶ。
+    NSOperationQueue* completionQueue = _completionQueue;
+    HTTPRequestOperation* operation =
+    [[HTTPRequestOperation alloc] initWithRequest:mutableRequest
+                                  responseHandler:^NSError*(NSHTTPURLResponse* response) {
+                                      return [file openWithResponse:response];
+                                  }
+                                      dataHandler:^BOOL(NSData* chunk) {
+                                          return [file appendData:chunk];
+                                      }
+                                       completion:^(NSHTTPURLResponse* response, NSData* data, NSError* error) {
+                                           // 書き込みに失敗して中断した場合は、中断ではなく書き込みのエラーを返す。
+                                           if (file.writeError) error = file.writeError;
+                                           NSData* sha256 = nil;
+                                           if (nil == error) sha256 = [file finish:&error];
+                                           if (completion) {
+                                               [completionQueue addOperationWithBlock:^{
+                                                   completion(response, sha256, error);
+                                               }];
+                                           }
+                                       }
+                                  completionQueue:_backgroundQueue];
+    [[self queueForURL:request.URL] addOperation:operation];
+    return operation;
+}
+
+
+- (HTTPRequestOperation*)getURL:(NSURL*)url
+                     completion:(HTTPClientCompletionBlock)completion
+{
+    return [self sendRequest:[NSURLRequest requestWithURL:url] completion:completion];
+}
+
+- (void)cancelAllRequests {
+    // 共有リクエストを待っている呼び出し元も全て中断する。
+    NSMutableArray* waiters = [NSMutableArray array];
+    @synchronized(_flights) {
+        for (HTTPRequestFlight* flight in [_flights allValues]) {
+            [waiters addObjectsFromArray:flight.waiters];
+        }
+    }
+    [waiters makeObjectsPerformSelector:@selector(cancel)];
+
+    @synchronized(_hostQueues) {
+        for (NSOperationQueue* queue in [_hostQueues allValues]) {
+            [queue cancelAllOperations];
+        }
+    }
+}
+
+@end
@@ -0,0 +1,276 @@
+/*
+ *  JPEGExif
+ *
+ *  Created by tyabuta on 2014/07/18.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "JPEGExif.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+#define JPEG_MARKER_SOI  0xD8
+#define JPEG_MARKER_EOI  0xD9
+#define JPEG_MARKER_SOS  0xDA
+#define JPEG_MARKER_APP0 0xE0
+#define JPEG_MARKER_APP1 0xE1
+
+#define EXIF_TAG_ORIENTATION 0x0112
+#define EXIF_TYPE_SHORT      3
+
+// "Exif\0\0" の後ろからTIFFが始まる。
+#define EXIF_HEADER_LENGTH 6
+
+// セグメントの長さの上限(長さのフィールド自身を含む)
+#define JPEG_SEGMENT_MAX 0xFFFF
+
+
+/*
+ * JPEG内のExifの位置
+ */
+typedef struct {
+    size_t segment;     // APP1のマーカーの位置(無ければ0)
+    size_t length;      // マーカーを含むセグメントの長さ
+    size_t insert;      // Exifが無い場合に入れる位置
+} JPEGExifLocation;
+
+/*
+ * TIFF(Exifの中身)の読み書き
+ */
+typedef struct {
+    uint8_t* data;
+    size_t   length;
+    int      little;
+} JPEGTIFF;
+
+
+
+
+/*------------------------------------------------------------------------------
+ TIFF
+ -----------------------------------------------------------------------------*/
+
+static uint32_t JPEGTIFFRead16(const JPEGTIFF* t, size_t offset){
+    const uint8_t* p = t->data + offset;
+    return t->little? (uint32_t)(p[0] | (p[1] << 8)) : (uint32_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t JPEGTIFFRead32(const JPEGTIFF* t, size_t offset){
+    const uint8_t* p = t->data + offset;
+    return t->little
+        ? ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24))
+        : (((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+static void JPEGTIFFWrite16(const JPEGTIFF* t, size_t offset, uint32_t value){
+    uint8_t* p = t->data + offset;
+    if (t->little) { p[0] = (uint8_t)value;        p[1] = (uint8_t)(value >> 8); }
+    else           { p[0] = (uint8_t)(value >> 8); p[1] = (uint8_t)value;        }
+}
+
+static void JPEGTIFFWrite32(const JPEGTIFF* t, size_t offset, uint32_t value){
+    if (t->little) {
+        JPEGTIFFWrite16(t, offset,     value & 0xFFFF);
+        JPEGTIFFWrite16(t, offset + 2, value >> 16);
+    } else {
+        JPEGTIFFWrite16(t, offset,     value >> 16);
+        JPEGTIFFWrite16(t, offset + 2, value & 0xFFFF);
+    }
+}
+
+/*
+ * ヘッダを確かめ、IFD0の位置とエントリ数を求める。
+ */
+static int JPEGTIFFOpen(JPEGTIFF* t, uint8_t* data, size_t length, uint32_t* ifd, uint32_t* count){
+    if (length < 8) return -1;
+    t->data   = data;
+    t->length = length;
+    if      (data[0] == 'I' && data[1] == 'I') t->little = 1;
+    else if (data[0] == 'M' && data[1] == 'M') t->little = 0;
+    else return -1;
+    if (42 != JPEGTIFFRead16(t, 2)) return -1;
+
+    *ifd = JPEGTIFFRead32(t, 4);
+    if ((size_t)*ifd + 2 > length) return -1;
+    *count = JPEGTIFFRead16(t, *ifd);
+    if ((size_t)*ifd + 2 + (size_t)*count * 12 + 4 > length) return -1;
+    return 0;
+}
+
+/*
+ * IFD0の向きのエントリの位置を返す。無ければ0
+ */
+static size_t JPEGTIFFFindOrientation(const JPEGTIFF* t, uint32_t ifd, uint32_t count){
+    for (uint32_t i = 0; i < count; i++) {
+        size_t entry = ifd + 2 + (size_t)i * 12;
+        if (EXIF_TAG_ORIENTATION == JPEGTIFFRead16(t, entry) &&
+            EXIF_TYPE_SHORT      == JPEGTIFFRead16(t, entry + 2)) {
+            return entry;
+        }
+    }
+    return 0;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ JPEG
+ -----------------------------------------------------------------------------*/
+
+/*
+ * SOSまでのセグメントを辿り、Exifの位置を探す。
+ */
+static int JPEGExifLocate(const uint8_t* p, size_t n, JPEGExifLocation* location){
+    memset(location, 0, sizeof(*location));
+    if (n < 4 || 0xFF != p[0] || JPEG_MARKER_SOI != p[1]) return -1;
+
+    location->insert = 2;
+    size_t pos = 2;
+    while (pos + 4 <= n) {
+        if (0xFF != p[pos]) return -1;
+        uint8_t marker = p[pos + 1];
+        if (0xFF == marker) { pos++; continue; }                // 詰め物
+        if (JPEG_MARKER_SOS == marker || JPEG_MARKER_EOI == marker) return 0;
+        if (0x01 == marker || (marker >= 0xD0 && marker <= 0xD7)) { pos += 2; continue; }
+
+        size_t length = ((size_t)p[pos + 2] << 8) | p[pos + 3];
+        if (length < 2 || pos + 2 + length > n) return -1;
+
+        if (JPEG_MARKER_APP0 == marker && 2 == pos) {
+            location->insert = pos + 2 + length;                // JFIFの後ろに入れる
+        }
+        if (JPEG_MARKER_APP1 == marker && length >= 2 + EXIF_HEADER_LENGTH + 8 &&
+            0 == memcmp(p + pos + 4, "Exif\0\0", EXIF_HEADER_LENGTH)) {
+            location->segment = pos;
+            location->length  = 2 + length;
+            return 0;
+        }
+        pos += 2 + length;
+    }
+    return -1;
+}
+
+/*
+ * prefix + segment + suffix の順に新しいバッファを作る。
+ * skipはjpegのうち、segmentで置き換える長さ。
+ */
+static uint8_t* JPEGExifSplice(const uint8_t* jpeg, size_t length, size_t at, size_t skip,
+                               const uint8_t* segment, size_t segmentLength, size_t* outLength){
+    size_t   total  = length - skip + segmentLength;
+    uint8_t* output = (uint8_t*)malloc(total);
+    if (NULL == output) return NULL;
+    memcpy(output, jpeg, at);
+    memcpy(output + at, segment, segmentLength);
+    memcpy(output + at + segmentLength, jpeg + at + skip, length - at - skip);
+    *outLength = total;
+    return output;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+int JPEGExifGetOrientation(const uint8_t* jpeg, size_t length){
+    JPEGExifLocation location;
+    if (JPEGExifLocate(jpeg, length, &location)) return -1;
+    if (0 == location.segment) return 0;
+
+    JPEGTIFF t;
+    uint32_t ifd, count;
+    size_t   header = location.segment + 4 + EXIF_HEADER_LENGTH;
+    if (JPEGTIFFOpen(&t, (uint8_t*)jpeg + header, location.segment + location.length - header, &ifd, &count)) {
+        return 0;
+    }
+    size_t entry = JPEGTIFFFindOrientation(&t, ifd, count);
+    return entry? (int)JPEGTIFFRead16(&t, entry + 8) : 0;
+}
+
+uint8_t* JPEGExifSetOrientation(const uint8_t* jpeg, size_t length, int orientation, size_t* outLength){
+    if (orientation < 1 || orientation > 8) return NULL;
+
+    JPEGExifLocation location;
+    if (JPEGExifLocate(jpeg, length, &location)) return NULL;
+
+    // Exifが無い場合は、向きだけのExifを入れる。
+    if (0 == location.segment) {
+        static const uint8_t minimal[] = {
+            0xFF, JPEG_MARKER_APP1, 0x00, 0x22,
+            'E', 'x', 'i', 'f', 0x00, 0x00,
+            'M', 'M', 0x00, 0x2A, 0x00, 0x00, 0x00, 0x08,
+            0x00, 0x01,
+            0x01, 0x12, 0x00, EXIF_TYPE_SHORT, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00,
+        };
+        uint8_t segment[sizeof(minimal)];
+        memcpy(segment, minimal, sizeof(minimal));
+        segment[29] = (uint8_t)orientation;
+        return JPEGExifSplice(jpeg, length, location.insert, 0, segment, sizeof(segment), outLength);
+    }
+
+    JPEGTIFF t;
+    uint32_t ifd, count;
+    size_t   header     = 4 + EXIF_HEADER_LENGTH;
+    size_t   tiffLength = location.length - header;
+    if (JPEGTIFFOpen(&t, (uint8_t*)jpeg + location.segment + header, tiffLength, &ifd, &count)) {
+        return NULL;
+    }
+
+    // タグがあれば値だけを書き換える。
+    size_t entry = JPEGTIFFFindOrientation(&t, ifd, count);
+    if (entry) {
+        uint8_t* output = (uint8_t*)malloc(length);
+        if (NULL == output) return NULL;
+        memcpy(output, jpeg, length);
+        t.data = output + location.segment + header;
+        JPEGTIFFWrite16(&t, entry + 8, (uint32_t)orientation);
+        *outLength = length;
+        return output;
+    }
+
+    // タグを加えたIFD0を末尾(偶数の位置)に作り、ヘッダのIFD0の位置を付け替える。
+    size_t newIFD    = (tiffLength + 1) & ~(size_t)1;
+    size_t newLength = header + newIFD + 2 + (size_t)(count + 1) * 12 + 4;
+    if (newLength - 2 > JPEG_SEGMENT_MAX) return NULL;
+
+    uint8_t* segment = (uint8_t*)malloc(newLength);
+    if (NULL == segment) return NULL;
+    memcpy(segment, jpeg + location.segment, location.length);
+    memset(segment + location.length, 0, newLength - location.length);
+    segment[2] = (uint8_t)((newLength - 2) >> 8);
+    segment[3] = (uint8_t)(newLength - 2);
+
+    uint8_t* tiff = segment + header;
+    t.data   = tiff;
+    t.length = newLength - header;
+
+    size_t out      = newIFD + 2;
+    int    inserted = 0;
+    for (uint32_t i = 0; i <= count; i++) {
+        size_t src = ifd + 2 + (size_t)i * 12;
+        if (!inserted && (i == count || JPEGTIFFRead16(&t, src) > EXIF_TAG_ORIENTATION)) {
+            JPEGTIFFWrite16(&t, out,     EXIF_TAG_ORIENTATION);
+            JPEGTIFFWrite16(&t, out + 2, EXIF_TYPE_SHORT);
+            JPEGTIFFWrite32(&t, out + 4, 1);
+            JPEGTIFFWrite16(&t, out + 8, (uint32_t)orientation);
+            JPEGTIFFWrite16(&t, out + 10, 0);
+            out += 12;
+            inserted = 1;
+        }
+        if (i == count) break;
+        memcpy(tiff + out, tiff + src, 12);
+        out += 12;
+    }
+    JPEGTIFFWrite32(&t, out, JPEGTIFFRead32(&t, ifd + 2 + (size_t)count * 12));   // 次のIFD
+    JPEGTIFFWrite16(&t, newIFD, count + 1);
+    JPEGTIFFWrite32(&t, 4, (uint32_t)newIFD);
+
+    uint8_t* output = JPEGExifSplice(jpeg, length, location.segment, location.length,
+                                     segment, newLength, outLength);
+    free(segment);
+    return output;
+}
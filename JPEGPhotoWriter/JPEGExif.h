@@ -0,0 +1,47 @@
+/*******************************************************************************
+  JPEGExif 1.0.0.0
+
+                         JPEGのExif(APP1)だけを書き換える
+
+   JPEGをデコードせずに、Exifの向き(Orientation)を読み書きする。
+   画素のデータには一切触れないので、再エンコードによる劣化も時間もかからない。
+
+   向きを書き換える時は、
+     - Exifに向きのタグがあれば、その値だけを書き換える。
+     - Exifはあるがタグが無ければ、タグを加えたIFD0をExifの末尾に作り直し、
+       ヘッダのIFD0の位置だけを付け替える。(他のデータの位置は動かないので、
+       ExifIFDやサムネイルへのオフセットはそのまま使える)
+     - Exifが無ければ、向きだけを持つ小さなExifをSOI(とJFIF)の直後に入れる。
+
+   UIKitに依存しないので、Linux上でもそのままコンパイルできる。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_JPEG_EXIF_H
+#define TYABUTA_JPEG_EXIF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Exifの向き(1~8)を返す。タグが無ければ0、JPEGとして正しくなければ-1を返す。
+ */
+int JPEGExifGetOrientation(const uint8_t* jpeg, size_t length);
+
+/*
+ * 向き(1~8)を書き換えたJPEGをmallocしたバッファで返す。長さはoutLengthに入る。
+ * 失敗時はNULLを返す。返したバッファはfreeすること。
+ */
+uint8_t* JPEGExifSetOrientation(const uint8_t* jpeg, size_t length, int orientation, size_t* outLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_JPEG_EXIF_H
@@ -0,0 +1,51 @@
+/*******************************************************************************
+  JPEGPhotoWriter 1.0.0.0
+
+                         JPEGをそのままカメラロールに保存する
+                ※ AssetsLibrary.framework を追加する必要がある。
+
+   UIImageWriteToSavedPhotosAlbumはUIImageを受け取るので、撮影したJPEGを
+   一度デコードして再エンコードすることになり、時間もメモリも画質も失う。
+   JPEGPhotoWriterはカメラが出力したJPEGのバイト列をそのまま
+   ALAssetsLibraryで保存する。向きを変える場合もJPEGExifでExifだけを書き換える。
+
+   保存は専用のキューで一つずつ行い、保存待ちの数はmaxPendingまでに制限する。
+   連写で保存が追いつかない場合は、メモリを使い続けずに失敗を返す。
+
+       [[JPEGPhotoWriter sharedWriter] writeJPEGData:jpeg orientation:0 completion:nil];
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_JPEG_PHOTO_WRITER_H
+#define TYABUTA_JPEG_PHOTO_WRITER_H
+
+#import <Foundation/Foundation.h>
+#import "JPEGExif.h"
+
+typedef void (^JPEGPhotoWriterCompletion)(NSURL* assetURL, NSError* error);
+
+@interface JPEGPhotoWriter : NSObject
+
++ (JPEGPhotoWriter*)sharedWriter;
+
+- (id)initWithMaxPending:(NSUInteger)maxPending;
+
+/*
+ * 保存待ちにできる数(sharedWriterは4)
+ */
+@property (nonatomic, readonly) NSUInteger maxPending;
+
+/*
+ * JPEGを保存する。orientationが1~8ならExifの向きを書き換えてから保存する。(0はそのまま)
+ * 保存待ちが一杯ならNOを返し、completionは呼ばれない。
+ * completionはメインスレッドで呼ばれる。
+ */
+- (BOOL)writeJPEGData:(NSData*)jpeg
+          orientation:(int)orientation
+           completion:(JPEGPhotoWriterCompletion)completion;
+
+@end
+
+
+#endif // TYABUTA_JPEG_PHOTO_WRITER_H
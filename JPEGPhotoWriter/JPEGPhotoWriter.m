@@ -0,0 +1,98 @@
+//
+//  JPEGPhotoWriter
+//
+//  Created by tyabuta on 2014/07/18.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "JPEGPhotoWriter.h"
+#import <AssetsLibrary/AssetsLibrary.h>
+
+
+/*
+ * デバックログ用のマクロ、リリース時は何もおこらないようになる。
+ * Tips: __VA_ARGS__ の前に##を付けると、引数ゼロでもコンパイルが通る。
+ */
+#ifdef DEBUG
+#define dmsg(fmt, ...) NSLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#else
+#define dmsg(...)
+#endif
+
+
+
+
+@implementation JPEGPhotoWriter
+{
+    ALAssetsLibrary*     _library;
+    dispatch_queue_t     _queue;
+    dispatch_semaphore_t _pending;   // 保存待ちの空き
+}
+
++ (JPEGPhotoWriter*)sharedWriter {
+    static JPEGPhotoWriter* writer = nil;
+    static dispatch_once_t  once;
+    dispatch_once(&once, ^{
+        writer = [[JPEGPhotoWriter alloc] initWithMaxPending:4];
+    });
+    return writer;
+}
+
+- (id)initWithMaxPending:(NSUInteger)maxPending {
+    self = [super init];
+    if (self) {
+        _maxPending = (maxPending > 0)? maxPending : 1;
+        _library    = [[ALAssetsLibrary alloc] init];
+        _queue      = dispatch_queue_create("JPEGPhotoWriter", DISPATCH_QUEUE_SERIAL);
+        _pending    = dispatch_semaphore_create((long)_maxPending);
+    }
+    return self;
+}
+
+- (BOOL)writeJPEGData:(NSData*)jpeg
+          orientation:(int)orientation
+           completion:(JPEGPhotoWriterCompletion)completion {
+    if (0 == jpeg.length) return NO;
+
+    // 空きが無ければ待たずに失敗を返す。
+    if (0 != dispatch_semaphore_wait(_pending, DISPATCH_TIME_NOW)) {
+        dmsg(@"保存待ちが一杯です。");
+        return NO;
+    }
+
+    dispatch_semaphore_t pending = _pending;
+    ALAssetsLibrary*     library = _library;
+    dispatch_async(_queue, ^{
+        NSData* data = jpeg;
+        if (orientation >= 1 && orientation <= 8 &&
+            orientation != JPEGExifGetOrientation((const uint8_t*)jpeg.bytes, jpeg.length)) {
+            size_t   length = 0;
+            uint8_t* bytes  = JPEGExifSetOrientation((const uint8_t*)jpeg.bytes, jpeg.length,
+                                                     orientation, &length);
+            if (bytes) {
+                data = [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+            } else {
+                dmsg(@"Exifを書き換えられないので、そのまま保存します。");
+            }
+        }
+
+        // 保存が終わるまでキューを止め、一つずつ書き込む。
+        dispatch_semaphore_t done = dispatch_semaphore_create(0);
+        [library writeImageDataToSavedPhotosAlbum:data
+                                         metadata:nil
+                                  completionBlock:^(NSURL* assetURL, NSError* error) {
+            if (error) dmsg(@"%@", error);
+            if (completion) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    completion(assetURL, error);
+                });
+            }
+            dispatch_semaphore_signal(done);
+        }];
+        dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+        dispatch_semaphore_signal(pending);
+    });
+    return YES;
+}
+
+@end
@@ -0,0 +1,214 @@
+/*******************************************************************************
+  JSONCursor 1.0.0.0
+
+                     NSDictionaryを作らずにJSONを読むためのカーソル
+
+   NSJSONSerializationは全ての値をオブジェクトに変換する為、大きなJSONでは
+   メモリ使用量とオブジェクト生成の負荷が大きい。
+   JSONCursorは一度の走査で構造文字の位置だけを索引にし、
+   必要な値だけを入力バッファ上から直接読み出す。
+   文字列は入力バッファを指すビュー(JSONStringRef)として取り出せる。
+
+   JSONStreamParserを使うと、ネットワークから届いたチャンクを順に渡して、
+   トップレベル配列の要素(またはトップレベルの値)を完成した順に受け取れる。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_JSON_CURSOR_H
+#define TYABUTA_JSON_CURSOR_H
+
+#import <Foundation/Foundation.h>
+
+
+/*------------------------------------------------------------------------------
+ Types
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 値の種類
+ */
+typedef enum {
+    JSONTypeInvalid = 0,
+    JSONTypeObject,
+    JSONTypeArray,
+    JSONTypeString,
+    JSONTypeNumber,
+    JSONTypeTrue,
+    JSONTypeFalse,
+    JSONTypeNull,
+} JSONType;
+
+/*
+ * 入力バッファ上の文字列を指すビュー
+ * エスケープ文字はそのまま含まれる。(hasEscapeがtrueの場合)
+ */
+typedef struct {
+    const char* bytes;
+    size_t      length;
+    bool        hasEscape;
+} JSONStringRef;
+
+/*
+ * 解析済みドキュメント
+ */
+typedef struct JSONDocument* JSONDocumentRef;
+
+/*
+ * ドキュメント中の値を指すカーソル
+ * ドキュメントを解放した後は使用できない。
+ */
+typedef struct {
+    JSONDocumentRef document;
+    uint32_t        index;
+} JSONValue;
+
+
+/*------------------------------------------------------------------------------
+ Document
+ -----------------------------------------------------------------------------*/
+
+/*
+ * NSDataからドキュメントを作成する。dataは保持される。
+ * 構文が壊れている場合はNULLを返す。
+ * 作成したドキュメントはJSONDocumentRelease関数で解放する必要があります。
+ */
+JSONDocumentRef JSONDocumentCreateWithData(NSData* data);
+
+/*
+ * バイト列からドキュメントを作成する。バイト列はコピーされないので、
+ * ドキュメントを解放するまで呼び出し側で保持しておく必要がある。
+ */
+JSONDocumentRef JSONDocumentCreateWithBytes(const void* bytes, size_t length);
+
+/*
+ * ドキュメントを解放する。
+ */
+void JSONDocumentRelease(JSONDocumentRef document);
+
+/*
+ * ルートの値を取得する。
+ */
+JSONValue JSONDocumentGetRoot(JSONDocumentRef document);
+
+
+/*------------------------------------------------------------------------------
+ Value
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 値の種類を取得する。
+ */
+JSONType JSONValueGetType(JSONValue value);
+
+/*
+ * 有効な値を指していればtrue
+ */
+bool JSONValueIsValid(JSONValue value);
+
+/*
+ * オブジェクトから指定キーの値を取得する。無ければ無効な値を返す。
+ * キーはエスケープされていない前提で、バイト列のまま比較する。
+ */
+JSONValue JSONObjectGetValue(JSONValue object, const char* key);
+
+/*
+ * オブジェクトのメンバを順に辿る。
+ * key: キー文字列を受け取る。(NULL可)
+ * 最初のメンバはJSONObjectFirstMember、次はJSONObjectNextMemberで取得する。
+ */
+JSONValue JSONObjectFirstMember(JSONValue object, JSONStringRef* key);
+JSONValue JSONObjectNextMember(JSONValue member, JSONStringRef* key);
+
+/*
+ * 配列の要素を順に辿る。
+ * 最初の要素はJSONArrayFirstElement、次はJSONArrayNextElementで取得する。
+ */
+JSONValue JSONArrayFirstElement(JSONValue array);
+JSONValue JSONArrayNextElement(JSONValue element);
+
+/*
+ * 配列の要素数を取得する。
+ */
+size_t JSONArrayGetCount(JSONValue array);
+
+/*
+ * 文字列のビューを取得する。文字列でなければfalseを返す。
+ */
+bool JSONValueGetString(JSONValue value, JSONStringRef* string);
+
+/*
+ * 数値を取得する。数値でなければfalseを返す。
+ */
+bool JSONValueGetInt64(JSONValue value, int64_t* number);
+bool JSONValueGetDouble(JSONValue value, double* number);
+
+/*
+ * 真偽値を取得する。真偽値でなければfalseを返す。
+ */
+bool JSONValueGetBool(JSONValue value, bool* boolean);
+
+
+/*------------------------------------------------------------------------------
+ Conversion
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 文字列ビューのエスケープを解除してNSStringを作成する。
+ */
+NSString* JSONStringCreateNSString(JSONStringRef string);
+
+/*
+ * 文字列ビューが指定のC文字列と一致すればtrue
+ */
+bool JSONStringEqualsCString(JSONStringRef string, const char* cstr);
+
+/*
+ * 値以下をFoundationオブジェクトに変換する。
+ * 一部分だけNSDictionaryとして扱いたい場合に使う。
+ */
+id JSONValueCopyObject(JSONValue value);
+
+
+
+
+/*------------------------------------------------------------------------------
+ JSONStreamParser
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 要素を受け取るブロック
+ * elementは呼び出し中のみ有効。
+ */
+typedef void (^JSONStreamElementBlock)(JSONValue element);
+
+/*
+ * チャンク毎にJSONを読み進めるパーサー
+ *
+ * 入力がトップレベル配列の場合は、配列の要素が完成する度に、
+ * それ以外(改行区切りのJSON等)はトップレベルの値が完成する度にブロックが呼ばれる。
+ * 保持するバッファは完成していない要素一つ分だけとなる。
+ */
+@interface JSONStreamParser : NSObject
+
+- (id)initWithElementHandler:(JSONStreamElementBlock)handler;
+
+/*
+ * チャンクを追加する。構文エラーがあればNOを返す。
+ */
+- (BOOL)appendData:(NSData*)data;
+
+/*
+ * 入力の終わりを通知する。要素が途中で終わっていればNOを返す。
+ */
+- (BOOL)finish;
+
+/*
+ * これまでに受け取った要素の数
+ */
+@property(nonatomic, readonly) NSUInteger elementCount;
+
+@end
+
+
+#endif // TYABUTA_JSON_CURSOR_H
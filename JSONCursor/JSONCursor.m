@@ -0,0 +1,982 @@
+//
+//  JSONCursor
+//
+//  Created by tyabuta on 2014/05/24.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "JSONCursor.h"
+
+#if defined(__ARM_NEON) && (defined(__arm64__) || defined(__aarch64__))
+#include <arm_neon.h>
+#define JSON_CURSOR_USE_NEON 1
+#endif
+
+
+// ネストの最大深さ
+#define JSON_MAX_DEPTH 1024
+
+// 無効な索引
+#define JSON_INVALID_INDEX UINT32_MAX
+
+
+struct JSONDocument {
+    const uint8_t* bytes;       // 入力バッファ
+    size_t         length;
+    uint32_t*      positions;   // 構造文字(と値の先頭)の位置
+    uint32_t*      matches;     // 括弧の対応(開き括弧 -> 閉じ括弧の索引)
+    uint32_t       count;
+    CFTypeRef      data;        // 保持しているNSData
+};
+
+
+
+
+/*------------------------------------------------------------------------------
+ Stage 1: Structural index
+ -----------------------------------------------------------------------------*/
+#pragma mark - Stage 1: Structural index
+
+/*
+ * 64byteずつのブロックで、文字の種類をビットマスクとして求める。
+ * 各ビットがブロック内の1byteに対応する。
+ */
+typedef struct {
+    uint64_t op;        // { } [ ] : ,
+    uint64_t ws;        // 空白
+    uint64_t quote;     // "
+    uint64_t backslash; // バックスラッシュ
+} JSONBlockMasks;
+
+enum {
+    JSON_CLASS_OP        = 1,
+    JSON_CLASS_WS        = 2,
+    JSON_CLASS_QUOTE     = 4,
+    JSON_CLASS_BACKSLASH = 8,
+};
+
+/*
+ * 文字の分類表
+ */
+static uint8_t JSONCharClassTable[256];
+
+static void JSONCharClassTableInit(void){
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        const char* ops = "{}[]:,";
+        for (const char* p = ops; *p; p++) JSONCharClassTable[(uint8_t)*p] = JSON_CLASS_OP;
+        JSONCharClassTable[' ']  = JSON_CLASS_WS;
+        JSONCharClassTable['\t'] = JSON_CLASS_WS;
+        JSONCharClassTable['\n'] = JSON_CLASS_WS;
+        JSONCharClassTable['\r'] = JSON_CLASS_WS;
+        JSONCharClassTable['"']  = JSON_CLASS_QUOTE;
+        JSONCharClassTable['\\'] = JSON_CLASS_BACKSLASH;
+    });
+}
+
+#if JSON_CURSOR_USE_NEON
+
+/*
+ * 0xFF/0x00で埋まった64byte分の比較結果を64bitのマスクにまとめる。
+ */
+static inline uint64_t JSONNeonMoveMask(uint8x16_t v0, uint8x16_t v1,
+                                        uint8x16_t v2, uint8x16_t v3){
+    const uint8x16_t bits = {1,2,4,8,16,32,64,128, 1,2,4,8,16,32,64,128};
+    uint8x16_t t0 = vandq_u8(v0, bits);
+    uint8x16_t t1 = vandq_u8(v1, bits);
+    uint8x16_t t2 = vandq_u8(v2, bits);
+    uint8x16_t t3 = vandq_u8(v3, bits);
+    uint8x16_t s0 = vpaddq_u8(t0, t1);
+    uint8x16_t s1 = vpaddq_u8(t2, t3);
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
+}
+
+static inline uint8x16_t JSONNeonClassify(uint8x16_t v, uint8_t cls){
+    switch (cls) {
+        case JSON_CLASS_OP: {
+            // ':' ',' と、0x20を立てると '[' ']' -> '{' '}' になる事を利用する。
+            uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+            uint8x16_t r = vceqq_u8(v, vdupq_n_u8(':'));
+            r = vorrq_u8(r, vceqq_u8(v, vdupq_n_u8(',')));
+            r = vorrq_u8(r, vceqq_u8(lower, vdupq_n_u8('{')));
+            r = vorrq_u8(r, vceqq_u8(lower, vdupq_n_u8('}')));
+            return r;
+        }
+        case JSON_CLASS_WS: {
+            uint8x16_t r = vceqq_u8(v, vdupq_n_u8(' '));
+            r = vorrq_u8(r, vceqq_u8(v, vdupq_n_u8('\t')));
+            r = vorrq_u8(r, vceqq_u8(v, vdupq_n_u8('\n')));
+            r = vorrq_u8(r, vceqq_u8(v, vdupq_n_u8('\r')));
+            return r;
+        }
+        case JSON_CLASS_QUOTE:
+            return vceqq_u8(v, vdupq_n_u8('"'));
+        default:
+            return vceqq_u8(v, vdupq_n_u8('\\'));
+    }
+}
+
+static inline void JSONClassifyBlock(const uint8_t* p, JSONBlockMasks* m){
+    uint8x16_t v0 = vld1q_u8(p);
+    uint8x16_t v1 = vld1q_u8(p + 16);
+    uint8x16_t v2 = vld1q_u8(p + 32);
+    uint8x16_t v3 = vld1q_u8(p + 48);
+#define JSON_MASK(cls) JSONNeonMoveMask(JSONNeonClassify(v0, cls), JSONNeonClassify(v1, cls), \
+                                        JSONNeonClassify(v2, cls), JSONNeonClassify(v3, cls))
+    m->op        = JSON_MASK(JSON_CLASS_OP);
+    m->ws        = JSON_MASK(JSON_CLASS_WS);
+    m->quote     = JSON_MASK(JSON_CLASS_QUOTE);
+    m->backslash = JSON_MASK(JSON_CLASS_BACKSLASH);
+#undef JSON_MASK
+}
+
+#else
+
+static inline void JSONClassifyBlock(const uint8_t* p, JSONBlockMasks* m){
+    uint64_t op = 0, ws = 0, quote = 0, backslash = 0;
+    for (int i = 0; i < 64; i++) {
+        uint8_t  cls = JSONCharClassTable[p[i]];
+        uint64_t bit = 1ULL << i;
+        if (cls) {
+            if (cls & JSON_CLASS_OP)        op        |= bit;
+            if (cls & JSON_CLASS_WS)        ws        |= bit;
+            if (cls & JSON_CLASS_QUOTE)     quote     |= bit;
+            if (cls & JSON_CLASS_BACKSLASH) backslash |= bit;
+        }
+    }
+    m->op = op; m->ws = ws; m->quote = quote; m->backslash = backslash;
+}
+
+#endif // JSON_CURSOR_USE_NEON
+
+/*
+ * エスケープされた文字のマスクを求める。
+ * carry: 前のブロック末尾のバックスラッシュが、このブロック先頭をエスケープするなら1
+ * バックスラッシュは稀なので、立っているビットだけを順に処理する。
+ */
+static inline uint64_t JSONEscapedMask(uint64_t backslash, uint64_t* carry){
+    uint64_t escaped = *carry;
+    uint64_t next    = 0;
+    backslash &= ~escaped;
+    while (backslash) {
+        int i = __builtin_ctzll(backslash);
+        if (63 == i) { next = 1; break; }
+        uint64_t target = 1ULL << (i + 1);
+        escaped   |= target;
+        backslash &= ~target;
+        backslash &= backslash - 1;
+    }
+    *carry = next;
+    return escaped;
+}
+
+/*
+ * 各ビットについて、そこまでのビットのXORを求める。(文字列内のマスクになる)
+ */
+static inline uint64_t JSONPrefixXor(uint64_t x){
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/*
+ * 構造文字、文字列の開始位置、リテラルの開始位置を列挙する。
+ * positionsには最低length+1個分の領域が必要。
+ * 文字列が閉じていなければfalseを返す。
+ */
+static bool JSONIndexBuild(const uint8_t* bytes, size_t length,
+                           uint32_t* positions, uint32_t* count){
+    JSONCharClassTableInit();
+
+    uint64_t escapeCarry   = 0;
+    uint64_t inStringCarry = 0;
+    uint64_t scalarCarry   = 0;
+    uint32_t n = 0;
+
+    uint8_t tail[64];
+    for (size_t base = 0; base < length; base += 64) {
+        const uint8_t* block = bytes + base;
+        if (length - base < 64) {
+            // 最後のブロックは空白で埋める。
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, length - base);
+            block = tail;
+        }
+
+        JSONBlockMasks m;
+        JSONClassifyBlock(block, &m);
+
+        uint64_t escaped  = JSONEscapedMask(m.backslash, &escapeCarry);
+        uint64_t quote    = m.quote & ~escaped;
+        uint64_t inString = JSONPrefixXor(quote) ^ inStringCarry;
+        inStringCarry     = (uint64_t)((int64_t)inString >> 63);
+
+        uint64_t op          = m.op & ~inString;
+        uint64_t ws          = m.ws & ~inString;
+        uint64_t stringStart = quote & inString;
+        uint64_t scalar      = ~(op | ws | inString | quote);
+        uint64_t scalarStart = scalar & ~((scalar << 1) | scalarCarry);
+        scalarCarry          = scalar >> 63;
+
+        uint64_t structurals = op | stringStart | scalarStart;
+        while (structurals) {
+            positions[n++] = (uint32_t)(base + __builtin_ctzll(structurals));
+            structurals &= structurals - 1;
+        }
+    }
+
+    *count = n;
+    return (0 == inStringCarry);
+}
+
+NS_INLINE bool JSONIsDigit(uint8_t c){
+    return ('0' <= c && c <= '9');
+}
+
+/*
+ * リテラル(true, false, null, 数値)の綴りを確かめる。
+ */
+static bool JSONScalarIsValid(const uint8_t* bytes, size_t length, uint32_t position){
+    const uint8_t  stop = JSON_CLASS_OP | JSON_CLASS_WS | JSON_CLASS_QUOTE;
+    const uint8_t* p    = bytes + position;
+    const uint8_t* end  = p;
+    while (end < bytes + length && 0 == (JSONCharClassTable[*end] & stop)) end++;
+    size_t n = end - p;
+
+    switch (*p) {
+        case 't': return (4 == n && 0 == memcmp(p, "true",  4));
+        case 'f': return (5 == n && 0 == memcmp(p, "false", 5));
+        case 'n': return (4 == n && 0 == memcmp(p, "null",  4));
+        default:  break;
+    }
+
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    if (p < end && '-' == *p) p++;
+    if (p < end && '0' == *p) {
+        p++;
+    }
+    else {
+        if (p == end || !JSONIsDigit(*p)) return false;
+        while (p < end && JSONIsDigit(*p)) p++;
+    }
+    if (p < end && '.' == *p) {
+        p++;
+        if (p == end || !JSONIsDigit(*p)) return false;
+        while (p < end && JSONIsDigit(*p)) p++;
+    }
+    if (p < end && ('e' == *p || 'E' == *p)) {
+        p++;
+        if (p < end && ('+' == *p || '-' == *p)) p++;
+        if (p == end || !JSONIsDigit(*p)) return false;
+        while (p < end && JSONIsDigit(*p)) p++;
+    }
+    return (p == end);
+}
+
+/*
+ * 構文の状態(次に来てよいもの)
+ */
+typedef enum {
+    JSONExpectValue = 0,
+    JSONExpectValueOrClose,     // [ の直後
+    JSONExpectKey,              // オブジェクトの , の後
+    JSONExpectKeyOrClose,       // { の直後
+    JSONExpectColon,
+    JSONExpectSeparator,        // 値の後の , か閉じ括弧
+    JSONExpectEnd,              // ルートの値の後
+} JSONExpect;
+
+/*
+ * 値と区切りの並び、リテラルの綴りを確かめながら括弧の対応を求める。
+ * 構文が壊れていればfalseを返す。
+ */
+static bool JSONIndexMatch(const uint8_t* bytes, size_t length, const uint32_t* positions,
+                           uint32_t count, uint32_t* matches){
+    uint32_t   stack[JSON_MAX_DEPTH];
+    int        depth  = 0;
+    JSONExpect expect = JSONExpectValue;
+    for (uint32_t i = 0; i < count; i++) {
+        matches[i] = i;
+        uint8_t c       = bytes[positions[i]];
+        bool    isValue = (JSONExpectValue == expect || JSONExpectValueOrClose == expect);
+        switch (c) {
+            case '{':
+            case '[':
+                if (!isValue) return false;
+                if (depth >= JSON_MAX_DEPTH) return false;
+                stack[depth++] = i;
+                expect = ('{' == c)? JSONExpectKeyOrClose : JSONExpectValueOrClose;
+                continue;
+            case '}':
+            case ']': {
+                if (!(JSONExpectSeparator == expect ||
+                      ('}' == c && JSONExpectKeyOrClose   == expect) ||
+                      (']' == c && JSONExpectValueOrClose == expect))) return false;
+                if (0 == depth) return false;
+                uint32_t open = stack[--depth];
+                if ((c - bytes[positions[open]]) != 2) return false; // '['+2=']' '{'+2='}'
+                matches[open] = i;
+                break;
+            }
+            case ':':
+                if (JSONExpectColon != expect) return false;
+                expect = JSONExpectValue;
+                continue;
+            case ',':
+                if (JSONExpectSeparator != expect) return false;
+                expect = ('{' == bytes[positions[stack[depth - 1]]])? JSONExpectKey : JSONExpectValue;
+                continue;
+            case '"':
+                if (JSONExpectKey == expect || JSONExpectKeyOrClose == expect) {
+                    expect = JSONExpectColon;
+                    continue;
+                }
+                if (!isValue) return false;
+                break;
+            default:
+                if (!isValue) return false;
+                if (!JSONScalarIsValid(bytes, length, positions[i])) return false;
+                break;
+        }
+        // 値が一つ終わった。
+        expect = (depth > 0)? JSONExpectSeparator : JSONExpectEnd;
+    }
+    return (JSONExpectEnd == expect);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Document
+ -----------------------------------------------------------------------------*/
+#pragma mark - Document
+
+JSONDocumentRef JSONDocumentCreateWithBytes(const void* bytes, size_t length){
+    if (length >= UINT32_MAX) return NULL;
+
+    JSONDocumentRef document = (JSONDocumentRef)calloc(1, sizeof(struct JSONDocument));
+    document->bytes     = (const uint8_t*)bytes;
+    document->length    = length;
+    document->positions = (uint32_t*)malloc(sizeof(uint32_t) * (length + 1));
+
+    bool ok = JSONIndexBuild(document->bytes, length, document->positions, &document->count);
+    if (ok && document->count > 0) {
+        // 実際の個数まで縮めてから括弧の対応表を作る。
+        document->positions = (uint32_t*)realloc(document->positions,
+                                                 sizeof(uint32_t) * document->count);
+        document->matches   = (uint32_t*)malloc(sizeof(uint32_t) * document->count);
+        ok = JSONIndexMatch(document->bytes, length, document->positions,
+                            document->count, document->matches);
+        // ルートの値の後ろに余分な値があってはならない。
+        ok = ok && (document->matches[0] == document->count - 1);
+    }
+    else {
+        ok = false;
+    }
+
+    if (!ok) {
+        JSONDocumentRelease(document);
+        return NULL;
+    }
+    return document;
+}
+
+JSONDocumentRef JSONDocumentCreateWithData(NSData* data){
+    JSONDocumentRef document = JSONDocumentCreateWithBytes(data.bytes, data.length);
+    if (document) {
+        document->data = CFBridgingRetain(data);
+    }
+    return document;
+}
+
+void JSONDocumentRelease(JSONDocumentRef document){
+    if (NULL == document) return;
+    if (document->data) CFRelease(document->data);
+    free(document->positions);
+    free(document->matches);
+    free(document);
+}
+
+JSONValue JSONDocumentGetRoot(JSONDocumentRef document){
+    JSONValue value = { document, document? 0 : JSON_INVALID_INDEX };
+    return value;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Value
+ -----------------------------------------------------------------------------*/
+#pragma mark - Value
+
+static const JSONValue JSONValueInvalid = { NULL, JSON_INVALID_INDEX };
+
+/*
+ * 索引が指す文字を取得する。範囲外なら0を返す。
+ */
+NS_INLINE uint8_t JSONCharAt(JSONDocumentRef document, uint32_t index){
+    if (index >= document->count) return 0;
+    return document->bytes[document->positions[index]];
+}
+
+NS_INLINE JSONValue JSONValueMake(JSONDocumentRef document, uint32_t index){
+    JSONValue value = { document, index };
+    return value;
+}
+
+bool JSONValueIsValid(JSONValue value){
+    return (value.document && value.index < value.document->count);
+}
+
+JSONType JSONValueGetType(JSONValue value){
+    if (!JSONValueIsValid(value)) return JSONTypeInvalid;
+    switch (JSONCharAt(value.document, value.index)) {
+        case '{': return JSONTypeObject;
+        case '[': return JSONTypeArray;
+        case '"': return JSONTypeString;
+        case 't': return JSONTypeTrue;
+        case 'f': return JSONTypeFalse;
+        case 'n': return JSONTypeNull;
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return JSONTypeNumber;
+        default:
+            return JSONTypeInvalid;
+    }
+}
+
+/*
+ * 指定索引から始まる文字列のビューを作る。
+ */
+static bool JSONStringAt(JSONDocumentRef document, uint32_t index, JSONStringRef* string){
+    if ('"' != JSONCharAt(document, index)) return false;
+
+    const uint8_t* begin = document->bytes + document->positions[index] + 1;
+    const uint8_t* end   = document->bytes + document->length;
+    const uint8_t* p     = begin;
+    bool     hasEscape   = false;
+    while (p < end) {
+        const uint8_t* q = (const uint8_t*)memchr(p, '"', end - p);
+        if (NULL == q) return false;
+
+        // 直前のバックスラッシュが奇数個ならエスケープされている。
+        const uint8_t* b = q;
+        while (b > begin && '\\' == b[-1]) b--;
+        if (b != q) hasEscape = true;
+        if (0 == ((q - b) & 1)) {
+            if (string) {
+                string->bytes     = (const char*)begin;
+                string->length    = q - begin;
+                string->hasEscape = hasEscape || (NULL != memchr(begin, '\\', q - begin));
+            }
+            return true;
+        }
+        p = q + 1;
+    }
+    return false;
+}
+
+/*
+ * 値の最後の索引(コンテナなら閉じ括弧)を取得する。
+ */
+NS_INLINE uint32_t JSONValueEnd(JSONValue value){
+    return value.document->matches[value.index];
+}
+
+/*
+ * メンバの値の索引から、キーを取り出してメンバを返す。
+ */
+static JSONValue JSONMemberAt(JSONDocumentRef document, uint32_t keyIndex, JSONStringRef* key){
+    if (':' != JSONCharAt(document, keyIndex + 1)) return JSONValueInvalid;
+    if (!JSONStringAt(document, keyIndex, key))    return JSONValueInvalid;
+    return JSONValueMake(document, keyIndex + 2);
+}
+
+JSONValue JSONObjectFirstMember(JSONValue object, JSONStringRef* key){
+    if (JSONTypeObject != JSONValueGetType(object)) return JSONValueInvalid;
+    uint32_t next = object.index + 1;
+    if ('}' == JSONCharAt(object.document, next)) return JSONValueInvalid;
+    return JSONMemberAt(object.document, next, key);
+}
+
+JSONValue JSONObjectNextMember(JSONValue member, JSONStringRef* key){
+    if (!JSONValueIsValid(member)) return JSONValueInvalid;
+    uint32_t next = JSONValueEnd(member) + 1;
+    if (',' != JSONCharAt(member.document, next)) return JSONValueInvalid;
+    return JSONMemberAt(member.document, next + 1, key);
+}
+
+JSONValue JSONObjectGetValue(JSONValue object, const char* key){
+    JSONStringRef name;
+    for (JSONValue member = JSONObjectFirstMember(object, &name);
+         JSONValueIsValid(member);
+         member = JSONObjectNextMember(member, &name)) {
+        if (JSONStringEqualsCString(name, key)) return member;
+    }
+    return JSONValueInvalid;
+}
+
+JSONValue JSONArrayFirstElement(JSONValue array){
+    if (JSONTypeArray != JSONValueGetType(array)) return JSONValueInvalid;
+    uint32_t next = array.index + 1;
+    if (']' == JSONCharAt(array.document, next)) return JSONValueInvalid;
+    return JSONValueMake(array.document, next);
+}
+
+JSONValue JSONArrayNextElement(JSONValue element){
+    if (!JSONValueIsValid(element)) return JSONValueInvalid;
+    uint32_t next = JSONValueEnd(element) + 1;
+    if (',' != JSONCharAt(element.document, next)) return JSONValueInvalid;
+    return JSONValueMake(element.document, next + 1);
+}
+
+size_t JSONArrayGetCount(JSONValue array){
+    size_t count = 0;
+    for (JSONValue element = JSONArrayFirstElement(array);
+         JSONValueIsValid(element);
+         element = JSONArrayNextElement(element)) {
+        count++;
+    }
+    return count;
+}
+
+bool JSONValueGetString(JSONValue value, JSONStringRef* string){
+    if (!JSONValueIsValid(value)) return false;
+    return JSONStringAt(value.document, value.index, string);
+}
+
+/*
+ * 数値リテラルの範囲を取得する。
+ */
+static size_t JSONNumberSpan(JSONValue value, const char** begin){
+    JSONDocumentRef document = value.document;
+    const uint8_t*  p   = document->bytes + document->positions[value.index];
+    const uint8_t*  end = document->bytes + document->length;
+    const uint8_t*  q   = p;
+    while (q < end && (('0' <= *q && *q <= '9') ||
+                       '-' == *q || '+' == *q || '.' == *q || 'e' == *q || 'E' == *q)) {
+        q++;
+    }
+    *begin = (const char*)p;
+    return q - p;
+}
+
+bool JSONValueGetInt64(JSONValue value, int64_t* number){
+    if (JSONTypeNumber != JSONValueGetType(value)) return false;
+
+    const char* p = NULL;
+    size_t    len = JSONNumberSpan(value, &p);
+    size_t      i = 0;
+    bool negative = false;
+    if ('-' == p[0]) { negative = true; i = 1; }
+    if (i == len) return false;
+
+    uint64_t result = 0;
+    for (; i < len; i++) {
+        unsigned digit = (unsigned)(p[i] - '0');
+        if (digit > 9) {
+            // 小数や指数表記は浮動小数として読んで丸める。
+            double d;
+            if (!JSONValueGetDouble(value, &d)) return false;
+            *number = (int64_t)d;
+            return true;
+        }
+        if (result > (UINT64_MAX - digit) / 10) return false;
+        result = result * 10 + digit;
+    }
+    if (negative) {
+        if (result > (uint64_t)INT64_MAX + 1) return false;
+        *number = (int64_t)(0 - result);
+    }
+    else {
+        if (result > (uint64_t)INT64_MAX) return false;
+        *number = (int64_t)result;
+    }
+    return true;
+}
+
+bool JSONValueGetDouble(JSONValue value, double* number){
+    if (JSONTypeNumber != JSONValueGetType(value)) return false;
+
+    const char* p = NULL;
+    size_t    len = JSONNumberSpan(value, &p);
+    char buf[64];
+    if (0 == len || len >= sizeof(buf)) return false;
+
+    // 入力バッファは終端されていないので、コピーしてから変換する。
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    char* end = NULL;
+    *number = strtod(buf, &end);
+    return (end == buf + len);
+}
+
+bool JSONValueGetBool(JSONValue value, bool* boolean){
+    JSONType type = JSONValueGetType(value);
+    if (JSONTypeTrue  == type) { *boolean = true;  return true; }
+    if (JSONTypeFalse == type) { *boolean = false; return true; }
+    return false;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Conversion
+ -----------------------------------------------------------------------------*/
+#pragma mark - Conversion
+
+bool JSONStringEqualsCString(JSONStringRef string, const char* cstr){
+    size_t len = strlen(cstr);
+    return (len == string.length && 0 == memcmp(string.bytes, cstr, len));
+}
+
+/*
+ * 4桁の16進数を読む。
+ */
+static int JSONReadHex4(const char* p, const char* end){
+    if (end - p < 4) return -1;
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        value <<= 4;
+        if      ('0' <= c && c <= '9') value |= c - '0';
+        else if ('a' <= c && c <= 'f') value |= c - 'a' + 10;
+        else if ('A' <= c && c <= 'F') value |= c - 'A' + 10;
+        else return -1;
+    }
+    return value;
+}
+
+/*
+ * コードポイントをUTF-8で書き込む。
+ */
+static size_t JSONWriteUTF8(uint32_t cp, char* out){
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+NSString* JSONStringCreateNSString(JSONStringRef string){
+    if (!string.hasEscape) {
+        return [[NSString alloc] initWithBytes:string.bytes
+                                        length:string.length
+                                      encoding:NSUTF8StringEncoding];
+    }
+
+    // エスケープを解除すると必ず短くなるので、同じ長さで足りる。
+    char*       buf = (char*)malloc(string.length + 1);
+    size_t        n = 0;
+    const char*   p = string.bytes;
+    const char* end = string.bytes + string.length;
+    while (p < end) {
+        if ('\\' != *p) {
+            buf[n++] = *p++;
+            continue;
+        }
+        if (++p >= end) break;
+        char c = *p++;
+        switch (c) {
+            case 'b': buf[n++] = '\b'; break;
+            case 'f': buf[n++] = '\f'; break;
+            case 'n': buf[n++] = '\n'; break;
+            case 'r': buf[n++] = '\r'; break;
+            case 't': buf[n++] = '\t'; break;
+            case 'u': {
+                int cp = JSONReadHex4(p, end);
+                if (cp < 0) { free(buf); return nil; }
+                p += 4;
+                // サロゲートペア
+                if (0xD800 <= cp && cp < 0xDC00 && end - p >= 6 && '\\' == p[0] && 'u' == p[1]) {
+                    int low = JSONReadHex4(p + 2, end);
+                    if (0xDC00 <= low && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                n += JSONWriteUTF8((uint32_t)cp, buf + n);
+                break;
+            }
+            default:
+                buf[n++] = c; // " \ /
+                break;
+        }
+    }
+    NSString* result = [[NSString alloc] initWithBytesNoCopy:buf
+                                                      length:n
+                                                    encoding:NSUTF8StringEncoding
+                                                freeWhenDone:YES];
+    // 不正なUTF-8などで作れなかった場合、bufは解放されない。
+    if (nil == result) free(buf);
+    return result;
+}
+
+id JSONValueCopyObject(JSONValue value){
+    switch (JSONValueGetType(value)) {
+        case JSONTypeObject: {
+            NSMutableDictionary* dictionary = [NSMutableDictionary dictionary];
+            JSONStringRef key;
+            for (JSONValue member = JSONObjectFirstMember(value, &key);
+                 JSONValueIsValid(member);
+                 member = JSONObjectNextMember(member, &key)) {
+                NSString* name   = JSONStringCreateNSString(key);
+                id        object = JSONValueCopyObject(member);
+                if (name && object) dictionary[name] = object;
+            }
+            return dictionary;
+        }
+        case JSONTypeArray: {
+            NSMutableArray* array = [NSMutableArray array];
+            for (JSONValue element = JSONArrayFirstElement(value);
+                 JSONValueIsValid(element);
+                 element = JSONArrayNextElement(element)) {
+                id object = JSONValueCopyObject(element);
+                if (object) [array addObject:object];
+            }
+            return array;
+        }
+        case JSONTypeString: {
+            JSONStringRef string;
+            if (!JSONValueGetString(value, &string)) return nil;
+            return JSONStringCreateNSString(string);
+        }
+        case JSONTypeNumber: {
+            int64_t integer;
+            const char* p = NULL;
+            size_t    len = JSONNumberSpan(value, &p);
+            bool isInteger = (NULL == memchr(p, '.', len) &&
+                              NULL == memchr(p, 'e', len) &&
+                              NULL == memchr(p, 'E', len));
+            if (isInteger && JSONValueGetInt64(value, &integer)) return @(integer);
+            double real;
+            if (JSONValueGetDouble(value, &real)) return @(real);
+            return nil;
+        }
+        case JSONTypeTrue:  return @YES;
+        case JSONTypeFalse: return @NO;
+        case JSONTypeNull:  return [NSNull null];
+        default:            return nil;
+    }
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation JSONStreamParser
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation JSONStreamParser
+
+// 入力の形式
+typedef enum {
+    JSONStreamModeUnknown = 0,
+    JSONStreamModeArray,   // トップレベル配列の要素を返す
+    JSONStreamModeValues,  // トップレベルの値を順に返す
+} JSONStreamMode;
+
+// 要素の種類
+typedef enum {
+    JSONStreamElementNone = 0,
+    JSONStreamElementContainer,
+    JSONStreamElementString,
+    JSONStreamElementScalar,
+} JSONStreamElement;
+
+@implementation JSONStreamParser
+{
+    JSONStreamElementBlock _handler;
+    NSMutableData*         _buffer;
+
+    JSONStreamMode    _mode;
+    JSONStreamElement _element;       // 読込中の要素の種類
+    size_t            _elementStart;  // 読込中の要素のバッファ上の開始位置
+    size_t            _scanned;       // 走査済みのバイト数
+    int               _depth;         // 要素内の括弧の深さ
+    BOOL              _inString;
+    BOOL              _escape;
+    BOOL              _expectComma;   // 配列で次にカンマが必要
+    BOOL              _afterComma;    // 配列でカンマの直後(次は要素が必要)
+    BOOL              _closed;        // トップレベル配列が閉じた
+    BOOL              _failed;
+}
+
+- (id)initWithElementHandler:(JSONStreamElementBlock)handler {
+    self = [super init];
+    if (self) {
+        _handler = [handler copy];
+        _buffer  = [NSMutableData data];
+    }
+    return self;
+}
+
+/*
+ * 完成した要素を解析してハンドラに渡す。
+ */
+- (BOOL)emitElementFrom:(size_t)start to:(size_t)end {
+    const uint8_t*  bytes = (const uint8_t*)_buffer.bytes;
+    JSONDocumentRef document = JSONDocumentCreateWithBytes(bytes + start, end - start);
+    if (NULL == document) return NO;
+
+    _handler(JSONDocumentGetRoot(document));
+    JSONDocumentRelease(document);
+
+    _elementCount++;
+    _element     = JSONStreamElementNone;
+    _expectComma = (JSONStreamModeArray == _mode);
+    return YES;
+}
+
+/*
+ * 要素の外にある1文字を処理する。
+ */
+- (BOOL)scanOutside:(uint8_t)c at:(size_t)i {
+    if (JSONCharClassTable[c] & JSON_CLASS_WS) return YES;
+
+    if (JSONStreamModeUnknown == _mode) {
+        if ('[' == c) {
+            _mode = JSONStreamModeArray;
+            return YES;
+        }
+        _mode = JSONStreamModeValues;
+    }
+
+    if (JSONStreamModeArray == _mode) {
+        if (_closed) return NO;
+        if (',' == c) {
+            if (!_expectComma) return NO;
+            _expectComma = NO;
+            _afterComma  = YES;
+            return YES;
+        }
+        if (']' == c) {
+            // "[1,]" のような末尾のカンマは不正
+            if (_afterComma) return NO;
+            _closed = YES;
+            return YES;
+        }
+        if (_expectComma) return NO;
+        _afterComma = NO;
+    }
+
+    _elementStart = i;
+    switch (c) {
+        case '"':
+            _element  = JSONStreamElementString;
+            _inString = YES;
+            break;
+        case '{':
+        case '[':
+            _element = JSONStreamElementContainer;
+            _depth   = 1;
+            break;
+        case '}':
+        case ']':
+        case ',':
+        case ':':
+            return NO;
+        default:
+            _element = JSONStreamElementScalar;
+            break;
+    }
+    return YES;
+}
+
+- (BOOL)appendData:(NSData*)data {
+    if (_failed) return NO;
+    JSONCharClassTableInit();
+    [_buffer appendData:data];
+
+    const uint8_t* bytes  = (const uint8_t*)_buffer.bytes;
+    size_t         length = _buffer.length;
+    for (size_t i = _scanned; i < length; i++) {
+        uint8_t c  = bytes[i];
+        BOOL    ok = YES;
+
+        if (_inString) {
+            if      (_escape)    _escape = NO;
+            else if ('\\' == c)  _escape = YES;
+            else if ('"'  == c) {
+                _inString = NO;
+                if (JSONStreamElementString == _element) {
+                    ok = [self emitElementFrom:_elementStart to:i + 1];
+                }
+            }
+        }
+        else if (JSONStreamElementNone == _element) {
+            ok = [self scanOutside:c at:i];
+        }
+        else if (JSONStreamElementScalar == _element) {
+            // リテラルは区切り文字が来た所で完成する。
+            uint8_t cls = JSONCharClassTable[c];
+            if (cls & (JSON_CLASS_WS | JSON_CLASS_OP)) {
+                ok = [self emitElementFrom:_elementStart to:i] && [self scanOutside:c at:i];
+            }
+        }
+        else {
+            if      ('"' == c)             _inString = YES;
+            else if ('{' == c || '[' == c) _depth++;
+            else if ('}' == c || ']' == c) {
+                if (0 == --_depth) {
+                    ok = [self emitElementFrom:_elementStart to:i + 1];
+                }
+            }
+        }
+
+        if (!ok) {
+            _failed = YES;
+            return NO;
+        }
+        // ハンドラの中でバッファは変更されないが、念のため取り直す。
+        bytes = (const uint8_t*)_buffer.bytes;
+    }
+
+    // 完成した要素の分はバッファから取り除く。
+    size_t keep = (JSONStreamElementNone == _element)? length : _elementStart;
+    if (keep > 0) {
+        [_buffer replaceBytesInRange:NSMakeRange(0, keep) withBytes:NULL length:0];
+        _elementStart -= (JSONStreamElementNone == _element)? 0 : keep;
+    }
+    _scanned = _buffer.length;
+    return YES;
+}
+
+- (BOOL)finish {
+    if (_failed) return NO;
+    if (JSONStreamElementScalar == _element && !_inString) {
+        if (![self emitElementFrom:_elementStart to:_buffer.length]) return NO;
+    }
+    if (JSONStreamElementNone != _element) return NO;
+    if (JSONStreamModeArray == _mode && !_closed) return NO;
+
+    _buffer  = [NSMutableData data];
+    _scanned = 0;
+    return YES;
+}
+
+@end
@@ -0,0 +1,87 @@
+/*******************************************************************************
+  KeyValueStore 1.0.0.0
+
+                         追記型ログによるキー・バリューストア
+
+   NSUserDefaultsのsynchronizeのように、書き込みの度にファイル全体を
+   書き直す事はせず、変更をレコードとしてログファイルの末尾に追記する。
+   書き込みは一定時間まとめてから一度に追記する。(グループコミット)
+   読み込みはメモリ上のインデックスから行うので、ファイルにはアクセスしない。
+
+   レコード: [crc32][length][type][keyLength][key][value]
+   起動時にログを先頭から再生し、CRCが一致しないレコード(書き込み途中で
+   終了した物)以降は切り捨てる。
+   不要になったレコードが増えると、有効な値だけを新しいファイルに書き出して
+   置き換える。(コンパクション)
+
+   ログの形式はKeyValueStoreFormat.hを参照。kvsbenchで書き直す方法との
+   速度の比較と、途中で切れたログの再生をPC上で確かめられる。
+       $ cc -O2 -o kvsbench kvsbench.c -lz
+       $ ./kvsbench -d /tmp
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_KEY_VALUE_STORE_H
+#define TYABUTA_KEY_VALUE_STORE_H
+
+#import <Foundation/Foundation.h>
+
+
+@interface KeyValueStore : NSObject
+
+/*
+ * Library/KeyValueStore.log に保存する、アプリケーション共通のストア
+ */
++ (KeyValueStore*)defaultStore;
+
+/*
+ * 指定パスのログを開く。無ければ作成する。
+ * 同じパスのストアを複数作らない事。
+ */
+- (id)initWithPath:(NSString*)path;
+
+/*
+ * 書き込みをまとめる時間[sec](初期値0.1sec)
+ * 終了時に最大でこの時間内の書き込みが失われる。
+ */
+@property(nonatomic) NSTimeInterval commitInterval;
+
+/*
+ * 値を保存する。
+ */
+- (void)setString:(NSString*)value forKey:(NSString*)key;
+- (void)setInteger:(NSInteger)value forKey:(NSString*)key;
+- (void)setDouble:(double)value forKey:(NSString*)key;
+- (void)setData:(NSData*)value forKey:(NSString*)key;
+
+/*
+ * 値を削除する。
+ */
+- (void)removeObjectForKey:(NSString*)key;
+
+/*
+ * 値を取得する。無い場合はnil,0を返す。
+ */
+- (id)objectForKey:(NSString*)key;
+- (NSString*)stringForKey:(NSString*)key;
+- (NSInteger)integerForKey:(NSString*)key;
+- (double)doubleForKey:(NSString*)key;
+- (NSData*)dataForKey:(NSString*)key;
+
+/*
+ * まとめている書き込みをすぐにログへ追記し、完了を待つ。
+ * バックグラウンドへ移行した時と終了時は自動で呼ばれる。
+ */
+- (void)synchronize;
+
+/*
+ * 有効な値だけを新しいログに書き出して置き換える。
+ * 通常は不要なレコードが増えた時に自動で行われる。
+ */
+- (void)compact;
+
+@end
+
+
+#endif // TYABUTA_KEY_VALUE_STORE_H
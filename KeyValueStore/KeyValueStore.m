@@ -0,0 +1,453 @@
+//
+//  KeyValueStore
+//
+//  Created by tyabuta on 2014/06/10.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "KeyValueStore.h"
+#import "KeyValueStoreFormat.h"
+#import <UIKit/UIKit.h>
+#import <pthread.h>
+#import <zlib.h>
+
+
+/*
+ * デバックログ用のマクロ、リリース時は何もおこらないようになる。
+ * Tips: __VA_ARGS__ の前に##を付けると、引数ゼロでもコンパイルが通る。
+ */
+#ifdef DEBUG
+#define dmsg(fmt, ...) NSLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#else
+#define dmsg(...)
+#endif
+
+
+// コンパクションを始める不要なレコードの最小サイズ
+static const unsigned long long KVSCompactionThreshold = 64 * 1024;
+
+
+
+
+/*------------------------------------------------------------------------------
+ Record functions
+ -----------------------------------------------------------------------------*/
+#pragma mark - Record functions
+
+/*
+ * 値をレコードとして書き込む際のバイト数
+ */
+static size_t KVSValueLength(id value){
+    if ([value isKindOfClass:[NSString class]]) return [value lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    if ([value isKindOfClass:[NSData class]])   return [value length];
+    if ([value isKindOfClass:[NSNumber class]]) return 8;
+    return 0;
+}
+
+/*
+ * レコード全体のバイト数
+ */
+static size_t KVSRecordSize(NSString* key, id value){
+    return sizeof(KVSRecordHeader) + KVS_RECORD_PREFIX_SIZE
+    + [key lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + KVSValueLength(value);
+}
+
+/*
+ * 文字列をUTF-8でlengthバイト追加する。(UTF8Stringと違い、途中のNULで切れない)
+ */
+static void KVSAppendUTF8(NSMutableData* log, NSString* string, size_t length){
+    NSUInteger start = log.length;
+    [log increaseLengthBy:length];
+    [string getBytes:(uint8_t*)log.mutableBytes + start
+           maxLength:length
+          usedLength:NULL
+            encoding:NSUTF8StringEncoding
+             options:0
+               range:NSMakeRange(0, string.length)
+      remainingRange:NULL];
+}
+
+/*
+ * レコードを追加する。valueがnilなら削除のレコードとなる。
+ */
+static void KVSAppendRecord(NSMutableData* log, NSString* key, id value){
+    size_t keyLength = [key lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    if (keyLength > UINT16_MAX) return;
+
+    uint8_t     type      = KVSRecordTypeRemove;
+    NSString*   string    = nil;
+    const void* bytes     = NULL;
+    size_t      length    = 0;
+    int64_t     integer;
+    double      real;
+
+    if ([value isKindOfClass:[NSString class]]) {
+        type   = KVSRecordTypeString;
+        string = value;
+        length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    }
+    else if ([value isKindOfClass:[NSData class]]) {
+        type   = KVSRecordTypeData;
+        bytes  = [value bytes];
+        length = [value length];
+    }
+    else if ([value isKindOfClass:[NSNumber class]]) {
+        const char* objCType = [value objCType];
+        if (0 == strcmp(objCType, @encode(double)) || 0 == strcmp(objCType, @encode(float))) {
+            type  = KVSRecordTypeDouble;
+            real  = [value doubleValue];
+            bytes = &real;
+        }
+        else {
+            type    = KVSRecordTypeInteger;
+            integer = [value longLongValue];
+            bytes   = &integer;
+        }
+        length = 8;
+    }
+
+    // ヘッダの領域を空けて本体を書き込み、最後にCRCを埋める。
+    NSUInteger start = log.length;
+    KVSRecordHeader header = {0, (uint32_t)(KVS_RECORD_PREFIX_SIZE + keyLength + length)};
+    uint16_t keyLength16 = (uint16_t)keyLength;
+    [log appendBytes:&header      length:sizeof(header)];
+    [log appendBytes:&type        length:1];
+    [log appendBytes:&keyLength16 length:2];
+    KVSAppendUTF8(log, key, keyLength);
+    if      (string) KVSAppendUTF8(log, string, length);
+    else if (length) [log appendBytes:bytes length:length];
+
+    uint8_t* record = (uint8_t*)log.mutableBytes + start;
+    header.crc = (uint32_t)crc32(0, record + sizeof(header), header.length);
+    memcpy(record, &header, sizeof(header));
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation KeyValueStore
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation KeyValueStore
+
+@implementation KeyValueStore
+{
+    NSString*            _path;
+    int                  _fd;
+    dispatch_queue_t     _ioQueue;
+
+    // _index, _pendingは_lockの中で操作する。
+    pthread_mutex_t      _lock;
+    NSMutableDictionary* _index;        // キー -> 値
+    NSMutableData*       _pending;      // まだログに追記していないレコード
+    BOOL                 _commitScheduled;
+
+    // 以下は_ioQueueの中でのみ操作する。
+    unsigned long long   _logSize;
+    unsigned long long   _garbageBytes; // 上書き、削除された不要なレコードのサイズ
+}
+
++ (KeyValueStore*)defaultStore {
+    static KeyValueStore*  defaultStore = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSString* library = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory,
+                                                                NSUserDomainMask,
+                                                                YES)[0];
+        defaultStore = [[KeyValueStore alloc] initWithPath:[library stringByAppendingPathComponent:@"KeyValueStore.log"]];
+    });
+    return defaultStore;
+}
+
+- (id)initWithPath:(NSString*)path {
+    self = [super init];
+    if (self) {
+        _path           = [path copy];
+        _commitInterval = 0.1;
+        _ioQueue        = dispatch_queue_create("KeyValueStore", DISPATCH_QUEUE_SERIAL);
+        _index          = [NSMutableDictionary dictionary];
+        _pending        = [NSMutableData data];
+        pthread_mutex_init(&_lock, NULL);
+
+        [self recover];
+
+        NSNotificationCenter* center = [NSNotificationCenter defaultCenter];
+        [center addObserver:self selector:@selector(synchronize)
+                       name:UIApplicationDidEnterBackgroundNotification object:nil];
+        [center addObserver:self selector:@selector(synchronize)
+                       name:UIApplicationWillTerminateNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    // 予約済みのcommitは自身を保持しているので、ここでは_ioQueueに残っている処理は無い。
+    [self commit];
+    if (_fd >= 0) close(_fd);
+    pthread_mutex_destroy(&_lock);
+}
+
+
+#pragma mark Recovery
+
+/*
+ * ログを先頭から再生してインデックスを作成する。
+ * 途中で壊れたレコードがあれば、それ以降を切り捨てる。
+ */
+- (void)recover {
+    NSData* log = [NSData dataWithContentsOfFile:_path
+                                         options:NSDataReadingMappedAlways
+                                           error:NULL];
+    const uint8_t* bytes = log.bytes;
+    unsigned long long length = log.length;
+    unsigned long long offset = 0;
+
+    while (offset + sizeof(KVSRecordHeader) + KVS_RECORD_PREFIX_SIZE <= length) {
+        KVSRecordHeader header;
+        memcpy(&header, bytes + offset, sizeof(header));
+        if (header.length < KVS_RECORD_PREFIX_SIZE ||
+            offset + sizeof(header) + header.length > length) break;
+
+        const uint8_t* body = bytes + offset + sizeof(header);
+        if (header.crc != (uint32_t)crc32(0, body, header.length)) break;
+
+        uint8_t  type = body[0];
+        uint16_t keyLength;
+        memcpy(&keyLength, body + 1, sizeof(keyLength));
+        if (KVS_RECORD_PREFIX_SIZE + keyLength > header.length) break;
+
+        NSString* key = [[NSString alloc] initWithBytes:body + KVS_RECORD_PREFIX_SIZE
+                                                 length:keyLength
+                                               encoding:NSUTF8StringEncoding];
+        const uint8_t* valueBytes  = body + KVS_RECORD_PREFIX_SIZE + keyLength;
+        size_t         valueLength = header.length - KVS_RECORD_PREFIX_SIZE - keyLength;
+
+        id value = nil;
+        switch (type) {
+            case KVSRecordTypeString:
+                value = [[NSString alloc] initWithBytes:valueBytes length:valueLength encoding:NSUTF8StringEncoding];
+                break;
+            case KVSRecordTypeData:
+                value = [NSData dataWithBytes:valueBytes length:valueLength];
+                break;
+            case KVSRecordTypeInteger: {
+                int64_t integer = 0;
+                if (valueLength == sizeof(integer)) memcpy(&integer, valueBytes, sizeof(integer));
+                value = @(integer);
+                break;
+            }
+            case KVSRecordTypeDouble: {
+                double real = 0;
+                if (valueLength == sizeof(real)) memcpy(&real, valueBytes, sizeof(real));
+                value = @(real);
+                break;
+            }
+            default:
+                break;
+        }
+
+        // 上書きされたレコードは不要になる。
+        id old = key? _index[key] : nil;
+        if (old) _garbageBytes += KVSRecordSize(key, old);
+        if (key) {
+            if (value) _index[key] = value;
+            else {
+                [_index removeObjectForKey:key];
+                _garbageBytes += sizeof(header) + header.length;
+            }
+        }
+        offset += sizeof(header) + header.length;
+    }
+
+    _fd = open([_path fileSystemRepresentation], O_RDWR | O_CREAT, 0644);
+    if (_fd < 0) {
+        dmsg(@"open failed: %@ (%d)", _path, errno);
+        return;
+    }
+    if (offset != length) {
+        dmsg(@"truncate broken record: %llu -> %llu", length, offset);
+        ftruncate(_fd, (off_t)offset);
+    }
+    lseek(_fd, (off_t)offset, SEEK_SET);
+    _logSize = offset;
+}
+
+
+#pragma mark Write
+
+/*
+ * インデックスを更新し、レコードを追記待ちにする。
+ * 追記はcommitInterval後にまとめて行う。
+ */
+- (void)setObject:(id)value forKey:(NSString*)key {
+    if (nil == key) return;
+
+    pthread_mutex_lock(&_lock);
+    id old = _index[key];
+    if (value) _index[key] = value;
+    else       [_index removeObjectForKey:key];
+    KVSAppendRecord(_pending, key, value);
+    BOOL schedule = (NO == _commitScheduled);
+    _commitScheduled = YES;
+    pthread_mutex_unlock(&_lock);
+
+    size_t garbage = old? KVSRecordSize(key, old) : 0;
+    if (nil == value) garbage += KVSRecordSize(key, nil);
+    dispatch_async(_ioQueue, ^{
+        _garbageBytes += garbage;
+    });
+
+    if (schedule) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_commitInterval * NSEC_PER_SEC)),
+                       _ioQueue, ^{
+                           [self commit];
+                       });
+    }
+}
+
+/*
+ * 追記待ちのレコードを一度にログへ書き込む。_ioQueueで呼ばれる。
+ */
+- (void)commit {
+    pthread_mutex_lock(&_lock);
+    NSData* pending  = _pending;
+    _pending         = [NSMutableData dataWithCapacity:pending.length];
+    _commitScheduled = NO;
+    pthread_mutex_unlock(&_lock);
+
+    if (0 == pending.length || _fd < 0) return;
+
+    const uint8_t* bytes  = pending.bytes;
+    size_t         length = pending.length;
+    size_t        written = 0;
+    BOOL               ok = YES;
+    while (written < length) {
+        ssize_t n = write(_fd, bytes + written, length - written);
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            ok = NO;
+            break;
+        }
+        written += n;
+    }
+    if (ok && 0 != fsync(_fd)) ok = NO;
+
+    if (NO == ok) {
+        dmsg(@"commit failed: %d", errno);
+        // 書きかけの分は切り捨ててレコードの境界に戻し、
+        // _indexが返している値を失わないよう、追記待ちに戻して次のcommitで再試行する。
+        ftruncate(_fd, (off_t)_logSize);
+        lseek(_fd, (off_t)_logSize, SEEK_SET);
+
+        pthread_mutex_lock(&_lock);
+        NSMutableData* retry = [pending mutableCopy];
+        [retry appendData:_pending];
+        _pending = retry;
+        pthread_mutex_unlock(&_lock);
+        return;
+    }
+    _logSize += length;
+
+    // 不要なレコードが半分を超えたらコンパクションする。
+    if (_garbageBytes > KVSCompactionThreshold && _garbageBytes * 2 > _logSize) {
+        [self compactLog];
+    }
+}
+
+/*
+ * 有効な値だけを新しいファイルに書き出し、renameで置き換える。_ioQueueで呼ばれる。
+ * スナップショット以降の書き込みは_pendingに残り、次のcommitで新しいログに追記される。
+ */
+- (void)compactLog {
+    pthread_mutex_lock(&_lock);
+    NSDictionary* snapshot = [_index copy];
+    pthread_mutex_unlock(&_lock);
+
+    NSMutableData* log = [NSMutableData dataWithCapacity:(NSUInteger)(_logSize - _garbageBytes)];
+    for (NSString* key in snapshot) {
+        KVSAppendRecord(log, key, snapshot[key]);
+    }
+
+    NSString* tempPath = [_path stringByAppendingPathExtension:@"compact"];
+    int fd = open([tempPath fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    BOOL ok = (write(fd, log.bytes, log.length) == (ssize_t)log.length && 0 == fsync(fd));
+    if (NO == ok || 0 != rename([tempPath fileSystemRepresentation], [_path fileSystemRepresentation])) {
+        close(fd);
+        unlink([tempPath fileSystemRepresentation]);
+        return;
+    }
+
+    dmsg(@"compacted: %llu -> %lu bytes", _logSize, (unsigned long)log.length);
+    close(_fd);
+    _fd           = fd;
+    _logSize      = log.length;
+    _garbageBytes = 0;
+}
+
+
+#pragma mark Public methods
+
+- (void)setString:(NSString*)value forKey:(NSString*)key {
+    [self setObject:[value copy] forKey:key];
+}
+
+- (void)setInteger:(NSInteger)value forKey:(NSString*)key {
+    [self setObject:@((long long)value) forKey:key];
+}
+
+- (void)setDouble:(double)value forKey:(NSString*)key {
+    [self setObject:@(value) forKey:key];
+}
+
+- (void)setData:(NSData*)value forKey:(NSString*)key {
+    [self setObject:[value copy] forKey:key];
+}
+
+- (void)removeObjectForKey:(NSString*)key {
+    [self setObject:nil forKey:key];
+}
+
+- (id)objectForKey:(NSString*)key {
+    if (nil == key) return nil;
+    pthread_mutex_lock(&_lock);
+    id value = _index[key];
+    pthread_mutex_unlock(&_lock);
+    return value;
+}
+
+- (NSString*)stringForKey:(NSString*)key {
+    id value = [self objectForKey:key];
+    return [value isKindOfClass:[NSString class]]? value : nil;
+}
+
+- (NSInteger)integerForKey:(NSString*)key {
+    id value = [self objectForKey:key];
+    return [value respondsToSelector:@selector(integerValue)]? [value integerValue] : 0;
+}
+
+- (double)doubleForKey:(NSString*)key {
+    id value = [self objectForKey:key];
+    return [value respondsToSelector:@selector(doubleValue)]? [value doubleValue] : 0;
+}
+
+- (NSData*)dataForKey:(NSString*)key {
+    id value = [self objectForKey:key];
+    return [value isKindOfClass:[NSData class]]? value : nil;
+}
+
+- (void)synchronize {
+    dispatch_sync(_ioQueue, ^{
+        [self commit];
+    });
+}
+
+- (void)compact {
+    dispatch_async(_ioQueue, ^{
+        [self commit];
+        [self compactLog];
+    });
+}
+
+@end
@@ -0,0 +1,51 @@
+/*******************************************************************************
+  KeyValueStoreFormat 1.0.0.0
+
+                         KeyValueStoreのログの形式
+
+   アプリ(KeyValueStore.m)とベンチマーク(kvsbench.c)で共有する定義。
+   Objective-Cに依存しない素のCで書く事。
+
+   ログはレコードを追記していくだけのファイルで、一つのレコードは
+       [KVSRecordHeader 8byte]
+       [type            1byte]   KVSRecordType
+       [keyLength       2byte]
+       [key             keyLength byte(UTF-8)]
+       [value           残り(KVSRecordTypeRemoveでは無し)]
+   crcはtype以降(header.length byte)のCRC32(zlibのcrc32)
+   数値は全て端末のバイト順(リトルエンディアン)で保存される。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_KEY_VALUE_STORE_FORMAT_H
+#define TYABUTA_KEY_VALUE_STORE_FORMAT_H
+
+#include <stdint.h>
+
+
+/*
+ * レコードの種類
+ */
+typedef enum {
+    KVSRecordTypeString  = 1,
+    KVSRecordTypeInteger = 2,
+    KVSRecordTypeDouble  = 3,
+    KVSRecordTypeData    = 4,
+    KVSRecordTypeRemove  = 5,
+} KVSRecordType;
+
+/*
+ * レコードのヘッダ
+ * crcはlength以降(type, keyLength, key, value)のCRC32
+ */
+typedef struct {
+    uint32_t crc;
+    uint32_t length;
+} KVSRecordHeader;
+
+// type(1byte) + keyLength(2byte)
+#define KVS_RECORD_PREFIX_SIZE 3
+
+
+#endif // TYABUTA_KEY_VALUE_STORE_FORMAT_H
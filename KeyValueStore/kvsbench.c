@@ -0,0 +1,277 @@
+/*
+ *  kvsbench
+ *
+ *  KeyValueStoreのログ形式への追記(グループコミット)と、NSUserDefaultsの
+ *  synchronizeのように書き込み毎にファイル全体を書き直す方法を、PC(Linux)上で比べる。
+ *  書き込んだログを再生して値を確かめ、途中で切れたレコードが捨てられる事も確かめる。
+ *
+ *      $ cc -O2 -o kvsbench kvsbench.c -lz
+ *      $ ./kvsbench -d /tmp
+ *
+ *      -d dir    ファイルを作るディレクトリ (初期値はカレント)
+ *      -n count  ログへの書き込み回数 (初期値は100000)
+ *      -b count  書き直す方法での書き込み回数 (初期値は1000)
+ *      -k keys   キーの数 (初期値は1000)
+ *      -g count  まとめて追記する書き込みの数 (初期値は100、1なら書き込み毎にfsync)
+ *
+ *  Created by tyabuta on 2014/06/10.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "KeyValueStoreFormat.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+
+typedef struct {
+    unsigned char* bytes;
+    size_t         length;
+    size_t         capacity;
+} Buffer;
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: kvsbench [-d dir] [-n count] [-b count] [-k keys] [-g count]\n");
+    exit(2);
+}
+
+static void bufferAppend(Buffer* buffer, const void* bytes, size_t length){
+    if (buffer->length + length > buffer->capacity) {
+        buffer->capacity = (buffer->capacity + length) * 2;
+        buffer->bytes    = realloc(buffer->bytes, buffer->capacity);
+        CHECK(buffer->bytes);
+    }
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+/*
+ * KeyValueStore.mのKVSAppendRecordと同じ形式で、整数のレコードを追加する。
+ */
+static void appendRecord(Buffer* buffer, const char* key, int64_t value){
+    uint16_t keyLength = (uint16_t)strlen(key);
+    uint8_t  type      = KVSRecordTypeInteger;
+    size_t   start     = buffer->length;
+
+    KVSRecordHeader header = { 0, (uint32_t)(KVS_RECORD_PREFIX_SIZE + keyLength + sizeof(value)) };
+    bufferAppend(buffer, &header,    sizeof(header));
+    bufferAppend(buffer, &type,      1);
+    bufferAppend(buffer, &keyLength, 2);
+    bufferAppend(buffer, key,        keyLength);
+    bufferAppend(buffer, &value,     sizeof(value));
+
+    unsigned char* record = buffer->bytes + start;
+    header.crc = (uint32_t)crc32(0, record + sizeof(header), header.length);
+    memcpy(record, &header, sizeof(header));
+}
+
+static void writeAll(int fd, const void* bytes, size_t length){
+    const unsigned char* p = bytes;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        CHECK(n > 0);
+        p      += n;
+        length -= n;
+    }
+}
+
+static void keyName(char* key, size_t size, int index){
+    snprintf(key, size, "key.%05d", index);
+}
+
+
+/*
+ * KeyValueStore.mのrecoverと同じ手順でログを再生し、キー毎の最後の値をvaluesに入れる。
+ * 有効なレコードの数を返し、validLengthに有効な末尾の位置を入れる。
+ */
+static size_t replayLog(const char* path, int64_t* values, int keys, size_t* validLength){
+    int fd = open(path, O_RDONLY);
+    CHECK(fd >= 0);
+    struct stat st;
+    fstat(fd, &st);
+    unsigned char* bytes = malloc(st.st_size + 1);
+    CHECK(bytes && read(fd, bytes, st.st_size) == st.st_size);
+    close(fd);
+
+    size_t length = st.st_size, offset = 0, records = 0;
+    while (offset + sizeof(KVSRecordHeader) + KVS_RECORD_PREFIX_SIZE <= length) {
+        KVSRecordHeader header;
+        memcpy(&header, bytes + offset, sizeof(header));
+        if (header.length < KVS_RECORD_PREFIX_SIZE ||
+            offset + sizeof(header) + header.length > length) break;
+
+        const unsigned char* body = bytes + offset + sizeof(header);
+        if (header.crc != (uint32_t)crc32(0, body, header.length)) break;
+
+        uint16_t keyLength;
+        memcpy(&keyLength, body + 1, sizeof(keyLength));
+        if (KVS_RECORD_PREFIX_SIZE + keyLength + sizeof(int64_t) != header.length) break;
+
+        // キーは"key.%05d"で、直後に値が続くので終端は無い。
+        const unsigned char* digits = body + KVS_RECORD_PREFIX_SIZE + 4;
+        int index = 0;
+        for (int i = 0; i < 5; i++) index = index * 10 + (digits[i] - '0');
+        CHECK(9 == keyLength && index >= 0 && index < keys);
+        memcpy(&values[index], body + KVS_RECORD_PREFIX_SIZE + keyLength, sizeof(int64_t));
+
+        offset += sizeof(header) + header.length;
+        records++;
+    }
+    free(bytes);
+    *validLength = offset;
+    return records;
+}
+
+
+/*
+ * 書き込み毎にファイル全体を書き出し、renameで置き換える。(synchronize相当)
+ */
+static double benchRewrite(const char* dir, int count, int keys){
+    char path[4096], temp[4096], key[32];
+    snprintf(path, sizeof(path), "%s/kvsbench.plist", dir);
+    snprintf(temp, sizeof(temp), "%s/kvsbench.plist.tmp", dir);
+
+    int64_t* values = calloc(keys, sizeof(int64_t));
+    Buffer   file   = { 0 };
+
+    double start = nowSec();
+    for (int i = 0; i < count; i++) {
+        values[i % keys] = i;
+
+        file.length = 0;
+        for (int k = 0; k < keys; k++) {
+            keyName(key, sizeof(key), k);
+            appendRecord(&file, key, values[k]);
+        }
+        int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        CHECK(fd >= 0);
+        writeAll(fd, file.bytes, file.length);
+        CHECK(0 == fsync(fd));
+        close(fd);
+        CHECK(0 == rename(temp, path));
+    }
+    double elapsed = nowSec() - start;
+
+    unlink(path);
+    free(file.bytes);
+    free(values);
+    return count / elapsed;
+}
+
+/*
+ * groupの書き込み毎に、まとめて追記してfsyncする。(KeyValueStoreのcommit相当)
+ */
+static double benchLog(const char* path, int count, int keys, int group){
+    char key[32];
+    unlink(path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    CHECK(fd >= 0);
+
+    Buffer pending = { 0 };
+    double start   = nowSec();
+    for (int i = 0; i < count; i++) {
+        keyName(key, sizeof(key), i % keys);
+        appendRecord(&pending, key, i);
+        if (pending.length && (0 == (i + 1) % group || i + 1 == count)) {
+            writeAll(fd, pending.bytes, pending.length);
+            CHECK(0 == fsync(fd));
+            pending.length = 0;
+        }
+    }
+    double elapsed = nowSec() - start;
+    close(fd);
+    free(pending.bytes);
+    return count / elapsed;
+}
+
+/*
+ * 書き込んだログを再生し、最後に書いた値が読めること、
+ * 途中で切れたレコードが捨てられることを確かめる。
+ */
+static void verifyLog(const char* path, int count, int keys){
+    int64_t* values = calloc(keys, sizeof(int64_t));
+    size_t   valid  = 0;
+    size_t records  = replayLog(path, values, keys, &valid);
+    CHECK(records == (size_t)count);
+    for (int k = 0; k < keys && k < count; k++) {
+        int64_t expected = ((count - 1 - k) / keys) * keys + k;
+        CHECK(values[k] == expected);
+    }
+
+    // 最後のレコードの途中で切れた状態にする。
+    CHECK(0 == truncate(path, (off_t)valid - 3));
+    size_t truncated = 0;
+    CHECK(replayLog(path, values, keys, &truncated) == (size_t)count - 1);
+    CHECK(truncated < valid - 3);
+
+    // 壊れたCRCのレコード以降は読まない。
+    int fd = open(path, O_RDWR);
+    unsigned char byte;
+    CHECK(fd >= 0 && 1 == pread(fd, &byte, 1, (off_t)truncated / 2 + sizeof(KVSRecordHeader)));
+    byte ^= 0xff;
+    CHECK(1 == pwrite(fd, &byte, 1, (off_t)truncated / 2 + sizeof(KVSRecordHeader)));
+    close(fd);
+    CHECK(replayLog(path, values, keys, &truncated) < (size_t)count - 1);
+
+    free(values);
+    printf("replay: ok (%d records, torn and corrupt tails dropped)\n", count);
+}
+
+int main(int argc, char* argv[]){
+    const char* dir      = ".";
+    int         count    = 100000;
+    int         baseline = 1000;
+    int         keys     = 1000;
+    int         group    = 100;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "d:n:b:k:g:"))) {
+        switch (opt) {
+            case 'd': dir      = optarg; break;
+            case 'n': count    = atoi(optarg); break;
+            case 'b': baseline = atoi(optarg); break;
+            case 'k': keys     = atoi(optarg); break;
+            case 'g': group    = atoi(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || count < 2 || baseline < 1 || keys < 1 || keys > 99999 || group < 1) usage();
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/kvsbench.log", dir);
+
+    double rewrite = benchRewrite(dir, baseline, keys);
+    double logged  = benchLog(path, count, keys, group);
+    double single  = benchLog(path, baseline, keys, 1);
+    printf("%d keys\n", keys);
+    printf("  rewrite whole file + fsync per write : %10.0f writes/s\n", rewrite);
+    printf("  append + fsync per write             : %10.0f writes/s\n", single);
+    printf("  append, group commit of %-5d        : %10.0f writes/s (%.0fx)\n",
+           group, logged, logged / rewrite);
+
+    benchLog(path, count, keys, group);
+    verifyLog(path, count, keys);
+    unlink(path);
+    return 0;
+}
@@ -7,6 +7,20 @@
 
 #import "OpenGLUtil.h"
 
+// FlightRecorderが追加されている場合だけ記録する。
+#if defined(__has_include)
+#if __has_include("FlightRecorder.h")
+#import "FlightRecorder.h"
+#endif
+#endif
+
+// ResourcePrefetcherが追加されている場合だけ読み込みを記録する。
+#if defined(__has_include)
+#if __has_include("ResourcePrefetcher.h")
+#import "ResourcePrefetcher.h"
+#endif
+#endif
+
 
 EAGLContext* GLContextCreate(){
     EAGLContext* context =
@@ -20,6 +34,9 @@ EAGLContext* GLContextCreate(){
 
 
 GLuint GLTextureLoadImage(NSString* filename){
+#ifdef TYABUTA_FLIGHT_RECORDER_H
+    uint64_t start = FlightRecorderNow();
+#endif
 
     // UIImageを使って画像読み込み
     CGImageRef imageRef = [UIImage imageNamed:filename].CGImage;
@@ -27,6 +44,12 @@ GLuint GLTextureLoadImage(NSString* filename){
         NSLog(@"Error: %@ not found", filename);
         return 0;
     }
+#ifdef TYABUTA_RESOURCE_PREFETCHER_H
+    if (ResourcePrefetcherIsRecording()) {
+        NSString* path = [[NSBundle mainBundle] pathForResource:filename ofType:nil];
+        ResourcePrefetcherRecord(ResourcePrefetchKindRead, path, 0, 0);
+    }
+#endif
 
     // データ配列を確保
     size_t width   = CGImageGetWidth(imageRef);
@@ -68,6 +91,9 @@ GLuint GLTextureLoadImage(NSString* filename){
                  GL_UNSIGNED_BYTE, imageData);
 
     free(imageData);
+#ifdef TYABUTA_FLIGHT_RECORDER_H
+    FlightRecorderTexture(filename, width, height, FlightRecorderElapsed(start));
+#endif
     return texture;
 }
 
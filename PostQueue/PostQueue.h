@@ -0,0 +1,91 @@
+/*******************************************************************************
+  PostQueue 1.0.0.0
+
+                         まとめて送信する永続化されたPOSTキュー
+
+   イベント毎にPOSTする代わりに、レコードをディスクのジャーナルに追記しておき、
+   サイズか時間で区切ったバッチをgzip圧縮して一回のPOSTで送信する。
+   送信済みの位置は別ファイルに記録するので、アプリを再起動しても未送信の
+   レコードは失われず、送信済みのレコードは再送されない。
+   送信に失敗した場合は、ジッタ付きの指数バックオフで再送する。
+
+   バッチのボディは、各レコードを改行で連結したものをgzip圧縮した物で、
+   Content-Encoding: gzip ヘッダを付けて送信する。
+   レコード自身に改行を含めない事。(URLエンコードしたパラメータ等)
+
+   通信にはHTTPClientを使用する。
+
+   送信先の代わりにPC上のpqstubへ送ると、バッチの大きさ、間隔、再送を確かめられる。
+
+       $ cc -O2 -o pqstub pqstub.c -lz
+       $ ./pqstub -p 8080 -f 3
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_POST_QUEUE_H
+#define TYABUTA_POST_QUEUE_H
+
+#import <Foundation/Foundation.h>
+
+
+@interface PostQueue : NSObject
+
+/*
+ * 送信先URL毎の共通のキューを取得する。
+ * ジャーナルはLibrary/PostQueue以下に保存される。
+ */
++ (PostQueue*)queueForURL:(NSURL*)url;
+
+/*
+ * 指定ディレクトリにジャーナルを置くキューを作成する。
+ * 同じディレクトリを使うキューを複数作らない事。
+ */
+- (id)initWithURL:(NSURL*)url directory:(NSString*)directory;
+
+/*
+ * 送信先URL
+ */
+@property(nonatomic, readonly) NSURL* URL;
+
+/*
+ * 一つのバッチの圧縮前の最大サイズ[byte](初期値64KB)
+ * 未送信のレコードがこのサイズに達するとすぐに送信する。
+ */
+@property(nonatomic) NSUInteger maxBatchBytes;
+
+/*
+ * 最初のレコードを追加してから送信するまでの最大の待ち時間[sec](初期値30sec)
+ */
+@property(nonatomic) NSTimeInterval flushInterval;
+
+/*
+ * 再送間隔の上限[sec](初期値10min)
+ */
+@property(nonatomic) NSTimeInterval maxRetryInterval;
+
+/*
+ * バッチのContent-Type(初期値 application/x-www-form-urlencoded)
+ */
+@property(nonatomic, copy) NSString* contentType;
+
+/*
+ * 未送信のレコードのサイズ[byte]
+ */
+@property(nonatomic, readonly) unsigned long long pendingBytes;
+
+/*
+ * レコードをジャーナルに追加する。書き込みはバックグラウンドで行われる。
+ */
+- (void)enqueueRecord:(NSData*)record;
+
+/*
+ * 待ち時間を待たずに、未送信のレコードを送信する。
+ * バックグラウンドへ移行する時などに呼ぶ。
+ */
+- (void)flush;
+
+@end
+
+
+#endif // TYABUTA_POST_QUEUE_H
@@ -0,0 +1,411 @@
+//
+//  PostQueue
+//
+//  Created by tyabuta on 2014/06/08.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "PostQueue.h"
+#import "HTTPClient.h"
+#import <CommonCrypto/CommonDigest.h>
+#import <zlib.h>
+
+
+/*
+ * デバックログ用のマクロ、リリース時は何もおこらないようになる。
+ * Tips: __VA_ARGS__ の前に##を付けると、引数ゼロでもコンパイルが通る。
+ */
+#ifdef DEBUG
+#define dmsg(fmt, ...) NSLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#else
+#define dmsg(...)
+#endif
+
+
+// ジャーナルのファイル名
+static NSString* const PostQueueJournalFileName = @"journal";
+
+// 送信済みの位置を記録するファイル名
+static NSString* const PostQueueOffsetFileName  = @"offset";
+
+// 最初の再送までの間隔[sec]
+static const NSTimeInterval PostQueueBaseRetryInterval = 2.0;
+
+// ジャーナルのレコードヘッダ(レコードのバイト数)
+typedef uint32_t PostQueueRecordHeader;
+
+
+
+
+/*------------------------------------------------------------------------------
+ Functions
+ -----------------------------------------------------------------------------*/
+#pragma mark - Functions
+
+/*
+ * gzip形式で圧縮する。
+ */
+static NSData* PostQueueGzip(NSData* data){
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // windowBitsに16を足すとgzipのヘッダとフッタが付く。
+    if (Z_OK != deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)) {
+        return nil;
+    }
+
+    // 上限のサイズを確保して一度で圧縮する。
+    uLong bound = deflateBound(&stream, (uLong)data.length);
+    NSMutableData* output = [NSMutableData dataWithLength:bound];
+    stream.next_in   = (Bytef*)data.bytes;
+    stream.avail_in  = (uInt)data.length;
+    stream.next_out  = (Bytef*)output.mutableBytes;
+    stream.avail_out = (uInt)bound;
+
+    int status = deflate(&stream, Z_FINISH);
+    output.length = stream.total_out;
+    deflateEnd(&stream);
+    return (Z_STREAM_END == status)? output : nil;
+}
+
+/*
+ * ジャーナルを先頭から走査し、完全に書き込まれているレコードの末尾の位置を返す。
+ * 書き込み途中で終了した場合、末尾のレコードは不完全になっている。
+ */
+static unsigned long long PostQueueJournalValidLength(NSData* journal){
+    const uint8_t* bytes = journal.bytes;
+    unsigned long long length = journal.length;
+    unsigned long long offset = 0;
+    while (offset + sizeof(PostQueueRecordHeader) <= length) {
+        PostQueueRecordHeader size;
+        memcpy(&size, bytes + offset, sizeof(size));
+        if (offset + sizeof(size) + size > length) break;
+        offset += sizeof(size) + size;
+    }
+    return offset;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation PostQueue
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation PostQueue
+
+@implementation PostQueue
+{
+    NSString*          _journalPath;
+    NSString*          _offsetPath;
+    NSFileHandle*      _journal;
+    dispatch_queue_t   _queue;
+    dispatch_source_t  _timer;
+
+    unsigned long long _journalSize;  // ジャーナルの有効なサイズ
+    unsigned long long _offset;       // 送信済みの位置
+
+    BOOL               _sending;      // バッチを送信中
+    BOOL               _retrying;     // 再送待ち
+    BOOL               _timerArmed;
+    NSUInteger         _attempt;      // 連続して失敗した回数
+}
+
++ (PostQueue*)queueForURL:(NSURL*)url {
+    static NSMutableDictionary* queues = nil;
+    static dispatch_once_t      onceToken;
+    dispatch_once(&onceToken, ^{
+        queues = [NSMutableDictionary dictionary];
+    });
+
+    NSString* key = url.absoluteString;
+    @synchronized(queues) {
+        PostQueue* queue = queues[key];
+        if (nil == queue) {
+            // URLのハッシュ値をディレクトリ名にする。
+            const char* str = [key UTF8String];
+            unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+            CC_SHA1(str, (CC_LONG)strlen(str), digest);
+            NSMutableString* name = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+            for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+                [name appendFormat:@"%02x", digest[i]];
+            }
+
+            NSString* library = NSSearchPathForDirectoriesInDomains(NSLibraryDirectory,
+                                                                    NSUserDomainMask,
+                                                                    YES)[0];
+            NSString* directory = [[library stringByAppendingPathComponent:@"PostQueue"]
+                                   stringByAppendingPathComponent:name];
+            queue = [[PostQueue alloc] initWithURL:url directory:directory];
+            queues[key] = queue;
+        }
+        return queue;
+    }
+}
+
+- (id)initWithURL:(NSURL*)url directory:(NSString*)directory {
+    self = [super init];
+    if (self) {
+        _URL              = [url copy];
+        _maxBatchBytes    = 64 * 1024;
+        _flushInterval    = 30;
+        _maxRetryInterval = 10 * 60;
+        _contentType      = @"application/x-www-form-urlencoded";
+        _journalPath      = [directory stringByAppendingPathComponent:PostQueueJournalFileName];
+        _offsetPath       = [directory stringByAppendingPathComponent:PostQueueOffsetFileName];
+        _queue            = dispatch_queue_create("PostQueue", DISPATCH_QUEUE_SERIAL);
+
+        [[NSFileManager defaultManager] createDirectoryAtPath:directory
+                                  withIntermediateDirectories:YES
+                                                   attributes:nil
+                                                        error:nil];
+        [self openJournal];
+
+        // タイマーは一つを使い回す。(送信待ちと再送待ち)
+        __weak PostQueue* weakSelf = self;
+        _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+        dispatch_source_set_timer(_timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_source_set_event_handler(_timer, ^{
+            [weakSelf timerFired];
+        });
+        dispatch_resume(_timer);
+
+        // 前回の未送信分が残っていれば送信を予約する。
+        dispatch_async(_queue, ^{
+            if (_journalSize > _offset) [self armTimer:_flushInterval];
+        });
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_timer) dispatch_source_cancel(_timer);
+    [_journal closeFile];
+}
+
+
+#pragma mark Journal
+
+/*
+ * ジャーナルと送信済みの位置を読み込む。
+ * 書き込み途中のレコードは切り捨てる。
+ */
+- (void)openJournal {
+    NSFileManager* fileManager = [NSFileManager defaultManager];
+    if (NO == [fileManager fileExistsAtPath:_journalPath]) {
+        [fileManager createFileAtPath:_journalPath contents:nil attributes:nil];
+    }
+
+    NSData* journal = [NSData dataWithContentsOfFile:_journalPath
+                                             options:NSDataReadingMappedIfSafe
+                                               error:NULL];
+    _journalSize = PostQueueJournalValidLength(journal);
+
+    _journal = [NSFileHandle fileHandleForUpdatingAtPath:_journalPath];
+    if (_journalSize != journal.length) {
+        dmsg(@"truncate broken record: %llu -> %llu", (unsigned long long)journal.length, _journalSize);
+        [_journal truncateFileAtOffset:_journalSize];
+    }
+
+    // ジャーナルを空にした直後に終了した場合は、位置がサイズを超えている。
+    NSData* offset = [NSData dataWithContentsOfFile:_offsetPath];
+    if (offset.length == sizeof(_offset)) memcpy(&_offset, offset.bytes, sizeof(_offset));
+    if (_offset > _journalSize) _offset = 0;
+}
+
+/*
+ * 送信済みの位置を記録する。
+ * 全て送信済みになれば、ジャーナルを空にする。
+ */
+- (void)commitOffset:(unsigned long long)offset {
+    _offset = offset;
+    if (_offset == _journalSize) {
+        // ジャーナルを先に空にする。(逆の順で終了すると再送してしまう為)
+        [_journal truncateFileAtOffset:0];
+        [_journal synchronizeFile];
+        _journalSize = 0;
+        _offset      = 0;
+    }
+    [[NSData dataWithBytes:&_offset length:sizeof(_offset)] writeToFile:_offsetPath atomically:YES];
+}
+
+/*
+ * 送信済みの位置から、maxBatchBytesまでのレコードを改行で連結して取り出す。
+ * 一つのレコードがmaxBatchBytesを超える場合は、そのレコードだけを取り出す。
+ * endにはバッチの末尾のジャーナル上の位置が入る。
+ */
+- (NSData*)readBatchWithEnd:(unsigned long long*)end {
+    NSData* journal = [NSData dataWithContentsOfFile:_journalPath
+                                             options:NSDataReadingMappedIfSafe
+                                               error:NULL];
+    const uint8_t* bytes = journal.bytes;
+    unsigned long long length = MIN(_journalSize, (unsigned long long)journal.length);
+    unsigned long long offset = _offset;
+
+    NSMutableData* batch = [NSMutableData dataWithCapacity:MIN(_maxBatchBytes, (NSUInteger)(length - offset))];
+    while (offset + sizeof(PostQueueRecordHeader) <= length) {
+        PostQueueRecordHeader size;
+        memcpy(&size, bytes + offset, sizeof(size));
+        if (batch.length > 0 && batch.length + 1 + size > _maxBatchBytes) break;
+
+        if (batch.length > 0) [batch appendBytes:"\n" length:1];
+        [batch appendBytes:bytes + offset + sizeof(size) length:size];
+        offset += sizeof(size) + size;
+    }
+    *end = offset;
+    return batch;
+}
+
+
+#pragma mark Timer
+
+/*
+ * 指定秒数後にタイマーを発火させる。
+ * 他のタイマーと発火をまとめられるよう、1割の誤差を許す。
+ */
+- (void)armTimer:(NSTimeInterval)interval {
+    _timerArmed = YES;
+    dispatch_source_set_timer(_timer,
+                              dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)),
+                              DISPATCH_TIME_FOREVER,
+                              (uint64_t)(interval * 0.1 * NSEC_PER_SEC));
+}
+
+- (void)disarmTimer {
+    _timerArmed = NO;
+    dispatch_source_set_timer(_timer, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+}
+
+- (void)timerFired {
+    _timerArmed = NO;
+    _retrying   = NO;
+    [self sendBatch];
+}
+
+
+#pragma mark Send
+
+/*
+ * 未送信のレコードをバッチにして送信する。
+ * 同時に送信するバッチは一つだけ。
+ */
+- (void)sendBatch {
+    if (_sending || _journalSize <= _offset) return;
+    [self disarmTimer];
+    _retrying = NO;
+
+    unsigned long long end = 0;
+    NSData* batch = [self readBatchWithEnd:&end];
+    if (end <= _offset) {
+        // ジャーナルを読めない場合は、送信に失敗した時と同じく間隔を空けて再試行する。
+        [self didSendBatchWithEnd:end
+                         response:nil
+                            error:[NSError errorWithDomain:NSCocoaErrorDomain
+                                                      code:NSFileReadUnknownError
+                                                  userInfo:nil]];
+        return;
+    }
+
+    // 圧縮できない場合は、Content-Encodingを付けずにそのまま送る。
+    NSData* compressed = PostQueueGzip(batch);
+    NSData* body       = compressed? compressed : batch;
+
+    NSMutableURLRequest* request = [NSMutableURLRequest requestWithURL:_URL];
+    request.HTTPMethod = @"POST";
+    request.HTTPBody   = body;
+    request.HTTPShouldHandleCookies = YES;
+    [request setValue:_contentType forHTTPHeaderField:@"Content-Type"];
+    if (compressed) [request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+    [request setValue:[NSString stringWithFormat:@"%lu", (unsigned long)body.length]
+   forHTTPHeaderField:@"Content-Length"];
+
+    dmsg(@"Posting batch (%lu -> %lu bytes) to %@ ...",
+         (unsigned long)batch.length, (unsigned long)body.length, _URL);
+
+    _sending = YES;
+    [[HTTPClient sharedClient] sendRequest:request
+                                completion:^(NSHTTPURLResponse* response, NSData* data, NSError* error) {
+                                    dispatch_async(_queue, ^{
+                                        [self didSendBatchWithEnd:end response:response error:error];
+                                    });
+                                }];
+}
+
+- (void)didSendBatchWithEnd:(unsigned long long)end
+                   response:(NSHTTPURLResponse*)response
+                      error:(NSError*)error
+{
+    _sending = NO;
+
+    // 4xxはリクエスト自体が不正なので、再送せずに捨てる。(408, 429は除く)
+    NSInteger status = response.statusCode;
+    BOOL success  = (nil == error && status >= 200 && status < 300);
+    BOOL rejected = (nil == error && status >= 400 && status < 500 && status != 408 && status != 429);
+
+    if (success || rejected) {
+        if (rejected) dmsg(@"batch rejected: %ld", (long)status);
+        _attempt = 0;
+        [self commitOffset:end];
+        [self schedule];
+        return;
+    }
+
+    // 失敗した場合は、間隔を倍々に伸ばし、半分はランダムにずらして再送する。
+    // (多数の端末が同時に再送しないように)
+    NSTimeInterval interval = MIN(PostQueueBaseRetryInterval * ldexp(1.0, (int)MIN(_attempt, 30)),
+                                  _maxRetryInterval);
+    interval = interval * 0.5 + interval * 0.5 * (arc4random_uniform(1000) / 1000.0);
+    _attempt++;
+    _retrying = YES;
+    dmsg(@"batch failed (%@ %ld), retry after %.1f sec", error, (long)status, interval);
+    [self armTimer:interval];
+}
+
+/*
+ * 未送信のレコードの量に応じて、すぐに送信するか送信を予約する。
+ */
+- (void)schedule {
+    if (_sending || _retrying) return;
+
+    unsigned long long pending = _journalSize - _offset;
+    if (pending >= _maxBatchBytes) {
+        [self sendBatch];
+    }
+    else if (pending > 0 && NO == _timerArmed) {
+        [self armTimer:_flushInterval];
+    }
+}
+
+
+#pragma mark Public methods
+
+- (unsigned long long)pendingBytes {
+    __block unsigned long long pending = 0;
+    dispatch_sync(_queue, ^{
+        pending = _journalSize - _offset;
+    });
+    return pending;
+}
+
+- (void)enqueueRecord:(NSData*)record {
+    NSData* copied = [record copy];
+    dispatch_async(_queue, ^{
+        // ヘッダとレコードを一度に書き込む。
+        PostQueueRecordHeader size = (PostQueueRecordHeader)copied.length;
+        NSMutableData* entry = [NSMutableData dataWithCapacity:sizeof(size) + size];
+        [entry appendBytes:&size length:sizeof(size)];
+        [entry appendData:copied];
+
+        [_journal seekToFileOffset:_journalSize];
+        [_journal writeData:entry];
+        _journalSize += entry.length;
+
+        [self schedule];
+    });
+}
+
+- (void)flush {
+    dispatch_async(_queue, ^{
+        [self sendBatch];
+    });
+}
+
+@end
@@ -0,0 +1,253 @@
+/*
+ *  pqstub
+ *
+ *  PostQueueの送信先の代わりになる、PC(Linux, Mac)上のスタブのエンドポイント。
+ *  受け取ったバッチを展開してレコード数を数え、前回からの間隔と一緒に表示する。
+ *  一定の割合でエラーを返し、再送(指数バックオフ)の動きも確かめられる。
+ *
+ *      $ cc -O2 -o pqstub pqstub.c -lz
+ *      $ ./pqstub -p 8080 -f 3 -o records.txt
+ *
+ *      (シミュレータのアプリから http://127.0.0.1:8080/ へ送信する)
+ *
+ *      $ sort records.txt | uniq -d     (重複して届いたレコード)
+ *
+ *      -p port   待ち受けるポート (初期値は8080)
+ *      -f n      n回に1回エラーを返す (初期値は0で、常に200)
+ *      -s code   エラーの時のステータス (初期値は503)
+ *      -o file   受け取ったレコードを一行ずつ追記する
+ *
+ *  Created by tyabuta on 2014/06/03.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+
+#define HEADER_MAX (16 * 1024)
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: pqstub [-p port] [-f n] [-s status] [-o file]\n");
+    exit(2);
+}
+
+/*
+ * ヘッダの値を探す。(大文字小文字を区別しない)
+ */
+static const char* findHeader(const char* headers, const char* name){
+    size_t length = strlen(name);
+    for (const char* line = headers; line && *line; ) {
+        if (0 == strncasecmp(line, name, length) && ':' == line[length]) {
+            const char* value = line + length + 1;
+            while (' ' == *value) value++;
+            return value;
+        }
+        line = strstr(line, "\r\n");
+        if (line) line += 2;
+    }
+    return NULL;
+}
+
+/*
+ * gzipを展開する。失敗時はNULL
+ */
+static unsigned char* inflateBody(const unsigned char* body, size_t length, size_t* outLength){
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // windowBitsに32を足すとgzip, zlibのヘッダを自動で判別する。
+    if (Z_OK != inflateInit2(&stream, 15 + 32)) return NULL;
+
+    size_t         capacity = length * 4 + 1024;
+    unsigned char* output   = malloc(capacity);
+    stream.next_in  = (Bytef*)body;
+    stream.avail_in = (uInt)length;
+
+    int status = Z_OK;
+    while (output && Z_OK == status) {
+        if (stream.total_out == capacity) {
+            capacity *= 2;
+            unsigned char* grown = realloc(output, capacity);
+            if (NULL == grown) { free(output); output = NULL; break; }
+            output = grown;
+        }
+        stream.next_out  = output + stream.total_out;
+        stream.avail_out = (uInt)(capacity - stream.total_out);
+        status = inflate(&stream, Z_NO_FLUSH);
+    }
+    *outLength = stream.total_out;
+    inflateEnd(&stream);
+    if (Z_STREAM_END != status) {
+        free(output);
+        return NULL;
+    }
+    return output;
+}
+
+static void respond(int fd, int status, const char* reason){
+    char response[256];
+    int  length = snprintf(response, sizeof(response),
+                           "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                           status, reason);
+    if (write(fd, response, length) < 0) perror("write");
+}
+
+/*
+ * 一つの接続からリクエストを一つ読む。ボディを返し、読めなければNULL
+ */
+static unsigned char* readRequest(int fd, char* headers, size_t* bodyLength, int* gzip){
+    size_t used = 0;
+    char*  end  = NULL;
+    while (NULL == end) {
+        if (used == HEADER_MAX - 1) return NULL;
+        ssize_t n = read(fd, headers + used, HEADER_MAX - 1 - used);
+        if (n <= 0) return NULL;
+        used += n;
+        headers[used] = '\0';
+        end = strstr(headers, "\r\n\r\n");
+    }
+
+    const char* contentLength = findHeader(headers, "Content-Length");
+    if (NULL == contentLength) return NULL;
+    const char* encoding = findHeader(headers, "Content-Encoding");
+    *gzip       = (encoding && 0 == strncasecmp(encoding, "gzip", 4));
+    *bodyLength = strtoul(contentLength, NULL, 10);
+
+    unsigned char* body     = malloc(*bodyLength + 1);
+    size_t         received = used - (end + 4 - headers);
+    if (NULL == body) return NULL;
+    memcpy(body, end + 4, received);
+    while (received < *bodyLength) {
+        ssize_t n = read(fd, body + received, *bodyLength - received);
+        if (n <= 0) {
+            free(body);
+            return NULL;
+        }
+        received += n;
+    }
+    *end = '\0';
+    return body;
+}
+
+int main(int argc, char* argv[]){
+    int         port       = 8080;
+    int         failEvery  = 0;
+    int         failStatus = 503;
+    const char* outputPath = NULL;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "p:f:s:o:"))) {
+        switch (opt) {
+            case 'p': port       = atoi(optarg); break;
+            case 'f': failEvery  = atoi(optarg); break;
+            case 's': failStatus = atoi(optarg); break;
+            case 'o': outputPath = optarg; break;
+            default:  usage();
+        }
+    }
+    if (optind != argc) usage();
+
+    FILE* output = NULL;
+    if (outputPath && NULL == (output = fopen(outputPath, "a"))) {
+        perror(outputPath);
+        return 1;
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes      = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (0 != bind(listener, (struct sockaddr*)&address, sizeof(address)) || 0 != listen(listener, 16)) {
+        perror("bind");
+        return 1;
+    }
+    printf("listening on 127.0.0.1:%d\n", port);
+    fflush(stdout);
+
+    static char headers[HEADER_MAX];
+    unsigned long long requests = 0, records = 0, wireBytes = 0, rawBytes = 0;
+    double last = 0.0;
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) continue;
+
+        size_t         length = 0;
+        int            gzip   = 0;
+        unsigned char* body   = readRequest(fd, headers, &length, &gzip);
+        if (NULL == body) {
+            respond(fd, 400, "Bad Request");
+            close(fd);
+            continue;
+        }
+
+        double now      = nowSec();
+        double interval = (last > 0.0)? now - last : 0.0;
+        last = now;
+        requests++;
+
+        // 指定回数毎に失敗させて、再送を確かめる。
+        if (failEvery > 0 && 0 == requests % failEvery) {
+            printf("#%llu  +%.1fs  %zu bytes -> %d\n", requests, interval, length, failStatus);
+            respond(fd, failStatus, "Stub Failure");
+            free(body);
+            close(fd);
+            fflush(stdout);
+            continue;
+        }
+
+        size_t         rawLength = length;
+        unsigned char* raw       = body;
+        if (gzip && NULL == (raw = inflateBody(body, length, &rawLength))) {
+            printf("#%llu  +%.1fs  %zu bytes: broken gzip\n", requests, interval, length);
+            respond(fd, 400, "Bad Request");
+            free(body);
+            close(fd);
+            continue;
+        }
+
+        // レコードは改行で区切られている。
+        unsigned long long count = (rawLength > 0)? 1 : 0;
+        for (size_t i = 0; i < rawLength; i++) {
+            if ('\n' == raw[i]) count++;
+        }
+        if (output && rawLength > 0) {
+            fwrite(raw, 1, rawLength, output);
+            fputc('\n', output);
+            fflush(output);
+        }
+
+        records   += count;
+        wireBytes += length;
+        rawBytes  += rawLength;
+        printf("#%llu  +%.1fs  %zu -> %zu bytes%s, %llu records  (total %llu records, %.1f%% of raw)\n",
+               requests, interval, rawLength, length, gzip? " gzip" : "", count, records,
+               rawBytes? 100.0 * wireBytes / rawBytes : 100.0);
+        fflush(stdout);
+
+        respond(fd, 200, "OK");
+        if (raw != body) free(raw);
+        free(body);
+        close(fd);
+    }
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+  ResourceArchive 1.0.0.0
+
+                         一つのファイルにまとめたリソースの読み込み
+
+   rapackで作成したアーカイブをmmapし、名前またはディレクトリで
+   リソースを取り出す。ファイル一覧の作成や個別のopenを行わないので、
+   リソースの数が多くても起動時の負担にならない。
+
+   名前の検索は完全ハッシュなので、文字列の比較は一度だけで済む。
+   圧縮されていないエントリはコピーせずに、マップした領域をそのまま返す。
+   返したNSDataが残っている間は、アーカイブも解放されない。
+
+       $ cc -O2 -o rapack rapack.c -lz
+       $ ./rapack -z -o Resources.rar Resources
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_RESOURCE_ARCHIVE_H
+#define TYABUTA_RESOURCE_ARCHIVE_H
+
+#import <Foundation/Foundation.h>
+
+
+@interface ResourceArchive : NSObject
+
+/*
+ * バンドルに含まれる Resources.rar (無い場合はnil)
+ */
++ (ResourceArchive*)mainArchive;
+
+/*
+ * アーカイブを開く。形式が正しくない場合はnilを返す。
+ */
+- (id)initWithPath:(NSString*)path;
+
+/*
+ * アーカイブのパス
+ */
+@property(nonatomic, readonly) NSString* path;
+
+/*
+ * エントリ数
+ */
+@property(nonatomic, readonly) NSUInteger count;
+
+/*
+ * 指定した名前のエントリがあるか。
+ */
+- (BOOL)containsName:(NSString*)name;
+
+/*
+ * 指定した名前のデータを取得する。無い場合はnilを返す。
+ * 圧縮されたエントリは、展開したデータを返す。
+ */
+- (NSData*)dataForName:(NSString*)name;
+
+/*
+ * マップされた領域を直接参照する。(NSDataも作らない)
+ * 無い場合と、圧縮されたエントリの場合はNULLを返す。
+ * ポインタはアーカイブが解放されるまで有効。
+ */
+- (const void*)bytesForName:(const char*)name length:(size_t*)length;
+
+/*
+ * エントリのデータが格納されているファイル内の範囲(先読み用)
+ * 無い場合はlocationがNSNotFoundになる。
+ */
+- (NSRange)fileRangeForName:(NSString*)name;
+
+/*
+ * 名前がprefixで始まるエントリの名前を、名前順で取得する。
+ * ディレクトリを指定する場合は "images/" のように末尾に"/"を付ける。
+ */
+- (NSArray*)namesWithPrefix:(NSString*)prefix;
+
+/*
+ * 名前がprefixで始まるエントリを、名前順で列挙する。
+ */
+- (void)enumerateDataWithPrefix:(NSString*)prefix
+                     usingBlock:(void (^)(NSString* name, NSData* data, BOOL* stop))block;
+
+@end
+
+
+#endif // TYABUTA_RESOURCE_ARCHIVE_H
@@ -0,0 +1,261 @@
+//
+//  ResourceArchive
+//
+//  Created by tyabuta on 2014/06/21.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "ResourceArchive.h"
+#import "ResourceArchiveFormat.h"
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <zlib.h>
+
+
+/*
+ * デバックログ用のマクロ、リリース時は何もおこらないようになる。
+ * Tips: __VA_ARGS__ の前に##を付けると、引数ゼロでもコンパイルが通る。
+ */
+#ifdef DEBUG
+#define dmsg(fmt, ...) NSLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#else
+#define dmsg(...)
+#endif
+
+
+
+
+@implementation ResourceArchive
+{
+    const uint8_t*      _map;
+    size_t              _mapSize;
+
+    const RAFileHeader* _header;
+    const uint32_t*     _seeds;
+    const RAEntry*      _entries;
+    const uint32_t*     _sorted;
+    const char*         _names;
+}
+
++ (ResourceArchive*)mainArchive {
+    static ResourceArchive* archive = nil;
+    static dispatch_once_t  once;
+    dispatch_once(&once, ^{
+        NSString* path = [[NSBundle mainBundle] pathForResource:@"Resources" ofType:@"rar"];
+        if (path) archive = [[ResourceArchive alloc] initWithPath:path];
+    });
+    return archive;
+}
+
+- (id)initWithPath:(NSString*)path {
+    self = [super init];
+    if (self) {
+        int fd = open([path fileSystemRepresentation], O_RDONLY);
+        if (fd < 0) return nil;
+
+        struct stat st;
+        if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(RAFileHeader)) {
+            close(fd);
+            return nil;
+        }
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (MAP_FAILED == map) return nil;
+
+        _map     = (const uint8_t*)map;
+        _mapSize = (size_t)st.st_size;
+        _path    = [path copy];
+        if (NO == [self validate]) {
+            dmsg(@"invalid archive: %@", path);
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_map) munmap((void*)_map, _mapSize);
+}
+
+/*
+ * ヘッダを確認し、各テーブルの位置を求める。
+ */
+- (BOOL)validate {
+    const RAFileHeader* header = (const RAFileHeader*)_map;
+    if (RA_MAGIC != header->magic || RA_VERSION != header->version) return NO;
+    if (0 == header->bucketCount || header->slotCount < header->entryCount) return NO;
+
+    uint64_t size = _mapSize;
+    if (header->seedsOffset   + sizeof(uint32_t) * (uint64_t)header->bucketCount > size ||
+        header->entriesOffset + sizeof(RAEntry)  * (uint64_t)header->slotCount   > size ||
+        header->sortedOffset  + sizeof(uint32_t) * (uint64_t)header->entryCount  > size ||
+        header->namesOffset   > size ||
+        header->entriesOffset % 8) {
+        return NO;
+    }
+
+    _header  = header;
+    _seeds   = (const uint32_t*)(_map + header->seedsOffset);
+    _entries = (const RAEntry*)(_map + header->entriesOffset);
+    _sorted  = (const uint32_t*)(_map + header->sortedOffset);
+    _names   = (const char*)(_map + header->namesOffset);
+
+    // 参照する範囲がファイル内に収まっているか。(壊れたファイルで落ちないように)
+    uint64_t namesSize = size - header->namesOffset;
+    for (uint32_t i = 0; i < header->slotCount; i++) {
+        const RAEntry* entry = &_entries[i];
+        if (0 == entry->nameLength) continue;
+        if (entry->offset + entry->size > size ||
+            (uint64_t)entry->nameOffset + entry->nameLength >= namesSize) {
+            return NO;
+        }
+    }
+    for (uint32_t i = 0; i < header->entryCount; i++) {
+        if (_sorted[i] >= header->slotCount) return NO;
+    }
+    return YES;
+}
+
+- (NSUInteger)count {
+    return _header->entryCount;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Lookup
+ -----------------------------------------------------------------------------*/
+#pragma mark - Lookup
+
+/*
+ * 名前からエントリを探す。無い場合はNULL
+ */
+- (const RAEntry*)entryForName:(const char*)name length:(size_t)length {
+    uint64_t       hash  = RAHash(name, length);
+    uint32_t       seed  = _seeds[hash % _header->bucketCount];
+    const RAEntry* entry = &_entries[RAHashSlot(hash, seed) % _header->slotCount];
+
+    // 完全ハッシュは登録した名前でしか衝突しないので、一度の比較で確定する。
+    if (entry->nameLength != length || entry->hash != (uint32_t)hash) return NULL;
+    if (0 != memcmp(_names + entry->nameOffset, name, length)) return NULL;
+    return entry;
+}
+
+- (const RAEntry*)entryForName:(NSString*)name {
+    const char* str = [name UTF8String];
+    if (NULL == str) return NULL;
+    return [self entryForName:str length:strlen(str)];
+}
+
+/*
+ * エントリのデータを作る。圧縮されていなければコピーしない。
+ */
+- (NSData*)dataForEntry:(const RAEntry*)entry {
+    const void* bytes = _map + entry->offset;
+
+    if (0 == (entry->flags & RA_FLAG_DEFLATE)) {
+        // NSDataが残っている間、マップを解放させない。
+        ResourceArchive* archive = self;
+        return [[NSData alloc] initWithBytesNoCopy:(void*)bytes
+                                            length:entry->size
+                                       deallocator:^(void* ptr, NSUInteger length) {
+                                           (void)archive;
+                                       }];
+    }
+
+    NSMutableData* data = [NSMutableData dataWithLength:entry->originalSize];
+    uLongf length = entry->originalSize;
+    if (Z_OK != uncompress((Bytef*)data.mutableBytes, &length, (const Bytef*)bytes, entry->size) ||
+        length != entry->originalSize) {
+        dmsg(@"broken entry: %.*s", entry->nameLength, _names + entry->nameOffset);
+        return nil;
+    }
+    return data;
+}
+
+- (NSString*)nameForEntry:(const RAEntry*)entry {
+    return [[NSString alloc] initWithBytes:_names + entry->nameOffset
+                                    length:entry->nameLength
+                                  encoding:NSUTF8StringEncoding];
+}
+
+- (BOOL)containsName:(NSString*)name {
+    return NULL != [self entryForName:name];
+}
+
+- (NSRange)fileRangeForName:(NSString*)name {
+    const RAEntry* entry = [self entryForName:name];
+    if (NULL == entry) return NSMakeRange(NSNotFound, 0);
+    return NSMakeRange((NSUInteger)entry->offset, entry->size);
+}
+
+- (NSData*)dataForName:(NSString*)name {
+    const RAEntry* entry = [self entryForName:name];
+    if (NULL == entry) return nil;
+    return [self dataForEntry:entry];
+}
+
+- (const void*)bytesForName:(const char*)name length:(size_t*)length {
+    const RAEntry* entry = [self entryForName:name length:strlen(name)];
+    if (NULL == entry || (entry->flags & RA_FLAG_DEFLATE)) return NULL;
+    if (length) *length = entry->size;
+    return _map + entry->offset;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Prefix
+ -----------------------------------------------------------------------------*/
+#pragma mark - Prefix
+
+/*
+ * 名前順の索引から、prefixで始まる範囲を二分探索で求める。
+ */
+- (NSRange)sortedRangeForPrefix:(NSString*)prefix {
+    const char* str    = [prefix UTF8String] ?: "";
+    size_t      length = strlen(str);
+
+    uint32_t low = 0, high = _header->entryCount;
+    while (low < high) {
+        uint32_t       mid   = low + (high - low) / 2;
+        const RAEntry* entry = &_entries[_sorted[mid]];
+        size_t         n     = MIN(length, (size_t)entry->nameLength);
+        int            cmp   = memcmp(_names + entry->nameOffset, str, n);
+        if (cmp < 0 || (0 == cmp && entry->nameLength < length)) low = mid + 1;
+        else high = mid;
+    }
+
+    uint32_t end = low;
+    while (end < _header->entryCount) {
+        const RAEntry* entry = &_entries[_sorted[end]];
+        if (entry->nameLength < length || 0 != memcmp(_names + entry->nameOffset, str, length)) break;
+        end++;
+    }
+    return NSMakeRange(low, end - low);
+}
+
+- (NSArray*)namesWithPrefix:(NSString*)prefix {
+    NSRange range = [self sortedRangeForPrefix:prefix];
+    NSMutableArray* names = [NSMutableArray arrayWithCapacity:range.length];
+    for (NSUInteger i = range.location; i < NSMaxRange(range); i++) {
+        [names addObject:[self nameForEntry:&_entries[_sorted[i]]]];
+    }
+    return names;
+}
+
+- (void)enumerateDataWithPrefix:(NSString*)prefix
+                     usingBlock:(void (^)(NSString* name, NSData* data, BOOL* stop))block {
+    NSRange range = [self sortedRangeForPrefix:prefix];
+    BOOL    stop  = NO;
+    for (NSUInteger i = range.location; i < NSMaxRange(range) && NO == stop; i++) {
+        const RAEntry* entry = &_entries[_sorted[i]];
+        @autoreleasepool {
+            block([self nameForEntry:entry], [self dataForEntry:entry], &stop);
+        }
+    }
+}
+
+@end
@@ -0,0 +1,111 @@
+/*******************************************************************************
+  ResourceArchiveFormat 1.0.0.0
+
+                         リソースアーカイブのファイル形式
+
+   アプリ(ResourceArchive.m)とパッカー(rapack.c)で共有する定義。
+   Objective-Cに依存しない素のCで書く事。
+
+   ファイルの構成:
+       [RAFileHeader 64byte]
+       [seed       uint32 x bucketCount]  バケット毎のハッシュのシード
+       [RAEntry    32byte x slotCount]    スロット順のエントリ(空きはnameLength=0)
+       [sorted     uint32 x entryCount]   名前順に並べたスロット番号
+       [names      名前文字列(終端文字付き)]
+       [data       alignment毎に揃えた各エントリのデータ]
+
+   名前の検索は CHD(hash and displace) による完全ハッシュで行う。
+       h    = RAHash(name)
+       slot = RAHashSlot(h, seed[h % bucketCount]) % slotCount
+   同じスロットに別の名前が入る事は無いので、比較は一度で済む。
+   数値は全てリトルエンディアンで保存される。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_RESOURCE_ARCHIVE_FORMAT_H
+#define TYABUTA_RESOURCE_ARCHIVE_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * ファイルの識別子 "RAR1"
+ */
+#define RA_MAGIC   0x31524152u
+#define RA_VERSION 1
+
+/*
+ * エントリのフラグ
+ */
+#define RA_FLAG_DEFLATE 0x0001  // zlib形式で圧縮されている
+
+
+/*
+ * ファイルヘッダ
+ * 各テーブルの位置はファイル先頭からのオフセット
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t slotCount;
+    uint32_t bucketCount;
+    uint32_t alignment;       // データの境界(2の累乗)
+    uint64_t seedsOffset;
+    uint64_t entriesOffset;
+    uint64_t sortedOffset;
+    uint64_t namesOffset;
+    uint64_t dataOffset;
+} RAFileHeader;
+
+/*
+ * エントリ
+ */
+typedef struct {
+    uint64_t offset;          // データの位置
+    uint32_t size;            // 格納されているサイズ
+    uint32_t originalSize;    // 展開後のサイズ
+    uint32_t nameOffset;      // namesからの位置
+    uint16_t nameLength;      // 終端文字を含まない長さ(0は空きスロット)
+    uint16_t flags;
+    uint32_t crc;             // 展開後のデータのCRC32
+    uint32_t hash;            // RAHashの下位32bit(比較前の絞り込み用)
+} RAEntry;
+
+
+/*
+ * 名前のハッシュ (FNV-1a 64bit)
+ */
+static inline uint64_t RAHash(const char* name, size_t length){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/*
+ * シードでハッシュを混ぜ直し、スロットの候補を作る。(MurmurHash3の最終処理)
+ */
+static inline uint64_t RAHashSlot(uint64_t h, uint32_t seed){
+    h ^= (uint64_t)seed * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+/*
+ * 構造体のサイズをコンパイル時に確認する。
+ */
+typedef char RAFileHeaderSizeCheck[(sizeof(RAFileHeader) == 64)? 1 : -1];
+typedef char RAEntrySizeCheck[(sizeof(RAEntry) == 32)? 1 : -1];
+
+
+#endif // TYABUTA_RESOURCE_ARCHIVE_FORMAT_H
@@ -0,0 +1,385 @@
+/*
+ *  rapack
+ *
+ *  ディレクトリ以下のファイルを一つのリソースアーカイブにまとめる。
+ *  ビルド時にPC(Mac, Linux)上で実行する為のツール。
+ *
+ *      $ cc -O2 -o rapack rapack.c -lz
+ *      $ ./rapack -z -o Resources.rar Resources
+ *
+ *      -o file   出力するアーカイブ (必須)
+ *      -a n      データの境界 (2の累乗, 初期値16)
+ *      -z        小さくなるファイルをzlibで圧縮する (png, jpg等は除く)
+ *
+ *  エントリ名はディレクトリからの相対パス("/"区切り)になる。
+ *  ドットで始まるファイルとディレクトリは含めない。
+ *  リトルエンディアンの環境でのみ動作する。
+ *
+ *  Created by tyabuta on 2014/06/21.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "ResourceArchiveFormat.h"
+
+
+typedef struct {
+    char*    name;
+    size_t   length;
+    uint64_t hash;
+    uint32_t slot;
+} PackItem;
+
+static PackItem* items     = NULL;
+static size_t    itemCount = 0;
+static size_t    itemAlloc = 0;
+
+
+/*------------------------------------------------------------------------------
+ Utility
+ -----------------------------------------------------------------------------*/
+
+static void* xmalloc(size_t size){
+    void* p = calloc(1, size ? size : 1);
+    if (NULL == p) {
+        fprintf(stderr, "rapack: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment){
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static int compareName(const void* a, const void* b){
+    return strcmp(((const PackItem*)a)->name, ((const PackItem*)b)->name);
+}
+
+/*
+ * 既に圧縮されている形式は、圧縮を試さない。
+ */
+static int isCompressedFormat(const char* name){
+    static const char* extensions[] = {
+        ".png", ".jpg", ".jpeg", ".gif", ".m4a", ".mp3", ".aac", ".mp4", ".mov",
+        ".gz", ".zip", ".pvr", ".pvrtc",
+    };
+    const char* dot = strrchr(name, '.');
+    if (NULL == dot) return 0;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (0 == strcasecmp(dot, extensions[i])) return 1;
+    }
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------------
+ Collect files
+ -----------------------------------------------------------------------------*/
+
+static void addItem(const char* name){
+    if (itemCount == itemAlloc) {
+        itemAlloc = itemAlloc ? itemAlloc * 2 : 256;
+        items = (PackItem*)realloc(items, sizeof(PackItem) * itemAlloc);
+        if (NULL == items) {
+            fprintf(stderr, "rapack: out of memory\n");
+            exit(1);
+        }
+    }
+    PackItem* item = &items[itemCount++];
+    item->name   = strdup(name);
+    item->length = strlen(name);
+    item->hash   = RAHash(name, item->length);
+    item->slot   = 0;
+    if (item->length > UINT16_MAX) {
+        fprintf(stderr, "rapack: name too long: %s\n", name);
+        exit(1);
+    }
+}
+
+/*
+ * rootからの相対パスでファイルを集める。
+ */
+static void collect(const char* root, const char* relative){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%s%s", root, *relative ? "/" : "", relative);
+
+    DIR* dir = opendir(path);
+    if (NULL == dir) {
+        perror(path);
+        exit(1);
+    }
+
+    struct dirent* ent;
+    while (NULL != (ent = readdir(dir))) {
+        if ('.' == ent->d_name[0]) continue;
+
+        char name[2048];
+        snprintf(name, sizeof(name), "%s%s%s", relative, *relative ? "/" : "", ent->d_name);
+        snprintf(path, sizeof(path), "%s/%s", root, name);
+
+        struct stat st;
+        if (0 != stat(path, &st)) {
+            perror(path);
+            exit(1);
+        }
+        if (S_ISDIR(st.st_mode)) {
+            collect(root, name);
+        }
+        else if (S_ISREG(st.st_mode)) {
+            addItem(name);
+        }
+    }
+    closedir(dir);
+}
+
+
+/*------------------------------------------------------------------------------
+ Perfect hash (CHD)
+ -----------------------------------------------------------------------------*/
+
+typedef struct {
+    uint32_t  bucket;
+    uint32_t  count;
+    uint32_t* members;        // itemsの番号
+} PackBucket;
+
+static int compareBucketSize(const void* a, const void* b){
+    const PackBucket* x = (const PackBucket*)a;
+    const PackBucket* y = (const PackBucket*)b;
+    if (x->count != y->count) return (x->count < y->count)? 1 : -1;
+    return (x->bucket < y->bucket)? -1 : (x->bucket > y->bucket)? 1 : 0;
+}
+
+/*
+ * 大きいバケットから順に、全員が空きスロットに収まるシードを探す。
+ * 見つからなければ0を返す。(スロット数を増やしてやり直す)
+ */
+static int buildPerfectHash(uint32_t bucketCount, uint32_t slotCount, uint32_t* seeds){
+    PackBucket* buckets = (PackBucket*)xmalloc(sizeof(PackBucket) * bucketCount);
+    for (uint32_t b = 0; b < bucketCount; b++) {
+        buckets[b].bucket  = b;
+        buckets[b].members = (uint32_t*)xmalloc(sizeof(uint32_t) * itemCount);
+    }
+    for (size_t i = 0; i < itemCount; i++) {
+        PackBucket* bucket = &buckets[items[i].hash % bucketCount];
+        bucket->members[bucket->count++] = (uint32_t)i;
+    }
+    qsort(buckets, bucketCount, sizeof(PackBucket), compareBucketSize);
+
+    uint8_t*  used  = (uint8_t*)xmalloc(slotCount);
+    uint32_t* slots = (uint32_t*)xmalloc(sizeof(uint32_t) * itemCount);
+    int       ok    = 1;
+
+    for (uint32_t b = 0; ok && b < bucketCount; b++) {
+        PackBucket* bucket = &buckets[b];
+        if (0 == bucket->count) break;
+
+        uint32_t seed = 0;
+        for (;; seed++) {
+            if (seed > (1u << 20)) {
+                ok = 0;
+                break;
+            }
+            uint32_t k = 0;
+            for (; k < bucket->count; k++) {
+                uint32_t slot = (uint32_t)(RAHashSlot(items[bucket->members[k]].hash, seed) % slotCount);
+                if (used[slot]) break;
+                // 同じバケット内での衝突
+                uint32_t j = 0;
+                while (j < k && slots[j] != slot) j++;
+                if (j < k) break;
+                slots[k] = slot;
+            }
+            if (k == bucket->count) break;
+        }
+        if (!ok) break;
+
+        seeds[bucket->bucket] = seed;
+        for (uint32_t k = 0; k < bucket->count; k++) {
+            used[slots[k]] = 1;
+            items[bucket->members[k]].slot = slots[k];
+        }
+    }
+
+    for (uint32_t b = 0; b < bucketCount; b++) free(buckets[b].members);
+    free(buckets);
+    free(used);
+    free(slots);
+    return ok;
+}
+
+
+/*------------------------------------------------------------------------------
+ Write
+ -----------------------------------------------------------------------------*/
+
+static unsigned char* readFile(const char* path, size_t* size){
+    FILE* fp = fopen(path, "rb");
+    if (NULL == fp) {
+        perror(path);
+        exit(1);
+    }
+    struct stat st;
+    fstat(fileno(fp), &st);
+    if ((uint64_t)st.st_size > UINT32_MAX) {
+        fprintf(stderr, "rapack: file too large: %s\n", path);
+        exit(1);
+    }
+    unsigned char* buffer = (unsigned char*)xmalloc((size_t)st.st_size);
+    *size = fread(buffer, 1, (size_t)st.st_size, fp);
+    fclose(fp);
+    return buffer;
+}
+
+static void writeAt(FILE* fp, uint64_t offset, const void* data, size_t size){
+    if (0 != fseeko(fp, (off_t)offset, SEEK_SET) || size != fwrite(data, 1, size, fp)) {
+        perror("rapack: write");
+        exit(1);
+    }
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: rapack [-z] [-a alignment] -o output directory\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    const char* output    = NULL;
+    uint32_t    alignment = 16;
+    int         deflate   = 0;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "o:a:z"))) {
+        switch (opt) {
+            case 'o': output    = optarg; break;
+            case 'a': alignment = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'z': deflate   = 1; break;
+            default:  usage();
+        }
+    }
+    if (NULL == output || optind + 1 != argc) usage();
+    if (alignment < 8 || (alignment & (alignment - 1))) {
+        fprintf(stderr, "rapack: alignment must be a power of two (>= 8)\n");
+        return 2;
+    }
+
+    const char* root = argv[optind];
+    collect(root, "");
+    if (0 == itemCount) {
+        fprintf(stderr, "rapack: no files in %s\n", root);
+        return 1;
+    }
+    qsort(items, itemCount, sizeof(PackItem), compareName);
+
+    // バケットあたり平均4件、スロットの使用率は約95%
+    uint32_t  bucketCount = (uint32_t)((itemCount + 3) / 4);
+    uint32_t  slotCount   = (uint32_t)(itemCount + itemCount / 20 + 1);
+    uint32_t* seeds       = (uint32_t*)xmalloc(sizeof(uint32_t) * bucketCount);
+    while (!buildPerfectHash(bucketCount, slotCount, seeds)) {
+        slotCount += slotCount / 10 + 1;
+    }
+
+    // テーブルの配置
+    size_t namesSize = 0;
+    for (size_t i = 0; i < itemCount; i++) namesSize += items[i].length + 1;
+
+    RAFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic         = RA_MAGIC;
+    header.version       = RA_VERSION;
+    header.entryCount    = (uint32_t)itemCount;
+    header.slotCount     = slotCount;
+    header.bucketCount   = bucketCount;
+    header.alignment     = alignment;
+    header.seedsOffset   = sizeof(RAFileHeader);
+    header.entriesOffset = alignUp(header.seedsOffset + sizeof(uint32_t) * bucketCount, 8);
+    header.sortedOffset  = header.entriesOffset + sizeof(RAEntry) * slotCount;
+    header.namesOffset   = header.sortedOffset + sizeof(uint32_t) * itemCount;
+    header.dataOffset    = alignUp(header.namesOffset + namesSize, alignment);
+
+    RAEntry*  entries = (RAEntry*)xmalloc(sizeof(RAEntry) * slotCount);
+    uint32_t* sorted  = (uint32_t*)xmalloc(sizeof(uint32_t) * itemCount);
+    char*     names   = (char*)xmalloc(namesSize);
+
+    char tmpPath[4096];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", output);
+    FILE* fp = fopen(tmpPath, "wb");
+    if (NULL == fp) {
+        perror(tmpPath);
+        return 1;
+    }
+
+    uint64_t offset         = header.dataOffset;
+    uint32_t nameOffset     = 0;
+    uint64_t totalOriginal  = 0;
+    size_t   compressedCount = 0;
+
+    for (size_t i = 0; i < itemCount; i++) {
+        PackItem* item  = &items[i];
+        RAEntry*  entry = &entries[item->slot];
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", root, item->name);
+        size_t         size = 0;
+        unsigned char* data = readFile(path, &size);
+
+        entry->offset       = offset;
+        entry->size         = (uint32_t)size;
+        entry->originalSize = (uint32_t)size;
+        entry->nameOffset   = nameOffset;
+        entry->nameLength   = (uint16_t)item->length;
+        entry->flags        = 0;
+        entry->crc          = (uint32_t)crc32(0L, data, (uInt)size);
+        entry->hash         = (uint32_t)item->hash;
+
+        // 1/8以上小さくならなければ、圧縮せずに格納する。(読み出し時にコピー不要)
+        unsigned char* stored = data;
+        unsigned char* packed = NULL;
+        if (deflate && size >= 256 && !isCompressedFormat(item->name)) {
+            uLongf packedSize = compressBound((uLong)size);
+            packed = (unsigned char*)xmalloc(packedSize);
+            if (Z_OK == compress2(packed, &packedSize, data, (uLong)size, Z_BEST_COMPRESSION) &&
+                packedSize < size - size / 8) {
+                stored       = packed;
+                entry->size  = (uint32_t)packedSize;
+                entry->flags = RA_FLAG_DEFLATE;
+                compressedCount++;
+            }
+        }
+        writeAt(fp, offset, stored, entry->size);
+
+        memcpy(names + nameOffset, item->name, item->length + 1);
+        nameOffset   += (uint32_t)item->length + 1;
+        sorted[i]     = item->slot;
+        offset        = alignUp(offset + entry->size, alignment);
+        totalOriginal += size;
+
+        free(packed);
+        free(data);
+    }
+
+    writeAt(fp, 0, &header, sizeof(header));
+    writeAt(fp, header.seedsOffset,   seeds,   sizeof(uint32_t) * bucketCount);
+    writeAt(fp, header.entriesOffset, entries, sizeof(RAEntry) * slotCount);
+    writeAt(fp, header.sortedOffset,  sorted,  sizeof(uint32_t) * itemCount);
+    writeAt(fp, header.namesOffset,   names,   namesSize);
+
+    if (0 != fclose(fp) || 0 != rename(tmpPath, output)) {
+        perror(output);
+        unlink(tmpPath);
+        return 1;
+    }
+
+    printf("%s: %zu files (%zu compressed), %llu -> %llu bytes, %u slots, %u buckets\n",
+           output, itemCount, compressedCount,
+           (unsigned long long)totalOriginal, (unsigned long long)offset,
+           slotCount, bucketCount);
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+  ResourcePrefetcher 1.0.0.0
+
+                         起動時のリソース読み込みの先読み
+
+   起動中に読み込まれたリソースの順番と範囲をトレースファイルに記録し、
+   次回の起動時にはその順番で先読みを行う。
+   UIが要求するまで待たずにカーネルへ読み込みを依頼するので、
+   ページフォルトの待ち時間が直列に積み重ならなくなる。
+
+   画像として記録されたものは、バックグラウンドでデコードまで済ませておき
+   imageImmediateLoadWithContentsOfFile(macro.h)から受け取れるようにする。
+
+   トレースはテキストで、1行に1件
+       <種類 r|i> <offset> <length> <path>
+   pathはバンドルのリソースディレクトリからの相対パス。(外部は絶対パス)
+   lengthが0の場合はファイル全体を表す。
+
+   PC(Linux)上でページキャッシュを破棄した状態の読み込み時間を
+   比較するには rptrace を使う。
+
+       $ cc -O2 -o rptrace rptrace.c
+       # echo 3 > /proc/sys/vm/drop_caches
+       $ ./rptrace -r Resources ResourcePrefetcher.trace
+       # echo 3 > /proc/sys/vm/drop_caches
+       $ ./rptrace -p -r Resources ResourcePrefetcher.trace
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_RESOURCE_PREFETCHER_H
+#define TYABUTA_RESOURCE_PREFETCHER_H
+
+#import <UIKit/UIKit.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 記録するリソースの種類
+ */
+typedef enum {
+    ResourcePrefetchKindRead  = 'r',  // 先読みのみ
+    ResourcePrefetchKindImage = 'i',  // 先読みしてデコードする
+} ResourcePrefetchKind;
+
+/*
+ * 前回のトレースを先読みし、今回の起動の記録を開始する。
+ * application:didFinishLaunchingWithOptions: の最初で呼ぶ。
+ */
+void ResourcePrefetcherStart(NSString* tracePath);
+
+/*
+ * Library/Caches/ResourcePrefetcher.trace を使って開始する。
+ */
+void ResourcePrefetcherStartDefault(void);
+
+/*
+ * 記録を終了し、トレースを保存する。起動が完了した時点で呼ぶ。
+ * 使われなかったデコード済みの画像も解放される。
+ */
+void ResourcePrefetcherFinish(void);
+
+/*
+ * 読み込んだリソースを記録する。(記録中でなければ何もしない)
+ * lengthが0の場合はファイル全体。
+ */
+void ResourcePrefetcherRecord(ResourcePrefetchKind kind, NSString* path, uint64_t offset, uint64_t length);
+
+/*
+ * 記録中か。パスを求めるのに手間がかかる場合に、先に確認する。
+ */
+BOOL ResourcePrefetcherIsRecording(void);
+
+/*
+ * 先読みでデコード済みの画像があれば取り出す。無ければnil
+ * 一度取り出した画像は保持しない。
+ */
+UIImage* ResourcePrefetcherTakeImage(NSString* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_RESOURCE_PREFETCHER_H
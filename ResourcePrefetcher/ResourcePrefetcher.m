@@ -0,0 +1,275 @@
+//
+//  ResourcePrefetcher
+//
+//  Created by tyabuta on 2014/06/24.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "ResourcePrefetcher.h"
+#import <fcntl.h>
+#import <pthread.h>
+#import <sys/stat.h>
+
+
+/*
+ * デバックログ用のマクロ、リリース時は何もおこらないようになる。
+ * Tips: __VA_ARGS__ の前に##を付けると、引数ゼロでもコンパイルが通る。
+ */
+#ifdef DEBUG
+#define dmsg(fmt, ...) NSLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#else
+#define dmsg(...)
+#endif
+
+
+// トレースの1行目
+static NSString* const ResourcePrefetcherTraceHeader = @"# ResourcePrefetcher 1";
+
+// 記録するエントリ数の上限
+static const NSUInteger ResourcePrefetcherMaxEntries = 4096;
+
+// 先にデコードしておく画像の合計サイズの上限[byte]
+static const size_t ResourcePrefetcherDecodeLimit = 32 * 1024 * 1024;
+
+
+// 以下はResourcePrefetcherLockで保護する。
+static pthread_mutex_t      ResourcePrefetcherLock     = PTHREAD_MUTEX_INITIALIZER;
+static NSString*            ResourcePrefetcherPath     = nil;
+static NSMutableArray*      ResourcePrefetcherTrace    = nil;  // 記録中の行(記録中でなければnil)
+static NSMutableSet*        ResourcePrefetcherTraceSet = nil;  // 重複を除く為
+static NSMutableDictionary* ResourcePrefetcherImages   = nil;  // 相対パス -> デコード済みのUIImage
+static NSMutableSet*        ResourcePrefetcherTaken    = nil;  // 既に要求された相対パス
+static size_t               ResourcePrefetcherImageBytes = 0;
+static BOOL                 ResourcePrefetcherFinished = NO;
+
+static volatile BOOL        ResourcePrefetcherRecording = NO;
+
+
+
+
+/*------------------------------------------------------------------------------
+ Path
+ -----------------------------------------------------------------------------*/
+#pragma mark - Path
+
+/*
+ * バンドル内のパスは、リソースディレクトリからの相対パスにする。
+ * (アプリのコンテナのパスは起動毎に変わる事がある為)
+ */
+static NSString* ResourcePrefetcherRelativePath(NSString* path){
+    static NSString* root = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        root = [[[NSBundle mainBundle] resourcePath] stringByAppendingString:@"/"];
+    });
+    return [path hasPrefix:root]? [path substringFromIndex:root.length] : path;
+}
+
+static NSString* ResourcePrefetcherAbsolutePath(NSString* path){
+    if ([path isAbsolutePath]) return path;
+    return [[[NSBundle mainBundle] resourcePath] stringByAppendingPathComponent:path];
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Prefetch
+ -----------------------------------------------------------------------------*/
+#pragma mark - Prefetch
+
+/*
+ * カーネルに先読みを依頼する。読み込みの完了は待たない。
+ */
+static void ResourcePrefetcherAdvise(NSString* path, uint64_t offset, uint64_t length){
+    int fd = open([path fileSystemRepresentation], O_RDONLY);
+    if (fd < 0) return;
+
+    if (0 == length) {
+        struct stat st;
+        if (0 == fstat(fd, &st) && (uint64_t)st.st_size > offset) {
+            length = (uint64_t)st.st_size - offset;
+        }
+    }
+    if (length) {
+#ifdef F_RDADVISE
+        struct radvisory advice;
+        advice.ra_offset = (off_t)offset;
+        advice.ra_count  = (int)MIN(length, (uint64_t)INT_MAX);
+        fcntl(fd, F_RDADVISE, &advice);
+#else
+        posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+#endif
+    }
+    close(fd);
+}
+
+/*
+ * imageImmediateLoadWithContentsOfFile(macro.h)と同じ方法でデコードする。
+ */
+static UIImage* ResourcePrefetcherDecodeImage(NSString* path, size_t* bytes){
+    UIImage*   image    = [[UIImage alloc] initWithContentsOfFile:path];
+    CGImageRef imageRef = [image CGImage];
+    if (NULL == imageRef) return nil;
+
+    CGRect rect = CGRectMake(0.f, 0.f, CGImageGetWidth(imageRef), CGImageGetHeight(imageRef));
+    CGContextRef bitmapContext = CGBitmapContextCreate(NULL,
+                                                       rect.size.width,
+                                                       rect.size.height,
+                                                       CGImageGetBitsPerComponent(imageRef),
+                                                       CGImageGetBytesPerRow(imageRef),
+                                                       CGImageGetColorSpace(imageRef),
+                                                       CGImageGetBitmapInfo(imageRef)
+                                                       );
+    if (NULL == bitmapContext) return nil;
+
+    CGContextDrawImage(bitmapContext, rect, imageRef);
+    CGImageRef decompressedImageRef = CGBitmapContextCreateImage(bitmapContext);
+    UIImage*   decompressedImage    = [UIImage imageWithCGImage:decompressedImageRef];
+    *bytes = CGImageGetBytesPerRow(imageRef) * CGImageGetHeight(imageRef);
+    CGImageRelease(decompressedImageRef);
+    CGContextRelease(bitmapContext);
+    return decompressedImage;
+}
+
+/*
+ * トレースの順に先読みし、続けて画像をデコードする。
+ */
+static void ResourcePrefetcherReplay(NSArray* lines){
+    dispatch_queue_t queue = dispatch_queue_create("ResourcePrefetcher", DISPATCH_QUEUE_SERIAL);
+    dispatch_async(queue, ^{
+        NSMutableArray* images = [NSMutableArray array];
+
+        // 全ての先読みを先に依頼して、読み込みを重ねる。
+        for (NSString* line in lines) {
+            const char* str = [line UTF8String];
+            char kind = 0;
+            unsigned long long offset = 0, length = 0;
+            int pos = 0;
+            if (3 != sscanf(str, "%c %llu %llu %n", &kind, &offset, &length, &pos) || 0 == pos) continue;
+
+            NSString* relative = [NSString stringWithUTF8String:str + pos];
+            ResourcePrefetcherAdvise(ResourcePrefetcherAbsolutePath(relative), offset, length);
+            if (ResourcePrefetchKindImage == kind) [images addObject:relative];
+        }
+
+        // 要求される順にデコードしておく。
+        for (NSString* relative in images) {
+            @autoreleasepool {
+                pthread_mutex_lock(&ResourcePrefetcherLock);
+                BOOL finished = ResourcePrefetcherFinished ||
+                                ResourcePrefetcherImageBytes >= ResourcePrefetcherDecodeLimit;
+                BOOL taken    = [ResourcePrefetcherTaken containsObject:relative];
+                pthread_mutex_unlock(&ResourcePrefetcherLock);
+                if (finished) break;
+                if (taken) continue;
+
+                size_t   bytes = 0;
+                UIImage* image = ResourcePrefetcherDecodeImage(ResourcePrefetcherAbsolutePath(relative), &bytes);
+                if (nil == image) continue;
+
+                pthread_mutex_lock(&ResourcePrefetcherLock);
+                if (NO == ResourcePrefetcherFinished && NO == [ResourcePrefetcherTaken containsObject:relative]) {
+                    ResourcePrefetcherImages[relative] = image;
+                    ResourcePrefetcherImageBytes += bytes;
+                }
+                pthread_mutex_unlock(&ResourcePrefetcherLock);
+            }
+        }
+        dmsg(@"%lu entries, %lu images", (unsigned long)lines.count, (unsigned long)images.count);
+    });
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+#pragma mark - Public
+
+void ResourcePrefetcherStart(NSString* tracePath){
+    pthread_mutex_lock(&ResourcePrefetcherLock);
+    if (ResourcePrefetcherPath) {
+        pthread_mutex_unlock(&ResourcePrefetcherLock);
+        return;
+    }
+    ResourcePrefetcherPath       = [tracePath copy];
+    ResourcePrefetcherTrace      = [NSMutableArray array];
+    ResourcePrefetcherTraceSet   = [NSMutableSet set];
+    ResourcePrefetcherImages     = [NSMutableDictionary dictionary];
+    ResourcePrefetcherTaken      = [NSMutableSet set];
+    ResourcePrefetcherRecording  = YES;
+    pthread_mutex_unlock(&ResourcePrefetcherLock);
+
+    NSString* trace = [NSString stringWithContentsOfFile:tracePath encoding:NSUTF8StringEncoding error:nil];
+    NSArray*  lines = [trace componentsSeparatedByString:@"\n"];
+    if (lines.count > 1 && [lines[0] isEqualToString:ResourcePrefetcherTraceHeader]) {
+        ResourcePrefetcherReplay([lines subarrayWithRange:NSMakeRange(1, lines.count - 1)]);
+    }
+}
+
+void ResourcePrefetcherStartDefault(void){
+    NSString* caches = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,
+                                                           NSUserDomainMask,
+                                                           YES)[0];
+    ResourcePrefetcherStart([caches stringByAppendingPathComponent:@"ResourcePrefetcher.trace"]);
+}
+
+void ResourcePrefetcherFinish(void){
+    pthread_mutex_lock(&ResourcePrefetcherLock);
+    NSArray*  trace = ResourcePrefetcherTrace;
+    NSString* path  = ResourcePrefetcherPath;
+    ResourcePrefetcherRecording  = NO;
+    ResourcePrefetcherFinished   = YES;
+    ResourcePrefetcherTrace      = nil;
+    ResourcePrefetcherTraceSet   = nil;
+    ResourcePrefetcherTaken      = nil;
+    [ResourcePrefetcherImages removeAllObjects];
+    ResourcePrefetcherImageBytes = 0;
+    pthread_mutex_unlock(&ResourcePrefetcherLock);
+
+    if (nil == trace) return;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSMutableString* text = [NSMutableString stringWithString:ResourcePrefetcherTraceHeader];
+        for (NSString* line in trace) {
+            [text appendString:@"\n"];
+            [text appendString:line];
+        }
+        [text writeToFile:path atomically:YES encoding:NSUTF8StringEncoding error:nil];
+    });
+}
+
+BOOL ResourcePrefetcherIsRecording(void){
+    return ResourcePrefetcherRecording;
+}
+
+void ResourcePrefetcherRecord(ResourcePrefetchKind kind, NSString* path, uint64_t offset, uint64_t length){
+    if (NO == ResourcePrefetcherRecording || nil == path) return;
+
+    NSString* line = [NSString stringWithFormat:@"%c %llu %llu %@",
+                      (char)kind, offset, length, ResourcePrefetcherRelativePath(path)];
+
+    pthread_mutex_lock(&ResourcePrefetcherLock);
+    if (ResourcePrefetcherTrace.count < ResourcePrefetcherMaxEntries &&
+        NO == [ResourcePrefetcherTraceSet containsObject:line]) {
+        [ResourcePrefetcherTrace addObject:line];
+        [ResourcePrefetcherTraceSet addObject:line];
+    }
+    pthread_mutex_unlock(&ResourcePrefetcherLock);
+}
+
+UIImage* ResourcePrefetcherTakeImage(NSString* path){
+    if (nil == path) return nil;
+    NSString* relative = ResourcePrefetcherRelativePath(path);
+
+    pthread_mutex_lock(&ResourcePrefetcherLock);
+    UIImage* image = ResourcePrefetcherImages[relative];
+    if (image) {
+        [ResourcePrefetcherImages removeObjectForKey:relative];
+    }
+    // デコードが間に合わなかった物は、以後デコードしない。
+    [ResourcePrefetcherTaken addObject:relative];
+    pthread_mutex_unlock(&ResourcePrefetcherLock);
+    return image;
+}
@@ -0,0 +1,149 @@
+/*
+ *  rptrace
+ *
+ *  ResourcePrefetcherのトレースをPC(Linux)上で再生し、読み込み時間を計測する。
+ *  ページキャッシュを破棄してから、先読み無し/有りの時間を比較する。
+ *
+ *      $ cc -O2 -o rptrace rptrace.c
+ *      # echo 3 > /proc/sys/vm/drop_caches
+ *      $ ./rptrace -r Resources ResourcePrefetcher.trace      (先読み無し)
+ *      # echo 3 > /proc/sys/vm/drop_caches
+ *      $ ./rptrace -p -r Resources ResourcePrefetcher.trace   (先読み有り)
+ *
+ *      -r dir    相対パスの基準にするディレクトリ (初期値はカレント)
+ *      -p        読み込む前に全てのエントリの先読みを依頼する
+ *
+ *  Created by tyabuta on 2014/06/24.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+typedef struct {
+    char*              path;
+    unsigned long long offset;
+    unsigned long long length;
+} TraceEntry;
+
+
+static double nowMs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: rptrace [-p] [-r root] trace\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    const char* root     = ".";
+    int         prefetch = 0;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "pr:"))) {
+        switch (opt) {
+            case 'p': prefetch = 1; break;
+            case 'r': root     = optarg; break;
+            default:  usage();
+        }
+    }
+    if (optind + 1 != argc) usage();
+
+    FILE* fp = fopen(argv[optind], "r");
+    if (NULL == fp) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    TraceEntry* entries = NULL;
+    size_t      count   = 0;
+    size_t      alloc   = 0;
+    char        line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if ('#' == line[0]) continue;
+
+        char kind = 0;
+        unsigned long long offset = 0, length = 0;
+        int pos = 0;
+        if (3 != sscanf(line, "%c %llu %llu %n", &kind, &offset, &length, &pos) || 0 == pos) continue;
+
+        if (count == alloc) {
+            alloc   = alloc ? alloc * 2 : 256;
+            entries = (TraceEntry*)realloc(entries, sizeof(TraceEntry) * alloc);
+            if (NULL == entries) {
+                fprintf(stderr, "rptrace: out of memory\n");
+                return 1;
+            }
+        }
+        char path[8192];
+        snprintf(path, sizeof(path), "%s%s%s", ('/' == line[pos])? "" : root,
+                 ('/' == line[pos])? "" : "/", line + pos);
+        entries[count].path   = strdup(path);
+        entries[count].offset = offset;
+        entries[count].length = length;
+        count++;
+    }
+    fclose(fp);
+
+    double start = nowMs();
+
+    // アプリと同じく、全ての先読みを先に依頼する。
+    if (prefetch) {
+        for (size_t i = 0; i < count; i++) {
+            int fd = open(entries[i].path, O_RDONLY);
+            if (fd < 0) continue;
+            posix_fadvise(fd, (off_t)entries[i].offset, (off_t)entries[i].length, POSIX_FADV_WILLNEED);
+            close(fd);
+        }
+    }
+    double advised = nowMs();
+
+    // トレースの順に読み込む。
+    size_t             bufferSize = 1 << 20;
+    char*              buffer     = (char*)malloc(bufferSize);
+    unsigned long long total      = 0;
+    size_t             missing    = 0;
+    for (size_t i = 0; i < count; i++) {
+        int fd = open(entries[i].path, O_RDONLY);
+        if (fd < 0) {
+            missing++;
+            continue;
+        }
+        unsigned long long offset = entries[i].offset;
+        unsigned long long remain = entries[i].length;
+        if (0 == remain) {
+            struct stat st;
+            fstat(fd, &st);
+            remain = ((unsigned long long)st.st_size > offset)? st.st_size - offset : 0;
+        }
+        while (remain > 0) {
+            ssize_t n = pread(fd, buffer, remain < bufferSize ? (size_t)remain : bufferSize, (off_t)offset);
+            if (n <= 0) break;
+            offset += (unsigned long long)n;
+            remain -= (unsigned long long)n;
+            total  += (unsigned long long)n;
+        }
+        close(fd);
+    }
+    double end = nowMs();
+
+    printf("%zu entries (%zu missing), %llu bytes, %s: advise %.1f ms, read %.1f ms, total %.1f ms\n",
+           count, missing, total, prefetch ? "prefetch" : "no prefetch",
+           advised - start, end - advised, end - start);
+
+    free(buffer);
+    for (size_t i = 0; i < count; i++) free(entries[i].path);
+    free(entries);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ *  SoundGainRamp
+ *
+ *  Created by tyabuta on 2014/07/13.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "SoundGainRamp.h"
+#include <math.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <Accelerate/Accelerate.h>
+#endif
+
+
+// 指数ランプの下限(-80dB)。これより下は0として扱う。
+#define SOUND_GAIN_FLOOR 1e-4f
+
+
+/*------------------------------------------------------------------------------
+ Kernel
+ -----------------------------------------------------------------------------*/
+
+/*
+ * x[i*stride] *= start + step*(i+1)
+ */
+static void SoundGainApplyLinear(float* x, size_t stride, size_t n, float start, float step){
+#if defined(__APPLE__)
+    float first = start + step;
+    vDSP_vrampmul(x, (vDSP_Stride)stride, &first, &step, x, (vDSP_Stride)stride, (vDSP_Length)n);
+#else
+    for (size_t i = 0; i < n; i++) {
+        x[i * stride] *= start + step * (float)(i + 1);
+    }
+#endif
+}
+
+/*
+ * x[i*stride] *= gain * ratio^(i+1)
+ */
+static void SoundGainApplyExponential(float* x, size_t stride, size_t n, float gain, float ratio){
+    for (size_t i = 0; i < n; i++) {
+        gain *= ratio;
+        x[i * stride] *= gain;
+    }
+}
+
+/*
+ * x[i*stride] *= gain
+ */
+static void SoundGainApplyConstant(float* x, size_t stride, size_t n, float gain){
+    if (1.0f == gain) return;
+#if defined(__APPLE__)
+    if (0.0f == gain) {
+        vDSP_vclr(x, (vDSP_Stride)stride, (vDSP_Length)n);
+    } else {
+        vDSP_vsmul(x, (vDSP_Stride)stride, &gain, x, (vDSP_Stride)stride, (vDSP_Length)n);
+    }
+#else
+    if (1 == stride) {
+        for (size_t i = 0; i < n; i++) x[i] *= gain;
+    } else {
+        for (size_t i = 0; i < n; i++) x[i * stride] *= gain;
+    }
+#endif
+}
+
+/*
+ * UIから渡された目標が変わっていれば、今の音量から新しいランプを始める。
+ */
+static void SoundGainRampBegin(SoundGainRamp* ramp){
+    uint32_t bits = __atomic_load_n(&ramp->requested, __ATOMIC_RELAXED);
+    float    gain;
+    memcpy(&gain, &bits, sizeof(float));
+    if (gain == ramp->target) return;
+
+    ramp->target = gain;
+    uint32_t n = (uint32_t)(ramp->rampTime * ramp->sampleRate + 0.5f);
+    if (0 == n) {
+        ramp->current   = gain;
+        ramp->remaining = 0;
+        return;
+    }
+
+    if (SoundGainRampExponential == ramp->shape) {
+        float from = (ramp->current < SOUND_GAIN_FLOOR)? SOUND_GAIN_FLOOR : ramp->current;
+        float to   = (gain          < SOUND_GAIN_FLOOR)? SOUND_GAIN_FLOOR : gain;
+        ramp->current = from;
+        ramp->step    = powf(to / from, 1.0f / (float)n);
+    } else {
+        ramp->step    = (gain - ramp->current) / (float)n;
+    }
+    ramp->remaining = n;
+}
+
+/*
+ * ランプをnサンプル進める。終わったら目標の値にそろえる。
+ */
+static void SoundGainRampAdvance(SoundGainRamp* ramp, size_t n){
+    ramp->remaining -= (uint32_t)n;
+    if (0 == ramp->remaining) {
+        ramp->current = ramp->target;
+    } else if (SoundGainRampExponential == ramp->shape) {
+        ramp->current *= powf(ramp->step, (float)n);
+    } else {
+        ramp->current += ramp->step * (float)n;
+    }
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+void SoundGainRampInit(SoundGainRamp* ramp, float sampleRate, float rampTime,
+                       SoundGainRampShape shape, float gain){
+    memset(ramp, 0, sizeof(*ramp));
+    ramp->sampleRate = sampleRate;
+    ramp->rampTime   = rampTime;
+    ramp->shape      = shape;
+    ramp->current    = gain;
+    ramp->target     = gain;
+    SoundGainRampSetTarget(ramp, gain);
+}
+
+void SoundGainRampSetTarget(SoundGainRamp* ramp, float gain){
+    if (!(gain > 0.0f)) gain = 0.0f;    // 負の値とNaNは0にする
+    uint32_t bits;
+    memcpy(&bits, &gain, sizeof(float));
+    __atomic_store_n(&ramp->requested, bits, __ATOMIC_RELAXED);
+}
+
+float SoundGainRampGetTarget(const SoundGainRamp* ramp){
+    uint32_t bits = __atomic_load_n(&ramp->requested, __ATOMIC_RELAXED);
+    float    gain;
+    memcpy(&gain, &bits, sizeof(float));
+    return gain;
+}
+
+void SoundGainRampProcess(SoundGainRamp* ramp, float* samples, size_t frames, size_t channels){
+    SoundGainRampBegin(ramp);
+
+    size_t done = 0;
+    if (ramp->remaining) {
+        done = (ramp->remaining < frames)? ramp->remaining : frames;
+        for (size_t c = 0; c < channels; c++) {
+            if (SoundGainRampExponential == ramp->shape) {
+                SoundGainApplyExponential(samples + c, channels, done, ramp->current, ramp->step);
+            } else {
+                SoundGainApplyLinear(samples + c, channels, done, ramp->current, ramp->step);
+            }
+        }
+        SoundGainRampAdvance(ramp, done);
+    }
+    if (done < frames) {
+        SoundGainApplyConstant(samples + done * channels, 1, (frames - done) * channels, ramp->current);
+    }
+}
+
+void SoundGainRampProcessPlanar(SoundGainRamp* ramp, float* const* buffers, size_t channels, size_t frames){
+    SoundGainRampBegin(ramp);
+
+    size_t done = 0;
+    if (ramp->remaining) {
+        done = (ramp->remaining < frames)? ramp->remaining : frames;
+        for (size_t c = 0; c < channels; c++) {
+            if (SoundGainRampExponential == ramp->shape) {
+                SoundGainApplyExponential(buffers[c], 1, done, ramp->current, ramp->step);
+            } else {
+                SoundGainApplyLinear(buffers[c], 1, done, ramp->current, ramp->step);
+            }
+        }
+        SoundGainRampAdvance(ramp, done);
+    }
+    if (done < frames) {
+        for (size_t c = 0; c < channels; c++) {
+            SoundGainApplyConstant(buffers[c] + done, 1, frames - done, ramp->current);
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*******************************************************************************
+  SoundGainRamp 1.0.0.0
+
+                         クリックノイズの出ない音量変更
+
+   音量を一度に変えるとバッファの途中で波形に段差ができ、
+   ジッパーノイズ(プチッという音)になる。
+   SoundGainRampは目標の音量までrampTimeかけてサンプル単位で音量を動かす。
+
+   目標はUIスレッドからアトミックに書くだけで、オーディオスレッドは
+   バッファの先頭でそれを読み、変わっていれば今の音量から新しいランプを始める。
+   ロックも待ちも無いので、レンダーコールバックの中でそのまま使える。
+
+   ランプは直線(Linear)と指数(Exponential)を選べる。
+   指数は聞こえ方が均等になるが0にはならないので、-80dBまで下げてから0にする。
+   ランプの終わりでは必ず目標の値にそろえるので、誤差や非正規化数が溜まらない。
+
+   Apple環境ではvDSPを使い、それ以外では素のCのループで計算する。
+   UIKitに依存しないので、Linux上でもそのままコンパイルできる。
+   検査と計測はgrtestで行う。
+
+       $ cc -O2 -pthread -o grtest grtest.c SoundGainRamp.c -lm
+       $ ./grtest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_SOUND_GAIN_RAMP_H
+#define TYABUTA_SOUND_GAIN_RAMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * ランプの形
+ */
+typedef enum {
+    SoundGainRampLinear = 0,
+    SoundGainRampExponential,
+} SoundGainRampShape;
+
+/*
+ * ランプの状態
+ * requested以外はオーディオスレッドだけが触る。
+ */
+typedef struct {
+    float              sampleRate;
+    float              rampTime;      // 目標に達するまでの時間[sec]
+    SoundGainRampShape shape;
+
+    float              current;       // 今の音量
+    float              target;        // ランプ中の目標
+    float              step;          // Linear:1サンプル毎の増分 Exponential:1サンプル毎の倍率
+    uint32_t           remaining;     // ランプの残りサンプル数
+
+    uint32_t           requested;     // UIから渡された目標(floatのビット列)
+} SoundGainRamp;
+
+/*
+ * 初期化する。rampTimeの目安は0.02~0.05sec
+ */
+void SoundGainRampInit(SoundGainRamp* ramp, float sampleRate, float rampTime,
+                       SoundGainRampShape shape, float gain);
+
+/*
+ * 目標の音量(0.0~)を設定する。(どのスレッドからでも可)
+ */
+void  SoundGainRampSetTarget(SoundGainRamp* ramp, float gain);
+float SoundGainRampGetTarget(const SoundGainRamp* ramp);
+
+/*
+ * インターリーブされたバッファに音量をかける。(オーディオスレッド)
+ * samplesはframes x channels個のサンプル。
+ */
+void SoundGainRampProcess(SoundGainRamp* ramp, float* samples, size_t frames, size_t channels);
+
+/*
+ * チャンネル毎に分かれたバッファに音量をかける。(オーディオスレッド)
+ */
+void SoundGainRampProcessPlanar(SoundGainRamp* ramp, float* const* buffers, size_t channels, size_t frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_SOUND_GAIN_RAMP_H
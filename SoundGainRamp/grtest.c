@@ -0,0 +1,293 @@
+/*
+ *  grtest
+ *
+ *  SoundGainRampをPC(Linux)上で検査し、ランプ中のバッファにかかる時間を、
+ *  一サンプル毎に状態を更新する素直なループと比べる。
+ *
+ *      $ cc -O2 -pthread -o grtest grtest.c SoundGainRamp.c -lm
+ *      $ ./grtest
+ *
+ *      -n frames  一回に処理するフレーム数 (初期値は4096)
+ *
+ *  -fsanitize=thread を付けてビルドすると、目標の書き込みと処理の競合も検査できる。
+ *
+ *  Created by tyabuta on 2014/07/13.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "SoundGainRamp.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+#define SAMPLE_RATE 48000.0f
+#define RAMP_TIME   0.02f                           // 960サンプル
+#define BLOCK       256
+#define MAX_FRAMES  16384
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(float* samples, size_t count, float value){
+    for (size_t i = 0; i < count; i++) samples[i] = value;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 1.0の直流にかけて、音量そのものを取り出す。
+ * 途中(2,5,6ブロック目)で目標を変え、ランプの途中からでも段差ができないことを見る。
+ * インターリーブとチャンネル毎のバッファは誤差無く同じ結果になる。
+ */
+static float rampJump(SoundGainRampShape shape){
+    SoundGainRamp interleaved, planar;
+    SoundGainRampInit(&interleaved, SAMPLE_RATE, RAMP_TIME, shape, 0.5f);
+    SoundGainRampInit(&planar,      SAMPLE_RATE, RAMP_TIME, shape, 0.5f);
+
+    float  buffer[2 * BLOCK], left[BLOCK], right[BLOCK];
+    float* buffers[2] = { left, right };
+    float  previous = 0.5f, jump = 0.0f;
+    for (int b = 0; b < 40; b++) {
+        float target = (2 == b)? 1.0f : (5 == b)? 0.0f : (6 == b)? 0.3f : -1.0f;
+        if (target >= 0.0f) {
+            SoundGainRampSetTarget(&interleaved, target);
+            SoundGainRampSetTarget(&planar,      target);
+        }
+        fill(buffer, 2 * BLOCK, 1.0f);
+        fill(left,   BLOCK, 1.0f);
+        fill(right,  BLOCK, 1.0f);
+        SoundGainRampProcess(&interleaved, buffer, BLOCK, 2);
+        SoundGainRampProcessPlanar(&planar, buffers, 2, BLOCK);
+
+        for (int i = 0; i < BLOCK; i++) {
+            CHECK(buffer[i * 2] == left[i] && buffer[i * 2 + 1] == right[i]);
+            CHECK(buffer[i * 2] == buffer[i * 2 + 1]);
+            jump     = fmaxf(jump, fabsf(buffer[i * 2] - previous));
+            previous = buffer[i * 2];
+        }
+    }
+    // ランプの終わりでは目標の値に誤差無くそろう。
+    CHECK(0.3f == previous && 0.3f == interleaved.current && 0.3f == planar.current);
+    return jump;
+}
+
+static void testRamp(void){
+    float linear      = rampJump(SoundGainRampLinear);
+    float exponential = rampJump(SoundGainRampExponential);
+    CHECK(linear      <= 1.0f / 960.0f + 1e-6f);
+    CHECK(exponential <= 0.0085f);
+    printf("ramp: ok (max jump linear %.5f, exponential %.5f)\n", linear, exponential);
+}
+
+/*
+ * ランプはrampTimeで終わり、その後は一定の音量になる。
+ * 指数ランプも最後は0になる。
+ */
+static void testEnd(void){
+    static float samples[2000];
+    for (int shape = SoundGainRampLinear; shape <= SoundGainRampExponential; shape++) {
+        SoundGainRamp ramp;
+        SoundGainRampInit(&ramp, SAMPLE_RATE, RAMP_TIME, (SoundGainRampShape)shape, 1.0f);
+        CHECK(1.0f == SoundGainRampGetTarget(&ramp));
+
+        SoundGainRampSetTarget(&ramp, 0.0f);
+        CHECK(0.0f == SoundGainRampGetTarget(&ramp));
+        fill(samples, 2000, 1.0f);
+        SoundGainRampProcess(&ramp, samples, 2000, 1);
+        CHECK(samples[0] < 1.0f && samples[958] > 0.0f);
+        for (int i = 1; i < 960; i++) CHECK(samples[i] <= samples[i - 1]);
+        for (int i = 960; i < 2000; i++) CHECK(0.0f == samples[i]);
+        CHECK(0 == ramp.remaining && 0.0f == ramp.current);
+
+        // 0からでも上がる。
+        SoundGainRampSetTarget(&ramp, 0.75f);
+        fill(samples, 2000, 1.0f);
+        SoundGainRampProcess(&ramp, samples, 2000, 1);
+        CHECK(samples[0] > 0.0f);
+        CHECK(fabsf(samples[959] - 0.75f) < 1e-3f);
+        for (int i = 960; i < 2000; i++) CHECK(0.75f == samples[i]);
+    }
+
+    // 負の値とNaNは0になる。時間0のランプはすぐに目標になる。
+    SoundGainRamp ramp;
+    SoundGainRampInit(&ramp, SAMPLE_RATE, 0.0f, SoundGainRampLinear, 1.0f);
+    SoundGainRampSetTarget(&ramp, -1.0f);
+    CHECK(0.0f == SoundGainRampGetTarget(&ramp));
+    SoundGainRampSetTarget(&ramp, NAN);
+    CHECK(0.0f == SoundGainRampGetTarget(&ramp));
+    SoundGainRampSetTarget(&ramp, 0.5f);
+    fill(samples, 16, 1.0f);
+    SoundGainRampProcess(&ramp, samples, 16, 1);
+    for (int i = 0; i < 16; i++) CHECK(0.5f == samples[i]);
+
+    printf("end of ramp: ok\n");
+}
+
+/*
+ * 別のスレッドから目標を書き続けても、音量は目標の範囲を出ず、段差もできない。
+ */
+static SoundGainRamp concurrentRamp;
+static int           concurrentStop;
+
+static void* concurrentWriter(void* arg){
+    static const float targets[] = { 0.25f, 1.0f, 0.5f, 0.75f };
+    long writes = 0;
+    while (0 == __atomic_load_n(&concurrentStop, __ATOMIC_ACQUIRE)) {
+        SoundGainRampSetTarget(&concurrentRamp, targets[writes % 4]);
+        writes++;
+        if (0 == writes % 64) sched_yield();
+    }
+    *(long*)arg = writes;
+    return NULL;
+}
+
+static void testConcurrent(void){
+    static float samples[2 * BLOCK];
+    SoundGainRampInit(&concurrentRamp, SAMPLE_RATE, RAMP_TIME, SoundGainRampLinear, 0.5f);
+
+    long      writes = 0;
+    pthread_t writer;
+    pthread_create(&writer, NULL, concurrentWriter, &writes);
+    float previous = 0.5f;
+    for (int b = 0; b < 20000; b++) {
+        fill(samples, 2 * BLOCK, 1.0f);
+        SoundGainRampProcess(&concurrentRamp, samples, BLOCK, 2);
+        for (int i = 0; i < BLOCK; i++) {
+            float gain = samples[i * 2];
+            CHECK(gain >= 0.25f - 1e-6f && gain <= 1.0f + 1e-6f);
+            CHECK(fabsf(gain - previous) <= 0.75f / 960.0f + 1e-6f);
+            previous = gain;
+        }
+    }
+    __atomic_store_n(&concurrentStop, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    printf("concurrent target: ok (%ld writes)\n", writes);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 一サンプル毎に残りを数えて音量を更新する素直なループ(比較用)
+ */
+typedef struct {
+    float    current;
+    float    step;
+    uint32_t remaining;
+} NaiveRamp;
+
+static void naiveProcess(NaiveRamp* ramp, float target, uint32_t rampFrames,
+                         float* samples, size_t frames, size_t channels){
+    ramp->step      = (target - ramp->current) / (float)rampFrames;
+    ramp->remaining = rampFrames;
+    for (size_t i = 0; i < frames; i++) {
+        if (ramp->remaining) {
+            ramp->current += ramp->step;
+            if (0 == --ramp->remaining) ramp->current = target;
+        }
+        for (size_t c = 0; c < channels; c++) samples[i * channels + c] *= ramp->current;
+    }
+}
+
+/*
+ * バッファ全体がランプになるように、毎回目標を0.6と0.8で入れ替える。
+ * (どちらもバッファを詰め直す時間を含む)
+ */
+static void bench(size_t frames){
+    static float samples[MAX_FRAMES * 2];
+    size_t count  = frames * 2;
+    long   rounds = (long)(200000000 / count);
+
+    NaiveRamp naive = { 1.0f, 0.0f, 0 };
+    double start = nowSec();
+    for (long r = 0; r < rounds; r++) {
+        fill(samples, count, 0.5f);
+        naiveProcess(&naive, (r & 1)? 0.8f : 0.6f, (uint32_t)frames, samples, frames, 2);
+    }
+    double baseline = (nowSec() - start) * 1e9 / ((double)rounds * count);
+
+    SoundGainRamp ramp;
+    SoundGainRampInit(&ramp, SAMPLE_RATE, (float)frames / SAMPLE_RATE, SoundGainRampLinear, 1.0f);
+    start = nowSec();
+    for (long r = 0; r < rounds; r++) {
+        SoundGainRampSetTarget(&ramp, (r & 1)? 0.8f : 0.6f);
+        fill(samples, count, 0.5f);
+        SoundGainRampProcess(&ramp, samples, frames, 2);
+    }
+    double linear = (nowSec() - start) * 1e9 / ((double)rounds * count);
+
+    SoundGainRampInit(&ramp, SAMPLE_RATE, (float)frames / SAMPLE_RATE, SoundGainRampExponential, 1.0f);
+    start = nowSec();
+    for (long r = 0; r < rounds; r++) {
+        SoundGainRampSetTarget(&ramp, (r & 1)? 0.8f : 0.6f);
+        fill(samples, count, 0.5f);
+        SoundGainRampProcess(&ramp, samples, frames, 2);
+    }
+    double exponential = (nowSec() - start) * 1e9 / ((double)rounds * count);
+
+    start = nowSec();
+    for (long r = 0; r < rounds; r++) {
+        fill(samples, count, 0.5f);
+        SoundGainRampProcess(&ramp, samples, frames, 2);
+    }
+    double steady = (nowSec() - start) * 1e9 / ((double)rounds * count);
+
+    printf("%zu stereo frames per buffer, ramping\n", frames);
+    printf("  naive per-sample update   : %.2f ns/sample\n", baseline);
+    printf("  SoundGainRamp linear      : %.2f ns/sample (%.1fx)\n", linear, baseline / linear);
+    printf("  SoundGainRamp exponential : %.2f ns/sample\n", exponential);
+    printf("  SoundGainRamp steady      : %.2f ns/sample\n", steady);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: grtest [-n frames]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    size_t frames = 4096;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': frames = (size_t)atol(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || frames < 1 || frames > MAX_FRAMES) usage();
+
+    testRamp();
+    testEnd();
+    testConcurrent();
+    bench(frames);
+    return 0;
+}
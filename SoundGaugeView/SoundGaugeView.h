@@ -5,11 +5,47 @@
 //  Copyright (c) 2013 tyabuta. All rights reserved.
 //
 //  ※ MediaPlayer.framework を追加する必要がある。
+//  ※ レベル表示を使う場合は、SoundLevelMeter(スペクトラムはSoundSpectrum)とTimerWheelを
+//     合わせて追加し、SoundLevelMeter.h(SoundSpectrum.h), TimerWheel.hを
+//     このヘッダより先にimportする。
+//     (追加されていなければlevelMeter, spectrumプロパティは無く、レベル表示もしない)
+//  ※ EventBus(EventBus, DeviceEvents)が追加されていれば、音量の変更はDeviceEventsで受け取る。
+//     (追加されていなければ、このビューが通知センターで受け取る)
 //
 
 
 #import <UIKit/UIKit.h>
 
+/*
+ * レベル表示の種類
+ */
+typedef enum {
+    SoundGaugeDisplayModeLevel = 0,   // RMSとピークのバー
+    SoundGaugeDisplayModeSpectrum,    // 周波数バンド毎のバー
+} SoundGaugeDisplayMode;
+
 @interface SoundGaugeView : UIView
 - (id)initWithFrame:(CGRect)frame;
+
+/*
+ * 設定するとスライダーの下に音声のレベルを表示する。(NULLで非表示)
+ * メーターはオーディオスレッドで更新し、表示は30fpsで読むだけ。
+ * メーターの寿命は呼び出し側で管理し、解放する前にNULLを設定すること。
+ */
+#if defined(TYABUTA_SOUND_LEVEL_METER_H) && defined(TYABUTA_TIMER_WHEEL_H)
+@property (nonatomic) SoundLevelMeter* levelMeter;
+#endif
+
+/*
+ * 設定するとスライダーの後ろにバンド毎のバーを表示する。(NULLで非表示)
+ * 寿命の扱いはlevelMeterと同じ。
+ */
+#if defined(TYABUTA_SOUND_SPECTRUM_H) && defined(TYABUTA_TIMER_WHEEL_H)
+@property (nonatomic) SoundSpectrum* spectrum;
+#endif
+
+/*
+ * どちらを表示するか。初期値はSoundGaugeDisplayModeLevel
+ */
+@property (nonatomic) SoundGaugeDisplayMode displayMode;
 @end
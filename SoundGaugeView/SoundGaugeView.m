@@ -1,7 +1,31 @@
 
+// レベル表示のモジュールは、追加されている場合だけ使う。(ヘッダより先にimportする)
+#if defined(__has_include)
+#if __has_include("SoundLevelMeter.h")
+#import "SoundLevelMeter.h"
+#endif
+#if __has_include("SoundSpectrum.h")
+#import "SoundSpectrum.h"
+#endif
+#if __has_include("TimerWheel.h")
+#import "TimerWheel.h"
+#endif
+#if __has_include("DeviceEvents.h")
+#import "DeviceEvents.h"
+#endif
+#endif
+
 #import "SoundGaugeView.h"
 #import <MediaPlayer/MediaPlayer.h>
 
+// レベル表示はTimerWheelで更新するので、TimerWheelが無ければどちらも表示しない。
+#if defined(TYABUTA_TIMER_WHEEL_H) && defined(TYABUTA_SOUND_LEVEL_METER_H)
+#define SOUND_GAUGE_LEVEL_METER 1
+#endif
+#if defined(TYABUTA_TIMER_WHEEL_H) && defined(TYABUTA_SOUND_SPECTRUM_H)
+#define SOUND_GAUGE_SPECTRUM 1
+#endif
+
 
 
 #pragma mark -
@@ -94,12 +118,38 @@ sliderAddBasic(CGRect frame, UIView* parentView, id target, SEL action){
     return slider;
 }
 
+#ifdef TYABUTA_TIMER_WHEEL_H
+
+/*
+ * 繰り返しタイマーをTimerWheelに登録する。
+ * 間隔の1割までの遅れを許容し、他のタイマーと起床をまとめる。
+ * (macro.hのTimerWheelStartと重ならない名前にしている)
+ * - (void)tick:(id)timer
+ */
+static inline id SoundGaugeTimerStart(double interval, id target, SEL action){
+    return [[TimerWheel sharedWheel] addTimerWithInterval:interval
+                                                tolerance:interval * 0.1
+                                                   target:target
+                                                 selector:action];
+}
+
+/*
+ * TimerWheelに登録したタイマーを解除する。
+ */
+static inline void SoundGaugeTimerStop(id timer){
+    [[TimerWheel sharedWheel] cancelTimer:timer];
+}
+
+#endif // TYABUTA_TIMER_WHEEL_H
+
 /*
- * 通知センターに登録したオブザーバを削除する。
- * オブザーバに登録したクラスはdealloc メソッドで削除しておく。
+ * 表示用に、リニア値のminDecibels~0dBを0.0~1.0に変換する。
  */
-static inline void NSNotificationCenterRemoveObserver(id observer){
-    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+static inline CGFloat SoundGaugeLevelToDisplay(float level, float minDecibels){
+    float db = (level <= 1e-6f)? -120.0f : 20.0f * log10f(level);
+    if (db <= minDecibels) return 0.0f;
+    if (db >= 0.0f) return 1.0f;
+    return 1.0f - db / minDecibels;
 }
 
 
@@ -120,6 +170,8 @@ static inline void MPMusicPlayerControllerSetVolume(float volume){
     musicPlayer.volume = volume;
 }
 
+#ifndef TYABUTA_DEVICE_EVENTS_H
+
 /*
  * 今の音量を取得する。0-1
  */
@@ -129,8 +181,6 @@ static inline float MPMusicPlayerControllerGetVolume(){
     return musicPlayer.volume;
 }
 
-
-
 /*
  * MusicPlayerの通知発行を有効にする。
  * 通知の必要がなくなったら、無効にしましょう。
@@ -151,14 +201,8 @@ MPMusicPlayerControllerGeneratingPlaybackNotifications(BOOL bBegin){
  * システムボリュームの変更通知のオブザーバとセレクタを登録する。
  * - (void)func:(NSNotification *)notification
  *
- * notification.name プロパティでどの通知が発生したのかがわかる。
- * MPMusicPlayerControllerVolumeDidChangeNotification
- *
- * 通知の必要がなくなったら、NSNotificationCenterRemoveObserver関数で
- * オブサーバー登録を抹消しましょう。
- *
- * 通知発行も必要ないなら、
- * MPMusicPlayerControllerGeneratingPlaybackNotifications関数で通知発行を停止しましょう。
+ * 通知発行も有効にするので、不要になったら
+ * MPMusicPlayerControllerGeneratingPlaybackNotifications関数で停止しましょう。
  */
 static inline void
 MPMusicPlayerControllerRegisterVolumeDidChangeNotification(id observer, SEL selector){
@@ -174,6 +218,11 @@ MPMusicPlayerControllerRegisterVolumeDidChangeNotification(id observer, SEL sele
     MPMusicPlayerControllerGeneratingPlaybackNotifications(YES);
 }
 
+#endif // TYABUTA_DEVICE_EVENTS_H
+
+
+
+
 #endif // MP_EXTERN_CLASS_AVAILABLE
 
 
@@ -209,12 +258,31 @@ MPMusicPlayerControllerRegisterVolumeDidChangeNotification(id observer, SEL sele
 // アイコンリソースの名前
 static NSString* const ICON_RESOURCE_NAME = @"SoundIcons.png";
 
+// レベル表示の更新間隔(sec)
+#define LEVEL_INTERVAL (1.0/30.0)
+
+// レベル表示の下限(dB)
+#define LEVEL_MIN_DECIBELS -60.0f
+
+// レベル表示の太さ(px)
+#define LEVEL_HEIGHT 3.0f
+
+// スペクトラムのバーの間隔(px)
+#define BAND_GAP 1.0f
+
 
 @implementation SoundGaugeView
 {
     UISlider*    _slider;                 // ボリュームコントロール用のスライダー
     UIImageView* _imageView;              // アイコン表示用のUiImageView
     UIImage*     _images[NUMBER_OF_ICON]; // アイコン画像の配列
+    UIView*      _levelView;              // RMSのレベル表示
+    UIView*      _peakView;               // ピークのレベル表示
+    NSArray*     _bandViews;              // スペクトラムのバンド毎の表示
+    id           _levelTimer;             // レベル表示の更新タイマー
+#ifdef TYABUTA_DEVICE_EVENTS_H
+    DeviceEventsSubscription* _volumeSubscription; // 音量の変更の購読(解放で解除される)
+#endif
 }
 
 - (id)initWithFrame:(CGRect)frame
@@ -240,21 +308,47 @@ static NSString* const ICON_RESOURCE_NAME = @"SoundIcons.png";
                                  self,
                                  @selector(sliderValueChanged:));
     
+        // レベル表示(メーターが設定されるまでは非表示)
+        _levelView = [[UIView alloc] initWithFrame:CGRectZero];
+        _levelView.backgroundColor        = [UIColor colorWithRed:0.3f green:0.85f blue:0.4f alpha:1.0f];
+        _levelView.userInteractionEnabled = NO;
+        _levelView.hidden                 = YES;
+        [self addSubview:_levelView];
+
+        _peakView = [[UIView alloc] initWithFrame:CGRectZero];
+        _peakView.backgroundColor        = [UIColor whiteColor];
+        _peakView.userInteractionEnabled = NO;
+        _peakView.hidden                 = YES;
+        [self addSubview:_peakView];
+
+#ifdef TYABUTA_DEVICE_EVENTS_H
+        // システムボリュームの変更を購読(登録時に一度呼ばれるのが初回更新になる)
+        __weak SoundGaugeView* weakSelf = self;
+        _volumeSubscription = [[DeviceEvents sharedEvents] subscribeVolume:^(DeviceVolumeEvent event) {
+            [weakSelf updateVolume:event.volume];
+        }];
+#else
         // システムボリュームの変更通知登録
         MPMusicPlayerControllerRegisterVolumeDidChangeNotification
         (self, @selector(volumeDidChange:));
-        
+
         // 初回更新
-        [self update];
+        [self updateVolume:MPMusicPlayerControllerGetVolume()];
+#endif
     }
     return self;
 }
 
 - (void)dealloc{
+#ifdef TYABUTA_TIMER_WHEEL_H
+    if (_levelTimer) SoundGaugeTimerStop(_levelTimer);
+#endif
+#ifndef TYABUTA_DEVICE_EVENTS_H
     // 通知発行の停止
     MPMusicPlayerControllerGeneratingPlaybackNotifications(NO);
     // オブザーバーの登録抹消
-    NSNotificationCenterRemoveObserver(self);
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+#endif
 }
 
 - (void)layoutSubviews{
@@ -275,10 +369,12 @@ static NSString* const ICON_RESOURCE_NAME = @"SoundIcons.png";
                                (h-TAPPABLE_SIZE)/2.0f,
                                w - kSliderLeft - kMargin,
                                TAPPABLE_SIZE);
+
+    // レベル表示はスライダーのトラックの下に置く。
+    [self updateLevel];
 }
 
-- (void)update {    
-    float fVolume = MPMusicPlayerControllerGetVolume();
+- (void)updateVolume:(float)fVolume {
     int   nVolume = (int)(fVolume * 100.0f);
 
     // スライダーの値更新
@@ -300,22 +396,146 @@ static NSString* const ICON_RESOURCE_NAME = @"SoundIcons.png";
     
 }
 
+/*
+ * メーターの値をレベル表示に反映する。
+ */
+- (void)updateLevel {
+    if (SoundGaugeDisplayModeSpectrum == _displayMode) {
+        [self updateSpectrum];
+        return;
+    }
+#ifdef SOUND_GAUGE_LEVEL_METER
+    if (NULL == _levelMeter) return;
+
+    SoundLevel level = SoundLevelMeterRead(_levelMeter);
+    CGRect     track = _slider.frame;
+    CGFloat    y     = CGRectGetMidY(track) + 6.0f;
+    CGFloat    w     = track.size.width;
+
+    _levelView.frame = CGRectMake(track.origin.x,
+                                  y,
+                                  w * SoundGaugeLevelToDisplay(level.rms, LEVEL_MIN_DECIBELS),
+                                  LEVEL_HEIGHT);
+    _peakView.frame  = CGRectMake(track.origin.x + (w - 2.0f) * SoundGaugeLevelToDisplay(level.peak, LEVEL_MIN_DECIBELS),
+                                  y,
+                                  2.0f,
+                                  LEVEL_HEIGHT);
+#endif
+}
+
+/*
+ * スペクトラムの値をバンド毎のバーに反映する。
+ * 書き込みと重なって読めなかった場合は、前の表示のままにする。
+ */
+- (void)updateSpectrum {
+#ifdef SOUND_GAUGE_SPECTRUM
+    if (NULL == _spectrum) return;
+
+    float  bands[SOUND_SPECTRUM_MAX_BANDS];
+    size_t count = SoundSpectrumRead(_spectrum, bands, SOUND_SPECTRUM_MAX_BANDS);
+    if (count != _bandViews.count) return;
+
+    // スライダーのトラックより上をバーの領域にする。
+    CGRect  track  = _slider.frame;
+    CGFloat bottom = CGRectGetMidY(track) - 4.0f;
+    CGFloat height = bottom - 2.0f;
+    CGFloat width  = track.size.width / (CGFloat)count;
+    for (size_t i = 0; i < count; i++) {
+        CGFloat h = height * SoundGaugeLevelToDisplay(bands[i], LEVEL_MIN_DECIBELS);
+        UIView* v = _bandViews[i];
+        v.frame = CGRectMake(track.origin.x + width * i,
+                             bottom - h,
+                             width - BAND_GAP,
+                             h);
+    }
+#endif
+}
+
+/*
+ * 表示の種類と設定に合わせて、ビューの表示とタイマーを切り替える。
+ */
+- (void)updateLevelDisplay {
+    BOOL showLevel    = NO;
+    BOOL showSpectrum = NO;
+#ifdef SOUND_GAUGE_LEVEL_METER
+    showLevel    = (SoundGaugeDisplayModeLevel    == _displayMode) && (NULL != _levelMeter);
+#endif
+#ifdef SOUND_GAUGE_SPECTRUM
+    showSpectrum = (SoundGaugeDisplayModeSpectrum == _displayMode) && (NULL != _spectrum);
+#endif
+
+    _levelView.hidden = _peakView.hidden = !showLevel;
+    for (UIView* v in _bandViews) v.hidden = !showSpectrum;
+
+#ifdef TYABUTA_TIMER_WHEEL_H
+    if (_levelTimer) {
+        SoundGaugeTimerStop(_levelTimer);
+        _levelTimer = nil;
+    }
+    if (showLevel || showSpectrum) {
+        _levelTimer = SoundGaugeTimerStart(LEVEL_INTERVAL, self, @selector(tick:));
+        [self updateLevel];
+    }
+#endif
+}
+
+#ifdef SOUND_GAUGE_LEVEL_METER
+- (void)setLevelMeter:(SoundLevelMeter*)levelMeter {
+    _levelMeter = levelMeter;
+    [self updateLevelDisplay];
+}
+#endif
+
+#ifdef SOUND_GAUGE_SPECTRUM
+- (void)setSpectrum:(SoundSpectrum*)spectrum {
+    _spectrum = spectrum;
+
+    // バンド数に合わせてバーを作り直す。
+    for (UIView* v in _bandViews) [v removeFromSuperview];
+    NSMutableArray* views = [NSMutableArray array];
+    size_t count = spectrum? SoundSpectrumBandCount(spectrum) : 0;
+    for (size_t i = 0; i < count; i++) {
+        UIView* v = [[UIView alloc] initWithFrame:CGRectZero];
+        v.backgroundColor        = [UIColor colorWithRed:0.3f green:0.85f blue:0.4f alpha:0.6f];
+        v.userInteractionEnabled = NO;
+        [self insertSubview:v belowSubview:_slider];
+        [views addObject:v];
+    }
+    _bandViews = views;
+    [self updateLevelDisplay];
+}
+#endif
+
+- (void)setDisplayMode:(SoundGaugeDisplayMode)displayMode {
+    _displayMode = displayMode;
+    [self updateLevelDisplay];
+}
+
 
 #pragma mark Events
 
+/*
+ * レベル表示の更新タイマー
+ */
+- (void)tick:(id)timer {
+    [self updateLevel];
+}
+
+#ifndef TYABUTA_DEVICE_EVENTS_H
 /*
  * システムボリュームの変更イベント
  */
 - (void)volumeDidChange:(NSNotification *)notification {
-    [self update];
+    [self updateVolume:MPMusicPlayerControllerGetVolume()];
 }
+#endif
 
 /*
  * スライダーの変更イベント
  */
 - (void)sliderValueChanged:(UISlider*)slider {
     MPMusicPlayerControllerSetVolume(slider.value);
-    [self update];
+    [self updateVolume:slider.value];
 }
 
 @end // SoundGaugeView
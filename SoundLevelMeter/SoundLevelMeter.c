@@ -0,0 +1,177 @@
+/*
+ *  SoundLevelMeter
+ *
+ *  Created by tyabuta on 2014/07/09.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "SoundLevelMeter.h"
+#include <math.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <Accelerate/Accelerate.h>
+#endif
+
+
+// これより小さい値は0とする。(非正規化数で遅くならないように)
+#define SOUND_LEVEL_FLOOR 1e-9f
+
+// 16bit整数を変換する際のバッファのサンプル数
+#define SOUND_LEVEL_CHUNK 256
+
+
+/*------------------------------------------------------------------------------
+ Kernel
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 二乗和と絶対値の最大を求める。
+ */
+static void SoundLevelMeasure(const float* samples, size_t count, size_t stride,
+                              float* sumOfSquares, float* peak){
+#if defined(__APPLE__)
+    vDSP_svesq(samples, (vDSP_Stride)stride, sumOfSquares, (vDSP_Length)count);
+    vDSP_maxmgv(samples, (vDSP_Stride)stride, peak, (vDSP_Length)count);
+#else
+    // 連続したサンプルなら、依存の無い8系統に分けてベクトル化しやすくする。
+    if (1 == stride) {
+        float s[8] = {0}, m[8] = {0};
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            for (int k = 0; k < 8; k++) {
+                float a = samples[i + k];
+                float b = fabsf(a);
+                s[k] += a * a;
+                m[k]  = (b > m[k])? b : m[k];
+            }
+        }
+        for (; i < count; i++) {
+            float a = samples[i];
+            s[0] += a * a;
+            m[0]  = fmaxf(m[0], fabsf(a));
+        }
+        *sumOfSquares = ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+        *peak         = fmaxf(fmaxf(fmaxf(m[0], m[1]), fmaxf(m[2], m[3])),
+                              fmaxf(fmaxf(m[4], m[5]), fmaxf(m[6], m[7])));
+        return;
+    }
+
+    float total = 0.0f, maximum = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        float a = samples[i * stride];
+        total  += a * a;
+        maximum = fmaxf(maximum, fabsf(a));
+    }
+    *sumOfSquares = total;
+    *peak         = maximum;
+#endif
+}
+
+/*
+ * ブロックの長さに対する一次の平滑化係数
+ */
+static float SoundLevelCoefficient(float time, float sampleRate, size_t frames){
+    if (time <= 0.0f) return 0.0f;
+    return expf(-(float)frames / (time * sampleRate));
+}
+
+/*
+ * サンプル数からフレーム数を求める。(時定数はフレーム数で決まる)
+ */
+static size_t SoundLevelFrames(size_t count, size_t channels){
+    size_t frames = (channels > 1)? count / channels : count;
+    return (frames > 0)? frames : 1;
+}
+
+/*
+ * 平滑化してから公開する。
+ */
+static void SoundLevelMeterUpdate(SoundLevelMeter* meter, float rms, float peak, size_t frames){
+    if (meter->coefficientFrames != frames) {
+        meter->coefficientFrames  = frames;
+        meter->attackCoefficient  = SoundLevelCoefficient(meter->attackTime,  meter->sampleRate, frames);
+        meter->releaseCoefficient = SoundLevelCoefficient(meter->releaseTime, meter->sampleRate, frames);
+    }
+
+    float c = (rms > meter->rms)? meter->attackCoefficient : meter->releaseCoefficient;
+    meter->rms = rms + c * (meter->rms - rms);
+    if (meter->rms < SOUND_LEVEL_FLOOR) meter->rms = 0.0f;
+
+    // ピークは即座に上がり、リリースの時定数で下がる。
+    meter->peak = fmaxf(peak, meter->peak * meter->releaseCoefficient);
+    if (meter->peak < SOUND_LEVEL_FLOOR) meter->peak = 0.0f;
+
+    uint32_t bits[2];
+    memcpy(&bits[0], &meter->rms,  sizeof(float));
+    memcpy(&bits[1], &meter->peak, sizeof(float));
+    uint64_t packed = ((uint64_t)bits[1] << 32) | bits[0];
+    __atomic_store_n(&meter->published, packed, __ATOMIC_RELEASE);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+void SoundLevelMeterInit(SoundLevelMeter* meter, float sampleRate, float attackTime, float releaseTime){
+    memset(meter, 0, sizeof(*meter));
+    meter->sampleRate  = sampleRate;
+    meter->attackTime  = attackTime;
+    meter->releaseTime = releaseTime;
+}
+
+void SoundLevelMeterProcess(SoundLevelMeter* meter, const float* samples, size_t count, size_t stride,
+                            size_t channels){
+    if (0 == count) return;
+
+    float sumOfSquares = 0.0f, peak = 0.0f;
+    SoundLevelMeasure(samples, count, stride, &sumOfSquares, &peak);
+    SoundLevelMeterUpdate(meter, sqrtf(sumOfSquares / (float)count), peak, SoundLevelFrames(count, channels));
+}
+
+void SoundLevelMeterProcessInt16(SoundLevelMeter* meter, const int16_t* samples, size_t count, size_t stride,
+                                 size_t channels){
+    if (0 == count) return;
+
+    float  buffer[SOUND_LEVEL_CHUNK];
+    float  total = 0.0f, peak = 0.0f;
+    for (size_t i = 0; i < count; i += SOUND_LEVEL_CHUNK) {
+        size_t n = (count - i < SOUND_LEVEL_CHUNK)? count - i : SOUND_LEVEL_CHUNK;
+#if defined(__APPLE__)
+        const float scale = 1.0f / 32768.0f;
+        vDSP_vflt16(samples + i * stride, (vDSP_Stride)stride, buffer, 1, (vDSP_Length)n);
+        vDSP_vsmul(buffer, 1, &scale, buffer, 1, (vDSP_Length)n);
+#else
+        for (size_t k = 0; k < n; k++) buffer[k] = samples[(i + k) * stride] * (1.0f / 32768.0f);
+#endif
+        float s = 0.0f, m = 0.0f;
+        SoundLevelMeasure(buffer, n, 1, &s, &m);
+        total += s;
+        peak   = fmaxf(peak, m);
+    }
+    SoundLevelMeterUpdate(meter, sqrtf(total / (float)count), peak, SoundLevelFrames(count, channels));
+}
+
+SoundLevel SoundLevelMeterRead(const SoundLevelMeter* meter){
+    uint64_t   packed = __atomic_load_n(&meter->published, __ATOMIC_ACQUIRE);
+    uint32_t   rms    = (uint32_t)packed;
+    uint32_t   peak   = (uint32_t)(packed >> 32);
+    SoundLevel level;
+    memcpy(&level.rms,  &rms,  sizeof(float));
+    memcpy(&level.peak, &peak, sizeof(float));
+    return level;
+}
+
+float SoundLevelToDecibels(float level){
+    if (level <= 1e-6f) return -120.0f;
+    return 20.0f * log10f(level);
+}
+
+float SoundLevelToDisplay(float level, float minDecibels){
+    float db = SoundLevelToDecibels(level);
+    if (db <= minDecibels) return 0.0f;
+    if (db >= 0.0f) return 1.0f;
+    return 1.0f - db / minDecibels;
+}
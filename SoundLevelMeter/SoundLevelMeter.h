@@ -0,0 +1,96 @@
+/*******************************************************************************
+  SoundLevelMeter 1.0.0.0
+
+                         オーディオ信号のレベルメーター
+
+   レンダーコールバック(オーディオスレッド)でバッファ毎にRMSとピークを求め、
+   アタック/リリースの時定数で滑らかにしてからUIへ渡す。
+
+   オーディオスレッドは計算した値を64bitの一語にまとめてアトミックに書き、
+   UIは好きな時にそれを読むだけなので、ロックもメモリ確保も待ちも無い。
+   (書き手一つ、読み手一つ。読み手には常に最新の値が見える)
+
+   Apple環境ではvDSPを使い、それ以外では素のCのループで計算する。
+   UIKitに依存しないので、Linux上でもそのままコンパイルできる。
+   検査と計測はslmtestで行う。
+
+       $ cc -O2 -pthread -o slmtest slmtest.c SoundLevelMeter.c -lm
+       $ ./slmtest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_SOUND_LEVEL_METER_H
+#define TYABUTA_SOUND_LEVEL_METER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * レベル(0.0~1.0のリニア値)
+ */
+typedef struct {
+    float rms;
+    float peak;
+} SoundLevel;
+
+/*
+ * メーターの状態
+ * published以外はオーディオスレッドだけが触る。
+ */
+typedef struct {
+    float    sampleRate;
+    float    attackTime;      // 上昇の時定数[sec]
+    float    releaseTime;     // 下降の時定数[sec]
+
+    float    rms;
+    float    peak;
+    size_t   coefficientFrames;
+    float    attackCoefficient;
+    float    releaseCoefficient;
+
+    uint64_t published __attribute__((aligned(8)));
+} SoundLevelMeter;
+
+/*
+ * 初期化する。時定数の目安はattack 0.01sec, release 0.3sec
+ */
+void SoundLevelMeterInit(SoundLevelMeter* meter, float sampleRate, float attackTime, float releaseTime);
+
+/*
+ * サンプルを計測する。(オーディオスレッド)
+ * countはサンプル数、strideはサンプルの間隔、channelsは一フレームに含まれるサンプル数。
+ * インターリーブされた全チャンネルをまとめて計るにはstride=1、count=フレーム数xチャンネル数、
+ * channels=チャンネル数を渡す。一つのチャンネルだけ計る場合はstride=チャンネル数、channels=1
+ * (時定数はcount/channelsのフレーム数から求める)
+ */
+void SoundLevelMeterProcess(SoundLevelMeter* meter, const float* samples, size_t count, size_t stride,
+                            size_t channels);
+void SoundLevelMeterProcessInt16(SoundLevelMeter* meter, const int16_t* samples, size_t count, size_t stride,
+                                 size_t channels);
+
+/*
+ * 最新のレベルを読む。(どのスレッドからでも可)
+ */
+SoundLevel SoundLevelMeterRead(const SoundLevelMeter* meter);
+
+/*
+ * リニア値をデシベルにする。0は-120dBとする。
+ */
+float SoundLevelToDecibels(float level);
+
+/*
+ * 表示用に、minDecibels~0dBを0.0~1.0に変換する。
+ */
+float SoundLevelToDisplay(float level, float minDecibels);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_SOUND_LEVEL_METER_H
@@ -0,0 +1,284 @@
+/*
+ *  slmtest
+ *
+ *  SoundLevelMeterをPC(Linux)上で合成した信号を使って検査し、
+ *  一サンプル当たりの計測時間を、素直な一重のループと比べる。
+ *
+ *      $ cc -O2 -pthread -o slmtest slmtest.c SoundLevelMeter.c -lm
+ *      $ ./slmtest
+ *
+ *      -n frames  一回に計測するフレーム数 (初期値は512)
+ *
+ *  Created by tyabuta on 2014/07/09.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "SoundLevelMeter.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+#define NEAR(a, b, tolerance) (fabsf((a) - (b)) <= (tolerance))
+
+#define SAMPLE_RATE 48000.0f
+#define MAX_FRAMES  8192
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sine(float* samples, size_t frames, size_t channels, size_t channel, float amplitude, float hz){
+    for (size_t i = 0; i < frames; i++) {
+        samples[i * channels + channel] = amplitude * sinf(2.0f * (float)M_PI * hz * i / SAMPLE_RATE);
+    }
+}
+
+static void fill(float* samples, size_t count, float value){
+    for (size_t i = 0; i < count; i++) samples[i] = value;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 時定数0(平滑化なし)で、正弦波、矩形波、無音のレベル
+ */
+static void testSignals(void){
+    static float   samples[MAX_FRAMES * 2];
+    static int16_t pcm[MAX_FRAMES];
+    SoundLevelMeter meter;
+    SoundLevelMeterInit(&meter, SAMPLE_RATE, 0.0f, 0.0f);
+
+    // 1kHzは48サンプルで一周するので、4800サンプルでちょうど100周
+    sine(samples, 4800, 1, 0, 0.5f, 1000.0f);
+    SoundLevelMeterProcess(&meter, samples, 4800, 1, 1);
+    SoundLevel level = SoundLevelMeterRead(&meter);
+    CHECK(NEAR(level.rms,  0.5f / sqrtf(2.0f), 1e-4f));
+    CHECK(NEAR(level.peak, 0.5f, 1e-4f));
+
+    for (int i = 0; i < 4800; i++) samples[i] = (i & 1)? 0.25f : -0.25f;
+    SoundLevelMeterProcess(&meter, samples, 4800, 1, 1);
+    level = SoundLevelMeterRead(&meter);
+    CHECK(NEAR(level.rms, 0.25f, 1e-5f) && NEAR(level.peak, 0.25f, 1e-6f));
+
+    fill(samples, 4800, 0.0f);
+    SoundLevelMeterProcess(&meter, samples, 4800, 1, 1);
+    level = SoundLevelMeterRead(&meter);
+    CHECK(0.0f == level.rms && 0.0f == level.peak);
+
+    // 16bit整数はfloatと同じ値になる。
+    for (int i = 0; i < 4800; i++) pcm[i] = (int16_t)lrintf(16384.0f * sinf(2.0f * (float)M_PI * i / 48.0f));
+    SoundLevelMeterProcessInt16(&meter, pcm, 4800, 1, 1);
+    level = SoundLevelMeterRead(&meter);
+    CHECK(NEAR(level.rms,  0.5f / sqrtf(2.0f), 1e-4f));
+    CHECK(NEAR(level.peak, 0.5f, 1e-4f));
+
+    // インターリーブされたステレオの片方のチャンネルだけを計る。
+    fill(samples, 9600, 0.0f);
+    sine(samples, 4800, 2, 0, 0.5f, 1000.0f);
+    SoundLevelMeterProcess(&meter, samples, 4800, 2, 1);
+    level = SoundLevelMeterRead(&meter);
+    CHECK(NEAR(level.rms, 0.5f / sqrtf(2.0f), 1e-4f));
+    SoundLevelMeterProcess(&meter, samples + 1, 4800, 2, 1);
+    CHECK(0.0f == SoundLevelMeterRead(&meter).rms);
+
+    // 端数(8で割り切れない数)も数える。
+    fill(samples, 13, 0.0f);
+    samples[12] = -0.75f;
+    SoundLevelMeterProcess(&meter, samples, 13, 1, 1);
+    CHECK(NEAR(SoundLevelMeterRead(&meter).peak, 0.75f, 1e-6f));
+
+    printf("signals: ok\n");
+}
+
+/*
+ * 0から1への段差に対し、アタックの時定数が経つと1-1/eに達する。
+ * ステレオをまとめて計っても(channels=2)同じ時間で達する。
+ */
+static float stepResponse(size_t channels, float attackTime){
+    static float samples[MAX_FRAMES * 2];
+    SoundLevelMeter meter;
+    SoundLevelMeterInit(&meter, SAMPLE_RATE, attackTime, 0.3f);
+    fill(samples, 480 * channels, 1.0f);
+
+    // 10msのブロックを時定数分
+    int blocks = (int)lrintf(attackTime / 0.01f);
+    for (int i = 0; i < blocks; i++) SoundLevelMeterProcess(&meter, samples, 480 * channels, 1, channels);
+    return SoundLevelMeterRead(&meter).rms;
+}
+
+static void testTimeConstants(void){
+    float expected = 1.0f - expf(-1.0f);
+    CHECK(NEAR(stepResponse(1, 0.05f), expected, 1e-3f));
+    CHECK(NEAR(stepResponse(2, 0.05f), expected, 1e-3f));
+    CHECK(NEAR(stepResponse(1, 0.2f),  expected, 1e-3f));
+
+    // ピークは即座に上がり、リリースで下がり、やがて0になる。(非正規化数にならない)
+    static float samples[480];
+    SoundLevelMeter meter;
+    SoundLevelMeterInit(&meter, SAMPLE_RATE, 0.01f, 0.1f);
+    fill(samples, 480, 0.8f);
+    SoundLevelMeterProcess(&meter, samples, 480, 1, 1);
+    CHECK(0.8f == SoundLevelMeterRead(&meter).peak);
+
+    fill(samples, 480, 0.0f);
+    for (int i = 0; i < 10; i++) SoundLevelMeterProcess(&meter, samples, 480, 1, 1);
+    CHECK(NEAR(SoundLevelMeterRead(&meter).peak, 0.8f * expf(-1.0f), 1e-3f));
+    for (int i = 0; i < 1000; i++) SoundLevelMeterProcess(&meter, samples, 480, 1, 1);
+    SoundLevel level = SoundLevelMeterRead(&meter);
+    CHECK(0.0f == level.rms && 0.0f == level.peak);
+
+    printf("time constants: ok\n");
+}
+
+static void testDecibels(void){
+    CHECK(NEAR(SoundLevelToDecibels(1.0f),  0.0f,   1e-5f));
+    CHECK(NEAR(SoundLevelToDecibels(0.5f), -6.0206f, 1e-3f));
+    CHECK(-120.0f == SoundLevelToDecibels(0.0f));
+    CHECK(0.0f == SoundLevelToDisplay(0.0f, -60.0f));
+    CHECK(1.0f == SoundLevelToDisplay(2.0f, -60.0f));
+    CHECK(NEAR(SoundLevelToDisplay(0.001f, -120.0f), 0.5f, 1e-4f));
+    printf("decibels: ok\n");
+}
+
+/*
+ * 書き込み中に読んでも、rmsとpeakの組が混ざらない。
+ * (k/1024の一定値のブロックを時定数0で計ると、誤差無くrmsとpeakが等しくなる)
+ */
+static SoundLevelMeter tornMeter;
+static int             tornStop;
+
+static void* tornReader(void* arg){
+    long reads = 0;
+    while (0 == __atomic_load_n(&tornStop, __ATOMIC_ACQUIRE)) {
+        SoundLevel level = SoundLevelMeterRead(&tornMeter);
+        CHECK(level.rms == level.peak);
+        reads++;
+    }
+    *(long*)arg = reads;
+    return NULL;
+}
+
+static void testTornRead(void){
+    static float samples[64];
+    SoundLevelMeterInit(&tornMeter, SAMPLE_RATE, 0.0f, 0.0f);
+
+    long      reads = 0;
+    pthread_t reader;
+    pthread_create(&reader, NULL, tornReader, &reads);
+    for (int i = 0; i < 2000000; i++) {
+        fill(samples, 64, (float)(i % 1024) / 1024.0f);
+        SoundLevelMeterProcess(&tornMeter, samples, 64, 1, 1);
+    }
+    __atomic_store_n(&tornStop, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    printf("torn read: ok (%ld reads)\n", reads);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 素直な一重のループ(比較用)
+ */
+static void naiveMeasure(const float* samples, size_t count, float* rms, float* peak){
+    float total = 0.0f, maximum = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        total  += samples[i] * samples[i];
+        maximum = fmaxf(maximum, fabsf(samples[i]));
+    }
+    *rms  = sqrtf(total / (float)count);
+    *peak = maximum;
+}
+
+static void bench(size_t frames){
+    static float   samples[MAX_FRAMES * 2];
+    static int16_t pcm[MAX_FRAMES * 2];
+    sine(samples, frames, 2, 0, 0.5f, 440.0f);
+    sine(samples, frames, 2, 1, 0.25f, 660.0f);
+    for (size_t i = 0; i < frames * 2; i++) pcm[i] = (int16_t)lrintf(samples[i] * 32767.0f);
+
+    SoundLevelMeter meter;
+    SoundLevelMeterInit(&meter, SAMPLE_RATE, 0.01f, 0.3f);
+    size_t count  = frames * 2;
+    long   rounds = (long)(200000000 / count);
+    volatile float sink = 0.0f;
+
+    double start = nowSec();
+    for (long r = 0; r < rounds; r++) {
+        float rms, peak;
+        naiveMeasure(samples, count, &rms, &peak);
+        sink = rms + peak;
+    }
+    double naive = (nowSec() - start) * 1e9 / ((double)rounds * count);
+
+    start = nowSec();
+    for (long r = 0; r < rounds; r++) SoundLevelMeterProcess(&meter, samples, count, 1, 2);
+    double interleaved = (nowSec() - start) * 1e9 / ((double)rounds * count);
+
+    start = nowSec();
+    for (long r = 0; r < rounds; r++) SoundLevelMeterProcess(&meter, samples, frames, 2, 1);
+    double strided = (nowSec() - start) * 1e9 / ((double)rounds * frames);
+
+    start = nowSec();
+    for (long r = 0; r < rounds; r++) SoundLevelMeterProcessInt16(&meter, pcm, count, 1, 2);
+    double int16 = (nowSec() - start) * 1e9 / ((double)rounds * count);
+    (void)sink;
+
+    printf("%zu stereo frames per buffer\n", frames);
+    printf("  naive loop                : %.2f ns/sample\n", naive);
+    printf("  float, stride 1           : %.2f ns/sample (%.1fx)\n", interleaved, naive / interleaved);
+    printf("  float, one channel        : %.2f ns/sample\n", strided);
+    printf("  int16, stride 1           : %.2f ns/sample\n", int16);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: slmtest [-n frames]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    size_t frames = 512;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': frames = (size_t)atol(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || frames < 1 || frames > MAX_FRAMES) usage();
+
+    testSignals();
+    testTimeConstants();
+    testDecibels();
+    testTornRead();
+    bench(frames);
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ *  SoundMixer
+ *
+ *  Created by tyabuta on 2014/07/15.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "SoundMixer.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <Accelerate/Accelerate.h>
+#endif
+
+
+#define SOUND_MIXER_QUEUE_MASK (SOUND_MIXER_QUEUE_CAPACITY - 1)
+
+#define SOUND_MIXER_PI_4 0.78539816339744830962f
+
+
+typedef enum {
+    SoundMixerCommandPlay = 0,
+    SoundMixerCommandStopAll,
+} SoundMixerCommandType;
+
+typedef struct {
+    SoundMixerCommandType type;
+    int                   sound;
+    float                 gainLeft;
+    float                 gainRight;
+} SoundMixerCommand;
+
+/*
+ * キューの要素
+ * sequenceが自分の位置と同じなら書き込め、位置+1なら読み出せる。
+ */
+typedef struct {
+    uint32_t          sequence;
+    SoundMixerCommand command;
+} SoundMixerCell;
+
+typedef struct {
+    float*  samples;
+    size_t  frames;
+    size_t  channels;
+} SoundMixerSound;
+
+typedef struct {
+    const SoundMixerSound* sound;
+    size_t                 position;
+    float                  gainLeft;
+    float                  gainRight;
+    uint32_t               age;
+} SoundMixerVoice;
+
+struct SoundMixer {
+    float             sampleRate;
+    size_t            voiceCount;
+    SoundMixerVoice*  voices;
+    uint32_t          age;
+    size_t            active;
+
+    SoundMixerSound*  sounds[SOUND_MIXER_MAX_SOUNDS];
+    uint32_t          soundCount;
+
+    uint32_t          enqueuePosition;
+    uint32_t          dequeuePosition;
+    SoundMixerCell    cells[SOUND_MIXER_QUEUE_CAPACITY];
+};
+
+
+
+
+/*------------------------------------------------------------------------------
+ Command queue
+ -----------------------------------------------------------------------------*/
+
+/*
+ * コマンドを積む。複数のスレッドから同時に呼べる。
+ */
+static int SoundMixerPush(SoundMixer* mixer, const SoundMixerCommand* command){
+    uint32_t position = __atomic_load_n(&mixer->enqueuePosition, __ATOMIC_RELAXED);
+    for (;;) {
+        SoundMixerCell* cell     = &mixer->cells[position & SOUND_MIXER_QUEUE_MASK];
+        uint32_t        sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int32_t         diff     = (int32_t)(sequence - position);
+        if (0 == diff) {
+            if (__atomic_compare_exchange_n(&mixer->enqueuePosition, &position, position + 1,
+                                            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->command = *command;
+                __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+            // 失敗した場合はpositionが最新の値になっている。
+        } else if (diff < 0) {
+            return 0;   // 一杯
+        } else {
+            position = __atomic_load_n(&mixer->enqueuePosition, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * コマンドを取り出す。オーディオスレッドだけが呼ぶ。
+ */
+static int SoundMixerPop(SoundMixer* mixer, SoundMixerCommand* command){
+    uint32_t        position = mixer->dequeuePosition;
+    SoundMixerCell* cell     = &mixer->cells[position & SOUND_MIXER_QUEUE_MASK];
+    uint32_t        sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != position + 1) return 0;
+
+    *command = cell->command;
+    __atomic_store_n(&cell->sequence, position + SOUND_MIXER_QUEUE_CAPACITY, __ATOMIC_RELEASE);
+    mixer->dequeuePosition = position + 1;
+    return 1;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Voices
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 空いているボイスか、無ければ一番古いボイスを返す。
+ */
+static SoundMixerVoice* SoundMixerAllocateVoice(SoundMixer* mixer){
+    SoundMixerVoice* oldest = &mixer->voices[0];
+    for (size_t i = 0; i < mixer->voiceCount; i++) {
+        SoundMixerVoice* voice = &mixer->voices[i];
+        if (NULL == voice->sound) return voice;
+        if ((int32_t)(voice->age - oldest->age) < 0) oldest = voice;
+    }
+    return oldest;
+}
+
+static void SoundMixerHandle(SoundMixer* mixer, const SoundMixerCommand* command){
+    if (SoundMixerCommandStopAll == command->type) {
+        for (size_t i = 0; i < mixer->voiceCount; i++) mixer->voices[i].sound = NULL;
+        return;
+    }
+
+    const SoundMixerSound* sound = __atomic_load_n(&mixer->sounds[command->sound], __ATOMIC_ACQUIRE);
+    if (NULL == sound) return;
+
+    SoundMixerVoice* voice = SoundMixerAllocateVoice(mixer);
+    voice->sound     = sound;
+    voice->position  = 0;
+    voice->gainLeft  = command->gainLeft;
+    voice->gainRight = command->gainRight;
+    voice->age       = mixer->age++;
+}
+
+/*
+ * output[2i], output[2i+1]にボイスのnフレームを加える。
+ */
+static void SoundMixerAccumulate(const SoundMixerVoice* voice, float* output, size_t n){
+    const SoundMixerSound* sound  = voice->sound;
+    const float*           source = sound->samples + voice->position * sound->channels;
+    size_t                 stride = sound->channels;
+    const float*           right  = source + (stride - 1);  // モノラルは同じサンプルを使う
+
+#if defined(__APPLE__)
+    vDSP_vsma(source, (vDSP_Stride)stride, &voice->gainLeft,  output,     2, output,     2, (vDSP_Length)n);
+    vDSP_vsma(right,  (vDSP_Stride)stride, &voice->gainRight, output + 1, 2, output + 1, 2, (vDSP_Length)n);
+#else
+    float gl = voice->gainLeft, gr = voice->gainRight;
+    if (1 == stride) {
+        for (size_t i = 0; i < n; i++) {
+            output[2 * i]     += source[i] * gl;
+            output[2 * i + 1] += source[i] * gr;
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            output[2 * i]     += source[2 * i] * gl;
+            output[2 * i + 1] += right[2 * i]  * gr;
+        }
+    }
+#endif
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+SoundMixer* SoundMixerCreate(float sampleRate, size_t voiceCount){
+    if (sampleRate <= 0.0f || 0 == voiceCount) return NULL;
+
+    SoundMixer* mixer = (SoundMixer*)calloc(1, sizeof(SoundMixer));
+    if (NULL == mixer) return NULL;
+    mixer->voices = (SoundMixerVoice*)calloc(voiceCount, sizeof(SoundMixerVoice));
+    if (NULL == mixer->voices) {
+        free(mixer);
+        return NULL;
+    }
+    mixer->sampleRate = sampleRate;
+    mixer->voiceCount = voiceCount;
+    for (uint32_t i = 0; i < SOUND_MIXER_QUEUE_CAPACITY; i++) {
+        mixer->cells[i].sequence = i;
+    }
+    return mixer;
+}
+
+void SoundMixerDestroy(SoundMixer* mixer){
+    if (NULL == mixer) return;
+    for (size_t i = 0; i < SOUND_MIXER_MAX_SOUNDS; i++) {
+        if (mixer->sounds[i]) {
+            free(mixer->sounds[i]->samples);
+            free(mixer->sounds[i]);
+        }
+    }
+    free(mixer->voices);
+    free(mixer);
+}
+
+float SoundMixerSampleRate(const SoundMixer* mixer){
+    return mixer->sampleRate;
+}
+
+int SoundMixerAddSound(SoundMixer* mixer, const float* samples, size_t frames, size_t channels){
+    if (0 == frames || (1 != channels && 2 != channels)) return -1;
+
+    SoundMixerSound* sound = (SoundMixerSound*)malloc(sizeof(SoundMixerSound));
+    if (NULL == sound) return -1;
+    sound->samples  = (float*)malloc(frames * channels * sizeof(float));
+    sound->frames   = frames;
+    sound->channels = channels;
+    if (NULL == sound->samples) {
+        free(sound);
+        return -1;
+    }
+    memcpy(sound->samples, samples, frames * channels * sizeof(float));
+
+    // 番号を予約してから公開する。
+    uint32_t index = __atomic_fetch_add(&mixer->soundCount, 1, __ATOMIC_RELAXED);
+    if (index >= SOUND_MIXER_MAX_SOUNDS) {
+        __atomic_fetch_sub(&mixer->soundCount, 1, __ATOMIC_RELAXED);
+        free(sound->samples);
+        free(sound);
+        return -1;
+    }
+    __atomic_store_n(&mixer->sounds[index], sound, __ATOMIC_RELEASE);
+    return (int)index;
+}
+
+int SoundMixerPlay(SoundMixer* mixer, int sound, float gain, float pan){
+    if (sound < 0 || sound >= SOUND_MIXER_MAX_SOUNDS) return 0;
+    if (pan < -1.0f) pan = -1.0f;
+    if (pan >  1.0f) pan =  1.0f;
+    if (!(gain > 0.0f)) gain = 0.0f;
+
+    // 等パワーのパン
+    float angle = (pan + 1.0f) * SOUND_MIXER_PI_4;
+    SoundMixerCommand command = {
+        SoundMixerCommandPlay, sound, gain * cosf(angle), gain * sinf(angle),
+    };
+    return SoundMixerPush(mixer, &command);
+}
+
+int SoundMixerStopAll(SoundMixer* mixer){
+    SoundMixerCommand command = { SoundMixerCommandStopAll, 0, 0.0f, 0.0f };
+    return SoundMixerPush(mixer, &command);
+}
+
+void SoundMixerRender(SoundMixer* mixer, float* output, size_t frames){
+    SoundMixerCommand command;
+    while (SoundMixerPop(mixer, &command)) {
+        SoundMixerHandle(mixer, &command);
+    }
+
+    memset(output, 0, frames * 2 * sizeof(float));
+
+    size_t active = 0;
+    for (size_t i = 0; i < mixer->voiceCount; i++) {
+        SoundMixerVoice* voice = &mixer->voices[i];
+        if (NULL == voice->sound) continue;
+
+        size_t remaining = voice->sound->frames - voice->position;
+        size_t n         = (remaining < frames)? remaining : frames;
+        SoundMixerAccumulate(voice, output, n);
+        voice->position += n;
+        if (voice->position >= voice->sound->frames) {
+            voice->sound = NULL;
+        } else {
+            active++;
+        }
+    }
+    __atomic_store_n(&mixer->active, active, __ATOMIC_RELAXED);
+
+    // 重なった音が割れないように飽和させる。
+#if defined(__APPLE__)
+    const float low = -1.0f, high = 1.0f;
+    vDSP_vclip(output, 1, &low, &high, output, 1, (vDSP_Length)(frames * 2));
+#else
+    for (size_t i = 0; i < frames * 2; i++) {
+        float v = output[i];
+        output[i] = (v > 1.0f)? 1.0f : (v < -1.0f)? -1.0f : v;
+    }
+#endif
+}
+
+size_t SoundMixerActiveVoices(const SoundMixer* mixer){
+    return __atomic_load_n(&mixer->active, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,86 @@
+/*******************************************************************************
+  SoundMixer 1.0.0.0
+
+                         効果音用のソフトウェアミキサー
+
+   デコード済みのPCMをサウンドバンクとして持ち、N個のボイスで同時に鳴らす。
+   ボイス毎に音量とパン(-1.0左~1.0右)を指定できる。
+
+   再生の指示はどのスレッドからでもコマンドキューに積むだけで、
+   オーディオスレッドはレンダーの先頭でキューを取り出してボイスを割り当てる。
+   キューは配列を使ったロックフリーのキューで、待ちもメモリ確保も無い。
+   ボイスが足りなければ一番古いボイスを止めて使う。
+
+   出力はステレオのインターリーブ(float)で、-1.0~1.0にクリップする。
+   Apple環境ではvDSPを使い、それ以外では素のCのループで計算する。
+   UIKitにもAudioUnitにも依存しないので、Linux上でもそのままオフラインで
+   レンダリングできる。(実際の出力はSoundMixerPlayerを参照)
+   検査と計測はsmtestで行う。
+
+       $ cc -O2 -pthread -o smtest smtest.c SoundMixer.c -lm
+       $ ./smtest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_SOUND_MIXER_H
+#define TYABUTA_SOUND_MIXER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// サウンドバンクに登録できる数
+#define SOUND_MIXER_MAX_SOUNDS 64
+
+// コマンドキューの長さ(2の累乗)
+#define SOUND_MIXER_QUEUE_CAPACITY 256
+
+typedef struct SoundMixer SoundMixer;
+
+/*
+ * 作成する。voiceCountは同時に鳴らせる数。
+ */
+SoundMixer* SoundMixerCreate(float sampleRate, size_t voiceCount);
+void SoundMixerDestroy(SoundMixer* mixer);
+
+float SoundMixerSampleRate(const SoundMixer* mixer);
+
+/*
+ * PCMをサウンドバンクに登録し、サウンド番号を返す。失敗時は-1
+ * samplesはframes x channels(1か2)個のインターリーブされたサンプルで、コピーされる。
+ * サンプルレートはミキサーと同じにしておくこと。
+ * 登録したサウンドはミキサーを破棄するまで有効。(どのスレッドからでも可)
+ */
+int SoundMixerAddSound(SoundMixer* mixer, const float* samples, size_t frames, size_t channels);
+
+/*
+ * サウンドを鳴らす。(どのスレッドからでも可)
+ * キューが一杯の場合は0を返す。
+ */
+int SoundMixerPlay(SoundMixer* mixer, int sound, float gain, float pan);
+
+/*
+ * 全てのボイスを止める。(どのスレッドからでも可)
+ */
+int SoundMixerStopAll(SoundMixer* mixer);
+
+/*
+ * framesフレーム分のステレオを書き出す。(オーディオスレッド)
+ * outputはframes x 2個のfloat
+ */
+void SoundMixerRender(SoundMixer* mixer, float* output, size_t frames);
+
+/*
+ * 鳴っているボイスの数(どのスレッドからでも可)
+ */
+size_t SoundMixerActiveVoices(const SoundMixer* mixer);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_SOUND_MIXER_H
@@ -0,0 +1,73 @@
+/*******************************************************************************
+  SoundMixerPlayer 1.0.0.0
+
+                         SoundMixerをRemoteIOで鳴らすプレイヤー
+                ※ AudioToolbox.framework を追加する必要がある。
+                ※ AVFoundation.framework を追加する必要がある。
+
+   効果音を起動時にExtAudioFileでPCMへデコードしてサウンドバンクに登録し、
+   RemoteIOのレンダーコールバックからSoundMixerで鳴らす。
+   AudioServicesPlaySystemSoundより遅延が小さく、同時発音数も決められる。
+
+   レンダーコールバックでは、ミキサーの出力にgainRampで音量をかけ、
+   levelMeterで計測する。どちらもSoundVolumeController, SoundGaugeViewに
+   そのまま渡せる。
+
+       SoundMixerPlayer* player = [SoundMixerPlayer sharedPlayer];
+       int tink = [player loadSoundWithPath:[[NSBundle mainBundle] pathForResource:@"Tink" ofType:@"caf"]];
+       [player start];
+       [player playSound:tink gain:1.0f pan:0.0f];
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_SOUND_MIXER_PLAYER_H
+#define TYABUTA_SOUND_MIXER_PLAYER_H
+
+#import <Foundation/Foundation.h>
+#import "SoundMixer.h"
+#import "SoundGainRamp.h"
+#import "SoundLevelMeter.h"
+
+@interface SoundMixerPlayer : NSObject
+
+/*
+ * 44.1kHz, 16ボイスの共有プレイヤー
+ */
++ (SoundMixerPlayer*)sharedPlayer;
+
+- (id)initWithSampleRate:(double)sampleRate voices:(NSUInteger)voices;
+
+@property (nonatomic, readonly) SoundMixer*      mixer;
+@property (nonatomic, readonly) SoundGainRamp*   gainRamp;
+@property (nonatomic, readonly) SoundLevelMeter* levelMeter;
+@property (nonatomic, readonly, getter=isRunning) BOOL running;
+
+/*
+ * startで設定するAVAudioSessionのカテゴリ。(既定はnilで、アプリの設定を変えない)
+ * 他のアプリの音を止めずに重ねる場合はAVAudioSessionCategoryAmbientを設定する。
+ * ※ セッションはアプリ全体で共有されるので、他の音声にも影響する。
+ */
+@property (nonatomic, copy) NSString* sessionCategory;
+
+/*
+ * 出力を開始/停止する。
+ */
+- (BOOL)start;
+- (void)stop;
+
+/*
+ * 音声ファイルをデコードしてサウンドバンクに登録し、サウンド番号を返す。失敗時は-1
+ * 同じパスは一度だけデコードする。
+ */
+- (int)loadSoundWithPath:(NSString*)path;
+
+/*
+ * サウンドを鳴らす。(どのスレッドからでも可)
+ */
+- (BOOL)playSound:(int)sound gain:(float)gain pan:(float)pan;
+
+@end
+
+
+#endif // TYABUTA_SOUND_MIXER_PLAYER_H
@@ -0,0 +1,255 @@
+//
+//  SoundMixerPlayer
+//
+//  Created by tyabuta on 2014/07/15.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "SoundMixerPlayer.h"
+#import <AudioToolbox/AudioToolbox.h>
+#import <AVFoundation/AVFoundation.h>
+
+
+/*
+ * デバックログ用のマクロ、リリース時は何もおこらないようになる。
+ * Tips: __VA_ARGS__ の前に##を付けると、引数ゼロでもコンパイルが通る。
+ */
+#ifdef DEBUG
+#define dmsg(fmt, ...) NSLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#else
+#define dmsg(...)
+#endif
+
+
+// 音量を変える時のランプの時間(sec)
+#define SOUND_MIXER_PLAYER_RAMP_TIME 0.03f
+
+// デコード時に一度に読むフレーム数
+#define SOUND_MIXER_PLAYER_READ_FRAMES 4096
+
+
+/*
+ * レンダーコールバックから触るものをまとめた構造体
+ * オーディオスレッドではObjective-Cのオブジェクトに触らない。
+ */
+typedef struct {
+    SoundMixer*     mixer;
+    SoundGainRamp   gainRamp;
+    SoundLevelMeter levelMeter;
+} SoundMixerPlayerContext;
+
+
+static OSStatus SoundMixerPlayerRender(void*                       inRefCon,
+                                       AudioUnitRenderActionFlags* ioActionFlags,
+                                       const AudioTimeStamp*       inTimeStamp,
+                                       UInt32                      inBusNumber,
+                                       UInt32                      inNumberFrames,
+                                       AudioBufferList*            ioData){
+    SoundMixerPlayerContext* context = (SoundMixerPlayerContext*)inRefCon;
+    float*                   output  = (float*)ioData->mBuffers[0].mData;
+
+    SoundMixerRender(context->mixer, output, inNumberFrames);
+    SoundGainRampProcess(&context->gainRamp, output, inNumberFrames, 2);
+    SoundLevelMeterProcess(&context->levelMeter, output, inNumberFrames * 2, 1, 2);
+    return noErr;
+}
+
+/*
+ * ステレオのインターリーブされたfloat
+ */
+static AudioStreamBasicDescription SoundMixerPlayerFormat(double sampleRate, UInt32 channels){
+    AudioStreamBasicDescription format;
+    memset(&format, 0, sizeof(format));
+    format.mSampleRate       = sampleRate;
+    format.mFormatID         = kAudioFormatLinearPCM;
+    format.mFormatFlags      = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+    format.mChannelsPerFrame = channels;
+    format.mBitsPerChannel   = 32;
+    format.mFramesPerPacket  = 1;
+    format.mBytesPerFrame    = 4 * channels;
+    format.mBytesPerPacket   = 4 * channels;
+    return format;
+}
+
+
+
+
+@implementation SoundMixerPlayer
+{
+    SoundMixerPlayerContext* _context;
+    AudioUnit                _unit;
+    double                   _sampleRate;
+    NSMutableDictionary*     _sounds;     // path -> サウンド番号
+}
+
++ (SoundMixerPlayer*)sharedPlayer {
+    static SoundMixerPlayer* player = nil;
+    static dispatch_once_t   once;
+    dispatch_once(&once, ^{
+        player = [[SoundMixerPlayer alloc] initWithSampleRate:44100.0 voices:16];
+    });
+    return player;
+}
+
+- (id)initWithSampleRate:(double)sampleRate voices:(NSUInteger)voices {
+    self = [super init];
+    if (self) {
+        _context = (SoundMixerPlayerContext*)calloc(1, sizeof(SoundMixerPlayerContext));
+        if (NULL == _context) return nil;
+        _context->mixer = SoundMixerCreate((float)sampleRate, voices);
+        if (NULL == _context->mixer) return nil;
+        SoundGainRampInit(&_context->gainRamp, (float)sampleRate, SOUND_MIXER_PLAYER_RAMP_TIME,
+                          SoundGainRampExponential, 1.0f);
+        SoundLevelMeterInit(&_context->levelMeter, (float)sampleRate, 0.01f, 0.3f);
+
+        _sampleRate = sampleRate;
+        _sounds     = [NSMutableDictionary dictionary];
+        if (NO == [self setupUnit]) return nil;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_unit) {
+        AudioOutputUnitStop(_unit);
+        AudioUnitUninitialize(_unit);
+        AudioComponentInstanceDispose(_unit);
+    }
+    if (_context) {
+        SoundMixerDestroy(_context->mixer);
+        free(_context);
+    }
+}
+
+- (SoundMixer*)mixer {
+    return _context->mixer;
+}
+
+- (SoundGainRamp*)gainRamp {
+    return &_context->gainRamp;
+}
+
+- (SoundLevelMeter*)levelMeter {
+    return &_context->levelMeter;
+}
+
+/*
+ * RemoteIOを作り、レンダーコールバックを設定する。
+ */
+- (BOOL)setupUnit {
+    AudioComponentDescription description;
+    memset(&description, 0, sizeof(description));
+    description.componentType         = kAudioUnitType_Output;
+    description.componentSubType      = kAudioUnitSubType_RemoteIO;
+    description.componentManufacturer = kAudioUnitManufacturer_Apple;
+
+    AudioComponent component = AudioComponentFindNext(NULL, &description);
+    if (NULL == component || noErr != AudioComponentInstanceNew(component, &_unit)) {
+        dmsg(@"RemoteIOが見つかりません。");
+        return NO;
+    }
+
+    AudioStreamBasicDescription format = SoundMixerPlayerFormat(_sampleRate, 2);
+    AURenderCallbackStruct callback = { SoundMixerPlayerRender, _context };
+    OSStatus status;
+    status = AudioUnitSetProperty(_unit, kAudioUnitProperty_StreamFormat,
+                                  kAudioUnitScope_Input, 0, &format, sizeof(format));
+    if (noErr == status) {
+        status = AudioUnitSetProperty(_unit, kAudioUnitProperty_SetRenderCallback,
+                                      kAudioUnitScope_Input, 0, &callback, sizeof(callback));
+    }
+    if (noErr == status) {
+        status = AudioUnitInitialize(_unit);
+    }
+    if (noErr != status) {
+        dmsg(@"RemoteIOの設定に失敗しました。 %d", (int)status);
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL)start {
+    if (_running) return YES;
+
+    // カテゴリはアプリ全体の設定なので、指定された場合だけ変える。
+    if (_sessionCategory) {
+        NSError* error = nil;
+        AVAudioSession* session = [AVAudioSession sharedInstance];
+        if (NO == [session setCategory:_sessionCategory error:&error] ||
+            NO == [session setActive:YES error:&error]) {
+            dmsg(@"%@", error);
+        }
+    }
+
+    OSStatus status = AudioOutputUnitStart(_unit);
+    if (noErr != status) {
+        dmsg(@"出力を開始できません。 %d", (int)status);
+        return NO;
+    }
+    _running = YES;
+    return YES;
+}
+
+- (void)stop {
+    if (NO == _running) return;
+    AudioOutputUnitStop(_unit);
+    _running = NO;
+}
+
+- (int)loadSoundWithPath:(NSString*)path {
+    @synchronized(self) {
+        NSNumber* loaded = _sounds[path];
+        if (loaded) return [loaded intValue];
+    }
+
+    ExtAudioFileRef file = NULL;
+    NSURL* url = [NSURL fileURLWithPath:path];
+    if (noErr != ExtAudioFileOpenURL((__bridge CFURLRef)url, &file)) {
+        dmsg(@"音声ファイルを開けません。 %@", path);
+        return -1;
+    }
+
+    // ミキサーと同じサンプルレートのfloatに変換して読む。
+    AudioStreamBasicDescription fileFormat;
+    UInt32 size = sizeof(fileFormat);
+    ExtAudioFileGetProperty(file, kExtAudioFileProperty_FileDataFormat, &size, &fileFormat);
+    UInt32 channels = (fileFormat.mChannelsPerFrame >= 2)? 2 : 1;
+    AudioStreamBasicDescription clientFormat = SoundMixerPlayerFormat(_sampleRate, channels);
+    if (noErr != ExtAudioFileSetProperty(file, kExtAudioFileProperty_ClientDataFormat,
+                                         sizeof(clientFormat), &clientFormat)) {
+        ExtAudioFileDispose(file);
+        return -1;
+    }
+
+    NSMutableData* pcm    = [NSMutableData data];
+    float          buffer[SOUND_MIXER_PLAYER_READ_FRAMES * 2];
+    for (;;) {
+        AudioBufferList list;
+        list.mNumberBuffers              = 1;
+        list.mBuffers[0].mNumberChannels = channels;
+        list.mBuffers[0].mDataByteSize   = sizeof(buffer);
+        list.mBuffers[0].mData           = buffer;
+        UInt32 frames = SOUND_MIXER_PLAYER_READ_FRAMES * 2 / channels;
+        if (noErr != ExtAudioFileRead(file, &frames, &list) || 0 == frames) break;
+        [pcm appendBytes:buffer length:frames * channels * sizeof(float)];
+    }
+    ExtAudioFileDispose(file);
+
+    size_t frames = pcm.length / (channels * sizeof(float));
+    int    sound  = SoundMixerAddSound(_context->mixer, (const float*)pcm.bytes, frames, channels);
+    if (sound < 0) {
+        dmsg(@"サウンドバンクに登録できません。 %@", path);
+        return -1;
+    }
+    @synchronized(self) {
+        _sounds[path] = @(sound);
+    }
+    return sound;
+}
+
+- (BOOL)playSound:(int)sound gain:(float)gain pan:(float)pan {
+    if (sound < 0) return NO;
+    return 0 != SoundMixerPlay(_context->mixer, sound, gain, pan);
+}
+
+@end
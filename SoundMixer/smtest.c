@@ -0,0 +1,376 @@
+/*
+ *  smtest
+ *
+ *  SoundMixerをPC(Linux)上でオフラインでレンダリングして検査し、
+ *  ボイスが鳴っている間の一フレーム当たりの時間を、
+ *  フレーム毎に全ボイスを回す素直なミキサーと比べる。
+ *
+ *      $ cc -O2 -pthread -o smtest smtest.c SoundMixer.c -lm
+ *      $ ./smtest
+ *
+ *      -v voices  計測で鳴らすボイスの数 (初期値は8)
+ *      -n frames  一回にレンダリングするフレーム数 (初期値は256)
+ *
+ *  -fsanitize=thread を付けてビルドすると、コマンドキューの競合も検査できる。
+ *
+ *  Created by tyabuta on 2014/07/15.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "SoundMixer.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+#define NEAR(a, b) (fabsf((a) - (b)) <= 1e-6f)
+
+#define SAMPLE_RATE 48000.0f
+#define MAX_FRAMES  4096
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * 一定値のサウンドを登録する。
+ */
+static int addConstant(SoundMixer* mixer, size_t frames, size_t channels, float left, float right){
+    float* samples = malloc(frames * channels * sizeof(float));
+    for (size_t i = 0; i < frames; i++) {
+        samples[i * channels] = left;
+        if (2 == channels) samples[i * 2 + 1] = right;
+    }
+    int sound = SoundMixerAddSound(mixer, samples, frames, channels);
+    free(samples);
+    return sound;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+static void testCreate(void){
+    CHECK(NULL == SoundMixerCreate(0.0f, 8));
+    CHECK(NULL == SoundMixerCreate(SAMPLE_RATE, 0));
+
+    SoundMixer* mixer = SoundMixerCreate(SAMPLE_RATE, 8);
+    CHECK(mixer && SAMPLE_RATE == SoundMixerSampleRate(mixer));
+    float sample = 0.5f;
+    CHECK(-1 == SoundMixerAddSound(mixer, &sample, 0, 1));
+    CHECK(-1 == SoundMixerAddSound(mixer, &sample, 1, 3));
+
+    // バンクが一杯になると-1
+    for (int i = 0; i < SOUND_MIXER_MAX_SOUNDS; i++) CHECK(i == SoundMixerAddSound(mixer, &sample, 1, 1));
+    CHECK(-1 == SoundMixerAddSound(mixer, &sample, 1, 1));
+    CHECK(0 == SoundMixerPlay(mixer, -1, 1.0f, 0.0f));
+    CHECK(0 == SoundMixerPlay(mixer, SOUND_MIXER_MAX_SOUNDS, 1.0f, 0.0f));
+    SoundMixerDestroy(mixer);
+    printf("create: ok\n");
+}
+
+/*
+ * 等パワーのパン。モノラルは両方に、ステレオはそれぞれのチャンネルに出る。
+ * 最後まで鳴ったボイスは止まり、その後は無音になる。
+ */
+static void testPan(void){
+    static float output[2 * 256];
+    SoundMixer* mixer  = SoundMixerCreate(SAMPLE_RATE, 8);
+    int         mono   = addConstant(mixer, 300, 1, 1.0f, 0.0f);
+    int         stereo = addConstant(mixer, 100, 2, 0.5f, -0.5f);
+
+    SoundMixerRender(mixer, output, 256);
+    for (int i = 0; i < 512; i++) CHECK(0.0f == output[i]);
+    CHECK(0 == SoundMixerActiveVoices(mixer));
+
+    CHECK(SoundMixerPlay(mixer, mono, 1.0f, -1.0f));
+    SoundMixerRender(mixer, output, 256);
+    CHECK(1.0f == output[0] && 0.0f == output[1] && 1.0f == output[510]);
+    CHECK(1 == SoundMixerActiveVoices(mixer));
+    SoundMixerRender(mixer, output, 256);
+    CHECK(1.0f == output[2 * 43] && 0.0f == output[2 * 44]);
+    CHECK(0 == SoundMixerActiveVoices(mixer));
+
+    // 範囲外のパンは端にそろえる。
+    CHECK(SoundMixerPlay(mixer, mono, 0.5f, 3.0f));
+    SoundMixerRender(mixer, output, 1);
+    CHECK(NEAR(output[0], 0.0f) && NEAR(output[1], 0.5f));
+    SoundMixerStopAll(mixer);
+
+    float center = cosf((float)M_PI / 4.0f);
+    CHECK(SoundMixerPlay(mixer, mono, 0.5f, 0.0f));
+    SoundMixerRender(mixer, output, 1);
+    CHECK(NEAR(output[0], 0.5f * center) && NEAR(output[1], 0.5f * center));
+    CHECK(NEAR(output[0] * output[0] + output[1] * output[1], 0.25f));
+    SoundMixerStopAll(mixer);
+
+    CHECK(SoundMixerPlay(mixer, stereo, 1.0f, 0.0f));
+    SoundMixerRender(mixer, output, 256);
+    CHECK(NEAR(output[0], 0.5f * center) && NEAR(output[1], -0.5f * center));
+    CHECK(0.0f == output[2 * 100] && 0.0f == output[2 * 100 + 1]);
+
+    // 負の音量とNaNは無音
+    CHECK(SoundMixerPlay(mixer, mono, -1.0f, 0.0f));
+    CHECK(SoundMixerPlay(mixer, mono, NAN, 0.0f));
+    SoundMixerRender(mixer, output, 1);
+    CHECK(0.0f == output[0] && 0.0f == output[1]);
+
+    SoundMixerDestroy(mixer);
+    printf("pan: ok\n");
+}
+
+/*
+ * 重なった音は-1.0~1.0で飽和する。
+ */
+static void testClip(void){
+    float output[2 * 16];
+    SoundMixer* mixer = SoundMixerCreate(SAMPLE_RATE, 8);
+    int         sound = addConstant(mixer, 1000, 2, 0.75f, -0.75f);
+    for (int i = 0; i < 5; i++) CHECK(SoundMixerPlay(mixer, sound, 1.0f, 0.0f));
+    SoundMixerRender(mixer, output, 16);
+    for (int i = 0; i < 16; i++) CHECK(1.0f == output[i * 2] && -1.0f == output[i * 2 + 1]);
+    SoundMixerDestroy(mixer);
+    printf("clip: ok\n");
+}
+
+/*
+ * ボイスが足りなければ一番古いボイスを止めて使う。
+ * サウンドkは k/64 の一定値なので、左の出力から鳴っているサウンドの和が分かる。
+ */
+static void testSteal(void){
+    float output[2];
+    SoundMixer* mixer = SoundMixerCreate(SAMPLE_RATE, 4);
+    int sounds[8];
+    for (int k = 0; k < 8; k++) sounds[k] = addConstant(mixer, 100000, 1, (float)(k + 1) / 64.0f, 0.0f);
+
+    for (int k = 0; k < 4; k++) {
+        CHECK(SoundMixerPlay(mixer, sounds[k], 1.0f, -1.0f));
+        SoundMixerRender(mixer, output, 1);
+    }
+    CHECK(4 == SoundMixerActiveVoices(mixer));
+    CHECK((1 + 2 + 3 + 4) / 64.0f == output[0]);
+
+    CHECK(SoundMixerPlay(mixer, sounds[4], 1.0f, -1.0f));
+    SoundMixerRender(mixer, output, 1);
+    CHECK((2 + 3 + 4 + 5) / 64.0f == output[0]);
+
+    // 一度に積まれた分も古い順に止める。
+    CHECK(SoundMixerPlay(mixer, sounds[5], 1.0f, -1.0f));
+    CHECK(SoundMixerPlay(mixer, sounds[6], 1.0f, -1.0f));
+    CHECK(SoundMixerPlay(mixer, sounds[7], 1.0f, -1.0f));
+    SoundMixerRender(mixer, output, 1);
+    CHECK((5 + 6 + 7 + 8) / 64.0f == output[0]);
+    CHECK(4 == SoundMixerActiveVoices(mixer));
+
+    CHECK(SoundMixerStopAll(mixer));
+    SoundMixerRender(mixer, output, 1);
+    CHECK(0.0f == output[0] && 0 == SoundMixerActiveVoices(mixer));
+    SoundMixerDestroy(mixer);
+    printf("voice stealing, stop all: ok\n");
+}
+
+/*
+ * キューが一杯ならPlayは0を返し、レンダリングすると空く。
+ */
+static void testQueueFull(void){
+    float output[2];
+    SoundMixer* mixer = SoundMixerCreate(SAMPLE_RATE, 4);
+    int         sound = addConstant(mixer, 1, 1, 0.0f, 0.0f);
+    for (int i = 0; i < SOUND_MIXER_QUEUE_CAPACITY; i++) CHECK(SoundMixerPlay(mixer, sound, 1.0f, 0.0f));
+    CHECK(0 == SoundMixerPlay(mixer, sound, 1.0f, 0.0f));
+    CHECK(0 == SoundMixerStopAll(mixer));
+    SoundMixerRender(mixer, output, 1);
+    CHECK(SoundMixerPlay(mixer, sound, 1.0f, 0.0f));
+    SoundMixerDestroy(mixer);
+    printf("queue full: ok\n");
+}
+
+/*
+ * 複数のスレッドから積んだコマンドは、レンダリング中でもちょうど一回ずつ鳴る。
+ * 1フレームのサウンドを 2^-13 の音量で鳴らし、1フレームずつレンダリングすると、
+ * 左の出力 x 8192 がそのレンダーで取り出したコマンドの数になる。
+ * 全てのボイスが埋まると盗まれた分を数えられないので、各スレッドは
+ * PRODUCER_BATCH個積む毎に次のレンダーを待つ。
+ */
+#define PRODUCER_COUNT  4
+#define PRODUCER_PLAYS  100000
+#define PRODUCER_BATCH  64
+#define PRODUCER_VOICES 4096
+
+static SoundMixer* producerMixer;
+static int         producerSound;
+static int         producerFinished;
+static uint32_t    producerRenders;
+
+static void* producer(void* arg){
+    for (int i = 0; i < PRODUCER_PLAYS; i += PRODUCER_BATCH) {
+        uint32_t renders = __atomic_load_n(&producerRenders, __ATOMIC_ACQUIRE);
+        for (int j = 0; j < PRODUCER_BATCH && i + j < PRODUCER_PLAYS; j++) {
+            // キューが一杯なら空くまで待つ。
+            while (!SoundMixerPlay(producerMixer, producerSound, 1.0f / 8192.0f, -1.0f)) sched_yield();
+        }
+        while (renders == __atomic_load_n(&producerRenders, __ATOMIC_ACQUIRE)) sched_yield();
+    }
+    __atomic_fetch_add(&producerFinished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void testProducers(void){
+    float output[2];
+    producerMixer = SoundMixerCreate(SAMPLE_RATE, PRODUCER_VOICES);
+    producerSound = addConstant(producerMixer, 1, 1, 1.0f, 0.0f);
+
+    pthread_t threads[PRODUCER_COUNT];
+    for (int i = 0; i < PRODUCER_COUNT; i++) pthread_create(&threads[i], NULL, producer, NULL);
+
+    long total  = (long)PRODUCER_COUNT * PRODUCER_PLAYS;
+    long played = 0, renders = 0;
+    while (played < total) {
+        int finished = __atomic_load_n(&producerFinished, __ATOMIC_ACQUIRE);
+        SoundMixerRender(producerMixer, output, 1);
+        __atomic_fetch_add(&producerRenders, 1, __ATOMIC_RELEASE);
+        long handled = lrintf(output[0] * 8192.0f);
+        CHECK(handled < PRODUCER_VOICES && 0.0f == output[1]);
+        played += handled;
+        renders++;
+
+        // 全てのスレッドが終わった後のレンダーで残りは全て取り出される。
+        if (PRODUCER_COUNT == finished) CHECK(played == total);
+        if (0 == renders % 16) sched_yield();
+    }
+    for (int i = 0; i < PRODUCER_COUNT; i++) pthread_join(threads[i], NULL);
+    SoundMixerRender(producerMixer, output, 1);
+    CHECK(0.0f == output[0]);
+
+    SoundMixerDestroy(producerMixer);
+    printf("producers: ok (%d threads, %ld plays in %ld renders)\n", PRODUCER_COUNT, played, renders);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+/*
+ * フレーム毎に全ボイスを回し、一サンプルずつ終わりを確かめる素直なミキサー(比較用)
+ */
+typedef struct {
+    const float* samples;
+    size_t       frames;
+    size_t       channels;
+    size_t       position;
+    float        gainLeft;
+    float        gainRight;
+} NaiveVoice;
+
+static void naiveRender(NaiveVoice* voices, size_t voiceCount, float* output, size_t frames){
+    for (size_t i = 0; i < frames; i++) {
+        float left = 0.0f, right = 0.0f;
+        for (size_t v = 0; v < voiceCount; v++) {
+            NaiveVoice* voice = &voices[v];
+            if (voice->position >= voice->frames) continue;
+            const float* frame = voice->samples + voice->position * voice->channels;
+            left  += frame[0] * voice->gainLeft;
+            right += frame[voice->channels - 1] * voice->gainRight;
+            voice->position++;
+        }
+        output[2 * i]     = fmaxf(-1.0f, fminf(1.0f, left));
+        output[2 * i + 1] = fmaxf(-1.0f, fminf(1.0f, right));
+    }
+}
+
+/*
+ * 半分はモノラル、半分はステレオの十分に長いサウンドを鳴らし続ける。
+ */
+static void bench(size_t voiceCount, size_t frames){
+    static float output[MAX_FRAMES * 2];
+    size_t soundFrames = 48000 * 10;
+    float* samples     = malloc(soundFrames * 2 * sizeof(float));
+    for (size_t i = 0; i < soundFrames * 2; i++) samples[i] = 0.1f * sinf((float)i * 0.01f);
+
+    SoundMixer* mixer = SoundMixerCreate(SAMPLE_RATE, voiceCount);
+    NaiveVoice* naive = calloc(voiceCount, sizeof(NaiveVoice));
+    int mono   = SoundMixerAddSound(mixer, samples, soundFrames, 1);
+    int stereo = SoundMixerAddSound(mixer, samples, soundFrames, 2);
+    long rounds = (long)((soundFrames - 1) / frames);
+
+    for (size_t v = 0; v < voiceCount; v++) {
+        float pan = (float)v / (float)voiceCount * 2.0f - 1.0f;
+        naive[v].samples   = samples;
+        naive[v].frames    = soundFrames;
+        naive[v].channels  = (v & 1)? 2 : 1;
+        naive[v].gainLeft  = 0.5f * cosf((pan + 1.0f) * (float)M_PI / 4.0f);
+        naive[v].gainRight = 0.5f * sinf((pan + 1.0f) * (float)M_PI / 4.0f);
+        SoundMixerPlay(mixer, (v & 1)? stereo : mono, 0.5f, pan);
+    }
+
+    double start = nowSec();
+    for (long r = 0; r < rounds; r++) naiveRender(naive, voiceCount, output, frames);
+    double baseline = (nowSec() - start) * 1e9 / ((double)rounds * frames);
+
+    start = nowSec();
+    for (long r = 0; r < rounds; r++) SoundMixerRender(mixer, output, frames);
+    double mixed = (nowSec() - start) * 1e9 / ((double)rounds * frames);
+    CHECK(voiceCount == SoundMixerActiveVoices(mixer));
+
+    printf("%zu voices, %zu frames per render\n", voiceCount, frames);
+    printf("  naive per-frame mixer : %6.2f ns/stereo frame\n", baseline);
+    printf("  SoundMixerRender      : %6.2f ns/stereo frame (%.1fx)\n", mixed, baseline / mixed);
+
+    SoundMixerDestroy(mixer);
+    free(naive);
+    free(samples);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: smtest [-v voices] [-n frames]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    size_t voices = 8;
+    size_t frames = 256;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "v:n:"))) {
+        switch (opt) {
+            case 'v': voices = (size_t)atol(optarg); break;
+            case 'n': frames = (size_t)atol(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || voices < 1 || voices > 256 || frames < 1 || frames > MAX_FRAMES) usage();
+
+    testCreate();
+    testPan();
+    testClip();
+    testSteal();
+    testQueueFull();
+    testProducers();
+    bench(voices, frames);
+    return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ *  SoundSpectrum
+ *
+ *  Created by tyabuta on 2014/07/11.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "SoundSpectrum.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__APPLE__)
+#include <Accelerate/Accelerate.h>
+#endif
+
+
+// これより小さい値は0とする。(非正規化数で遅くならないように)
+#define SOUND_SPECTRUM_FLOOR 1e-9f
+
+// 読み手が書き込みと重なった時に読み直す回数
+#define SOUND_SPECTRUM_READ_RETRY 4
+
+#define SOUND_SPECTRUM_PI 3.14159265358979323846
+
+
+struct SoundSpectrum {
+    size_t    fftSize;
+    size_t    hopSize;
+    float     sampleRate;
+    size_t    bandCount;
+    float     attackCoefficient;
+    float     releaseCoefficient;
+    float     scale;                  // 振幅の正規化係数
+
+    // 入力の履歴(リングバッファ)
+    float*    history;
+    size_t    position;
+    size_t    filled;
+    size_t    pending;                // 前回の解析からのサンプル数
+
+    float*    window;
+    float*    frame;                  // 窓をかけたサンプル
+    float*    magnitudes;             // fftSize/2+1
+    float*    real;                   // fftSize/2
+    float*    imag;                   // fftSize/2
+#if defined(__APPLE__)
+    FFTSetup  setup;
+    vDSP_Length log2n;
+#else
+    float*    twiddleReal;            // 複素FFT(fftSize/2点)の回転因子
+    float*    twiddleImag;
+    float*    splitReal;              // 実数FFTへ戻す為の回転因子
+    float*    splitImag;
+    uint32_t* bitReverse;
+#endif
+
+    uint32_t  bandLow[SOUND_SPECTRUM_MAX_BANDS];
+    uint32_t  bandHigh[SOUND_SPECTRUM_MAX_BANDS];
+    float     bandFrequency[SOUND_SPECTRUM_MAX_BANDS];
+    float     bands[SOUND_SPECTRUM_MAX_BANDS];
+
+    // 公開用(シーケンスロック)
+    uint32_t  sequence;
+    uint32_t  published[SOUND_SPECTRUM_MAX_BANDS];
+};
+
+
+
+
+/*------------------------------------------------------------------------------
+ FFT
+ -----------------------------------------------------------------------------*/
+
+#if !defined(__APPLE__)
+
+/*
+ * 回転因子とビット反転表を作る。
+ */
+static void SoundSpectrumPrepareFFT(SoundSpectrum* s){
+    size_t half = s->fftSize / 2;
+    int    bits = 0;
+    while (((size_t)1 << bits) < half) bits++;
+
+    for (size_t i = 0; i < half; i++) {
+        uint32_t r = 0;
+        for (int b = 0; b < bits; b++) {
+            if (i & ((size_t)1 << b)) r |= 1u << (bits - 1 - b);
+        }
+        s->bitReverse[i] = r;
+    }
+    for (size_t i = 0; i < half / 2; i++) {
+        double a = -2.0 * SOUND_SPECTRUM_PI * (double)i / (double)half;
+        s->twiddleReal[i] = (float)cos(a);
+        s->twiddleImag[i] = (float)sin(a);
+    }
+    for (size_t i = 0; i < half; i++) {
+        double a = -2.0 * SOUND_SPECTRUM_PI * (double)i / (double)s->fftSize;
+        s->splitReal[i] = (float)cos(a);
+        s->splitImag[i] = (float)sin(a);
+    }
+}
+
+/*
+ * fftSize/2点の複素FFT(基数2、時間間引き)
+ */
+static void SoundSpectrumComplexFFT(SoundSpectrum* s, float* re, float* im){
+    size_t n = s->fftSize / 2;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t j = s->bitReverse[i];
+        if (i < j) {
+            float t;
+            t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    // 最初の段は回転因子が1なので別に処理する。
+    for (size_t i = 0; i < n; i += 2) {
+        float ar = re[i], ai = im[i], br = re[i + 1], bi = im[i + 1];
+        re[i]     = ar + br; im[i]     = ai + bi;
+        re[i + 1] = ar - br; im[i + 1] = ai - bi;
+    }
+
+    for (size_t size = 4; size <= n; size <<= 1) {
+        size_t half = size / 2;
+        size_t step = n / size;
+        for (size_t start = 0; start < n; start += size) {
+            float* ar = re + start;
+            float* ai = im + start;
+            float* br = re + start + half;
+            float* bi = im + start + half;
+            for (size_t j = 0; j < half; j++) {
+                float wr = s->twiddleReal[j * step];
+                float wi = s->twiddleImag[j * step];
+                float tr = wr * br[j] - wi * bi[j];
+                float ti = wr * bi[j] + wi * br[j];
+                br[j] = ar[j] - tr; bi[j] = ai[j] - ti;
+                ar[j] = ar[j] + tr; ai[j] = ai[j] + ti;
+            }
+        }
+    }
+}
+
+#endif // !__APPLE__
+
+/*
+ * frameに窓をかけたサンプルがある状態で、magnitudesに振幅を求める。
+ */
+static void SoundSpectrumTransform(SoundSpectrum* s){
+    size_t half = s->fftSize / 2;
+    float* mag  = s->magnitudes;
+
+#if defined(__APPLE__)
+    DSPSplitComplex split = { s->real, s->imag };
+    vDSP_ctoz((const DSPComplex*)s->frame, 2, &split, 1, (vDSP_Length)half);
+    vDSP_fft_zrip(s->setup, &split, 1, s->log2n, FFT_FORWARD);
+
+    // zripは直流とナイキストをrealp[0]とimagp[0]に入れ、全体を2倍にして返す。
+    float dc      = s->real[0];
+    float nyquist = s->imag[0];
+    s->imag[0] = 0.0f;
+    vDSP_zvabs(&split, 1, mag, 1, (vDSP_Length)half);
+    mag[0]    = fabsf(dc);
+    mag[half] = fabsf(nyquist);
+
+    float scale = s->scale * 0.5f;
+    vDSP_vsmul(mag, 1, &scale, mag, 1, (vDSP_Length)(half + 1));
+#else
+    float* re = s->real;
+    float* im = s->imag;
+    for (size_t i = 0; i < half; i++) {
+        re[i] = s->frame[2 * i];
+        im[i] = s->frame[2 * i + 1];
+    }
+    SoundSpectrumComplexFFT(s, re, im);
+
+    // 偶数番目と奇数番目の変換に分け、実数入力のスペクトルに戻す。
+    mag[0]    = fabsf(re[0] + im[0]) * s->scale;
+    mag[half] = fabsf(re[0] - im[0]) * s->scale;
+    for (size_t k = 1; k < half; k++) {
+        float zr = re[k],        zi = im[k];
+        float cr = re[half - k], ci = -im[half - k];
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float dr = 0.5f * (zr - cr), di = 0.5f * (zi - ci);
+        // 奇数番目 = (z - conj) / 2i
+        float orr = di, oi = -dr;
+        float wr = s->splitReal[k], wi = s->splitImag[k];
+        float xr = er + (wr * orr - wi * oi);
+        float xi = ei + (wr * oi  + wi * orr);
+        mag[k] = sqrtf(xr * xr + xi * xi) * s->scale;
+    }
+#endif
+}
+
+/*
+ * 履歴から一つのフレームを取り出し、解析してバンドを公開する。
+ */
+static void SoundSpectrumAnalyzeHistory(SoundSpectrum* s){
+    size_t n     = s->fftSize;
+    size_t first = n - s->position;     // 古い方から並べる
+
+#if defined(__APPLE__)
+    vDSP_vmul(s->history + s->position, 1, s->window,         1, s->frame,         1, (vDSP_Length)first);
+    vDSP_vmul(s->history,               1, s->window + first, 1, s->frame + first, 1, (vDSP_Length)s->position);
+#else
+    for (size_t i = 0; i < first; i++)       s->frame[i]         = s->history[s->position + i] * s->window[i];
+    for (size_t i = 0; i < s->position; i++) s->frame[first + i] = s->history[i] * s->window[first + i];
+#endif
+    SoundSpectrumTransform(s);
+
+    for (size_t b = 0; b < s->bandCount; b++) {
+        float level = 0.0f;
+        for (uint32_t k = s->bandLow[b]; k < s->bandHigh[b]; k++) {
+            if (level < s->magnitudes[k]) level = s->magnitudes[k];
+        }
+        float c = (level > s->bands[b])? s->attackCoefficient : s->releaseCoefficient;
+        float v = level + c * (s->bands[b] - level);
+        s->bands[b] = (v < SOUND_SPECTRUM_FLOOR)? 0.0f : v;
+    }
+
+    // シーケンスを奇数にしてから書き、偶数に戻す。
+    uint32_t sequence = s->sequence;
+    __atomic_store_n(&s->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t b = 0; b < s->bandCount; b++) {
+        uint32_t bits;
+        memcpy(&bits, &s->bands[b], sizeof(float));
+        __atomic_store_n(&s->published[b], bits, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&s->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static float SoundSpectrumCoefficient(float time, float sampleRate, size_t frames){
+    if (time <= 0.0f) return 0.0f;
+    return expf(-(float)frames / (time * sampleRate));
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+SoundSpectrum* SoundSpectrumCreate(size_t fftSize, size_t hopSize, float sampleRate,
+                                   size_t bandCount, float minFrequency, float maxFrequency){
+    if (fftSize < 64 || fftSize > 16384 || (fftSize & (fftSize - 1))) return NULL;
+    if (0 == hopSize || 0 == bandCount || bandCount > SOUND_SPECTRUM_MAX_BANDS) return NULL;
+    if (sampleRate <= 0.0f || minFrequency <= 0.0f || maxFrequency <= minFrequency) return NULL;
+
+    SoundSpectrum* s = (SoundSpectrum*)calloc(1, sizeof(SoundSpectrum));
+    if (NULL == s) return NULL;
+
+    size_t half = fftSize / 2;
+    s->fftSize    = fftSize;
+    s->hopSize    = hopSize;
+    s->sampleRate = sampleRate;
+    s->bandCount  = bandCount;
+    s->history    = (float*)calloc(fftSize, sizeof(float));
+    s->window     = (float*)malloc(fftSize * sizeof(float));
+    s->frame      = (float*)malloc(fftSize * sizeof(float));
+    s->magnitudes = (float*)malloc((half + 1) * sizeof(float));
+    s->real       = (float*)malloc(half * sizeof(float));
+    s->imag       = (float*)malloc(half * sizeof(float));
+    int failed = !s->history || !s->window || !s->frame || !s->magnitudes || !s->real || !s->imag;
+
+#if defined(__APPLE__)
+    s->log2n = 0;
+    while (((size_t)1 << s->log2n) < fftSize) s->log2n++;
+    s->setup = vDSP_create_fftsetup(s->log2n, kFFTRadix2);
+    failed |= (NULL == s->setup);
+#else
+    s->twiddleReal = (float*)malloc(half / 2 * sizeof(float));
+    s->twiddleImag = (float*)malloc(half / 2 * sizeof(float));
+    s->splitReal   = (float*)malloc(half * sizeof(float));
+    s->splitImag   = (float*)malloc(half * sizeof(float));
+    s->bitReverse  = (uint32_t*)malloc(half * sizeof(uint32_t));
+    failed |= !s->twiddleReal || !s->twiddleImag || !s->splitReal || !s->splitImag || !s->bitReverse;
+#endif
+    if (failed) {
+        SoundSpectrumDestroy(s);
+        return NULL;
+    }
+
+#if defined(__APPLE__)
+    vDSP_hann_window(s->window, (vDSP_Length)fftSize, vDSP_HANN_DENORM);
+#else
+    for (size_t i = 0; i < fftSize; i++) {
+        s->window[i] = (float)(0.5 - 0.5 * cos(2.0 * SOUND_SPECTRUM_PI * (double)i / (double)fftSize));
+    }
+    SoundSpectrumPrepareFFT(s);
+#endif
+
+    // 窓の平均で割り、正弦波の振幅が1.0になるようにする。
+    double sum = 0.0;
+    for (size_t i = 0; i < fftSize; i++) sum += s->window[i];
+    s->scale = (float)(2.0 / sum);
+
+    // 対数間隔でバンドの境界を決める。低域で同じビンに重なる場合は最低1ビンにする。
+    if (maxFrequency > sampleRate * 0.5f) maxFrequency = sampleRate * 0.5f;
+    double binWidth = (double)sampleRate / (double)fftSize;
+    double ratio    = log((double)maxFrequency / (double)minFrequency) / (double)bandCount;
+    uint32_t low    = (uint32_t)ceil(minFrequency / binWidth);
+    if (low < 1) low = 1;
+    for (size_t b = 0; b < bandCount; b++) {
+        double   upper = minFrequency * exp(ratio * (double)(b + 1));
+        uint32_t high  = (uint32_t)ceil(upper / binWidth);
+        if (high <= low) high = low + 1;
+        if (high > half + 1) high = (uint32_t)(half + 1);
+        if (low >= high) low = high - 1;
+        s->bandLow[b]       = low;
+        s->bandHigh[b]      = high;
+        s->bandFrequency[b] = (float)(minFrequency * exp(ratio * ((double)b + 0.5)));
+        low = high;
+    }
+
+    SoundSpectrumSetBallistics(s, 0.02f, 0.25f);
+    return s;
+}
+
+void SoundSpectrumDestroy(SoundSpectrum* s){
+    if (NULL == s) return;
+#if defined(__APPLE__)
+    if (s->setup) vDSP_destroy_fftsetup(s->setup);
+#else
+    free(s->twiddleReal);
+    free(s->twiddleImag);
+    free(s->splitReal);
+    free(s->splitImag);
+    free(s->bitReverse);
+#endif
+    free(s->history);
+    free(s->window);
+    free(s->frame);
+    free(s->magnitudes);
+    free(s->real);
+    free(s->imag);
+    free(s);
+}
+
+void SoundSpectrumSetBallistics(SoundSpectrum* s, float attackTime, float releaseTime){
+    s->attackCoefficient  = SoundSpectrumCoefficient(attackTime,  s->sampleRate, s->hopSize);
+    s->releaseCoefficient = SoundSpectrumCoefficient(releaseTime, s->sampleRate, s->hopSize);
+}
+
+size_t SoundSpectrumFFTSize(const SoundSpectrum* s){
+    return s->fftSize;
+}
+
+size_t SoundSpectrumBandCount(const SoundSpectrum* s){
+    return s->bandCount;
+}
+
+float SoundSpectrumBandFrequency(const SoundSpectrum* s, size_t index){
+    return (index < s->bandCount)? s->bandFrequency[index] : 0.0f;
+}
+
+void SoundSpectrumProcess(SoundSpectrum* s, const float* samples, size_t count, size_t stride){
+    size_t n = s->fftSize;
+    while (count) {
+        // 次の解析か、リングバッファの終端までをまとめてコピーする。
+        size_t hop   = s->hopSize - s->pending;
+        size_t chunk = n - s->position;
+        if (chunk > hop)   chunk = hop;
+        if (chunk > count) chunk = count;
+
+        float* dst = s->history + s->position;
+        if (1 == stride) {
+            memcpy(dst, samples, chunk * sizeof(float));
+        } else {
+            for (size_t i = 0; i < chunk; i++) dst[i] = samples[i * stride];
+        }
+        samples    += chunk * stride;
+        count      -= chunk;
+        s->position = (s->position + chunk) & (n - 1);
+        s->pending += chunk;
+        s->filled   = (s->filled + chunk > n)? n : s->filled + chunk;
+
+        if (s->pending == s->hopSize) {
+            s->pending = 0;
+            if (s->filled == n) SoundSpectrumAnalyzeHistory(s);
+        }
+    }
+}
+
+void SoundSpectrumAnalyze(SoundSpectrum* s, const float* frame, float* magnitudes){
+    size_t n = s->fftSize;
+#if defined(__APPLE__)
+    vDSP_vmul(frame, 1, s->window, 1, s->frame, 1, (vDSP_Length)n);
+#else
+    for (size_t i = 0; i < n; i++) s->frame[i] = frame[i] * s->window[i];
+#endif
+    SoundSpectrumTransform(s);
+    memcpy(magnitudes, s->magnitudes, (n / 2 + 1) * sizeof(float));
+}
+
+size_t SoundSpectrumRead(const SoundSpectrum* s, float* bands, size_t capacity){
+    size_t count = (capacity < s->bandCount)? capacity : s->bandCount;
+
+    for (int retry = 0; retry < SOUND_SPECTRUM_READ_RETRY; retry++) {
+        uint32_t before = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+        if (0 == before) return 0;      // まだ一度も解析していない
+        if (before & 1) continue;       // 書き込み中
+
+        for (size_t b = 0; b < count; b++) {
+            uint32_t bits = __atomic_load_n(&s->published[b], __ATOMIC_RELAXED);
+            memcpy(&bands[b], &bits, sizeof(float));
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (before == __atomic_load_n(&s->sequence, __ATOMIC_RELAXED)) return count;
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*******************************************************************************
+  SoundSpectrum 1.0.0.0
+
+                         オーディオ信号のスペクトラムアナライザ
+
+   レンダーコールバック(オーディオスレッド)でサンプルを溜め、
+   hopSize毎にハン窓をかけた実数FFTを行い、対数間隔のバンドにまとめる。
+   バンド毎にアタック/リリースの時定数で滑らかにしてからUIへ渡す。
+
+   メモリは全て作成時に確保するので、オーディオスレッドでは確保も待ちも無い。
+   UIへはシーケンスロックで渡す。書き込み中に読んだ場合は読み直し、
+   それでも取れなければ前の表示を使えばよい。
+
+   Apple環境ではvDSP_fft_zripを使い、それ以外では事前に計算した
+   回転因子とビット反転表を使った基数2のFFTで計算する。
+   UIKitに依存しないので、Linux上でもそのままコンパイルできる。
+
+       SoundSpectrum* spectrum = SoundSpectrumCreate(1024, 1024, 48000, 16, 60, 16000);
+       // オーディオスレッド
+       SoundSpectrumProcess(spectrum, samples, frames, 1);
+       // UI
+       float bands[16];
+       if (SoundSpectrumRead(spectrum, bands, 16)) { ... }
+
+   検査と計測はsstestで行う。
+
+       $ cc -O2 -pthread -o sstest sstest.c SoundSpectrum.c -lm
+       $ ./sstest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_SOUND_SPECTRUM_H
+#define TYABUTA_SOUND_SPECTRUM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// バンド数の上限
+#define SOUND_SPECTRUM_MAX_BANDS 64
+
+typedef struct SoundSpectrum SoundSpectrum;
+
+/*
+ * 作成する。fftSizeは2の累乗(64~16384)、bandCountは1~SOUND_SPECTRUM_MAX_BANDS。
+ * 引数が正しくなければNULLを返す。
+ */
+SoundSpectrum* SoundSpectrumCreate(size_t fftSize, size_t hopSize, float sampleRate,
+                                   size_t bandCount, float minFrequency, float maxFrequency);
+void SoundSpectrumDestroy(SoundSpectrum* spectrum);
+
+/*
+ * バンドの時定数[sec]を設定する。初期値はattack 0.02sec, release 0.25sec
+ * オーディオスレッドが動いていない時に呼ぶこと。
+ */
+void SoundSpectrumSetBallistics(SoundSpectrum* spectrum, float attackTime, float releaseTime);
+
+size_t SoundSpectrumFFTSize(const SoundSpectrum* spectrum);
+size_t SoundSpectrumBandCount(const SoundSpectrum* spectrum);
+
+/*
+ * バンドの中心周波数[Hz]
+ */
+float SoundSpectrumBandFrequency(const SoundSpectrum* spectrum, size_t index);
+
+/*
+ * サンプルを入力する。(オーディオスレッド)
+ * countはサンプル数、strideはサンプルの間隔。hopSize毎に解析して公開する。
+ */
+void SoundSpectrumProcess(SoundSpectrum* spectrum, const float* samples, size_t count, size_t stride);
+
+/*
+ * fftSize個のサンプルを解析し、fftSize/2+1個の振幅を求める。
+ * 振幅は正弦波の振幅が1.0になるように正規化してある。
+ * SoundSpectrumProcessと同じ作業領域を使うので、オーディオスレッド以外で使う場合は
+ * 別のSoundSpectrumを作ること。
+ */
+void SoundSpectrumAnalyze(SoundSpectrum* spectrum, const float* frame, float* magnitudes);
+
+/*
+ * 最新のバンドの振幅(0.0~1.0のリニア値)を読む。(どのスレッドからでも可)
+ * 読めたバンド数を返す。まだ解析していないか、書き込みと重なり続けた場合は0を返す。
+ */
+size_t SoundSpectrumRead(const SoundSpectrum* spectrum, float* bands, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_SOUND_SPECTRUM_H
@@ -0,0 +1,281 @@
+/*
+ *  sstest
+ *
+ *  SoundSpectrumをPC(Linux)上で検査し、一回の解析(hop)にかかる時間を計測する。
+ *  FFTの結果は倍精度の素朴なDFTと比べる。
+ *
+ *      $ cc -O2 -pthread -o sstest sstest.c SoundSpectrum.c -lm
+ *      $ ./sstest
+ *
+ *      -n size   計測するFFTのサイズ (初期値は1024)
+ *
+ *  Created by tyabuta on 2014/07/12.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "SoundSpectrum.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+#define SAMPLE_RATE 48000.0f
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float noise(void){
+    return (float)rand() / (float)RAND_MAX - 0.5f;
+}
+
+/*
+ * ハン窓をかけた倍精度のDFT(比較用)。SoundSpectrumAnalyzeと同じ正規化をする。
+ */
+static void naiveDFT(const float* frame, size_t n, double* magnitudes){
+    double* c = malloc(n * sizeof(double));
+    double* s = malloc(n * sizeof(double));
+    double* w = malloc(n * sizeof(double));
+    double  sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        c[i] = cos(2.0 * M_PI * i / n);
+        s[i] = sin(2.0 * M_PI * i / n);
+        w[i] = (0.5 - 0.5 * c[i]) * frame[i];
+        sum += 0.5 - 0.5 * c[i];
+    }
+    for (size_t k = 0; k <= n / 2; k++) {
+        double re = 0.0, im = 0.0;
+        for (size_t i = 0, j = 0; i < n; i++, j = (j + k) & (n - 1)) {
+            re += w[i] * c[j];
+            im -= w[i] * s[j];
+        }
+        magnitudes[k] = sqrt(re * re + im * im) * 2.0 / sum;
+    }
+    free(c);
+    free(s);
+    free(w);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+static void testCreate(void){
+    CHECK(NULL == SoundSpectrumCreate(32,    32,   SAMPLE_RATE, 16, 60, 16000));
+    CHECK(NULL == SoundSpectrumCreate(1000,  1000, SAMPLE_RATE, 16, 60, 16000));
+    CHECK(NULL == SoundSpectrumCreate(32768, 1024, SAMPLE_RATE, 16, 60, 16000));
+    CHECK(NULL == SoundSpectrumCreate(1024,  0,    SAMPLE_RATE, 16, 60, 16000));
+    CHECK(NULL == SoundSpectrumCreate(1024,  1024, SAMPLE_RATE, 0,  60, 16000));
+    CHECK(NULL == SoundSpectrumCreate(1024,  1024, SAMPLE_RATE, SOUND_SPECTRUM_MAX_BANDS + 1, 60, 16000));
+    CHECK(NULL == SoundSpectrumCreate(1024,  1024, SAMPLE_RATE, 16, 16000, 60));
+
+    // バンドの中心周波数は範囲内で対数的に増える。
+    SoundSpectrum* spectrum = SoundSpectrumCreate(1024, 1024, SAMPLE_RATE, 16, 60, 16000);
+    CHECK(spectrum && 16 == SoundSpectrumBandCount(spectrum) && 1024 == SoundSpectrumFFTSize(spectrum));
+    float ratio = SoundSpectrumBandFrequency(spectrum, 1) / SoundSpectrumBandFrequency(spectrum, 0);
+    for (size_t b = 0; b < 16; b++) {
+        float f = SoundSpectrumBandFrequency(spectrum, b);
+        CHECK(f >= 60.0f && f <= 16000.0f);
+        if (b > 0) CHECK(fabsf(f / SoundSpectrumBandFrequency(spectrum, b - 1) - ratio) < 1e-3f);
+    }
+    CHECK(0.0f == SoundSpectrumBandFrequency(spectrum, 16));
+    SoundSpectrumDestroy(spectrum);
+    printf("create: ok\n");
+}
+
+/*
+ * 全てのサイズで、素朴なDFTとの差が小さい。
+ */
+static void testAnalyze(void){
+    srand(1);
+    for (size_t n = 64; n <= 16384; n *= 2) {
+        SoundSpectrum* spectrum   = SoundSpectrumCreate(n, n, SAMPLE_RATE, 16, 60, 16000);
+        float*         frame      = malloc(n * sizeof(float));
+        float*         magnitudes = malloc((n / 2 + 1) * sizeof(float));
+        double*        reference  = malloc((n / 2 + 1) * sizeof(double));
+        for (size_t i = 0; i < n; i++) frame[i] = noise();
+
+        SoundSpectrumAnalyze(spectrum, frame, magnitudes);
+        naiveDFT(frame, n, reference);
+        double error = 0.0;
+        for (size_t k = 0; k <= n / 2; k++) error = fmax(error, fabs(reference[k] - magnitudes[k]));
+        CHECK(error < 1e-5);
+
+        // ビンの中心にある正弦波は、その振幅になる。
+        size_t bin = n / 8 + 1;
+        for (size_t i = 0; i < n; i++) frame[i] = 0.8f * sinf(2.0f * (float)M_PI * bin * i / n);
+        SoundSpectrumAnalyze(spectrum, frame, magnitudes);
+        CHECK(fabsf(magnitudes[bin] - 0.8f) < 1e-3f);
+
+        SoundSpectrumDestroy(spectrum);
+        free(frame);
+        free(magnitudes);
+        free(reference);
+    }
+    printf("analyze vs DFT: ok (64 ... 16384)\n");
+}
+
+/*
+ * 1kHzの正弦波を少しずつ入力すると、1kHzを含むバンドが最大になる。
+ */
+static void testProcess(void){
+    SoundSpectrum* spectrum = SoundSpectrumCreate(1024, 512, SAMPLE_RATE, 16, 60, 16000);
+    float bands[16];
+    CHECK(0 == SoundSpectrumRead(spectrum, bands, 16));
+
+    float  buffer[2 * 256];
+    long   t = 0;
+    for (int r = 0; r < 400; r++) {
+        for (int i = 0; i < 256; i++, t++) {
+            buffer[i * 2]     = 0.8f * sinf(2.0f * (float)M_PI * 1000.0f * t / SAMPLE_RATE);
+            buffer[i * 2 + 1] = 0.0f;
+        }
+        SoundSpectrumProcess(spectrum, buffer, 256, 2);
+    }
+    CHECK(16 == SoundSpectrumRead(spectrum, bands, 16));
+    CHECK(4 == SoundSpectrumRead(spectrum, bands, 4));
+    SoundSpectrumRead(spectrum, bands, 16);
+
+    size_t loudest = 0, nearest = 0;
+    for (size_t b = 0; b < 16; b++) {
+        if (bands[b] > bands[loudest]) loudest = b;
+        if (fabsf(log2f(SoundSpectrumBandFrequency(spectrum, b) / 1000.0f)) <
+            fabsf(log2f(SoundSpectrumBandFrequency(spectrum, nearest) / 1000.0f))) nearest = b;
+    }
+    CHECK(loudest == nearest);
+    CHECK(bands[loudest] > 0.5f && bands[loudest] < 0.85f);
+
+    // 無音が続くと0まで下がる。
+    for (int i = 0; i < 512; i++) buffer[i] = 0.0f;
+    for (int r = 0; r < 2000; r++) SoundSpectrumProcess(spectrum, buffer, 512, 1);
+    SoundSpectrumRead(spectrum, bands, 16);
+    for (size_t b = 0; b < 16; b++) CHECK(0.0f == bands[b]);
+
+    SoundSpectrumDestroy(spectrum);
+    printf("process: ok\n");
+}
+
+/*
+ * 書き込み中に読んでも、違う解析のバンドが混ざらない。
+ * 同じ雑音を2の累乗倍して入力すると、時定数0ではバンドの比が誤差無く一定になる。
+ */
+static SoundSpectrum* tornSpectrum;
+static int            tornStop;
+static float          tornRatio[16];
+
+static void* tornReader(void* arg){
+    long  reads = 0;
+    float bands[16];
+    while (0 == __atomic_load_n(&tornStop, __ATOMIC_ACQUIRE)) {
+        if (16 != SoundSpectrumRead(tornSpectrum, bands, 16)) continue;
+        for (size_t b = 1; b < 16; b++) CHECK(bands[b] / bands[0] == tornRatio[b]);
+        reads++;
+    }
+    *(long*)arg = reads;
+    return NULL;
+}
+
+static void testTornRead(void){
+    size_t n = 256;
+    tornSpectrum = SoundSpectrumCreate(n, n, SAMPLE_RATE, 16, 200, 20000);
+    SoundSpectrumSetBallistics(tornSpectrum, 0.0f, 0.0f);
+
+    float base[256], scaled[256], bands[16];
+    srand(2);
+    for (size_t i = 0; i < n; i++) base[i] = noise();
+    SoundSpectrumProcess(tornSpectrum, base, n, 1);
+    CHECK(16 == SoundSpectrumRead(tornSpectrum, bands, 16));
+    for (size_t b = 0; b < 16; b++) CHECK(bands[b] > 0.0f);
+    for (size_t b = 1; b < 16; b++) tornRatio[b] = bands[b] / bands[0];
+
+    long      reads = 0;
+    pthread_t reader;
+    pthread_create(&reader, NULL, tornReader, &reads);
+    for (int r = 0; r < 200000; r++) {
+        float scale = ldexpf(1.0f, r % 8 - 4);
+        for (size_t i = 0; i < n; i++) scaled[i] = base[i] * scale;
+        SoundSpectrumProcess(tornSpectrum, scaled, n, 1);
+    }
+    __atomic_store_n(&tornStop, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    SoundSpectrumDestroy(tornSpectrum);
+    printf("torn read: ok (%ld reads)\n", reads);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+static void bench(size_t n){
+    SoundSpectrum* spectrum = SoundSpectrumCreate(n, n, SAMPLE_RATE, 16, 60, 16000);
+    size_t count  = n * 2000;
+    float* input  = malloc(count * sizeof(float));
+    for (size_t i = 0; i < count; i++) input[i] = noise();
+
+    double start = nowSec();
+    SoundSpectrumProcess(spectrum, input, count, 1);
+    double hop = (nowSec() - start) / (count / n);
+
+    double* reference = malloc((n / 2 + 1) * sizeof(double));
+    int     rounds    = (n <= 4096)? 20 : 2;
+    start = nowSec();
+    for (int r = 0; r < rounds; r++) naiveDFT(input + r * n, n, reference);
+    double naive = (nowSec() - start) / rounds;
+
+    printf("fft size %zu, hop %zu\n", n, n);
+    printf("  naive DFT           : %9.1f us/hop\n", naive * 1e6);
+    printf("  SoundSpectrumProcess: %9.1f us/hop (budget %.0f us at 48kHz)\n",
+           hop * 1e6, n / SAMPLE_RATE * 1e6);
+
+    SoundSpectrumDestroy(spectrum);
+    free(input);
+    free(reference);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: sstest [-n size]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    size_t size = 1024;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': size = (size_t)atol(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || size < 64 || size > 16384 || (size & (size - 1))) usage();
+
+    testCreate();
+    testAnalyze();
+    testProcess();
+    testTornRead();
+    bench(size);
+    return 0;
+}
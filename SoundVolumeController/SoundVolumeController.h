@@ -5,12 +5,40 @@
                 ※  MediaPlayer.framework を追加する必要がある。
                 ※ AudioToolbox.framework を追加する必要がある。
 
+   gainRampを設定すると、システムボリュームではなく自前の音声の音量を
+   ランプで滑らかに上げ下げする。(ジッパーノイズが出ない)
+   ※ SoundGainRampを追加し、SoundGainRamp.hをこのヘッダより先にimportする。
+
+   mixerPlayerを設定すると、ボタンの効果音をAudioServicesPlaySystemSoundではなく
+   SoundMixerPlayerで鳴らす。(遅延が小さく、連打しても同時発音数が増えすぎない)
+   ※ SoundMixerを追加し、SoundMixerPlayer.hをこのヘッダより先にimportする。
+   効果音はアプリのバンドルのSoundVolumeLimit.caf, SoundVolumeStep.cafを使う。
+   (バンドルに無い音はシステムサウンドで鳴らす)
+
+   (追加されていなければgainRamp, mixerPlayerプロパティは無い)
+
                                                              (c) 2013 tyabuta.
  ******************************************************************************/
 
 #import <UIKit/UIKit.h>
 
 @interface SoundVolumeController : UIViewController
+
+/*
+ * 自前の音声の音量。設定するとボタンはこの目標を変更する。(NULLでシステムボリューム)
+ * レンダーコールバックでSoundGainRampProcessを呼んで音量をかけること。
+ * ランプの寿命は呼び出し側で管理する。
+ */
+#ifdef TYABUTA_SOUND_GAIN_RAMP_H
+@property (nonatomic) SoundGainRamp* gainRamp;
+#endif
+
+/*
+ * 効果音を鳴らすプレイヤー。設定した時に効果音をデコードして登録する。(nilでシステムサウンド)
+ */
+#ifdef TYABUTA_SOUND_MIXER_PLAYER_H
+@property (nonatomic) SoundMixerPlayer* mixerPlayer;
+#endif
 @end
 
 
@@ -1,3 +1,13 @@
+// 自前の音量と効果音のモジュールは、追加されている場合だけ使う。(ヘッダより先にimportする)
+#if defined(__has_include)
+#if __has_include("SoundGainRamp.h")
+#import "SoundGainRamp.h"
+#endif
+#if __has_include("SoundMixerPlayer.h")
+#import "SoundMixerPlayer.h"
+#endif
+#endif
+
 #import "SoundVolumeController.h"
 #import <MediaPlayer/MediaPlayer.h>
 #import <AudioToolbox/AudioToolbox.h>
@@ -16,10 +26,16 @@
 #define SOUND_ID_FOR_LIMIT  1104
 #define SOUND_ID_FOR_VOLUME 1057
 
+// mixerPlayerで鳴らす効果音(アプリのバンドルのリソース名)
+#define SOUND_RESOURCE_FOR_LIMIT  @"SoundVolumeLimit"
+#define SOUND_RESOURCE_FOR_VOLUME @"SoundVolumeStep"
+
 @implementation SoundVolumeController
 {
     UIButton* upButton;
     UIButton* downButton;
+    int       limitSound;   // mixerPlayerのサウンド番号
+    int       volumeSound;
 }
 
 - (void)viewDidLoad
@@ -61,28 +77,93 @@
     [self.view addSubview:downButton];
 }
 
+#ifdef TYABUTA_SOUND_MIXER_PLAYER_H
+/*
+ * バンドルの効果音をmixerPlayerに登録する。無ければ-1
+ */
+static int SoundVolumeLoadResource(SoundMixerPlayer* mixerPlayer, NSString* name){
+    NSString* path = [[NSBundle mainBundle] pathForResource:name ofType:@"caf"];
+    if (nil == path) return -1;
+    return [mixerPlayer loadSoundWithPath:path];
+}
+
+- (void)setMixerPlayer:(SoundMixerPlayer*)mixerPlayer
+{
+    _mixerPlayer = mixerPlayer;
+    limitSound   = SoundVolumeLoadResource(mixerPlayer, SOUND_RESOURCE_FOR_LIMIT);
+    volumeSound  = SoundVolumeLoadResource(mixerPlayer, SOUND_RESOURCE_FOR_VOLUME);
+    [mixerPlayer start];
+}
+#endif
+
+/*
+ * 効果音を鳴らす。mixerPlayerで鳴らせなければシステムサウンドで鳴らす。
+ */
+- (void)playSoundForLimit:(BOOL)limit
+{
+#ifdef TYABUTA_SOUND_MIXER_PLAYER_H
+    int sound = limit? limitSound : volumeSound;
+    if (_mixerPlayer && [_mixerPlayer playSound:sound gain:1.0f pan:0.0f]) {
+        return;
+    }
+#endif
+    AudioServicesPlaySystemSound(limit? SOUND_ID_FOR_LIMIT : SOUND_ID_FOR_VOLUME);
+}
+
+/*
+ * 自前の音声の音量を一目盛り変える。
+ * 目標を変えるだけで、実際の変化はランプの時間をかけて行われる。
+ * 限界ならNOを返す。
+ */
+#ifdef TYABUTA_SOUND_GAIN_RAMP_H
+- (BOOL)stepGainRamp:(float)delta
+{
+    float gain = SoundGainRampGetTarget(_gainRamp);
+    if ((delta > 0.0f && gain >= 1.0f) || (delta < 0.0f && gain <= 0.0f)) {
+        return NO;
+    }
+    gain = fminf(fmaxf(gain + delta, 0.0f), 1.0f);
+    SoundGainRampSetTarget(_gainRamp, gain);
+    return YES;
+}
+#endif
+
 - (void)upButtonTouched:(UIButton*)sender
 {
+#ifdef TYABUTA_SOUND_GAIN_RAMP_H
+    if (_gainRamp) {
+        [self playSoundForLimit:![self stepGainRamp:A_VOLUME]];
+        return;
+    }
+#endif
+
     MPMusicPlayerController* musicPlayer = [MPMusicPlayerController applicationMusicPlayer];
     if (musicPlayer.volume < 1.0f){
         musicPlayer.volume += A_VOLUME;
-        AudioServicesPlaySystemSound(SOUND_ID_FOR_VOLUME);
+        [self playSoundForLimit:NO];
     }
     else {
-        AudioServicesPlaySystemSound(SOUND_ID_FOR_LIMIT);
+        [self playSoundForLimit:YES];
     }
 }
 
 
 - (void)downButtonTouched:(UIButton*)sender
 {
+#ifdef TYABUTA_SOUND_GAIN_RAMP_H
+    if (_gainRamp) {
+        [self playSoundForLimit:![self stepGainRamp:-A_VOLUME]];
+        return;
+    }
+#endif
+
     MPMusicPlayerController* musicPlayer = [MPMusicPlayerController applicationMusicPlayer];
     if (musicPlayer.volume > 0.0f){
         musicPlayer.volume -= A_VOLUME;
-        AudioServicesPlaySystemSound(SOUND_ID_FOR_VOLUME);
+        [self playSoundForLimit:NO];
     }
     else {
-        AudioServicesPlaySystemSound(SOUND_ID_FOR_LIMIT);
+        [self playSoundForLimit:YES];
     }
 
 }
@@ -0,0 +1,72 @@
+/*******************************************************************************
+  TimerWheel 1.0.0.0
+
+                 複数のタイマーを一つの起床にまとめる階層タイマーホイール
+
+   NSTimerをビュー毎に作成すると、ウィジェットの数だけランループが起床する。
+   TimerWheelは全てのタイマーを一つのホイールで管理し、同じスロットに
+   落ちた期限を一回の起床でまとめて処理する。
+   登録と解除はO(1)で行える。
+
+   ※ メインスレッド専用。コールバックもメインスレッドで呼ばれる。
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_TIMER_WHEEL_H
+#define TYABUTA_TIMER_WHEEL_H
+
+#import <Foundation/Foundation.h>
+
+/*
+ * タイマー発火時に呼ばれるブロック
+ */
+typedef void (^TimerWheelBlock)(void);
+
+
+@interface TimerWheel : NSObject
+
+/*
+ * アプリケーション共通のホイールを取得する。
+ */
++ (TimerWheel*)sharedWheel;
+
+/*
+ * タイマーを登録する。
+ * interval:  発火間隔[sec]
+ * tolerance: 許容する遅れ[sec]
+ *            この範囲で他のタイマーと期限を揃え、起床回数を減らす。
+ * repeats:   YES->繰り返し NO->一回のみ
+ *
+ * 戻り値はcancelTimer:に渡すトークン。
+ */
+- (id)addTimerWithInterval:(NSTimeInterval)interval
+                 tolerance:(NSTimeInterval)tolerance
+                   repeats:(BOOL)repeats
+                     block:(TimerWheelBlock)block;
+
+/*
+ * ターゲットとセレクタでタイマーを登録する。
+ * ターゲットは弱参照で保持され、解放されたタイマーは自動的に解除される。
+ * - (void)tick:(id)timer
+ */
+- (id)addTimerWithInterval:(NSTimeInterval)interval
+                 tolerance:(NSTimeInterval)tolerance
+                    target:(id)target
+                  selector:(SEL)selector;
+
+/*
+ * タイマーを解除する。
+ * 解除済みのトークンを渡しても何もおこらない。
+ */
+- (void)cancelTimer:(id)token;
+
+/*
+ * 登録中のタイマー数
+ */
+@property(nonatomic, readonly) NSUInteger count;
+
+@end
+
+
+#endif // TYABUTA_TIMER_WHEEL_H
@@ -0,0 +1,471 @@
+//
+//  TimerWheel
+//
+//  Created by tyabuta on 2014/05/10.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "TimerWheel.h"
+#import <mach/mach_time.h>
+
+
+/*------------------------------------------------------------------------------
+ Wheel parameters
+ -----------------------------------------------------------------------------*/
+#pragma mark - Wheel parameters
+
+// 1ティックあたりの時間[sec]
+#define TIMER_WHEEL_RESOLUTION 0.01
+
+// 階層の数
+#define TIMER_WHEEL_LEVELS 4
+
+// 最下層のスロット数(256ティック = 2.56sec)
+#define TIMER_WHEEL_ROOT_BITS  8
+#define TIMER_WHEEL_ROOT_SIZE  (1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_ROOT_MASK  (TIMER_WHEEL_ROOT_SIZE - 1)
+
+// 上位層のスロット数(64スロットずつ)
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_LEVEL_SIZE (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVEL_MASK (TIMER_WHEEL_LEVEL_SIZE - 1)
+
+// ホイール全体で扱える最大の期限(約7.7日)
+#define TIMER_WHEEL_MAX_TICKS \
+((1ULL << (TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS*(TIMER_WHEEL_LEVELS-1))) - 1)
+
+/*
+ * 指定階層のスロットが受け持つ期限のビットシフト量
+ */
+NS_INLINE int TimerWheelLevelShift(int level){
+    return (0 == level)? 0 : TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS*(level-1);
+}
+
+/*
+ * 指定階層に入れられる最大の残りティック数(この値未満)
+ */
+NS_INLINE uint64_t TimerWheelLevelSpan(int level){
+    return 1ULL << (TIMER_WHEEL_ROOT_BITS + TIMER_WHEEL_LEVEL_BITS*level);
+}
+
+/*
+ * 指定期限が入るスロット番号
+ */
+NS_INLINE int TimerWheelSlotIndex(int level, uint64_t deadline){
+    uint64_t mask = (0 == level)? TIMER_WHEEL_ROOT_MASK : TIMER_WHEEL_LEVEL_MASK;
+    return (int)((deadline >> TimerWheelLevelShift(level)) & mask);
+}
+
+/*
+ * 秒をティック数に変換する。(切り上げ、最低1ティック)
+ */
+NS_INLINE uint64_t TimerWheelTicksFromInterval(NSTimeInterval interval){
+    if (interval <= 0.0) return 1;
+    double ticks = ceil(interval / TIMER_WHEEL_RESOLUTION);
+    if (ticks > (double)TIMER_WHEEL_MAX_TICKS) return TIMER_WHEEL_MAX_TICKS;
+    return (ticks < 1.0)? 1 : (uint64_t)ticks;
+}
+
+/*
+ * 許容遅れの秒をティック数に変換する。(切り捨て、許容範囲を超えて揃えない)
+ */
+NS_INLINE uint64_t TimerWheelToleranceTicks(NSTimeInterval tolerance){
+    if (tolerance <= 0.0) return 0;
+    double ticks = floor(tolerance / TIMER_WHEEL_RESOLUTION);
+    return (ticks > (double)TIMER_WHEEL_MAX_TICKS)? TIMER_WHEEL_MAX_TICKS : (uint64_t)ticks;
+}
+
+/*
+ * 許容遅れの範囲内で期限を揃える。
+ * 許容範囲以下の最大の2のべき乗に切り上げる事で、
+ * 近い期限を持つタイマー同士が同じスロットに集まる。
+ */
+NS_INLINE uint64_t TimerWheelCoalesce(uint64_t deadline, uint64_t tolerance){
+    uint64_t grain = 1;
+    while ((grain << 1) <= tolerance + 1) grain <<= 1;
+    return (deadline + grain - 1) & ~(grain - 1);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ TimerWheelEntry
+ -----------------------------------------------------------------------------*/
+#pragma mark - TimerWheelEntry
+
+/*
+ * ホイールに登録されるタイマー一つ分。
+ * スロット内は双方向リストでつながっている為、解除はO(1)で行える。
+ */
+@interface TimerWheelEntry : NSObject {
+@public
+    TimerWheelEntry*                    _next;
+    __unsafe_unretained TimerWheelEntry* _prev;
+    int             _level;     // 登録中の階層(未登録は-1)
+    int             _slot;      // 登録中のスロット番号
+    uint64_t        _deadline;  // 発火するティック(揃えた後)
+    uint64_t        _nominal;   // 本来の期限のティック(揃える前)
+    uint64_t        _interval;  // 発火間隔[tick]
+    uint64_t        _tolerance; // 許容遅れ[tick]
+    BOOL            _repeats;
+    BOOL            _cancelled;
+    TimerWheelBlock _block;
+}
+@end
+
+@implementation TimerWheelEntry
+@end
+
+
+
+
+/*------------------------------------------------------------------------------
+ Implementation TimerWheel
+ -----------------------------------------------------------------------------*/
+#pragma mark - Implementation TimerWheel
+
+@implementation TimerWheel
+{
+    // スロット毎のリストの先頭(上位層は先頭64スロットのみ使う)
+    TimerWheelEntry* _slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_ROOT_SIZE];
+
+    // 最下層のスロットが空でないかを表すビットマップ
+    uint64_t _rootBitmap[TIMER_WHEEL_ROOT_SIZE / 64];
+
+    // 上位層毎の登録数
+    NSUInteger _levelCounts[TIMER_WHEEL_LEVELS];
+
+    // 処理済みのティック
+    uint64_t _currentTick;
+
+    // advanceTo:で進める先のティック(処理中の現在時刻)
+    uint64_t _targetTick;
+
+    // ホイール開始時刻(mach_absolute_time)
+    uint64_t _origin;
+    double   _secondsPerMachUnit;
+
+    // ランループへの起床要求
+    NSTimer* _timer;
+    uint64_t _timerTick;
+}
+
++ (TimerWheel*)sharedWheel {
+    static TimerWheel*     sharedWheel = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedWheel = [[TimerWheel alloc] init];
+    });
+    return sharedWheel;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        mach_timebase_info_data_t info;
+        mach_timebase_info(&info);
+        _secondsPerMachUnit = (double)info.numer / (double)info.denom * 1e-9;
+        _origin      = mach_absolute_time();
+        _currentTick = 0;
+        _count       = 0;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_timer invalidate];
+}
+
+
+#pragma mark Public methods
+
+- (id)addTimerWithInterval:(NSTimeInterval)interval
+                 tolerance:(NSTimeInterval)tolerance
+                   repeats:(BOOL)repeats
+                     block:(TimerWheelBlock)block
+{
+    NSAssert([NSThread isMainThread], @"TimerWheel must be used on the main thread.");
+
+    // 処理済みティックは遅れている場合があるので、現在時刻を基準にする。
+    uint64_t base = MAX([self nowTick], _currentTick);
+
+    TimerWheelEntry* entry = [[TimerWheelEntry alloc] init];
+    entry->_level     = -1;
+    entry->_interval  = TimerWheelTicksFromInterval(interval);
+    entry->_tolerance = TimerWheelToleranceTicks(tolerance);
+    entry->_repeats   = repeats;
+    entry->_block     = [block copy];
+    entry->_nominal   = base + entry->_interval;
+    entry->_deadline  = TimerWheelCoalesce(entry->_nominal, entry->_tolerance);
+    [self insertEntry:entry];
+    _count++;
+
+    [self rescheduleTimer];
+    return entry;
+}
+
+- (id)addTimerWithInterval:(NSTimeInterval)interval
+                 tolerance:(NSTimeInterval)tolerance
+                    target:(id)target
+                  selector:(SEL)selector
+{
+    __weak id         weakTarget = target;
+    __weak TimerWheel* weakSelf  = self;
+    __block __weak id weakToken  = nil;
+
+    id token =
+    [self addTimerWithInterval:interval
+                     tolerance:tolerance
+                       repeats:YES
+                         block:^{
+                             id strongTarget = weakTarget;
+                             if (nil == strongTarget) {
+                                 // ターゲットが解放されていれば自動的に解除する。
+                                 [weakSelf cancelTimer:weakToken];
+                                 return;
+                             }
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Warc-performSelector-leaks"
+                             [strongTarget performSelector:selector withObject:weakToken];
+#pragma clang diagnostic pop
+                         }];
+    weakToken = token;
+    return token;
+}
+
+- (void)cancelTimer:(id)token {
+    if (NO == [token isKindOfClass:[TimerWheelEntry class]]) return;
+
+    TimerWheelEntry* entry = token;
+    if (entry->_cancelled) return;
+
+    entry->_cancelled = YES;
+    entry->_block     = nil;
+    [self unlinkEntry:entry];
+    _count--;
+
+    [self rescheduleTimer];
+}
+
+
+#pragma mark Slot list
+
+/*
+ * 期限に応じた階層とスロットへエントリを繋ぐ。
+ */
+- (void)insertEntry:(TimerWheelEntry*)entry {
+    uint64_t deadline = entry->_deadline;
+    if (deadline < _currentTick) deadline = _currentTick;
+    if (deadline - _currentTick > TIMER_WHEEL_MAX_TICKS) {
+        deadline = _currentTick + TIMER_WHEEL_MAX_TICKS;
+    }
+    entry->_deadline = deadline;
+
+    uint64_t delta = deadline - _currentTick;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS-1 && delta >= TimerWheelLevelSpan(level)) {
+        level++;
+    }
+    int slot = TimerWheelSlotIndex(level, deadline);
+
+    entry->_level = level;
+    entry->_slot  = slot;
+    entry->_prev  = nil;
+    entry->_next  = _slots[level][slot];
+    if (entry->_next) entry->_next->_prev = entry;
+    _slots[level][slot] = entry;
+
+    _levelCounts[level]++;
+    if (0 == level) _rootBitmap[slot >> 6] |= (1ULL << (slot & 63));
+}
+
+/*
+ * エントリをスロットから外す。
+ */
+- (void)unlinkEntry:(TimerWheelEntry*)entry {
+    int level = entry->_level;
+    if (level < 0) return;
+    int slot = entry->_slot;
+
+    TimerWheelEntry* next = entry->_next;
+    if (entry->_prev) entry->_prev->_next = next;
+    else              _slots[level][slot] = next;
+    if (next) next->_prev = entry->_prev;
+
+    entry->_next  = nil;
+    entry->_prev  = nil;
+    entry->_level = -1;
+
+    _levelCounts[level]--;
+    if (0 == level && nil == _slots[0][slot]) {
+        _rootBitmap[slot >> 6] &= ~(1ULL << (slot & 63));
+    }
+}
+
+/*
+ * スロットのリストをまとめて取り外し、配列として返す。
+ */
+- (NSArray*)detachSlot:(int)slot level:(int)level {
+    NSMutableArray* entries = nil;
+    while (_slots[level][slot]) {
+        TimerWheelEntry* entry = _slots[level][slot];
+        [self unlinkEntry:entry];
+        if (nil == entries) entries = [NSMutableArray array];
+        [entries addObject:entry];
+    }
+    return entries;
+}
+
+
+#pragma mark Advance
+
+/*
+ * 現在時刻のティックを取得する。
+ */
+- (uint64_t)nowTick {
+    double elapsed = (mach_absolute_time() - _origin) * _secondsPerMachUnit;
+    return (uint64_t)(elapsed / TIMER_WHEEL_RESOLUTION);
+}
+
+/*
+ * 最下層で、fromより後に登録がある最初のティックまでの距離を返す。
+ * 同じ周回内に見つからなければ0を返す。
+ */
+- (uint64_t)rootDistanceFrom:(uint64_t)from limit:(uint64_t)limit {
+    for (uint64_t d = 1; d <= limit; d++) {
+        int slot = (int)((from + d) & TIMER_WHEEL_ROOT_MASK);
+        uint64_t word = _rootBitmap[slot >> 6] >> (slot & 63);
+        if (word & 1ULL) return d;
+        if (0 == word) {
+            // このワード内の残りは空なので、次のワード境界まで飛ばす。
+            d += 63 - (slot & 63);
+        }
+    }
+    return 0;
+}
+
+/*
+ * 上位層のスロットを一つ下の階層へ移し替える。
+ */
+- (void)cascadeLevel:(int)level {
+    if (level >= TIMER_WHEEL_LEVELS) return;
+
+    int slot = TimerWheelSlotIndex(level, _currentTick);
+    if (0 == slot) [self cascadeLevel:level + 1];
+
+    for (TimerWheelEntry* entry in [self detachSlot:slot level:level]) {
+        [self insertEntry:entry];
+    }
+}
+
+/*
+ * 指定ティックまで処理を進め、期限を迎えたタイマーを発火させる。
+ */
+- (void)advanceTo:(uint64_t)targetTick {
+    _targetTick = targetTick;
+    while (_currentTick < targetTick) {
+        // 空のティックは周回の境界まで読み飛ばす。
+        uint64_t toBoundary = TIMER_WHEEL_ROOT_SIZE - (_currentTick & TIMER_WHEEL_ROOT_MASK);
+        uint64_t limit      = MIN(toBoundary, targetTick - _currentTick);
+        uint64_t distance   = [self rootDistanceFrom:_currentTick limit:limit];
+        _currentTick += (distance)? distance : limit;
+
+        // 周回の境界では上位層から降ろしてくる。
+        if (0 == (_currentTick & TIMER_WHEEL_ROOT_MASK)) {
+            [self cascadeLevel:1];
+        }
+
+        [self fireSlot:(int)(_currentTick & TIMER_WHEEL_ROOT_MASK)];
+    }
+}
+
+/*
+ * 最下層のスロットに登録されたタイマーを発火させる。
+ */
+- (void)fireSlot:(int)slot {
+    NSArray* entries = [self detachSlot:slot level:0];
+    for (TimerWheelEntry* entry in entries) {
+        // 先に発火したコールバック内で解除されている場合がある。
+        if (entry->_cancelled) continue;
+
+        TimerWheelBlock block = entry->_block;
+        if (entry->_repeats) {
+            // 揃える前の期限からの間隔で次回を決め、揃えた分や処理の遅れを蓄積させない。
+            // 停止やバックグラウンドで逃した回は、NSTimerと同様にまとめて飛ばす。
+            // (_currentTickは追いつく途中のティックなので、進める先の時刻と比べる)
+            uint64_t now  = MAX(_targetTick, _currentTick);
+            uint64_t next = entry->_nominal + entry->_interval;
+            if (next <= now) next += ((now - next) / entry->_interval + 1) * entry->_interval;
+            entry->_nominal  = next;
+            entry->_deadline = TimerWheelCoalesce(next, entry->_tolerance);
+            [self insertEntry:entry];
+        }
+        else {
+            entry->_cancelled = YES;
+            entry->_block     = nil;
+            _count--;
+        }
+
+        if (block) block();
+    }
+}
+
+
+#pragma mark RunLoop adapter
+
+/*
+ * 次に処理が必要なティックを求める。登録が無ければ0を返す。
+ */
+- (uint64_t)nextWakeTick {
+    uint64_t next = 0;
+
+    if (_levelCounts[0]) {
+        uint64_t distance = [self rootDistanceFrom:_currentTick limit:TIMER_WHEEL_ROOT_SIZE];
+        if (distance) next = _currentTick + distance;
+    }
+
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (_levelCounts[level]) {
+            // 上位層は次の周回の境界で降ろす必要がある。
+            uint64_t boundary = (_currentTick | TIMER_WHEEL_ROOT_MASK) + 1;
+            if (0 == next || boundary < next) next = boundary;
+            break;
+        }
+    }
+    return next;
+}
+
+/*
+ * 次の期限に合わせて、ランループのタイマーを一つだけ設定し直す。
+ */
+- (void)rescheduleTimer {
+    uint64_t wakeTick = [self nextWakeTick];
+    if (_timer && wakeTick == _timerTick) return;
+
+    [_timer invalidate];
+    _timer     = nil;
+    _timerTick = wakeTick;
+    if (0 == wakeTick) return;
+
+    double   elapsed = (mach_absolute_time() - _origin) * _secondsPerMachUnit;
+    double     delay = MAX(0.0, wakeTick * TIMER_WHEEL_RESOLUTION - elapsed);
+    NSDate* fireDate = [NSDate dateWithTimeIntervalSinceNow:delay];
+
+    _timer = [[NSTimer alloc] initWithFireDate:fireDate
+                                      interval:0
+                                        target:self
+                                      selector:@selector(timerFired:)
+                                      userInfo:nil
+                                       repeats:NO];
+    [[NSRunLoop mainRunLoop] addTimer:_timer forMode:NSRunLoopCommonModes];
+}
+
+- (void)timerFired:(NSTimer*)timer {
+    uint64_t target = MAX([self nowTick], _timerTick);
+    _timer = nil;
+    [self advanceTo:target];
+    [self rescheduleTimer];
+}
+
+@end
@@ -0,0 +1,230 @@
+/*
+ *  UUIDGenerator
+ *
+ *  Created by tyabuta on 2014/06/28.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "UUIDGenerator.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#if !defined(__APPLE__)
+#include <errno.h>
+#include <sys/random.h>
+#endif
+
+
+/*
+ * スレッド毎に保持する乱数のバイト数
+ * arc4random_bufの呼び出しをこのサイズ毎にまとめる。
+ */
+#define UUID_RANDOM_POOL_SIZE 512
+
+typedef struct {
+    uint8_t  bytes[UUID_RANDOM_POOL_SIZE];
+    size_t   position;
+    unsigned generation;
+} UUIDRandomPool;
+
+/*
+ * UUIDv7の単調増加の為の状態
+ * counterは rand_a(12bit) + rand_b の上位30bit の42bitを使う。
+ */
+#define UUID_V7_COUNTER_BITS 42
+
+typedef struct {
+    uint64_t timestamp;
+    uint64_t counter;
+} UUIDV7State;
+
+static __thread UUIDRandomPool UUIDPool    = {{0}, UUID_RANDOM_POOL_SIZE, 0};
+static __thread UUIDV7State    UUIDV7      = {0, 0};
+
+// fork後に親と同じ乱数を使わないよう、プールを作り直す為の世代
+static unsigned        UUIDGeneration     = 1;
+static pthread_once_t  UUIDAtForkOnce     = PTHREAD_ONCE_INIT;
+
+
+
+
+/*------------------------------------------------------------------------------
+ Random
+ -----------------------------------------------------------------------------*/
+
+static void UUIDChildAfterFork(void){
+    UUIDGeneration++;
+}
+
+static void UUIDRegisterAtFork(void){
+    pthread_atfork(NULL, NULL, UUIDChildAfterFork);
+}
+
+static void UUIDFillRandom(uint8_t* buffer, size_t length){
+#if defined(__APPLE__)
+    arc4random_buf(buffer, length);
+#else
+    while (length > 0) {
+        ssize_t n = getrandom(buffer, length, 0);
+        if (n < 0) {
+            if (EINTR == errno) continue;
+            abort();
+        }
+        buffer += n;
+        length -= (size_t)n;
+    }
+#endif
+}
+
+/*
+ * スレッド毎のプールから乱数を取り出す。使った分はプールから消す。
+ */
+static void UUIDRandomBytes(void* out, size_t length){
+    UUIDRandomPool* pool = &UUIDPool;
+    uint8_t*        dst  = (uint8_t*)out;
+
+    if (__builtin_expect(pool->generation != UUIDGeneration, 0)) {
+        pthread_once(&UUIDAtForkOnce, UUIDRegisterAtFork);
+        pool->generation = UUIDGeneration;
+        pool->position   = UUID_RANDOM_POOL_SIZE;
+    }
+
+    while (length > 0) {
+        if (UUID_RANDOM_POOL_SIZE == pool->position) {
+            UUIDFillRandom(pool->bytes, UUID_RANDOM_POOL_SIZE);
+            pool->position = 0;
+        }
+        size_t n = UUID_RANDOM_POOL_SIZE - pool->position;
+        if (n > length) n = length;
+        memcpy(dst, pool->bytes + pool->position, n);
+        memset(pool->bytes + pool->position, 0, n);
+        pool->position += n;
+        dst            += n;
+        length         -= n;
+    }
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Generate
+ -----------------------------------------------------------------------------*/
+
+void UUIDGenerateV4Bytes(UUIDBytes* uuids, size_t count){
+    UUIDRandomBytes(uuids, sizeof(UUIDBytes) * count);
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* b = uuids[i].bytes;
+        b[6] = 0x40 | (b[6] & 0x0F);  // version 4
+        b[8] = 0x80 | (b[8] & 0x3F);  // variant 10
+    }
+}
+
+static uint64_t UUIDCurrentMilliseconds(void){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+}
+
+/*
+ * 新しいミリ秒のカウンタの初期値は乱数とし、増やす余地を残す為に最上位bitは0にする。
+ */
+static uint64_t UUIDV7InitialCounter(void){
+    uint64_t counter = 0;
+    UUIDRandomBytes(&counter, sizeof(counter));
+    return counter & ((1ULL << (UUID_V7_COUNTER_BITS - 1)) - 1);
+}
+
+void UUIDGenerateV7Bytes(UUIDBytes* uuids, size_t count){
+    UUIDV7State* state = &UUIDV7;
+    uint64_t     now   = UUIDCurrentMilliseconds();
+
+    // 末尾の32bitは毎回乱数にする。
+    uint32_t tails[64];
+
+    for (size_t i = 0; i < count; i++) {
+        if (0 == i % 64) {
+            size_t n = count - i;
+            UUIDRandomBytes(tails, sizeof(uint32_t) * (n < 64 ? n : 64));
+        }
+
+        if (now > state->timestamp) {
+            state->timestamp = now;
+            state->counter   = UUIDV7InitialCounter();
+        }
+        else {
+            // 同じミリ秒(または時計が戻った場合)はカウンタで順序を保つ。
+            state->counter++;
+            if (state->counter >> UUID_V7_COUNTER_BITS) {
+                state->timestamp++;
+                state->counter = UUIDV7InitialCounter();
+            }
+        }
+
+        uint64_t ms      = state->timestamp;
+        uint64_t counter = state->counter;
+        uint32_t tail    = tails[i % 64];
+        uint8_t* b       = uuids[i].bytes;
+
+        b[0]  = (uint8_t)(ms >> 40);
+        b[1]  = (uint8_t)(ms >> 32);
+        b[2]  = (uint8_t)(ms >> 24);
+        b[3]  = (uint8_t)(ms >> 16);
+        b[4]  = (uint8_t)(ms >> 8);
+        b[5]  = (uint8_t)(ms);
+        b[6]  = 0x70 | (uint8_t)((counter >> 38) & 0x0F);  // version 7
+        b[7]  = (uint8_t)(counter >> 30);
+        b[8]  = 0x80 | (uint8_t)((counter >> 24) & 0x3F);  // variant 10
+        b[9]  = (uint8_t)(counter >> 16);
+        b[10] = (uint8_t)(counter >> 8);
+        b[11] = (uint8_t)(counter);
+        memcpy(b + 12, &tail, sizeof(tail));
+    }
+}
+
+uint64_t UUIDV7Timestamp(const UUIDBytes* uuid){
+    const uint8_t* b = uuid->bytes;
+    return ((uint64_t)b[0] << 40) | ((uint64_t)b[1] << 32) | ((uint64_t)b[2] << 24) |
+           ((uint64_t)b[3] << 16) | ((uint64_t)b[4] << 8)  |  (uint64_t)b[5];
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Format
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 1バイト分の16進数2文字の表
+ */
+static const char UUIDHexTable[512] =
+    "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECFD0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEFF0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+/*
+ * 各バイトを書き込む文字列上の位置
+ */
+static const uint8_t UUIDStringPosition[16] = {
+    0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34,
+};
+
+void UUIDFormat(const UUIDBytes* uuid, char* str){
+    for (int i = 0; i < 16; i++) {
+        memcpy(str + UUIDStringPosition[i], UUIDHexTable + uuid->bytes[i] * 2, 2);
+    }
+    str[8] = str[13] = str[18] = str[23] = '-';
+}
+
+void UUIDFormatBatch(const UUIDBytes* uuids, size_t count, char* str, size_t stride){
+    for (size_t i = 0; i < count; i++) {
+        UUIDFormat(&uuids[i], str + i * stride);
+    }
+}
@@ -0,0 +1,77 @@
+/*******************************************************************************
+  UUIDGenerator 1.0.0.0
+
+                         大量のUUIDを高速に生成する
+
+   CFUUIDのようにオブジェクトを作らず、呼び出し元のバッファへ直接書き込む。
+   乱数はスレッド毎にまとめて取得したCSPRNG(arc4random_buf)の出力から使う。
+
+   UUIDv4  : 122bitの乱数
+   UUIDv7  : 先頭48bitがUNIX時間[ms]のUUID (RFC 9562)
+             生成時刻の順に並ぶので、ファイル名やインデックスのキーにすると
+             近い時刻に作られたものが近くに並ぶ。
+             同じミリ秒内はスレッド毎のカウンタで単調増加する。
+             (スレッドをまたいだ順序はミリ秒単位でのみ保証される)
+
+   素のCで書いてあるので、Linux上でもそのままコンパイルできる。
+   検査と計測はuuidtestで行う。
+
+       $ cc -O2 -pthread -o uuidtest uuidtest.c UUIDGenerator.c
+       $ ./uuidtest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_UUID_GENERATOR_H
+#define TYABUTA_UUID_GENERATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 文字列にした場合の長さ(終端文字を含まない)
+ * XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX
+ */
+#define UUID_STRING_LENGTH 36
+
+typedef struct {
+    uint8_t bytes[16];
+} UUIDBytes;
+
+/*
+ * UUIDv4をcount個生成する。
+ */
+void UUIDGenerateV4Bytes(UUIDBytes* uuids, size_t count);
+
+/*
+ * UUIDv7をcount個生成する。
+ */
+void UUIDGenerateV7Bytes(UUIDBytes* uuids, size_t count);
+
+/*
+ * 大文字の16進数で文字列にする。(CFUUIDCreateStringと同じ形式)
+ * strにはUUID_STRING_LENGTH文字を書き込み、終端文字は付けない。
+ */
+void UUIDFormat(const UUIDBytes* uuid, char* str);
+
+/*
+ * count個のUUIDを、strideバイト間隔で文字列にする。
+ * strideにUUID_STRING_LENGTH + 1を指定し、間に'\n'等を入れて使う。
+ */
+void UUIDFormatBatch(const UUIDBytes* uuids, size_t count, char* str, size_t stride);
+
+/*
+ * UUIDv7に含まれるUNIX時間[ms]を取り出す。
+ */
+uint64_t UUIDV7Timestamp(const UUIDBytes* uuid);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_UUID_GENERATOR_H
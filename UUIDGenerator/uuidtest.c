@@ -0,0 +1,257 @@
+/*
+ *  uuidtest
+ *
+ *  UUIDGeneratorをPC(Linux)上で検査し、生成と文字列化の速度を計測する。
+ *  比べる対象は、一つずつ乱数を取得してsnprintfで文字列にする方法。
+ *
+ *      $ cc -O2 -pthread -o uuidtest uuidtest.c UUIDGenerator.c
+ *      $ ./uuidtest
+ *
+ *      -n count  計測で生成する数 (初期値は2000000)
+ *
+ *  Created by tyabuta on 2014/06/24.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "UUIDGenerator.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+#define BATCH 4096
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t unixMilliseconds(void){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * snprintfで文字列にする。(比較用)
+ */
+static void formatReference(const UUIDBytes* uuid, char* str){
+    const uint8_t* b = uuid->bytes;
+    snprintf(str, UUID_STRING_LENGTH + 1,
+             "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+             b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+             b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+}
+
+static int compareBytes(const void* a, const void* b){
+    return memcmp(a, b, sizeof(UUIDBytes));
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+/*
+ * バージョンとバリアントのビット、文字列の形式
+ */
+static void testFormat(void){
+    static UUIDBytes uuids[BATCH];
+    static char      strings[BATCH][UUID_STRING_LENGTH + 1];
+    char reference[UUID_STRING_LENGTH + 1];
+
+    for (int version = 4; version <= 7; version += 3) {
+        if (4 == version) UUIDGenerateV4Bytes(uuids, BATCH);
+        else              UUIDGenerateV7Bytes(uuids, BATCH);
+        UUIDFormatBatch(uuids, BATCH, &strings[0][0], UUID_STRING_LENGTH + 1);
+
+        for (int i = 0; i < BATCH; i++) {
+            CHECK(version == uuids[i].bytes[6] >> 4);
+            CHECK(0x80 == (uuids[i].bytes[8] & 0xC0));
+
+            char single[UUID_STRING_LENGTH];
+            UUIDFormat(&uuids[i], single);
+            formatReference(&uuids[i], reference);
+            CHECK(0 == memcmp(single, reference, UUID_STRING_LENGTH));
+            CHECK(0 == memcmp(strings[i], reference, UUID_STRING_LENGTH));
+        }
+    }
+    printf("version, variant, format: ok\n");
+}
+
+/*
+ * v4は重複しない。(4096 x 64個で偶然重なる確率は無視できる)
+ */
+static void testUnique(void){
+    size_t     count = BATCH * 64;
+    UUIDBytes* uuids = malloc(count * sizeof(UUIDBytes));
+    UUIDGenerateV4Bytes(uuids, count);
+    qsort(uuids, count, sizeof(UUIDBytes), compareBytes);
+    for (size_t i = 1; i < count; i++) CHECK(0 != compareBytes(&uuids[i - 1], &uuids[i]));
+
+    // 各ビットの1の割合が半分に近い。(固定のビットを除く)
+    for (int bit = 0; bit < 128; bit++) {
+        if ((bit >= 48 && bit < 52) || bit == 64 || bit == 65) continue;
+        size_t ones = 0;
+        for (size_t i = 0; i < count; i++) ones += (uuids[i].bytes[bit / 8] >> (7 - bit % 8)) & 1;
+        CHECK(ones > count * 0.49 && ones < count * 0.51);
+    }
+    free(uuids);
+    printf("v4 unique: ok\n");
+}
+
+/*
+ * v7はスレッド内で狭義の単調増加で、時刻は現在時刻を指す。
+ * 文字列にしても同じ順に並ぶ。
+ */
+static void checkOrdered(void){
+    static __thread UUIDBytes uuids[BATCH];
+    static __thread char      strings[BATCH][UUID_STRING_LENGTH + 1];
+    UUIDBytes last;
+    memset(&last, 0, sizeof(last));
+
+    for (int round = 0; round < 64; round++) {
+        uint64_t before = unixMilliseconds();
+        UUIDGenerateV7Bytes(uuids, BATCH);
+        uint64_t after  = unixMilliseconds();
+        UUIDFormatBatch(uuids, BATCH, &strings[0][0], UUID_STRING_LENGTH + 1);
+
+        for (int i = 0; i < BATCH; i++) {
+            CHECK(compareBytes(&last, &uuids[i]) < 0);
+            if (i > 0) CHECK(strncmp(strings[i - 1], strings[i], UUID_STRING_LENGTH) < 0);
+            last = uuids[i];
+        }
+        // カウンタが溢れると次のミリ秒を借りるので、少し先まで許す。
+        CHECK(UUIDV7Timestamp(&uuids[0]) + 1 >= before);
+        CHECK(UUIDV7Timestamp(&uuids[BATCH - 1]) <= after + 1000);
+    }
+}
+
+static void* orderedThread(void* arg){
+    checkOrdered();
+    return NULL;
+}
+
+static void testOrdered(void){
+    checkOrdered();
+
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) pthread_create(&threads[i], NULL, orderedThread, NULL);
+    for (int i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+    printf("v7 ordered: ok\n");
+}
+
+/*
+ * fork後の子は親と同じ乱数を使わない。
+ */
+static void testFork(void){
+    UUIDBytes parent[2], child[2];
+    UUIDGenerateV4Bytes(parent, 1);     // 親のプールを作っておく
+
+    int fds[2];
+    CHECK(0 == pipe(fds));
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (0 == pid) {
+        UUIDGenerateV4Bytes(child, 2);
+        _exit(sizeof(child) == write(fds[1], child, sizeof(child))? 0 : 1);
+    }
+    UUIDGenerateV4Bytes(parent, 2);
+    CHECK(sizeof(child) == read(fds[0], child, sizeof(child)));
+    int status = 0;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+    close(fds[0]);
+    close(fds[1]);
+
+    CHECK(0 != compareBytes(&parent[0], &child[0]) && 0 != compareBytes(&parent[1], &child[1]));
+    printf("fork: ok\n");
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+static void bench(long count){
+    static UUIDBytes uuids[BATCH];
+    static char      strings[BATCH][UUID_STRING_LENGTH + 1];
+
+    // 一つずつgetrandomしてsnprintfで文字列にする。
+    double start = nowSec();
+    for (long i = 0; i < count; i++) {
+        UUIDBytes* uuid = &uuids[i % BATCH];
+        CHECK(sizeof(uuid->bytes) == getrandom(uuid->bytes, sizeof(uuid->bytes), 0));
+        uuid->bytes[6] = (uuid->bytes[6] & 0x0F) | 0x40;
+        uuid->bytes[8] = (uuid->bytes[8] & 0x3F) | 0x80;
+        formatReference(uuid, strings[i % BATCH]);
+    }
+    double baseline = count / (nowSec() - start);
+
+    start = nowSec();
+    for (long i = 0; i < count; i += BATCH) {
+        UUIDGenerateV4Bytes(uuids, BATCH);
+        UUIDFormatBatch(uuids, BATCH, &strings[0][0], UUID_STRING_LENGTH + 1);
+    }
+    double v4 = count / (nowSec() - start);
+
+    start = nowSec();
+    for (long i = 0; i < count; i += BATCH) {
+        UUIDGenerateV7Bytes(uuids, BATCH);
+        UUIDFormatBatch(uuids, BATCH, &strings[0][0], UUID_STRING_LENGTH + 1);
+    }
+    double v7 = count / (nowSec() - start);
+
+    printf("%ld ids, generate + format\n", count);
+    printf("  getrandom + snprintf per id : %6.1f M ids/s\n", baseline / 1e6);
+    printf("  UUIDGenerateV4Bytes         : %6.1f M ids/s (%.1fx)\n", v4 / 1e6, v4 / baseline);
+    printf("  UUIDGenerateV7Bytes         : %6.1f M ids/s (%.1fx)\n", v7 / 1e6, v7 / baseline);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: uuidtest [-n count]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    long count = 2000000;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': count = atol(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || count <= 0) usage();
+
+    testFormat();
+    testUnique();
+    testOrdered();
+    testFork();
+    bench(count);
+    return 0;
+}
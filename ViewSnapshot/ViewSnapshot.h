@@ -0,0 +1,53 @@
+/*******************************************************************************
+  ViewSnapshot 1.0.0.0
+
+                         ビュー階層のスナップショット
+
+   UIViewの階層をViewSnapshotCoreで書き出す。
+   ノード数に比例した時間で、一つのバッファに書き出すので、
+   大きな画面でもdumpSubviewのように止まらない。
+
+   バイナリのスナップショットは、クラス、フレーム、フラグ(hidden, opaque,
+   userInteractionEnabled, clipsToBounds)を保存し、
+   二つのスナップショットの違いを取り出せる。
+
+       NSData* before = ViewSnapshotData(self.view);
+       ...
+       NSLog(@"%@", ViewSnapshotDiff(before, ViewSnapshotData(self.view)));
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_VIEW_SNAPSHOT_H
+#define TYABUTA_VIEW_SNAPSHOT_H
+
+#import <UIKit/UIKit.h>
+#import "ViewSnapshotCore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 階層をテキストにする。optionsはVSTextOptionFrame, VSTextOptionFlagsの組み合わせ。
+ * 0の場合はdumpSubviewと同じ形式になる。
+ */
+NSString* ViewSnapshotText(UIView* view, int options);
+
+/*
+ * 階層をバイナリのスナップショットにする。
+ */
+NSData* ViewSnapshotData(UIView* view);
+
+/*
+ * 二つのスナップショットの違いをテキストで返す。
+ * 違いが無ければ空文字列、形式が正しくなければnilを返す。
+ */
+NSString* ViewSnapshotDiff(NSData* before, NSData* after);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_VIEW_SNAPSHOT_H
@@ -0,0 +1,96 @@
+//
+//  ViewSnapshot
+//
+//  Created by tyabuta on 2014/07/05.
+//  Copyright (c) 2014 tyabuta. All rights reserved.
+//
+
+#import "ViewSnapshot.h"
+#import <objc/runtime.h>
+
+
+/*
+ * UIViewをノードとして辿る為の関数
+ * 辿っている間はビューが階層に保持されているので、所有権は持たない。
+ */
+static void ViewSnapshotDescribe(void* context, const void* node, VSNodeInfo* info){
+    UIView* view  = (__bridge UIView*)node;
+    CGRect  frame = view.frame;
+
+    info->className  = class_getName([view class]);
+    info->x          = (float)frame.origin.x;
+    info->y          = (float)frame.origin.y;
+    info->width      = (float)frame.size.width;
+    info->height     = (float)frame.size.height;
+    info->flags      = (view.hidden                 ? VSNodeFlagHidden          : 0)
+                     | (view.opaque                 ? VSNodeFlagOpaque          : 0)
+                     | (view.userInteractionEnabled ? VSNodeFlagUserInteraction : 0)
+                     | (view.clipsToBounds          ? VSNodeFlagClipsToBounds   : 0);
+    info->childCount = (uint32_t)view.subviews.count;
+}
+
+static void ViewSnapshotChildren(void* context, const void* node, const void** children){
+    UIView*    view = (__bridge UIView*)node;
+    NSUInteger i    = 0;
+    for (UIView* subview in view.subviews) {
+        children[i++] = (__bridge const void*)subview;
+    }
+}
+
+static const VSVisitor ViewSnapshotVisitor = {
+    NULL, ViewSnapshotDescribe, ViewSnapshotChildren,
+};
+
+
+
+
+NSString* ViewSnapshotText(UIView* view, int options){
+    if (nil == view) return @"";
+
+    VSBuffer buffer;
+    VSBufferInit(&buffer);
+    if (VSWriteText(&ViewSnapshotVisitor, (__bridge const void*)view, options, &buffer)) {
+        VSBufferFree(&buffer);
+        return nil;
+    }
+    // バッファの所有権をNSStringに渡す。
+    NSString* text = [[NSString alloc] initWithBytesNoCopy:buffer.data
+                                                    length:buffer.length
+                                                  encoding:NSUTF8StringEncoding
+                                              freeWhenDone:YES];
+    if (nil == text) VSBufferFree(&buffer);
+    return text;
+}
+
+NSData* ViewSnapshotData(UIView* view){
+    if (nil == view) return nil;
+
+    VSBuffer buffer;
+    VSBufferInit(&buffer);
+    if (VSWriteBinary(&ViewSnapshotVisitor, (__bridge const void*)view, &buffer)) {
+        VSBufferFree(&buffer);
+        return nil;
+    }
+    return [NSData dataWithBytesNoCopy:buffer.data length:buffer.length freeWhenDone:YES];
+}
+
+NSString* ViewSnapshotDiff(NSData* before, NSData* after){
+    VSBuffer buffer;
+    VSBufferInit(&buffer);
+    long differences = VSDiff((const uint8_t*)before.bytes, before.length,
+                              (const uint8_t*)after.bytes,  after.length, &buffer);
+    if (differences < 0) {
+        VSBufferFree(&buffer);
+        return nil;
+    }
+    if (0 == differences) {
+        VSBufferFree(&buffer);
+        return @"";
+    }
+    NSString* text = [[NSString alloc] initWithBytesNoCopy:buffer.data
+                                                    length:buffer.length
+                                                  encoding:NSUTF8StringEncoding
+                                              freeWhenDone:YES];
+    if (nil == text) VSBufferFree(&buffer);
+    return text;
+}
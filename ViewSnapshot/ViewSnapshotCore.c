@@ -0,0 +1,568 @@
+/*
+ *  ViewSnapshotCore
+ *
+ *  Created by tyabuta on 2014/07/05.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "ViewSnapshotCore.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const char VSMagic[4] = {'V', 'S', 'S', '1'};
+
+
+
+
+/*------------------------------------------------------------------------------
+ Buffer
+ -----------------------------------------------------------------------------*/
+
+void VSBufferInit(VSBuffer* buffer){
+    buffer->data     = NULL;
+    buffer->length   = 0;
+    buffer->capacity = 0;
+}
+
+void VSBufferFree(VSBuffer* buffer){
+    free(buffer->data);
+    VSBufferInit(buffer);
+}
+
+/*
+ * 容量を倍々に増やし、追記の合計が線形時間になるようにする。
+ */
+static int VSBufferReserve(VSBuffer* buffer, size_t length){
+    if (buffer->capacity - buffer->length >= length) return 0;
+
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity - buffer->length < length) capacity *= 2;
+
+    uint8_t* data = (uint8_t*)realloc(buffer->data, capacity);
+    if (NULL == data) return -1;
+    buffer->data     = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+int VSBufferAppend(VSBuffer* buffer, const void* data, size_t length){
+    if (VSBufferReserve(buffer, length)) return -1;
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+static int VSBufferAppendVarint(VSBuffer* buffer, uint64_t value){
+    uint8_t bytes[10];
+    size_t  n = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        bytes[n++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return VSBufferAppend(buffer, bytes, n);
+}
+
+static int VSBufferAppendFloat(VSBuffer* buffer, float value){
+    return VSBufferAppend(buffer, &value, sizeof(value));
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Traverse
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 先行順に辿る為のスタック
+ */
+typedef struct {
+    const void** nodes;
+    uint32_t*    depths;
+    size_t       count;
+    size_t       capacity;
+} VSStack;
+
+static int VSStackReserve(VSStack* stack, size_t count){
+    if (stack->capacity - stack->count >= count) return 0;
+
+    size_t capacity = stack->capacity ? stack->capacity : 256;
+    while (capacity - stack->count < count) capacity *= 2;
+
+    const void** nodes  = (const void**)realloc((void*)stack->nodes, sizeof(void*) * capacity);
+    if (NULL == nodes) return -1;
+    stack->nodes = nodes;
+    uint32_t*    depths = (uint32_t*)realloc(stack->depths, sizeof(uint32_t) * capacity);
+    if (NULL == depths) return -1;
+    stack->depths   = depths;
+    stack->capacity = capacity;
+    return 0;
+}
+
+typedef int (*VSNodeWriter)(void* writer, const VSNodeInfo* info, uint32_t depth);
+
+/*
+ * rootから先行順に全てのノードをwriteに渡す。
+ */
+static int VSTraverse(const VSVisitor* visitor, const void* root, VSNodeWriter write, void* writer){
+    VSStack stack = {NULL, NULL, 0, 0};
+    int     result = 0;
+
+    if (VSStackReserve(&stack, 1)) return -1;
+    stack.nodes[0]  = root;
+    stack.depths[0] = 0;
+    stack.count     = 1;
+
+    while (stack.count > 0 && 0 == result) {
+        stack.count--;
+        const void* node  = stack.nodes[stack.count];
+        uint32_t    depth = stack.depths[stack.count];
+
+        VSNodeInfo info;
+        memset(&info, 0, sizeof(info));
+        visitor->describe(visitor->context, node, &info);
+        if (NULL == info.className) info.className = "";
+
+        result = write(writer, &info, depth);
+        if (result || 0 == info.childCount) continue;
+
+        // 子ノードを逆順に積み、先頭の子から取り出されるようにする。
+        if (VSStackReserve(&stack, info.childCount)) {
+            result = -1;
+            break;
+        }
+        const void** children = stack.nodes + stack.count;
+        visitor->children(visitor->context, node, children);
+        for (uint32_t i = 0, j = info.childCount - 1; i < j; i++, j--) {
+            const void* tmp = children[i];
+            children[i] = children[j];
+            children[j] = tmp;
+        }
+        for (uint32_t i = 0; i < info.childCount; i++) {
+            stack.depths[stack.count + i] = depth + 1;
+        }
+        stack.count += info.childCount;
+    }
+
+    free((void*)stack.nodes);
+    free(stack.depths);
+    return result;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Text
+ -----------------------------------------------------------------------------*/
+
+typedef struct {
+    VSBuffer* out;
+    int       options;
+} VSTextWriter;
+
+static int VSWriteTextNode(void* context, const VSNodeInfo* info, uint32_t depth){
+    VSTextWriter* writer = (VSTextWriter*)context;
+    VSBuffer*     out    = writer->out;
+
+    if (VSBufferReserve(out, (size_t)depth * 4 + strlen(info->className) + 96)) return -1;
+    for (uint32_t i = 0; i < depth; i++) {
+        memcpy(out->data + out->length, (i == depth - 1)? "+---" : "|   ", 4);
+        out->length += 4;
+    }
+    size_t length = strlen(info->className);
+    memcpy(out->data + out->length, info->className, length);
+    out->length += length;
+
+    // 予約した範囲に収まるよう、切り詰められた場合も書き込めた分だけ進める。
+    if (writer->options & VSTextOptionFrame) {
+        int n = snprintf((char*)out->data + out->length, 64, " {%g, %g, %g, %g}",
+                         info->x, info->y, info->width, info->height);
+        out->length += (n < 64)? (size_t)n : 63;
+    }
+    if (writer->options & VSTextOptionFlags) {
+        int n = snprintf((char*)out->data + out->length, 16, " 0x%x", info->flags);
+        out->length += (n < 16)? (size_t)n : 15;
+    }
+    out->data[out->length++] = '\n';
+    return 0;
+}
+
+int VSWriteText(const VSVisitor* visitor, const void* root, int options, VSBuffer* out){
+    VSTextWriter writer = {out, options};
+    return VSTraverse(visitor, root, VSWriteTextNode, &writer);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Binary
+ -----------------------------------------------------------------------------*/
+
+/*
+ * クラス名の表 (オープンアドレス法のハッシュ表)
+ */
+typedef struct {
+    uint64_t    hash;
+    const char* name;
+    uint32_t    identifier;
+} VSClassSlot;
+
+typedef struct {
+    VSBuffer     names;       // { nameLength, name } x count
+    VSBuffer     nodes;
+    VSClassSlot* slots;
+    size_t       slotCount;   // 2の累乗
+    uint32_t     classCount;
+    uint64_t     nodeCount;
+} VSBinaryWriter;
+
+static uint64_t VSHashName(const char* name){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *name; name++) {
+        h ^= (uint8_t)*name;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int VSClassTableGrow(VSBinaryWriter* writer){
+    size_t       count = writer->slotCount ? writer->slotCount * 2 : 64;
+    VSClassSlot* slots = (VSClassSlot*)calloc(count, sizeof(VSClassSlot));
+    if (NULL == slots) return -1;
+
+    for (size_t i = 0; i < writer->slotCount; i++) {
+        VSClassSlot* slot = &writer->slots[i];
+        if (NULL == slot->name) continue;
+        size_t k = slot->hash & (count - 1);
+        while (slots[k].name) k = (k + 1) & (count - 1);
+        slots[k] = *slot;
+    }
+    free(writer->slots);
+    writer->slots     = slots;
+    writer->slotCount = count;
+    return 0;
+}
+
+/*
+ * クラス名の番号を返す。初めての名前は表に追加する。
+ */
+static int VSClassIdentifier(VSBinaryWriter* writer, const char* name, uint32_t* identifier){
+    if ((writer->classCount + 1) * 2 > writer->slotCount && VSClassTableGrow(writer)) return -1;
+
+    uint64_t hash = VSHashName(name);
+    size_t   k    = hash & (writer->slotCount - 1);
+    while (writer->slots[k].name) {
+        VSClassSlot* slot = &writer->slots[k];
+        if (slot->hash == hash && (slot->name == name || 0 == strcmp(slot->name, name))) {
+            *identifier = slot->identifier;
+            return 0;
+        }
+        k = (k + 1) & (writer->slotCount - 1);
+    }
+
+    size_t length = strlen(name);
+    if (VSBufferAppendVarint(&writer->names, length) ||
+        VSBufferAppend(&writer->names, name, length)) {
+        return -1;
+    }
+    writer->slots[k].hash       = hash;
+    writer->slots[k].name       = name;
+    writer->slots[k].identifier = writer->classCount;
+    *identifier = writer->classCount++;
+    return 0;
+}
+
+static int VSWriteBinaryNode(void* context, const VSNodeInfo* info, uint32_t depth){
+    VSBinaryWriter* writer = (VSBinaryWriter*)context;
+    VSBuffer*       nodes  = &writer->nodes;
+    uint32_t        identifier;
+    (void)depth;
+
+    if (VSClassIdentifier(writer, info->className, &identifier) ||
+        VSBufferAppendVarint(nodes, identifier) ||
+        VSBufferAppendVarint(nodes, info->childCount) ||
+        VSBufferAppendVarint(nodes, info->flags) ||
+        VSBufferAppendFloat(nodes, info->x) ||
+        VSBufferAppendFloat(nodes, info->y) ||
+        VSBufferAppendFloat(nodes, info->width) ||
+        VSBufferAppendFloat(nodes, info->height)) {
+        return -1;
+    }
+    writer->nodeCount++;
+    return 0;
+}
+
+int VSWriteBinary(const VSVisitor* visitor, const void* root, VSBuffer* out){
+    VSBinaryWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    VSBufferInit(&writer.names);
+    VSBufferInit(&writer.nodes);
+
+    int result = VSTraverse(visitor, root, VSWriteBinaryNode, &writer);
+    if (0 == result) {
+        if (VSBufferAppend(out, VSMagic, sizeof(VSMagic)) ||
+            VSBufferAppendVarint(out, writer.classCount) ||
+            VSBufferAppend(out, writer.names.data, writer.names.length) ||
+            VSBufferAppendVarint(out, writer.nodeCount) ||
+            VSBufferAppend(out, writer.nodes.data, writer.nodes.length)) {
+            result = -1;
+        }
+    }
+
+    VSBufferFree(&writer.names);
+    VSBufferFree(&writer.nodes);
+    free(writer.slots);
+    return result;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Read
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 読み込んだスナップショット
+ * end[i]はノードiの部分木の次のノードの番号
+ */
+typedef struct {
+    const char** names;
+    uint32_t*    nameLengths;
+    uint32_t     classCount;
+
+    uint32_t*    classes;
+    uint32_t*    childCounts;
+    uint32_t*    flags;
+    float*       frames;      // x, y, width, height
+    uint32_t*    ends;
+    uint32_t     nodeCount;
+} VSSnapshot;
+
+static int VSReadVarint(const uint8_t** p, const uint8_t* end, uint64_t* value){
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p >= end) return -1;
+        uint8_t byte = *(*p)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (0 == (byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void VSSnapshotFree(VSSnapshot* snapshot){
+    free((void*)snapshot->names);
+    free(snapshot->nameLengths);
+    free(snapshot->classes);
+    free(snapshot->childCounts);
+    free(snapshot->flags);
+    free(snapshot->frames);
+    free(snapshot->ends);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+static int VSSnapshotRead(VSSnapshot* snapshot, const uint8_t* data, size_t length){
+    const uint8_t* p   = data;
+    const uint8_t* end = data + length;
+    uint64_t       value;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    if (length < sizeof(VSMagic) || memcmp(p, VSMagic, sizeof(VSMagic))) return -1;
+    p += sizeof(VSMagic);
+
+    if (VSReadVarint(&p, end, &value) || value > length) return -1;
+    snapshot->classCount  = (uint32_t)value;
+    snapshot->names       = (const char**)malloc(sizeof(char*) * (value + 1));
+    snapshot->nameLengths = (uint32_t*)malloc(sizeof(uint32_t) * (value + 1));
+    if (NULL == snapshot->names || NULL == snapshot->nameLengths) goto fail;
+
+    for (uint32_t i = 0; i < snapshot->classCount; i++) {
+        if (VSReadVarint(&p, end, &value) || value > (uint64_t)(end - p)) goto fail;
+        snapshot->names[i]       = (const char*)p;
+        snapshot->nameLengths[i] = (uint32_t)value;
+        p += value;
+    }
+
+    // 1ノードは最低15バイトなので、それを超える数は壊れている。
+    if (VSReadVarint(&p, end, &value) || value > (uint64_t)(end - p) / 15 || 0 == value) goto fail;
+    uint32_t count = (uint32_t)value;
+    snapshot->nodeCount   = count;
+    snapshot->classes     = (uint32_t*)malloc(sizeof(uint32_t) * count);
+    snapshot->childCounts = (uint32_t*)malloc(sizeof(uint32_t) * count);
+    snapshot->flags       = (uint32_t*)malloc(sizeof(uint32_t) * count);
+    snapshot->frames      = (float*)malloc(sizeof(float) * 4 * count);
+    snapshot->ends        = (uint32_t*)malloc(sizeof(uint32_t) * count);
+    if (!snapshot->classes || !snapshot->childCounts || !snapshot->flags ||
+        !snapshot->frames || !snapshot->ends) {
+        goto fail;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t identifier, children, flags;
+        if (VSReadVarint(&p, end, &identifier) || identifier >= snapshot->classCount ||
+            VSReadVarint(&p, end, &children)   || children >= count ||
+            VSReadVarint(&p, end, &flags)      || (size_t)(end - p) < sizeof(float) * 4) {
+            goto fail;
+        }
+        snapshot->classes[i]     = (uint32_t)identifier;
+        snapshot->childCounts[i] = (uint32_t)children;
+        snapshot->flags[i]       = (uint32_t)flags;
+        memcpy(&snapshot->frames[i * 4], p, sizeof(float) * 4);
+        p += sizeof(float) * 4;
+    }
+
+    // 子の数から各部分木の終わりを求める。(後ろから、子の終わりを辿る)
+    for (uint32_t i = count; i-- > 0;) {
+        uint32_t next = i + 1;
+        for (uint32_t k = 0; k < snapshot->childCounts[i]; k++) {
+            if (next >= count) goto fail;
+            next = snapshot->ends[next];
+        }
+        snapshot->ends[i] = next;
+    }
+    if (count != snapshot->ends[0]) goto fail;
+    return 0;
+
+fail:
+    VSSnapshotFree(snapshot);
+    return -1;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Diff
+ -----------------------------------------------------------------------------*/
+
+static int VSAppendClassName(VSBuffer* out, const VSSnapshot* snapshot, uint32_t node){
+    uint32_t identifier = snapshot->classes[node];
+    return VSBufferAppend(out, snapshot->names[identifier], snapshot->nameLengths[identifier]);
+}
+
+static int VSAppendFormat(VSBuffer* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static int VSAppendFormat(VSBuffer* out, const char* format, ...){
+    char    buf[160];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) return -1;
+    return VSBufferAppend(out, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+}
+
+/*
+ * 部分木の追加または削除を書き出す。
+ */
+static int VSAppendSubtree(VSBuffer* out, char mark, char side, const VSSnapshot* snapshot, uint32_t node){
+    return VSAppendFormat(out, "%c %c#%u ", mark, side, node) ||
+           VSAppendClassName(out, snapshot, node) ||
+           VSAppendFormat(out, " (%u nodes)\n", snapshot->ends[node] - node);
+}
+
+static int VSClassEqual(const VSSnapshot* a, uint32_t i, const VSSnapshot* b, uint32_t j){
+    uint32_t x = a->classes[i];
+    uint32_t y = b->classes[j];
+    return a->nameLengths[x] == b->nameLengths[y] &&
+           0 == memcmp(a->names[x], b->names[y], a->nameLengths[x]);
+}
+
+static long VSDiffSnapshots(const VSSnapshot* a, const VSSnapshot* b, VSBuffer* out){
+    long      differences = 0;
+    uint32_t* stack       = (uint32_t*)malloc(sizeof(uint32_t) * 2 * (a->nodeCount < b->nodeCount ? a->nodeCount : b->nodeCount));
+    size_t    count       = 0;
+    if (NULL == stack) return -1;
+
+    if (!VSClassEqual(a, 0, b, 0)) {
+        differences = 2;
+        if (VSAppendSubtree(out, '-', 'a', a, 0) || VSAppendSubtree(out, '+', 'b', b, 0)) differences = -1;
+        free(stack);
+        return differences;
+    }
+    stack[count++] = 0;
+    stack[count++] = 0;
+
+    while (count > 0 && differences >= 0) {
+        uint32_t j = stack[--count];
+        uint32_t i = stack[--count];
+
+        const float* fa = &a->frames[i * 4];
+        const float* fb = &b->frames[j * 4];
+        if (memcmp(fa, fb, sizeof(float) * 4)) {
+            differences++;
+            if (VSAppendFormat(out, "~ a#%u b#%u ", i, j) || VSAppendClassName(out, a, i) ||
+                VSAppendFormat(out, " frame {%g, %g, %g, %g} -> {%g, %g, %g, %g}\n",
+                               fa[0], fa[1], fa[2], fa[3], fb[0], fb[1], fb[2], fb[3])) {
+                differences = -1;
+                break;
+            }
+        }
+        if (a->flags[i] != b->flags[j]) {
+            differences++;
+            if (VSAppendFormat(out, "~ a#%u b#%u ", i, j) || VSAppendClassName(out, a, i) ||
+                VSAppendFormat(out, " flags 0x%x -> 0x%x\n", a->flags[i], b->flags[j])) {
+                differences = -1;
+                break;
+            }
+        }
+
+        // 子を位置で対応付ける。対応した組は後で辿る為に積む。(逆順に取り出される)
+        size_t   base = count;
+        uint32_t ca   = i + 1, na = a->childCounts[i];
+        uint32_t cb   = j + 1, nb = b->childCounts[j];
+        for (uint32_t k = 0; k < na || k < nb; k++) {
+            if (k < na && k < nb && VSClassEqual(a, ca, b, cb)) {
+                stack[count++] = ca;
+                stack[count++] = cb;
+            }
+            else {
+                if (k < na) {
+                    differences++;
+                    if (VSAppendSubtree(out, '-', 'a', a, ca)) differences = -1;
+                }
+                if (k < nb && differences >= 0) {
+                    differences++;
+                    if (VSAppendSubtree(out, '+', 'b', b, cb)) differences = -1;
+                }
+                if (differences < 0) break;
+            }
+            if (k < na) ca = a->ends[ca];
+            if (k < nb) cb = b->ends[cb];
+        }
+
+        // 先頭の子から出力されるように、積んだ組を逆順にする。
+        for (size_t x = base, y = count - 2; count - base >= 4 && x < y; x += 2, y -= 2) {
+            uint32_t t0 = stack[x], t1 = stack[x + 1];
+            stack[x]     = stack[y];
+            stack[x + 1] = stack[y + 1];
+            stack[y]     = t0;
+            stack[y + 1] = t1;
+        }
+    }
+
+    free(stack);
+    return differences;
+}
+
+long VSDiff(const uint8_t* before, size_t beforeLength,
+            const uint8_t* after,  size_t afterLength, VSBuffer* out){
+    VSSnapshot a, b;
+    if (VSSnapshotRead(&a, before, beforeLength)) return -1;
+    if (VSSnapshotRead(&b, after, afterLength)) {
+        VSSnapshotFree(&a);
+        return -1;
+    }
+    long differences = VSDiffSnapshots(&a, &b, out);
+    VSSnapshotFree(&a);
+    VSSnapshotFree(&b);
+    return differences;
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+  ViewSnapshotCore 1.0.0.0
+
+                         ツリー構造のスナップショットの書き出しと比較
+
+   ビューの階層のようなツリーを、ノードを訪問する関数(VSVisitor)を通して
+   先行順に一度だけ辿り、一つのバッファにテキストまたはバイナリで書き出す。
+   再帰を使わず、明示的なスタックで辿るので、深いツリーでも溢れない。
+   処理時間はノード数(テキストは出力の文字数)に比例する。
+
+   UIKitに依存しない素のCで書いてあるので、Linux上でも合成したツリーで
+   動作を確認できる。UIViewとの接続はViewSnapshot.mで行う。
+   検査と計測はvstestで行う。
+
+       $ cc -O2 -o vstest vstest.c ViewSnapshotCore.c
+       $ ./vstest
+
+   バイナリの形式: (数値はvarint, floatはリトルエンディアン)
+       "VSS1"
+       classCount, { nameLength, name } x classCount
+       nodeCount,  { classId, childCount, flags, x, y, width, height } x nodeCount
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_VIEW_SNAPSHOT_CORE_H
+#define TYABUTA_VIEW_SNAPSHOT_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 伸長するバッファ
+ */
+typedef struct {
+    uint8_t* data;
+    size_t   length;
+    size_t   capacity;
+} VSBuffer;
+
+void VSBufferInit(VSBuffer* buffer);
+void VSBufferFree(VSBuffer* buffer);
+int  VSBufferAppend(VSBuffer* buffer, const void* data, size_t length);
+
+/*
+ * ノードのフラグ
+ */
+enum {
+    VSNodeFlagHidden          = 1 << 0,
+    VSNodeFlagOpaque          = 1 << 1,
+    VSNodeFlagUserInteraction = 1 << 2,
+    VSNodeFlagClipsToBounds   = 1 << 3,
+};
+
+/*
+ * ノードの情報
+ * classNameは書き出しが終わるまで有効な文字列であること。
+ */
+typedef struct {
+    const char* className;
+    float       x;
+    float       y;
+    float       width;
+    float       height;
+    uint32_t    flags;
+    uint32_t    childCount;
+} VSNodeInfo;
+
+/*
+ * ノードを訪問する関数
+ * describe : ノードの情報を取得する。
+ * children : 子ノードをchildCount個、順にchildrenへ書き込む。
+ */
+typedef struct {
+    void* context;
+    void (*describe)(void* context, const void* node, VSNodeInfo* info);
+    void (*children)(void* context, const void* node, const void** children);
+} VSVisitor;
+
+/*
+ * テキストの書き出しの設定
+ */
+enum {
+    VSTextOptionFrame = 1 << 0,  // フレームを付ける
+    VSTextOptionFlags = 1 << 1,  // フラグを付ける
+};
+
+/*
+ * 階層をテキストで書き出す。(macro.hのdumpSubviewと同じ形式)
+ *     UIView
+ *     +---UILabel
+ *     |   +---...
+ * 成功時は0、メモリ不足の場合は-1を返す。
+ */
+int VSWriteText(const VSVisitor* visitor, const void* root, int options, VSBuffer* out);
+
+/*
+ * 階層をバイナリで書き出す。
+ * 成功時は0、メモリ不足の場合は-1を返す。
+ */
+int VSWriteBinary(const VSVisitor* visitor, const void* root, VSBuffer* out);
+
+/*
+ * 二つのバイナリのスナップショットを比較し、違いをテキストで書き出す。
+ * 子ノードは位置で対応付け、クラスが違う場合は削除と追加として扱う。
+ *     ~ a#12 b#12 UILabel frame {0, 0, 10, 10} -> {0, 0, 20, 10}
+ *     ~ a#12 b#12 UILabel flags 0x4 -> 0x5
+ *     - a#40 UIButton (3 nodes)
+ *     + b#41 UIImageView (1 nodes)
+ * 違いの数を返す。形式が正しくない場合とメモリ不足の場合は-1を返す。
+ */
+long VSDiff(const uint8_t* before, size_t beforeLength,
+            const uint8_t* after,  size_t afterLength, VSBuffer* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_VIEW_SNAPSHOT_CORE_H
@@ -0,0 +1,408 @@
+/*
+ *  vstest
+ *
+ *  ViewSnapshotCoreをPC(Linux)上の合成したツリーで検査し、書き出しと比較の時間を計測する。
+ *  比べる対象は、子の文字列を親へコピーしていく以前のdumpSubviewと同じ方法。
+ *
+ *      $ cc -O2 -o vstest vstest.c ViewSnapshotCore.c
+ *      $ ./vstest
+ *
+ *      -n count  計測するツリーのノード数 (初期値は100000)
+ *
+ *  -fsanitize=address を付けてビルドすると、壊れた入力での範囲外の読み込みも検査できる。
+ *
+ *  Created by tyabuta on 2014/07/08.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ViewSnapshotCore.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+
+/*
+ * 合成したツリーのノード
+ */
+typedef struct Node {
+    const char*   className;
+    float         frame[4];
+    uint32_t      flags;
+    uint32_t      childCount;
+    uint32_t      capacity;
+    struct Node** children;
+} Node;
+
+static const char* classNames[] = { "UIView", "UILabel", "UIButton", "UIImageView", "UIScrollView" };
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Node* nodeCreate(const char* className, float x, float y, float width, float height, uint32_t flags){
+    Node* node = calloc(1, sizeof(Node));
+    CHECK(node);
+    node->className = className;
+    node->frame[0]  = x;
+    node->frame[1]  = y;
+    node->frame[2]  = width;
+    node->frame[3]  = height;
+    node->flags     = flags;
+    return node;
+}
+
+static void nodeAdd(Node* parent, Node* child){
+    if (parent->childCount == parent->capacity) {
+        parent->capacity = parent->capacity? parent->capacity * 2 : 4;
+        parent->children = realloc(parent->children, parent->capacity * sizeof(Node*));
+        CHECK(parent->children);
+    }
+    parent->children[parent->childCount++] = child;
+}
+
+static void nodeFree(Node* root){
+    // 深いツリーでも溢れないよう、再帰せずにスタックで辿って解放する。
+    Node** stack = malloc(sizeof(Node*));
+    size_t count = 0, capacity = 1;
+    stack[count++] = root;
+    while (count) {
+        Node* node = stack[--count];
+        for (uint32_t i = 0; i < node->childCount; i++) {
+            if (count == capacity) stack = realloc(stack, (capacity *= 2) * sizeof(Node*));
+            stack[count++] = node->children[i];
+        }
+        free(node->children);
+        free(node);
+    }
+    free(stack);
+}
+
+static void describe(void* context, const void* node, VSNodeInfo* info){
+    const Node* n = (const Node*)node;
+    info->className  = n->className;
+    info->x          = n->frame[0];
+    info->y          = n->frame[1];
+    info->width      = n->frame[2];
+    info->height     = n->frame[3];
+    info->flags      = n->flags;
+    info->childCount = n->childCount;
+}
+
+static void children(void* context, const void* node, const void** out){
+    const Node* n = (const Node*)node;
+    for (uint32_t i = 0; i < n->childCount; i++) out[i] = n->children[i];
+}
+
+static const VSVisitor visitor = { NULL, describe, children };
+
+static void expectText(const VSBuffer* buffer, const char* expected){
+    if (buffer->length != strlen(expected) || memcmp(buffer->data, expected, buffer->length)) {
+        fprintf(stderr, "FAIL got:\n%.*s\nexpected:\n%s", (int)buffer->length, buffer->data, expected);
+        exit(1);
+    }
+}
+
+/*
+ * ノード数countのランダムなツリー(親を既存のノードから選ぶ)
+ */
+static Node* randomTree(int count, Node** nodes){
+    srand(3);
+    nodes[0] = nodeCreate(classNames[0], 0, 0, 320, 480, 0);
+    for (int i = 1; i < count; i++) {
+        int r = rand();
+        nodes[i] = nodeCreate(classNames[r % 5], (float)(r % 320), (float)(i % 480), 100, 20, r & 0xF);
+        nodeAdd(nodes[rand() % i], nodes[i]);
+    }
+    return nodes[0];
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+static void testSmallTree(void){
+    Node* root   = nodeCreate("UIView",      0,  0, 320, 480, VSNodeFlagOpaque);
+    Node* label  = nodeCreate("UILabel",     0,  0, 100,  20, VSNodeFlagHidden | VSNodeFlagUserInteraction);
+    Node* image  = nodeCreate("UIImageView", 1,  2, 3.5f,  4, 0);
+    Node* button = nodeCreate("UIButton",    0, 20,  50,  30, VSNodeFlagUserInteraction);
+    nodeAdd(root, label);
+    nodeAdd(label, image);
+    nodeAdd(root, button);
+
+    VSBuffer text, before, after, diff;
+    VSBufferInit(&text);
+    VSBufferInit(&before);
+    VSBufferInit(&after);
+    VSBufferInit(&diff);
+
+    CHECK(0 == VSWriteText(&visitor, root, 0, &text));
+    expectText(&text,
+               "UIView\n"
+               "+---UILabel\n"
+               "|   +---UIImageView\n"
+               "+---UIButton\n");
+    text.length = 0;
+    CHECK(0 == VSWriteText(&visitor, root, VSTextOptionFrame | VSTextOptionFlags, &text));
+    expectText(&text,
+               "UIView {0, 0, 320, 480} 0x2\n"
+               "+---UILabel {0, 0, 100, 20} 0x5\n"
+               "|   +---UIImageView {1, 2, 3.5, 4} 0x0\n"
+               "+---UIButton {0, 20, 50, 30} 0x4\n");
+
+    // 同じ物の比較では違いが無い。
+    CHECK(0 == VSWriteBinary(&visitor, root, &before));
+    CHECK(0 == memcmp(before.data, "VSS1", 4));
+    CHECK(0 == VSDiff(before.data, before.length, before.data, before.length, &diff));
+    CHECK(0 == diff.length);
+
+    // フレーム、フラグ、クラスの変更
+    label->frame[2] = 120;
+    button->flags   = VSNodeFlagHidden | VSNodeFlagUserInteraction;
+    image->className = "UISwitch";
+    CHECK(0 == VSWriteBinary(&visitor, root, &after));
+    CHECK(4 == VSDiff(before.data, before.length, after.data, after.length, &diff));
+    expectText(&diff,
+               "~ a#1 b#1 UILabel frame {0, 0, 100, 20} -> {0, 0, 120, 20}\n"
+               "- a#2 UIImageView (1 nodes)\n"
+               "+ b#2 UISwitch (1 nodes)\n"
+               "~ a#3 b#3 UIButton flags 0x4 -> 0x5\n");
+
+    // 子の削除
+    root->childCount = 1;
+    after.length = 0;
+    diff.length  = 0;
+    CHECK(0 == VSWriteBinary(&visitor, root, &after));
+    CHECK(4 == VSDiff(before.data, before.length, after.data, after.length, &diff));
+    CHECK(0 == VSBufferAppend(&diff, "", 1));
+    CHECK(NULL != strstr((const char*)diff.data, "- a#3 UIButton (1 nodes)\n"));
+    root->childCount = 2;
+
+    // 壊れた入力は-1を返す。(途中で切れた物は全て、書き換えた物は範囲外を読まない事)
+    for (size_t length = 0; length < before.length; length++) {
+        diff.length = 0;
+        CHECK(-1 == VSDiff(before.data, length, before.data, before.length, &diff));
+        CHECK(-1 == VSDiff(before.data, before.length, before.data, length, &diff));
+    }
+    uint8_t* corrupt = malloc(before.length);
+    for (size_t i = 0; i < before.length; i++) {
+        for (int value = 0; value < 256; value += 17) {
+            memcpy(corrupt, before.data, before.length);
+            corrupt[i] = (uint8_t)value;
+            diff.length = 0;
+            VSDiff(corrupt, before.length, before.data, before.length, &diff);
+        }
+    }
+    memcpy(corrupt, before.data, before.length);
+    corrupt[0] = 'X';
+    CHECK(-1 == VSDiff(corrupt, before.length, before.data, before.length, &diff));
+    free(corrupt);
+
+    VSBufferFree(&text);
+    VSBufferFree(&before);
+    VSBufferFree(&after);
+    VSBufferFree(&diff);
+    nodeFree(root);
+    printf("small tree: ok\n");
+}
+
+/*
+ * 深い一本のツリーでもスタックが溢れない。
+ */
+static void testDeepChain(int depth){
+    Node* root = nodeCreate("UIView", 0, 0, 320, 480, 0);
+    Node* node   = root;
+    Node* second = NULL;
+    for (int i = 1; i < depth; i++) {
+        Node* child = nodeCreate(classNames[i % 5], (float)i, 0, 10, 10, 0);
+        nodeAdd(node, child);
+        if (2 == i) second = child;
+        node = child;
+    }
+
+    VSBuffer text, before, after, diff;
+    VSBufferInit(&text);
+    VSBufferInit(&before);
+    VSBufferInit(&after);
+    VSBufferInit(&diff);
+
+    double start = nowSec();
+    CHECK(0 == VSWriteBinary(&visitor, root, &before));
+    second->frame[0] = 9;
+    CHECK(0 == VSWriteBinary(&visitor, root, &after));
+    CHECK(1 == VSDiff(before.data, before.length, after.data, after.length, &diff));
+    double elapsed = nowSec() - start;
+    CHECK(0 == VSBufferAppend(&diff, "", 1));
+    CHECK(NULL != strstr((const char*)diff.data, "~ a#2 b#2 UIButton frame {2, 0, 10, 10} -> {9, 0, 10, 10}\n"));
+
+    // テキストは深さに比例して字下げが伸びるので、2000段で切って確かめる。
+    Node* cut = root;
+    for (int i = 0; i < 2000 && cut->childCount; i++) cut = cut->children[0];
+    uint32_t childCount = cut->childCount;
+    cut->childCount = 0;
+    CHECK(0 == VSWriteText(&visitor, root, 0, &text));
+    size_t lines = 0;
+    for (size_t i = 0; i < text.length; i++) lines += ('\n' == text.data[i]);
+    CHECK(2001 == lines);
+    cut->childCount = childCount;
+
+    VSBufferFree(&text);
+    VSBufferFree(&before);
+    VSBufferFree(&after);
+    VSBufferFree(&diff);
+    nodeFree(root);
+    printf("deep chain: ok (%d deep, binary x2 + diff %.1fms)\n", depth, elapsed * 1e3);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 以前のdumpSubviewと同じ方法。
+ * 子毎に字下げの文字列を作り直し、子の結果の文字列を親の文字列へコピーする。
+ */
+static char* dumpRecursive(const Node* node, const char* indent){
+    size_t indentLength = strlen(indent);
+    size_t length = indentLength + strlen(node->className) + 1;
+    char*  result = malloc(length + 1);
+    snprintf(result, length + 1, "%s%s\n", indent, node->className);
+
+    for (uint32_t i = 0; i < node->childCount; i++) {
+        char* childIndent = malloc(indentLength + 5);
+        memcpy(childIndent, indent, indentLength);
+        memcpy(childIndent + indentLength, "|   ", 5);
+        char* child = dumpRecursive(node->children[i], childIndent);
+        size_t childLength = strlen(child);
+        result = realloc(result, length + childLength + 1);
+        memcpy(result + length, child, childLength + 1);
+        length += childLength;
+        free(child);
+        free(childIndent);
+    }
+    return result;
+}
+
+static void bench(int count){
+    Node** nodes = malloc(count * sizeof(Node*));
+    Node*  root  = randomTree(count, nodes);
+
+    VSBuffer text, before, after, diff;
+    VSBufferInit(&text);
+    VSBufferInit(&before);
+    VSBufferInit(&after);
+    VSBufferInit(&diff);
+
+    double start = nowSec();
+    char*  old   = dumpRecursive(root, "");
+    double recursive = nowSec() - start;
+    free(old);
+
+    start = nowSec();
+    CHECK(0 == VSWriteText(&visitor, root, 0, &text));
+    double textTime = nowSec() - start;
+
+    text.length = 0;
+    start = nowSec();
+    CHECK(0 == VSWriteText(&visitor, root, VSTextOptionFrame | VSTextOptionFlags, &text));
+    double fullTextTime = nowSec() - start;
+
+    start = nowSec();
+    CHECK(0 == VSWriteBinary(&visitor, root, &before));
+    double binaryTime = nowSec() - start;
+
+    nodes[count / 5]->frame[2] = 55;
+    nodes[count / 3]->flags   ^= VSNodeFlagHidden;
+    nodes[count / 2]->className = "UISwitch";
+    nodeAdd(nodes[count - 1], nodeCreate("UIView", 0, 0, 1, 1, 0));
+    CHECK(0 == VSWriteBinary(&visitor, root, &after));
+
+    start = nowSec();
+    long changes = VSDiff(before.data, before.length, after.data, after.length, &diff);
+    double diffTime = nowSec() - start;
+    CHECK(changes >= 4);
+
+    printf("%d nodes (random tree)\n", count);
+    printf("  recursive string copy (old dumpSubview) : %7.1fms\n", recursive * 1e3);
+    printf("  VSWriteText                             : %7.1fms\n", textTime * 1e3);
+    printf("  VSWriteText (frame, flags)              : %7.1fms  %zu bytes\n", fullTextTime * 1e3, text.length);
+    printf("  VSWriteBinary                           : %7.1fms  %zu bytes\n", binaryTime * 1e3, before.length);
+    printf("  VSDiff                                  : %7.1fms  %ld changes\n", diffTime * 1e3, changes);
+
+    nodeFree(root);
+    free(nodes);
+
+    // 深いツリーでは、以前の方法は子の文字列を祖先の数だけコピーし直す。
+    int   depth = 1000;
+    Node* chain = nodeCreate("UIView", 0, 0, 320, 480, 0);
+    Node* node  = chain;
+    for (int i = 1; i < depth; i++) {
+        Node* child = nodeCreate(classNames[i % 5], 0, 0, 10, 10, 0);
+        nodeAdd(node, child);
+        node = child;
+    }
+    start = nowSec();
+    old   = dumpRecursive(chain, "");
+    recursive = nowSec() - start;
+    free(old);
+
+    text.length = 0;
+    start = nowSec();
+    CHECK(0 == VSWriteText(&visitor, chain, 0, &text));
+    textTime = nowSec() - start;
+
+    printf("%d deep chain\n", depth);
+    printf("  recursive string copy (old dumpSubview) : %7.1fms\n", recursive * 1e3);
+    printf("  VSWriteText                             : %7.1fms  %zu bytes\n", textTime * 1e3, text.length);
+
+    VSBufferFree(&text);
+    VSBufferFree(&before);
+    VSBufferFree(&after);
+    VSBufferFree(&diff);
+    nodeFree(chain);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: vstest [-n count]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    int count = 100000;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:"))) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || count < 2) usage();
+
+    testSmallTree();
+    testDeepChain(100000);
+    bench(count);
+    return 0;
+}
@@ -0,0 +1,453 @@
+/*
+ *  YUVConverter
+ *
+ *  Created by tyabuta on 2014/07/20.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#include "YUVConverter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <pthread.h>
+#endif
+
+
+// 帯の最小の行数(これより細かく分けても速くならない)
+#define YUV_BAND_MIN_ROWS 16
+
+// 90度、270度の回転で、まとめて転置する行数(帯の行数はこの倍数にする)
+#define YUV_TILE_ROWS 16
+
+// 固定小数点の小数部のビット数
+#define YUV_FIXED_SHIFT 16
+#define YUV_FIXED_ONE   (1 << YUV_FIXED_SHIFT)
+
+
+/*
+ * 変換の係数(固定小数点)
+ */
+typedef struct {
+    int32_t yOffset;
+    int32_t yScale;
+    int32_t rv;     // R = Y + rv*V
+    int32_t gu;     // G = Y - gu*U - gv*V
+    int32_t gv;
+    int32_t bu;     // B = Y + bu*U
+} YUVCoefficients;
+
+/*
+ * 変換全体で共有する情報
+ */
+typedef struct {
+    const YUVImage*   image;
+    YUVConvertOptions options;
+    YUVCoefficients   k;
+    uint8_t*          dst;
+    size_t            dstStride;
+    int               width;        // 回転前の縮小画像の大きさ
+    int               height;
+    int               bandRows;
+    int               failed;
+} YUVJob;
+
+/*
+ * 一行分の作業領域
+ */
+typedef struct {
+    uint8_t* y;
+    int32_t* r;
+    int32_t* g;
+    int32_t* b;
+} YUVRow;
+
+
+
+
+/*------------------------------------------------------------------------------
+ Coefficients
+ -----------------------------------------------------------------------------*/
+
+static int32_t YUVFixed(double value){
+    return (int32_t)(value * YUV_FIXED_ONE + (value < 0? -0.5 : 0.5));
+}
+
+static void YUVCoefficientsInit(YUVCoefficients* k, YUVColorSpace colorSpace, YUVRange range){
+    double kr = (YUVColorSpaceBT709 == colorSpace)? 0.2126 : 0.299;
+    double kb = (YUVColorSpaceBT709 == colorSpace)? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    double ys = (YUVRangeFull == range)? 1.0 : 255.0 / 219.0;
+    double cs = (YUVRangeFull == range)? 1.0 : 255.0 / 224.0;
+
+    k->yOffset = (YUVRangeFull == range)? 0 : 16;
+    k->yScale  = YUVFixed(ys);
+    k->rv      = YUVFixed(2.0 * (1.0 - kr) * cs);
+    k->gu      = YUVFixed(2.0 * kb * (1.0 - kb) / kg * cs);
+    k->gv      = YUVFixed(2.0 * kr * (1.0 - kr) / kg * cs);
+    k->bu      = YUVFixed(2.0 * (1.0 - kb) * cs);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Kernel
+ -----------------------------------------------------------------------------*/
+
+static inline uint32_t YUVClamp(int32_t value){
+    value >>= YUV_FIXED_SHIFT;
+    return (uint32_t)(value < 0? 0 : value > 255? 255 : value);
+}
+
+/*
+ * 画素の中のn番目のバイトを指すシフト量
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define YUV_BYTE_SHIFT(n) (24 - 8 * (n))
+#else
+#define YUV_BYTE_SHIFT(n) (8 * (n))
+#endif
+
+/*
+ * 一つの色差から、R, G, Bへの寄与を求める。
+ */
+static inline void YUVChromaContribution(const YUVCoefficients* k, int u, int v,
+                                         int32_t* r, int32_t* g, int32_t* b){
+    u -= 128;
+    v -= 128;
+    *r =  k->rv * v;
+    *g = -k->gu * u - k->gv * v;
+    *b =  k->bu * u;
+}
+
+/*
+ * 輝度と色差の寄与を画素にする。
+ * redは0(RGBA)か2(BGRA)で、定数で呼ぶとインライン展開されて分岐が消える。
+ * 一画素を32bitの一語にまとめて書くと、バイト毎に書くよりSIMDに展開しやすい。
+ */
+static inline void YUVPackRow(const YUVCoefficients* k, const uint8_t* restrict y, const YUVRow* row,
+                              uint8_t* restrict out, int n, int red){
+    // 出力はuint8_tなので、ポインタを局所変数にしておかないと毎回読み直しになる。
+    const int32_t* restrict r = row->r;
+    const int32_t* restrict g = row->g;
+    const int32_t* restrict b = row->b;
+    const int32_t  yOffset    = k->yOffset;
+    const int32_t  yScale     = k->yScale;
+    const uint32_t alpha      = 255u << YUV_BYTE_SHIFT(3);
+    for (int i = 0; i < n; i++) {
+        int32_t  l     = (y[i] - yOffset) * yScale + (YUV_FIXED_ONE >> 1);
+        uint32_t pixel = (YUVClamp(l + r[i]) << YUV_BYTE_SHIFT(red))
+                       | (YUVClamp(l + g[i]) << YUV_BYTE_SHIFT(1))
+                       | (YUVClamp(l + b[i]) << YUV_BYTE_SHIFT(2 - red))
+                       | alpha;
+        memcpy(out + 4 * i, &pixel, sizeof(pixel));
+    }
+}
+
+/*
+ * 色差面から(cx, cy)の色差を読む。
+ */
+static inline void YUVReadChroma(const YUVImage* image, int cx, int cy, int* u, int* v){
+    if (NULL == image->v) {
+        const uint8_t* p = image->u + (size_t)cy * image->uStride + 2 * (size_t)cx;
+        *u = p[0];
+        *v = p[1];
+    } else {
+        *u = image->u[(size_t)cy * image->uStride + cx];
+        *v = image->v[(size_t)cy * image->vStride + cx];
+    }
+}
+
+/*
+ * 等倍の場合は、輝度の行をそのまま使い、色差は二画素ずつ展開する。
+ */
+static const uint8_t* YUVGatherDirect(const YUVJob* job, int uy, YUVRow* row){
+    const YUVImage* image = job->image;
+    int             cy    = uy >> 1;
+    int             pairs = job->width >> 1;
+
+    if (NULL == image->v) {
+        const uint8_t* uv = image->u + (size_t)cy * image->uStride;
+        for (int i = 0; i < pairs; i++) {
+            int32_t r, g, b;
+            YUVChromaContribution(&job->k, uv[2 * i], uv[2 * i + 1], &r, &g, &b);
+            row->r[2 * i] = row->r[2 * i + 1] = r;
+            row->g[2 * i] = row->g[2 * i + 1] = g;
+            row->b[2 * i] = row->b[2 * i + 1] = b;
+        }
+    } else {
+        const uint8_t* u = image->u + (size_t)cy * image->uStride;
+        const uint8_t* v = image->v + (size_t)cy * image->vStride;
+        for (int i = 0; i < pairs; i++) {
+            int32_t r, g, b;
+            YUVChromaContribution(&job->k, u[i], v[i], &r, &g, &b);
+            row->r[2 * i] = row->r[2 * i + 1] = r;
+            row->g[2 * i] = row->g[2 * i + 1] = g;
+            row->b[2 * i] = row->b[2 * i + 1] = b;
+        }
+    }
+    if (job->width & 1) {
+        int u, v, last = job->width - 1;
+        YUVReadChroma(image, last >> 1, cy, &u, &v);
+        YUVChromaContribution(&job->k, u, v, &row->r[last], &row->g[last], &row->b[last]);
+    }
+    return image->y + (size_t)uy * image->yStride;
+}
+
+/*
+ * 縮小する場合は、s×sの輝度と(s/2)×(s/2)の色差の平均をとる。
+ * 1/2では色差が一画素に一つずつ対応するので、そのまま使う。
+ */
+static const uint8_t* YUVGatherScaled(const YUVJob* job, int uy, YUVRow* row){
+    const YUVImage*    image  = job->image;
+    size_t             stride = image->yStride;
+    int                n      = job->width;
+    uint8_t* restrict  y      = row->y;
+
+    if (2 == job->options.scale) {
+        const uint8_t* p0 = image->y + (size_t)(2 * uy) * stride;
+        const uint8_t* p1 = p0 + stride;
+        for (int i = 0; i < n; i++) {
+            y[i] = (uint8_t)((p0[2 * i] + p0[2 * i + 1] + p1[2 * i] + p1[2 * i + 1] + 2) >> 2);
+        }
+        if (NULL == image->v) {
+            const uint8_t* uv = image->u + (size_t)uy * image->uStride;
+            for (int i = 0; i < n; i++) {
+                YUVChromaContribution(&job->k, uv[2 * i], uv[2 * i + 1], &row->r[i], &row->g[i], &row->b[i]);
+            }
+        } else {
+            const uint8_t* u = image->u + (size_t)uy * image->uStride;
+            const uint8_t* v = image->v + (size_t)uy * image->vStride;
+            for (int i = 0; i < n; i++) {
+                YUVChromaContribution(&job->k, u[i], v[i], &row->r[i], &row->g[i], &row->b[i]);
+            }
+        }
+        return y;
+    }
+
+    const uint8_t* p0 = image->y + (size_t)(4 * uy) * stride;
+    const uint8_t* p1 = p0 + stride;
+    const uint8_t* p2 = p1 + stride;
+    const uint8_t* p3 = p2 + stride;
+    for (int i = 0; i < n; i++) {
+        int sum = 0;
+        for (int m = 0; m < 4; m++) sum += p0[4 * i + m] + p1[4 * i + m] + p2[4 * i + m] + p3[4 * i + m];
+        y[i] = (uint8_t)((sum + 8) >> 4);
+    }
+    if (NULL == image->v) {
+        const uint8_t* c0 = image->u + (size_t)(2 * uy) * image->uStride;
+        const uint8_t* c1 = c0 + image->uStride;
+        for (int i = 0; i < n; i++) {
+            int u = (c0[4 * i]     + c0[4 * i + 2] + c1[4 * i]     + c1[4 * i + 2] + 2) >> 2;
+            int v = (c0[4 * i + 1] + c0[4 * i + 3] + c1[4 * i + 1] + c1[4 * i + 3] + 2) >> 2;
+            YUVChromaContribution(&job->k, u, v, &row->r[i], &row->g[i], &row->b[i]);
+        }
+    } else {
+        const uint8_t* u0 = image->u + (size_t)(2 * uy) * image->uStride;
+        const uint8_t* u1 = u0 + image->uStride;
+        const uint8_t* v0 = image->v + (size_t)(2 * uy) * image->vStride;
+        const uint8_t* v1 = v0 + image->vStride;
+        for (int i = 0; i < n; i++) {
+            int u = (u0[2 * i] + u0[2 * i + 1] + u1[2 * i] + u1[2 * i + 1] + 2) >> 2;
+            int v = (v0[2 * i] + v0[2 * i + 1] + v1[2 * i] + v1[2 * i + 1] + 2) >> 2;
+            YUVChromaContribution(&job->k, u, v, &row->r[i], &row->g[i], &row->b[i]);
+        }
+    }
+    return y;
+}
+
+static inline void YUVPack(const YUVJob* job, const uint8_t* y, const YUVRow* row, uint8_t* out){
+    if (YUVPixelRGBA == job->options.order) YUVPackRow(&job->k, y, row, out, job->width, 0);
+    else                                    YUVPackRow(&job->k, y, row, out, job->width, 2);
+}
+
+/*
+ * 回転前の行[first, first+count)を90度、270度回転して書く。
+ * 出力の一行にはcount画素が並ぶので、列を一画素ずつ書くよりキャッシュに優しい。
+ */
+static void YUVTransposeTile(const YUVJob* job, const uint32_t* tile, int first, int count){
+    int      n = job->width;
+    uint32_t line[YUV_TILE_ROWS];
+    for (int ux = 0; ux < n; ux++) {
+        uint8_t* out;
+        if (YUVRotate90 == job->options.rotation) {
+            for (int k = 0; k < count; k++) line[k] = tile[(size_t)(count - 1 - k) * n + ux];
+            out = job->dst + (size_t)ux * job->dstStride + 4 * (size_t)(job->height - first - count);
+        } else {
+            for (int k = 0; k < count; k++) line[k] = tile[(size_t)k * n + ux];
+            out = job->dst + (size_t)(n - 1 - ux) * job->dstStride + 4 * (size_t)first;
+        }
+        memcpy(out, line, 4 * (size_t)count);
+    }
+}
+
+/*
+ * 回転前の行[begin, end)を変換する。
+ * 回転しない場合はそのまま出力の行に、180度は左右を反転して書き、
+ * 90度、270度はYUV_TILE_ROWS行ずつ溜めてから転置して書く。
+ */
+static void YUVConvertBand(YUVJob* job, int begin, int end){
+    YUVRotation rotation  = job->options.rotation;
+    int         transpose = (YUVRotate90 == rotation || YUVRotate270 == rotation);
+    size_t      n         = (size_t)job->width;
+    size_t      tileRows  = transpose? YUV_TILE_ROWS : (YUVRotate180 == rotation)? 1 : 0;
+    void*       memory    = malloc(3 * n * sizeof(int32_t) + tileRows * n * sizeof(uint32_t) + n);
+    if (NULL == memory) {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    YUVRow row;
+    row.r = (int32_t*)memory;
+    row.g = row.r + n;
+    row.b = row.g + n;
+    uint32_t* tile = (uint32_t*)(row.b + n);
+    row.y = (uint8_t*)(tile + tileRows * n);
+
+    int first = begin;
+    for (int uy = begin; uy < end; uy++) {
+        const uint8_t* y = (1 == job->options.scale)? YUVGatherDirect(job, uy, &row) : YUVGatherScaled(job, uy, &row);
+        switch (rotation) {
+            case YUVRotate0:
+                YUVPack(job, y, &row, job->dst + (size_t)uy * job->dstStride);
+                break;
+            case YUVRotate180: {
+                uint8_t* out = job->dst + (size_t)(job->height - 1 - uy) * job->dstStride;
+                YUVPack(job, y, &row, (uint8_t*)tile);
+                for (size_t i = 0; i < n; i++) memcpy(out + 4 * i, &tile[n - 1 - i], sizeof(uint32_t));
+                break;
+            }
+            default:
+                YUVPack(job, y, &row, (uint8_t*)(tile + (size_t)(uy - first) * n));
+                if (uy - first + 1 == YUV_TILE_ROWS || uy + 1 == end) {
+                    YUVTransposeTile(job, tile, first, uy - first + 1);
+                    first = uy + 1;
+                }
+                break;
+        }
+    }
+    free(memory);
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Threads
+ -----------------------------------------------------------------------------*/
+
+static int YUVCPUCount(void){
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0)? (int)count : 1;
+}
+
+#if !defined(__APPLE__)
+
+typedef struct {
+    YUVJob* job;
+    int     next;       // 次の帯(アトミックに進める)
+    int     bands;
+} YUVWorkers;
+
+static void* YUVWorker(void* context){
+    YUVWorkers* workers = (YUVWorkers*)context;
+    YUVJob*     job     = workers->job;
+    for (;;) {
+        int band = __atomic_fetch_add(&workers->next, 1, __ATOMIC_RELAXED);
+        if (band >= workers->bands) break;
+        int begin = band * job->bandRows;
+        int end   = (begin + job->bandRows < job->height)? begin + job->bandRows : job->height;
+        YUVConvertBand(job, begin, end);
+    }
+    return NULL;
+}
+
+#endif
+
+static void YUVRunBands(YUVJob* job, int threads, int bands){
+#if defined(__APPLE__)
+    (void)threads;
+    dispatch_apply((size_t)bands, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t band){
+        int begin = (int)band * job->bandRows;
+        int end   = (begin + job->bandRows < job->height)? begin + job->bandRows : job->height;
+        YUVConvertBand(job, begin, end);
+    });
+#else
+    YUVWorkers workers = { job, 0, bands };
+    pthread_t  pool[64];
+    int        started = 0;
+    if (threads > 64) threads = 64;
+    for (int i = 1; i < threads; i++) {
+        if (0 == pthread_create(&pool[started], NULL, YUVWorker, &workers)) started++;
+    }
+    YUVWorker(&workers);
+    for (int i = 0; i < started; i++) pthread_join(pool[i], NULL);
+#endif
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Public
+ -----------------------------------------------------------------------------*/
+
+void YUVConvertOptionsInit(YUVConvertOptions* options){
+    memset(options, 0, sizeof(*options));
+    options->colorSpace = YUVColorSpaceBT601;
+    options->range      = YUVRangeVideo;
+    options->order      = YUVPixelBGRA;
+    options->scale      = 1;
+    options->rotation   = YUVRotate0;
+}
+
+int YUVConvertOutputSize(const YUVImage* image, const YUVConvertOptions* options, int* width, int* height){
+    if (NULL == image->y || NULL == image->u) return -1;
+    if (image->width < 2 || image->height < 2) return -1;
+    if (1 != options->scale && 2 != options->scale && 4 != options->scale) return -1;
+
+    int w = image->width  / options->scale;
+    int h = image->height / options->scale;
+    if (0 == w || 0 == h) return -1;
+    if (YUVRotate90 == options->rotation || YUVRotate270 == options->rotation) {
+        *width  = h;
+        *height = w;
+    } else {
+        *width  = w;
+        *height = h;
+    }
+    return 0;
+}
+
+int YUVConvert(const YUVImage* image, uint8_t* dst, size_t dstStride, const YUVConvertOptions* options){
+    YUVJob job;
+    int    width, height;
+    memset(&job, 0, sizeof(job));
+    if (YUVConvertOutputSize(image, options, &width, &height)) return -1;
+    if (dstStride < (size_t)width * 4) return -1;
+
+    job.image     = image;
+    job.options   = *options;
+    job.dst       = dst;
+    job.dstStride = dstStride;
+    job.width     = image->width  / options->scale;
+    job.height    = image->height / options->scale;
+    YUVCoefficientsInit(&job.k, options->colorSpace, options->range);
+
+    // CPU一つあたり数本の帯にして、速いコアが遅いコアの分を取れるようにする。
+    int threads   = (options->threads > 0)? options->threads : YUVCPUCount();
+    int bands     = threads * 4;
+    job.bandRows  = (job.height + bands - 1) / bands;
+    if (job.bandRows < YUV_BAND_MIN_ROWS) job.bandRows = YUV_BAND_MIN_ROWS;
+    job.bandRows  = (job.bandRows + YUV_TILE_ROWS - 1) / YUV_TILE_ROWS * YUV_TILE_ROWS;
+    bands         = (job.height + job.bandRows - 1) / job.bandRows;
+
+    if (1 == threads || 1 == bands) {
+        YUVConvertBand(&job, 0, job.height);
+    } else {
+        YUVRunBands(&job, threads, bands);
+    }
+    return job.failed? -1 : 0;
+}
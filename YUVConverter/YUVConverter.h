@@ -0,0 +1,116 @@
+/*******************************************************************************
+  YUVConverter 1.0.0.0
+
+                         YUV420(NV12, I420)からRGBA/BGRAへの変換
+
+   カメラのフレーム(CVPixelBuffer)をUIImageを経由せずにRGBAへ変換する。
+   BT.601/BT.709、ビデオレンジ/フルレンジに対応し、
+   縮小(1/2, 1/4)と回転(90度単位)も変換と同時に行う。
+
+   変換は回転前の行毎に、輝度の行と色差の寄与(R, G, Bそれぞれ)を一時配列に並べてから、
+   分岐の無い固定小数点のループで画素にする。このループはコンパイラがSIMD
+   (armではNEON、x86ではSSE)に展開できる形にしてある。
+   色差の寄与は一つの色差から二画素分を求めるので、画素毎の乗算は輝度の一回だけになる。
+
+   回転は書き込む時に行い、90度、270度は16行ずつ溜めてから転置して書く。
+
+   行は帯に分け、Apple環境ではdispatch_apply、それ以外ではpthreadで並列に変換する。
+   UIKitに依存しないので、Linux上でもそのままコンパイルできる。
+   CVPixelBufferからはAVFoundationMacro.hのCVPixelBufferConvertToRGBAで変換できる。
+
+       YUVImage image = { y, yStride, uv, uvStride, NULL, 0, 1920, 1080 };
+       YUVConvertOptions options;
+       YUVConvertOptionsInit(&options);
+       options.scale = 2;
+       YUVConvert(&image, rgba, 960 * 4, &options);
+
+   検査と計測はyuvtestで行う。
+
+       $ cc -O3 -pthread -o yuvtest yuvtest.c YUVConverter.c -lm
+       $ ./yuvtest
+
+                                                             (c) 2014 tyabuta.
+ ******************************************************************************/
+
+#ifndef TYABUTA_YUV_CONVERTER_H
+#define TYABUTA_YUV_CONVERTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    YUVColorSpaceBT601 = 0,
+    YUVColorSpaceBT709,
+} YUVColorSpace;
+
+typedef enum {
+    YUVRangeVideo = 0,      // Y:16~235 C:16~240
+    YUVRangeFull,           // 0~255
+} YUVRange;
+
+typedef enum {
+    YUVPixelBGRA = 0,       // iOSのCGImage, CVPixelBufferと同じ並び
+    YUVPixelRGBA,           // OpenGLのGL_RGBA
+} YUVPixelOrder;
+
+/*
+ * 時計回りの回転
+ */
+typedef enum {
+    YUVRotate0 = 0,
+    YUVRotate90,
+    YUVRotate180,
+    YUVRotate270,
+} YUVRotation;
+
+/*
+ * 入力画像
+ * NV12の場合はuにCbCrが交互に並んだ面を渡し、vはNULLにする。
+ * I420の場合はu, vにそれぞれの面を渡す。
+ */
+typedef struct {
+    const uint8_t* y;
+    size_t         yStride;
+    const uint8_t* u;
+    size_t         uStride;
+    const uint8_t* v;
+    size_t         vStride;
+    int            width;
+    int            height;
+} YUVImage;
+
+typedef struct {
+    YUVColorSpace colorSpace;
+    YUVRange      range;
+    YUVPixelOrder order;
+    int           scale;        // 縮小率 1, 2, 4 (平均をとる)
+    YUVRotation   rotation;
+    int           threads;      // 0は論理CPU数
+} YUVConvertOptions;
+
+/*
+ * BT.601, ビデオレンジ, BGRA, 等倍, 回転なし
+ */
+void YUVConvertOptionsInit(YUVConvertOptions* options);
+
+/*
+ * 出力の大きさを求める。引数が正しくなければ-1を返す。
+ */
+int YUVConvertOutputSize(const YUVImage* image, const YUVConvertOptions* options, int* width, int* height);
+
+/*
+ * 変換する。dstはdstStrideバイト間隔の行をYUVConvertOutputSizeの高さ分持つこと。
+ * 成功時は0、引数が正しくない場合とメモリが足りない場合は-1を返す。
+ */
+int YUVConvert(const YUVImage* image, uint8_t* dst, size_t dstStride, const YUVConvertOptions* options);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // TYABUTA_YUV_CONVERTER_H
@@ -0,0 +1,389 @@
+/*
+ *  yuvtest
+ *
+ *  YUVConverterをPC(Linux)上で倍精度の参照実装と比べて検査し、
+ *  一フレームの変換時間を、画素毎に浮動小数点で計算する素直な変換と比べる。
+ *
+ *      $ cc -O3 -pthread -o yuvtest yuvtest.c YUVConverter.c -lm
+ *      $ ./yuvtest
+ *
+ *      -s WxH   計測するフレームの大きさ (初期値は1920x1080)
+ *      -t n     計測で使うスレッド数 (初期値は0で論理CPU数)
+ *
+ *  -fsanitize=address,undefined を付けてビルドすると、範囲外の読み書きも検査できる。
+ *
+ *  Created by tyabuta on 2014/07/19.
+ *  Copyright (c) 2014 tyabuta. All rights reserved.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "YUVConverter.h"
+
+
+#define CHECK(cond) do {                                                    \
+    if (!(cond)) {                                                          \
+        fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+        exit(1);                                                            \
+    }                                                                       \
+} while (0)
+
+// 出力の行の後ろに置く番兵
+#define PADDING  16
+#define SENTINEL 0xA5
+
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * 乱数で埋めたNV12とI420のフレーム(同じ画素)
+ */
+typedef struct {
+    int      width;
+    int      height;
+    uint8_t* y;
+    uint8_t* uv;
+    uint8_t* u;
+    uint8_t* v;
+    YUVImage nv12;
+    YUVImage i420;
+} Frame;
+
+static void frameInit(Frame* frame, int width, int height, unsigned seed){
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    frame->width  = width;
+    frame->height = height;
+    frame->y      = malloc((size_t)width * height);
+    frame->uv     = malloc((size_t)cw * 2 * ch);
+    frame->u      = malloc((size_t)cw * ch);
+    frame->v      = malloc((size_t)cw * ch);
+
+    srand(seed);
+    for (size_t i = 0; i < (size_t)width * height; i++) frame->y[i] = (uint8_t)rand();
+    for (size_t i = 0; i < (size_t)cw * ch; i++) {
+        frame->uv[i * 2]     = frame->u[i] = (uint8_t)rand();
+        frame->uv[i * 2 + 1] = frame->v[i] = (uint8_t)rand();
+    }
+    YUVImage nv12 = { frame->y, (size_t)width, frame->uv, (size_t)cw * 2, NULL,     0,          width, height };
+    YUVImage i420 = { frame->y, (size_t)width, frame->u,  (size_t)cw,     frame->v, (size_t)cw, width, height };
+    frame->nv12 = nv12;
+    frame->i420 = i420;
+}
+
+static void frameFree(Frame* frame){
+    free(frame->y);
+    free(frame->uv);
+    free(frame->u);
+    free(frame->v);
+}
+
+/*
+ * 倍精度の参照実装。回転前、縮小後の画素(ux, uy)のRGBを求める。
+ * 縮小の平均は変換と同じく整数に丸めてから色に変える。
+ */
+static void reference(const YUVImage* image, const YUVConvertOptions* options, int ux, int uy, double rgb[3]){
+    int    s = options->scale;
+    double y = 0.0, u = 0.0, v = 0.0;
+    for (int j = 0; j < s; j++) {
+        for (int i = 0; i < s; i++) y += image->y[(size_t)(uy * s + j) * image->yStride + ux * s + i];
+    }
+    y = floor(y / (s * s) + 0.5);
+
+    // 色差は縦横半分なので、1/2の縮小ではそのまま、1/4では2x2の平均
+    int c  = (s > 1)? s / 2 : 1;
+    int cx = (1 == s)? ux >> 1 : ux * c;
+    int cy = (1 == s)? uy >> 1 : uy * c;
+    for (int j = 0; j < c; j++) {
+        for (int i = 0; i < c; i++) {
+            if (NULL == image->v) {
+                u += image->u[(size_t)(cy + j) * image->uStride + (cx + i) * 2];
+                v += image->u[(size_t)(cy + j) * image->uStride + (cx + i) * 2 + 1];
+            } else {
+                u += image->u[(size_t)(cy + j) * image->uStride + cx + i];
+                v += image->v[(size_t)(cy + j) * image->vStride + cx + i];
+            }
+        }
+    }
+    u = floor(u / (c * c) + 0.5);
+    v = floor(v / (c * c) + 0.5);
+
+    double kr = (YUVColorSpaceBT709 == options->colorSpace)? 0.2126 : 0.299;
+    double kb = (YUVColorSpaceBT709 == options->colorSpace)? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    if (YUVRangeVideo == options->range) {
+        y = (y - 16.0) * 255.0 / 219.0;
+        u = (u - 128.0) * 255.0 / 224.0;
+        v = (v - 128.0) * 255.0 / 224.0;
+    } else {
+        u -= 128.0;
+        v -= 128.0;
+    }
+    rgb[0] = y + 2.0 * (1.0 - kr) * v;
+    rgb[1] = y - 2.0 * kb * (1.0 - kb) / kg * u - 2.0 * kr * (1.0 - kr) / kg * v;
+    rgb[2] = y + 2.0 * (1.0 - kb) * u;
+    for (int i = 0; i < 3; i++) rgb[i] = fmin(255.0, fmax(0.0, rgb[i]));
+}
+
+/*
+ * 出力を参照実装と比べ、最大の差を返す。stepおきの画素だけを見る。
+ * アルファは255、行の後ろの番兵は書き換えられていないこと。
+ */
+static double compare(const YUVImage* image, const YUVConvertOptions* options,
+                      const uint8_t* out, size_t stride, int width, int height, int step){
+    int    sw = image->width / options->scale, sh = image->height / options->scale;
+    double error = 0.0;
+    for (long index = 0; index < (long)width * height; index += step) {
+        int ox = (int)(index % width), oy = (int)(index / width), ux, uy;
+        switch (options->rotation) {
+            case YUVRotate0:   ux = ox;          uy = oy;          break;
+            case YUVRotate90:  ux = oy;          uy = sh - 1 - ox; break;
+            case YUVRotate180: ux = sw - 1 - ox; uy = sh - 1 - oy; break;
+            default:           ux = sw - 1 - oy; uy = ox;          break;
+        }
+        double rgb[3];
+        reference(image, options, ux, uy, rgb);
+
+        const uint8_t* p = out + (size_t)oy * stride + (size_t)ox * 4;
+        int r = (YUVPixelRGBA == options->order)? p[0] : p[2];
+        int b = (YUVPixelRGBA == options->order)? p[2] : p[0];
+        error = fmax(error, fabs(r - rgb[0]));
+        error = fmax(error, fabs(p[1] - rgb[1]));
+        error = fmax(error, fabs(b - rgb[2]));
+        CHECK(255 == p[3]);
+    }
+    for (int row = 0; row < height; row++) {
+        for (int i = 0; i < PADDING; i++) CHECK(SENTINEL == out[(size_t)row * stride + (size_t)width * 4 + i]);
+    }
+    return error;
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Tests
+ -----------------------------------------------------------------------------*/
+
+static void testArguments(void){
+    Frame frame;
+    frameInit(&frame, 64, 48, 1);
+    uint8_t* out = malloc(64 * 48 * 4);
+    YUVConvertOptions options;
+    YUVConvertOptionsInit(&options);
+    int width, height;
+
+    CHECK(0 == YUVConvertOutputSize(&frame.nv12, &options, &width, &height) && 64 == width && 48 == height);
+    options.rotation = YUVRotate90;
+    options.scale    = 4;
+    CHECK(0 == YUVConvertOutputSize(&frame.nv12, &options, &width, &height) && 12 == width && 16 == height);
+
+    options.scale = 3;
+    CHECK(-1 == YUVConvertOutputSize(&frame.nv12, &options, &width, &height));
+    CHECK(-1 == YUVConvert(&frame.nv12, out, 64 * 4, &options));
+    YUVConvertOptionsInit(&options);
+    CHECK(-1 == YUVConvert(&frame.nv12, out, 64 * 4 - 1, &options));
+
+    YUVImage image = frame.nv12;
+    image.width = 1;
+    CHECK(-1 == YUVConvert(&image, out, 64 * 4, &options));
+    image = frame.nv12;
+    image.u = NULL;
+    CHECK(-1 == YUVConvert(&image, out, 64 * 4, &options));
+
+    free(out);
+    frameFree(&frame);
+    printf("arguments: ok\n");
+}
+
+/*
+ * 全ての形式、縮小、回転、色空間、レンジで、参照実装との差が丸めの範囲に収まる。
+ * 大きなフレームは回転なし等倍の時だけ色空間とレンジを全て試し、画素も間引いて見る。
+ */
+static void testReference(void){
+    static const int sizes[][2] = { { 37, 23 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); si++) {
+        Frame frame;
+        frameInit(&frame, sizes[si][0], sizes[si][1], (unsigned)si);
+        int      small  = (frame.width < 100);
+        size_t   stride = (size_t)frame.width * 4 + PADDING;
+        uint8_t* out    = malloc(stride * (frame.width > frame.height? frame.width : frame.height));
+        double   error  = 0.0;
+        int      count  = 0;
+
+        for (int format = 0; format < 2; format++)
+        for (int scale = 1; scale <= 4; scale *= 2)
+        for (int rotation = YUVRotate0; rotation <= YUVRotate270; rotation++)
+        for (int colorSpace = YUVColorSpaceBT601; colorSpace <= YUVColorSpaceBT709; colorSpace++)
+        for (int range = YUVRangeVideo; range <= YUVRangeFull; range++) {
+            if (!small && (colorSpace || range) && !(1 == scale && YUVRotate0 == rotation)) continue;
+
+            YUVConvertOptions options;
+            YUVConvertOptionsInit(&options);
+            options.scale      = scale;
+            options.rotation   = (YUVRotation)rotation;
+            options.colorSpace = (YUVColorSpace)colorSpace;
+            options.range      = (YUVRange)range;
+            options.order      = (rotation & 1)? YUVPixelRGBA : YUVPixelBGRA;
+
+            const YUVImage* image = format? &frame.i420 : &frame.nv12;
+            int width, height;
+            CHECK(0 == YUVConvertOutputSize(image, &options, &width, &height));
+            size_t outStride = (size_t)width * 4 + PADDING;
+            memset(out, SENTINEL, outStride * height);
+            CHECK(0 == YUVConvert(image, out, outStride, &options));
+
+            int step = ((long)width * height > 200000)? 97 : 1;
+            error = fmax(error, compare(image, &options, out, outStride, width, height, step));
+            count++;
+        }
+        CHECK(error <= 0.502);
+        printf("%dx%d vs reference: ok (%d conversions, max error %.3f)\n", frame.width, frame.height, count, error);
+        free(out);
+        frameFree(&frame);
+    }
+}
+
+/*
+ * スレッド数(帯の分け方)によらず同じ結果になる。
+ */
+static void testThreads(void){
+    Frame frame;
+    frameInit(&frame, 1000, 750, 7);
+    size_t   size   = (size_t)1000 * 750 * 4;
+    uint8_t* single = malloc(size);
+    uint8_t* multi  = malloc(size);
+
+    for (int rotation = YUVRotate0; rotation <= YUVRotate270; rotation++) {
+        YUVConvertOptions options;
+        YUVConvertOptionsInit(&options);
+        options.rotation = (YUVRotation)rotation;
+        int width, height;
+        YUVConvertOutputSize(&frame.nv12, &options, &width, &height);
+
+        options.threads = 1;
+        CHECK(0 == YUVConvert(&frame.nv12, single, (size_t)width * 4, &options));
+        for (int threads = 2; threads <= 7; threads += 5) {
+            options.threads = threads;
+            memset(multi, 0, size);
+            CHECK(0 == YUVConvert(&frame.nv12, multi, (size_t)width * 4, &options));
+            CHECK(0 == memcmp(single, multi, size));
+        }
+    }
+    free(single);
+    free(multi);
+    frameFree(&frame);
+    printf("threads: ok\n");
+}
+
+
+
+
+/*------------------------------------------------------------------------------
+ Benchmark
+ -----------------------------------------------------------------------------*/
+
+/*
+ * 画素毎に浮動小数点で計算する素直な変換(比較用)。NV12, BT.601, ビデオレンジ, BGRA
+ */
+static uint8_t clampByte(float value){
+    return (value < 0.0f)? 0 : (value > 255.0f)? 255 : (uint8_t)(value + 0.5f);
+}
+
+static void naiveConvert(const YUVImage* image, uint8_t* dst, size_t dstStride){
+    for (int row = 0; row < image->height; row++) {
+        const uint8_t* y   = image->y + (size_t)row * image->yStride;
+        const uint8_t* uv  = image->u + (size_t)(row / 2) * image->uStride;
+        uint8_t*       out = dst + (size_t)row * dstStride;
+        for (int x = 0; x < image->width; x++) {
+            float l = (y[x] - 16.0f) * 1.164383f;
+            float u = uv[(x / 2) * 2]     - 128.0f;
+            float v = uv[(x / 2) * 2 + 1] - 128.0f;
+            out[x * 4 + 0] = clampByte(l + 2.017232f * u);
+            out[x * 4 + 1] = clampByte(l - 0.391762f * u - 0.812968f * v);
+            out[x * 4 + 2] = clampByte(l + 1.596027f * v);
+            out[x * 4 + 3] = 255;
+        }
+    }
+}
+
+static void bench(int width, int height, int threads){
+    Frame frame;
+    frameInit(&frame, width, height, 3);
+    uint8_t* out    = malloc((size_t)width * height * 4);
+    int      rounds = (int)(3840L * 2160 * 20 / ((long)width * height));
+    if (rounds < 1) rounds = 1;
+
+    double start = nowSec();
+    for (int r = 0; r < rounds; r++) naiveConvert(&frame.nv12, out, (size_t)width * 4);
+    double naive = (nowSec() - start) / rounds;
+    printf("NV12 %dx%d -> BGRA\n", width, height);
+    printf("  naive float per pixel : %7.2f ms\n", naive * 1e3);
+
+    static const struct {
+        const char* name;
+        int         threads;
+        int         scale;
+        YUVRotation rotation;
+    } cases[] = {
+        { "1 thread",     1, 1, YUVRotate0  },
+        { "direct",      -1, 1, YUVRotate0  },
+        { "scale 1/2",   -1, 2, YUVRotate0  },
+        { "scale 1/4",   -1, 4, YUVRotate0  },
+        { "rotate 90",   -1, 1, YUVRotate90 },
+        { "rotate 180",  -1, 1, YUVRotate180 },
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        YUVConvertOptions options;
+        YUVConvertOptionsInit(&options);
+        options.threads  = (cases[c].threads < 0)? threads : cases[c].threads;
+        options.scale    = cases[c].scale;
+        options.rotation = cases[c].rotation;
+        int w, h;
+        YUVConvertOutputSize(&frame.nv12, &options, &w, &h);
+
+        start = nowSec();
+        for (int r = 0; r < rounds; r++) CHECK(0 == YUVConvert(&frame.nv12, out, (size_t)w * 4, &options));
+        double elapsed = (nowSec() - start) / rounds;
+        printf("  YUVConvert %-10s : %7.2f ms (%.2f ns/px, %.1fx)\n",
+               cases[c].name, elapsed * 1e3, elapsed * 1e9 / ((double)width * height), naive / elapsed);
+    }
+    free(out);
+    frameFree(&frame);
+}
+
+
+
+
+static void usage(void){
+    fprintf(stderr, "usage: yuvtest [-s WxH] [-t threads]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[]){
+    int width = 1920, height = 1080, threads = 0;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "s:t:"))) {
+        switch (opt) {
+            case 's': if (2 != sscanf(optarg, "%dx%d", &width, &height)) usage(); break;
+            case 't': threads = atoi(optarg); break;
+            default:  usage();
+        }
+    }
+    if (optind != argc || width < 4 || height < 4 || width > 16384 || height > 16384 || threads < 0) usage();
+
+    testArguments();
+    testReference();
+    testThreads();
+    bench(width, height, threads);
+    return 0;
+}
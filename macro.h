@@ -30,6 +30,11 @@
  */
 #import <sys/time.h>
 
+/*
+ * uuid_generate_random関数を使用する為に必要なインポート。
+ */
+#import <uuid/uuid.h>
+
 
 
 /*
@@ -65,6 +70,26 @@
 #define dmsg(...)
 #endif
 
+/*
+ * #import "AsyncLog.h"
+ * dmsgの出力をAsyncLogに切り替える。
+ * 呼び出したスレッドでは文字列の組み立ても書き込みも行わない。
+ * 関数名と行番号の分、fmtに渡せる引数は6個までとなる。
+ */
+#if defined(DEBUG) && defined(TYABUTA_ASYNC_LOG_H)
+#undef dmsg
+#define dmsg(fmt, ...) AsyncLog((@"%s @%d " fmt), __PRETTY_FUNCTION__, __LINE__, ##__VA_ARGS__);
+#endif
+
+/*
+ * #import "FlightRecorder.h"
+ * フライトレコーダーにログを残す。リリースビルドでも記録される。
+ * 40byteを超える部分は切り捨てられる。
+ */
+#ifdef TYABUTA_FLIGHT_RECORDER_H
+#define frlog(fmt, ...) FlightRecorderLog([[NSString stringWithFormat:fmt, ##__VA_ARGS__] UTF8String]);
+#endif
+
 
 /*
  * オブジェクトにメッセージを送る。
@@ -180,7 +205,6 @@ NS_INLINE NSString* NSUserDefaultsDumpApp(){
 NS_INLINE void NSUserDefaultsSetString(NSString* str, NSString* forKey){
     NSUserDefaults* userDefaults = [NSUserDefaults standardUserDefaults];
     [userDefaults setValue:str forKey:forKey];
-    [userDefaults synchronize];
 }
 
 /*
@@ -189,7 +213,6 @@ NS_INLINE void NSUserDefaultsSetString(NSString* str, NSString* forKey){
 NS_INLINE void NSUserDefaultsSetInteger(NSInteger intValue, NSString* forKey){
     NSUserDefaults* userDefaults = [NSUserDefaults standardUserDefaults];
     [userDefaults setInteger:intValue forKey:forKey];
-    [userDefaults synchronize];
 }
 
 /*
@@ -198,7 +221,6 @@ NS_INLINE void NSUserDefaultsSetInteger(NSInteger intValue, NSString* forKey){
 NS_INLINE void NSUserDefaultsSetFloat(float floatValue, NSString* forKey){
     NSUserDefaults* userDefaults = [NSUserDefaults standardUserDefaults];
     [userDefaults setFloat:floatValue forKey:forKey];
-    [userDefaults synchronize];
 }
 
 /*
@@ -207,7 +229,15 @@ NS_INLINE void NSUserDefaultsSetFloat(float floatValue, NSString* forKey){
 NS_INLINE void NSUserDefaultsRemoveKey(NSString* forKey){
     NSUserDefaults* userDefaults = [NSUserDefaults standardUserDefaults];
     [userDefaults removeObjectForKey:forKey];
-    [userDefaults synchronize];
+}
+
+/*
+ * UserDefaultsの変更をファイルに書き出す。
+ * 各Set関数は書き出しを行わない(システムが適当な間隔で書き出す)ので、
+ * 直ちに保存したい区切りでのみ呼ぶ事。
+ */
+NS_INLINE void NSUserDefaultsSynchronize(){
+    [[NSUserDefaults standardUserDefaults] synchronize];
 }
 
 /*
@@ -233,6 +263,45 @@ NS_INLINE float NSUserDefaultsGetFloat(NSString* key){
 
 
 
+/*
+ * #import "KeyValueStore.h"
+ * 毎フレーム保存するような値は、UserDefaultsの代わりにKeyValueStoreを使う。
+ * 書き込みはログへの追記となり、一定時間まとめて行われる。
+ */
+#ifdef TYABUTA_KEY_VALUE_STORE_H
+
+NS_INLINE void KeyValueStoreSetString(NSString* str, NSString* forKey){
+    [[KeyValueStore defaultStore] setString:str forKey:forKey];
+}
+
+NS_INLINE void KeyValueStoreSetInteger(NSInteger intValue, NSString* forKey){
+    [[KeyValueStore defaultStore] setInteger:intValue forKey:forKey];
+}
+
+NS_INLINE void KeyValueStoreSetFloat(float floatValue, NSString* forKey){
+    [[KeyValueStore defaultStore] setDouble:floatValue forKey:forKey];
+}
+
+NS_INLINE void KeyValueStoreRemoveKey(NSString* forKey){
+    [[KeyValueStore defaultStore] removeObjectForKey:forKey];
+}
+
+NS_INLINE NSString* KeyValueStoreGetString(NSString* key){
+    return [[KeyValueStore defaultStore] stringForKey:key];
+}
+
+NS_INLINE NSInteger KeyValueStoreGetInteger(NSString* key){
+    return [[KeyValueStore defaultStore] integerForKey:key];
+}
+
+NS_INLINE float KeyValueStoreGetFloat(NSString* key){
+    return (float)[[KeyValueStore defaultStore] doubleForKey:key];
+}
+
+#endif // TYABUTA_KEY_VALUE_STORE_H
+
+
+
 /*------------------------------------------------------------------------------
                              File IO functions
  -----------------------------------------------------------------------------*/
@@ -272,6 +341,18 @@ NS_INLINE void NSLogRedirectToDocumentFile(NSString* filename){
     freopen([path cStringUsingEncoding:NSUTF8StringEncoding], "a+", stderr);
 }
 
+/*
+ * #import "AsyncLog.h"
+ * AsyncLogの出力先をドキュメントディレクトリのファイルにする。
+ * maxFileSizeを超えると filename.1 ~ filename.3 へローテーションする。
+ */
+#ifdef TYABUTA_ASYNC_LOG_H
+NS_INLINE BOOL AsyncLogRedirectToDocumentFile(NSString* filename, size_t maxFileSize){
+    NSString* path = NSDocumentDirectoryMakePath(filename);
+    return AsyncLogOpen([path fileSystemRepresentation], maxFileSize, 3);
+}
+#endif // TYABUTA_ASYNC_LOG_H
+
 /*
  * モジュールディレクトリから指定ディレクトリのファイル一覧のPATH配列を取得する。
  */
@@ -290,6 +371,36 @@ NS_INLINE NSArray* getFilePathsFromResource(NSString* dir){
     return [NSArray arrayWithArray:arr];
 }
 
+/*
+ * #import "ResourceArchive.h"
+ * getFilePathsFromResourceの代わりに、バンドルのResources.rarから
+ * 指定ディレクトリ以下(サブディレクトリを含む)のエントリ名の配列を取得する。
+ * ディレクトリの走査は行わず、アーカイブの索引から取り出す。
+ */
+#ifdef TYABUTA_RESOURCE_ARCHIVE_H
+NS_INLINE NSArray* getFileNamesFromResourceArchive(NSString* dir){
+    NSString* prefix = [dir hasSuffix:@"/"]? dir : [dir stringByAppendingString:@"/"];
+    return [[ResourceArchive mainArchive] namesWithPrefix:prefix];
+}
+
+/*
+ * #import "ResourceArchive.h"
+ * バンドルのResources.rarからデータを取得する。
+ */
+NS_INLINE NSData* getDataFromResourceArchive(NSString* name){
+    ResourceArchive* archive = [ResourceArchive mainArchive];
+#ifdef TYABUTA_RESOURCE_PREFETCHER_H
+    if (ResourcePrefetcherIsRecording()) {
+        NSRange range = [archive fileRangeForName:name];
+        if (NSNotFound != range.location) {
+            ResourcePrefetcherRecord(ResourcePrefetchKindRead, archive.path, range.location, range.length);
+        }
+    }
+#endif
+    return [archive dataForName:name];
+}
+#endif // TYABUTA_RESOURCE_ARCHIVE_H
+
 /*
  * PATHをスラッシュでつなげる。
  */
@@ -311,6 +422,18 @@ NS_INLINE NSString* getModulePath(){
     return [[NSBundle mainBundle] resourcePath];
 }
 
+/*
+ * モジュールディレクトリのファイルを読み込む。
+ * ResourcePrefetcherを使う場合は、読み込みが記録される。
+ */
+NS_INLINE NSData* getDataFromModuleFile(NSString* name){
+    NSString* path = joinPath(getModulePath(), name);
+#ifdef TYABUTA_RESOURCE_PREFETCHER_H
+    ResourcePrefetcherRecord(ResourcePrefetchKindRead, path, 0, 0);
+#endif
+    return [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+}
+
 
 
 
@@ -368,42 +491,291 @@ NS_INLINE NSDictionary* NSURLRequestJson(NSURL* url){
 }
 
 
+/*
+ * #import "HTTPClient.h"
+ * 呼び出し元のスレッドをブロックしない非同期版のリクエスト関数
+ */
+#ifdef TYABUTA_HTTP_CLIENT_H
 
 /*
- * URLエンコードする
+ * 指定のURLを非同期でリクエストし、NSDataオブジェクトを取得する。
+ * 同じURLのリクエストが通信中であれば、その通信の結果を共有する。
+ * handlerはメインスレッドで呼ばれる。
  */
-NS_INLINE NSString* NSURLEncodeWithString(NSString* str){
-    CFStringRef encodedString =
-    CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault,
-                                            (CFStringRef)str,
-                                            NULL,
-                                            CFSTR(";,/?:@&=+$#"),
-                                            kCFStringEncodingUTF8);
+NS_INLINE HTTPRequestOperation*
+NSURLRequestDataAsync(NSURL* url, void (^handler)(NSData* data, NSError* error)){
+    return [[HTTPClient sharedClient] sendSharedRequest:[NSURLRequest requestWithURL:url]
+                                             completion:^(NSHTTPURLResponse* response,
+                                                          NSData* data, NSError* error) {
+                                                 handler(data, error);
+                                             }];
+}
 
-    NSString* nsString = [NSString stringWithString:(__bridge NSString*)encodedString];
-    CFRelease(encodedString);
-    return nsString;
+/*
+ * 指定のURLを非同期でリクエストする。
+ * 取得した内容は文字列として返す。
+ */
+NS_INLINE HTTPRequestOperation*
+NSURLRequestStringAsync(NSURL* url, void (^handler)(NSString* content, NSError* error)){
+    return NSURLRequestDataAsync(url, ^(NSData* data, NSError* error) {
+        NSString* content = nil;
+        if (data) {
+            content = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        }
+        handler(content, error);
+    });
+}
 
+/*
+ * 指定のURLを非同期でリクエストする。
+ * 取得した内容はディクショナリとして返す。
+ * JSONの解析はバックグラウンドで一度だけ行い、同じURLを同時に要求した
+ * 全ての呼び出し元で結果(不変なオブジェクト)を共有する。
+ * handlerはメインスレッドで呼ばれる。
+ */
+NS_INLINE HTTPRequestOperation*
+NSURLRequestJsonAsync(NSURL* url, void (^handler)(NSDictionary* dictionary, NSError* error)){
+    return [[HTTPClient sharedClient] sendSharedRequest:[NSURLRequest requestWithURL:url]
+                                             parserName:@"NSJSONSerialization"
+                                                 parser:^id(NSData* data, NSError** error) {
+                                                     return [NSJSONSerialization JSONObjectWithData:data
+                                                                                           options:0
+                                                                                             error:error];
+                                                 }
+                                             completion:^(NSHTTPURLResponse* response,
+                                                          id object, NSError* error) {
+                                                 handler(object, error);
+                                             }];
+}
+
+/*
+ * 指定のURLをファイルへダウンロードする。
+ * ボディはメモリに溜めずに書き込まれ、中断した場合は次回続きから再開する。
+ * handlerはメインスレッドで呼ばれる。
+ */
+NS_INLINE HTTPRequestOperation*
+NSURLRequestDownloadAsync(NSURL* url, NSString* path, void (^handler)(NSError* error)){
+    return [[HTTPClient sharedClient] downloadRequest:[NSURLRequest requestWithURL:url]
+                                               toFile:path
+                                           completion:^(NSHTTPURLResponse* response,
+                                                        NSData* sha256, NSError* error) {
+                                               handler(error);
+                                           }];
+}
+
+#endif // TYABUTA_HTTP_CLIENT_H
+
+
+/*
+ * #import "HTTPClient.h"
+ * #import "JSONCursor.h"
+ * 大きなJSONを全体をバッファリングせずに読む関数
+ */
+#if defined(TYABUTA_HTTP_CLIENT_H) && defined(TYABUTA_JSON_CURSOR_H)
+
+/*
+ * 指定のURLでリクエストし、受信したチャンクから順にJSONを解析する。
+ * トップレベル配列の要素(またはトップレベルの値)が完成する度に
+ * elementHandlerがバックグラウンドのキューで呼ばれる。
+ * elementはelementHandlerの中でのみ有効。
+ * 全て読み終わるとcompletionがメインスレッドで呼ばれる。
+ */
+NS_INLINE HTTPRequestOperation*
+NSURLRequestJsonStream(NSURL* url,
+                       JSONStreamElementBlock elementHandler,
+                       void (^completion)(NSUInteger elementCount, NSError* error)){
+
+    dispatch_queue_t queue = dispatch_queue_create("NSURLRequestJsonStream", DISPATCH_QUEUE_SERIAL);
+    JSONStreamParser* parser = [[JSONStreamParser alloc] initWithElementHandler:elementHandler];
+    __block BOOL parseFailed = NO;
+
+    return
+    [[HTTPClient sharedClient] sendRequest:[NSURLRequest requestWithURL:url]
+                               dataHandler:^BOOL(NSData* chunk) {
+                                   dispatch_async(queue, ^{
+                                       if (NO == parseFailed && NO == [parser appendData:chunk]) {
+                                           parseFailed = YES;
+                                       }
+                                   });
+                                   return YES;
+                               }
+                                completion:^(NSHTTPURLResponse* response,
+                                             NSData* data, NSError* error) {
+                                    dispatch_async(queue, ^{
+                                        NSError* result = error;
+                                        if (nil == result && (parseFailed || NO == [parser finish])) {
+                                            result = [NSError errorWithDomain:@"NSURLRequestJsonStream"
+                                                                         code:-1
+                                                                     userInfo:@{NSLocalizedDescriptionKey : @"JSON parse error"}];
+                                        }
+                                        NSUInteger count = parser.elementCount;
+                                        dispatch_async(dispatch_get_main_queue(), ^{
+                                            completion(count, result);
+                                        });
+                                    });
+                                }];
+}
+
+#endif // TYABUTA_HTTP_CLIENT_H && TYABUTA_JSON_CURSOR_H
+
+
+
+/*
+ * URLエンコードでそのまま出力できる文字の表(1:そのまま 0:エンコード)
+ * 英数字と "-._~!*'()" 以外は全てパーセントエンコードする。
+ * CFURLCreateStringByAddingPercentEscapesに ";,/?:@&=+$#" を指定した場合と同じ結果になる。
+ */
+static const uint8_t NSURLUnreservedCharTable[256] = {
+    ['0' ... '9'] = 1, ['A' ... 'Z'] = 1, ['a' ... 'z'] = 1,
+    ['-'] = 1, ['.'] = 1, ['_'] = 1, ['~'] = 1,
+    ['!'] = 1, ['*'] = 1, ['\''] = 1, ['('] = 1, [')'] = 1,
+};
+
+/*
+ * URLエンコード後のバイト数を求める。
+ * 分岐を作らず、エンコードが必要な文字毎に2byteずつ加算する。
+ */
+NS_INLINE size_t NSURLEncodedLength(const uint8_t* src, size_t length){
+    size_t n = length;
+    for (size_t i = 0; i < length; i++) {
+        n += (NSURLUnreservedCharTable[src[i]] ^ 1) << 1;
+    }
+    return n;
+}
 
+/*
+ * URLエンコードしてdstに書き込む。書き込んだ末尾の位置を返す。
+ * dstにはNSURLEncodedLength関数で求めたサイズが必要。
+ */
+NS_INLINE char* NSURLEncodeBytes(const uint8_t* src, size_t length, char* dst){
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = src[i];
+        if (NSURLUnreservedCharTable[c]) {
+            *dst++ = (char)c;
+        }
+        else {
+            dst[0] = '%';
+            dst[1] = hex[c >> 4];
+            dst[2] = hex[c & 0x0F];
+            dst += 3;
+        }
+    }
+    return dst;
+}
+
+/*
+ * URLエンコードする
+ */
+NS_INLINE NSString* NSURLEncodeWithString(NSString* str){
+    if (nil == str) return nil;
+    const uint8_t* src = (const uint8_t*)[str UTF8String];
+    size_t      length = strlen((const char*)src);
+    size_t     encoded = NSURLEncodedLength(src, length);
+
+    // エンコードが不要ならそのまま返す。
+    if (encoded == length) return [str copy];
+
+    // 一度のメモリ確保で書き込み、バッファはNSStringに引き渡す。
+    char* buf = (char*)malloc(encoded);
+    NSURLEncodeBytes(src, length, buf);
+    return [[NSString alloc] initWithBytesNoCopy:buf
+                                          length:encoded
+                                        encoding:NSUTF8StringEncoding
+                                    freeWhenDone:YES];
+}
+
+/*
+ * URLデコードする
+ * 不正な"%"の並びはそのまま残す。"+"は空白に変換しない。
+ */
+NS_INLINE NSString* NSURLDecodeWithString(NSString* str){
+    if (nil == str) return nil;
+    const uint8_t* src = (const uint8_t*)[str UTF8String];
+    size_t      length = strlen((const char*)src);
+    const void*    pct = memchr(src, '%', length);
+    if (NULL == pct) return [str copy];
+
+    // デコード後は必ず短くなるので、元の長さで足りる。
+    char*  buf = (char*)malloc(length);
+    size_t   n = (const uint8_t*)pct - src;
+    memcpy(buf, src, n);
+    for (size_t i = n; i < length; i++) {
+        uint8_t c = src[i];
+        if ('%' == c && i + 2 < length && isxdigit(src[i+1]) && isxdigit(src[i+2])) {
+            uint8_t hi = src[i+1], lo = src[i+2];
+            hi = (hi <= '9')? hi - '0' : (hi | 0x20) - 'a' + 10;
+            lo = (lo <= '9')? lo - '0' : (lo | 0x20) - 'a' + 10;
+            buf[n++] = (char)((hi << 4) | lo);
+            i += 2;
+        }
+        else {
+            buf[n++] = (char)c;
+        }
+    }
+
+    NSString* decoded = [[NSString alloc] initWithBytesNoCopy:buf
+                                                       length:n
+                                                     encoding:NSUTF8StringEncoding
+                                                 freeWhenDone:YES];
+    if (nil == decoded) free(buf); // UTF-8として不正
+    return decoded;
 }
 
 /*
  * ディクショナリから、URLリクエストパラメータを作成する。
  * 各パラメータはURLエンコードされます。
  * @{ @"q" : @"value" } => q=value
+ *
+ * 一回目の走査で出力サイズを確定し、一つのバッファに書き込む。
  */
 NS_INLINE NSString*
 NSURLBuildParamWithDictionary(NSDictionary* params) {
-    NSMutableString *buf = [NSMutableString string];
-    for (NSString* key in params ) {
-        [buf appendFormat:@"%@=%@&", key, NSURLEncodeWithString(params[key])];
+    NSUInteger count = params.count;
+    if (0 == count) return @"";
+
+    // キーと値のUTF-8表現を集めて、出力サイズを求める。
+    // UTF8Stringの指す先は元の文字列が生きている間だけ有効なので、stringsで保持しておく。
+    NSMutableArray* strings = [NSMutableArray arrayWithCapacity:count * 2];
+    const uint8_t** keys    = (const uint8_t**)malloc(sizeof(uint8_t*) * count * 2);
+    size_t*         lengths = (size_t*)malloc(sizeof(size_t) * count * 2);
+    const uint8_t** values  = keys + count;
+    size_t*         keyLens = lengths;
+    size_t*         valLens = lengths + count;
+
+    size_t     total = count - 1; // "&"の数
+    NSUInteger     i = 0;
+    for (id key in params) {
+        id value = params[key];
+        NSString* name = [key   isKindOfClass:[NSString class]]? key   : [key description];
+        NSString* str  = [value isKindOfClass:[NSString class]]? value : [value description];
+        [strings addObject:name];
+        [strings addObject:str];
+        keys[i]    = (const uint8_t*)[name UTF8String];
+        values[i]  = (const uint8_t*)[str UTF8String];
+        keyLens[i] = strlen((const char*)keys[i]);
+        valLens[i] = strlen((const char*)values[i]);
+        total += keyLens[i] + 1 + NSURLEncodedLength(values[i], valLens[i]);
+        i++;
     }
 
-    // 末尾の不要な"&"を削除する。
-    if ([buf length] > 0) {
-        [buf deleteCharactersInRange:NSMakeRange(buf.length-1, 1)];
+    // 確定したサイズで書き込む。
+    char* buf = (char*)malloc(total);
+    char*   p = buf;
+    for (i = 0; i < count; i++) {
+        if (i > 0) *p++ = '&';
+        memcpy(p, keys[i], keyLens[i]);
+        p += keyLens[i];
+        *p++ = '=';
+        p = NSURLEncodeBytes(values[i], valLens[i], p);
     }
-    return buf;
+    free(keys);
+    free(lengths);
+
+    return [[NSString alloc] initWithBytesNoCopy:buf
+                                          length:total
+                                        encoding:NSUTF8StringEncoding
+                                    freeWhenDone:YES];
 }
 
 /*
@@ -436,6 +808,19 @@ NSURLPostRequest(NSURL* url, NSDictionary* params, id<NSURLConnectionDelegate> d
     return YES;
 }
 
+/*
+ * #import "PostQueue.h"
+ * 指定URLへのPOSTをキューに溜め、まとめて送信する。
+ * パラメータはジャーナルに保存され、アプリを終了しても失われない。
+ * 送信タイミングはPostQueueが決める為、結果は受け取れない。
+ */
+#ifdef TYABUTA_POST_QUEUE_H
+NS_INLINE void NSURLPostRequestEnqueue(NSURL* url, NSDictionary* params){
+    NSString* strParams = NSURLBuildParamWithDictionary(params);
+    [[PostQueue queueForURL:url] enqueueRecord:[strParams dataUsingEncoding:NSUTF8StringEncoding]];
+}
+#endif // TYABUTA_POST_QUEUE_H
+
 /*
  * HTTPリクエストのレスポンスヘッダの情報をダンプする。
  */
@@ -515,6 +900,34 @@ NS_INLINE void NSTimerStop(NSTimer* timer){
     [timer invalidate];
 }
 
+/*
+ * #import "TimerWheel.h"
+ * 多数のタイマーを使う場合は、NSTimerの代わりにTimerWheelを使うと
+ * ランループの起床が一回にまとまる。
+ */
+#ifdef TYABUTA_TIMER_WHEEL_H
+
+/*
+ * TimerWheelに繰り返しタイマーをセットする。
+ * tolerance: 許容する遅れ[sec]、他のタイマーと期限を揃える為に使う。
+ * - (void)tick:(id)timer
+ */
+NS_INLINE id TimerWheelStart(double interval, double tolerance, id target, SEL action){
+    return [[TimerWheel sharedWheel] addTimerWithInterval:interval
+                                                tolerance:tolerance
+                                                   target:target
+                                                 selector:action];
+}
+
+/*
+ * TimerWheelのタイマーを停止させる。
+ */
+NS_INLINE void TimerWheelStop(id timer){
+    [[TimerWheel sharedWheel] cancelTimer:timer];
+}
+
+#endif // TYABUTA_TIMER_WHEEL_H
+
 
 /*------------------------------------------------------------------------------
                                View functions
@@ -740,36 +1153,32 @@ NS_INLINE void viewSetScale(UIView* view, CGFloat scale){
 
 /*
  * dumpSubView関数内部で呼ばれる内部関数
+ * 全ての行を一つの文字列に追記していく。(途中の文字列を作らない)
  */
-static NSString* _dumpSubview(UIView* view, int indent){
-
-    NSString* strIndent = @"";
+static void _dumpSubview(UIView* view, int indent, NSMutableString* str){
     for (int i=0; i<indent; i++){
-        if (i==indent-1) {
-            strIndent = [strIndent stringByAppendingString:@"+---"];
-        }
-        else {
-            strIndent = [strIndent stringByAppendingString:@"|   "];
-        }
+        [str appendString:(i==indent-1)? @"+---" : @"|   "];
     }
-
-    NSString* str = [NSString stringWithFormat:@"%@%s\n",
-                     strIndent,
-                     class_getName([view class])];
+    [str appendFormat:@"%s\n", class_getName([view class])];
 
     for (UIView* subView in view.subviews){
-        NSString* ret = _dumpSubview(subView, indent+1);
-        str = [str stringByAppendingString:ret];
+        _dumpSubview(subView, indent+1, str);
     }
-    return str;
 }
 
 
 /*
  * UIViewのSubViewを階層表示した文字列を返す。
+ * ViewSnapshotを使う場合は、再帰せずにバッファへ書き出す。
  */
 NS_INLINE NSString* dumpSubview(UIView* view){
-    return _dumpSubview(view, 0);
+#ifdef TYABUTA_VIEW_SNAPSHOT_H
+    return ViewSnapshotText(view, 0);
+#else
+    NSMutableString* str = [NSMutableString string];
+    _dumpSubview(view, 0, str);
+    return str;
+#endif
 }
 
 /*
@@ -778,6 +1187,12 @@ NS_INLINE NSString* dumpSubview(UIView* view){
  */
 NS_INLINE UIImage*
 imageImmediateLoadWithContentsOfFile(NSString* path){
+#ifdef TYABUTA_RESOURCE_PREFETCHER_H
+    // 先読みでデコード済みであれば、それを使う。
+    UIImage* prefetched = ResourcePrefetcherTakeImage(path);
+    ResourcePrefetcherRecord(ResourcePrefetchKindImage, path, 0, 0);
+    if (prefetched) return prefetched;
+#endif
     UIImage *image = [[UIImage alloc] initWithContentsOfFile:path];
     CGImageRef imageRef = [image CGImage];
     CGRect rect = CGRectMake(0.f, 0.f, CGImageGetWidth(imageRef), CGImageGetHeight(imageRef));
@@ -1292,6 +1707,9 @@ NS_INLINE void MPMusicPlayerControllerAddVolume(float addVolume){
  *
  * 通知発行も必要ないなら、
  * MPMusicPlayerControllerGeneratingPlaybackNotifications関数で通知発行を停止しましょう。
+ *
+ * 複数のビューで受ける場合はDeviceEvents(EventBus)で購読すると、
+ * 通知の受け取りが一つにまとまり、更新も一フレームに一回になる。
  */
 NS_INLINE void
 MPMusicPlayerControllerRegisterVolumeDidChangeNotification(id observer, SEL selector){
@@ -1479,8 +1897,25 @@ NS_INLINE UIColor* UIColorClearWhite(){
 
 /*
  * 数値文字列を整数値に変換する。
+ * FastNumberを使う場合は、短いASCII文字列をスタック上で解析する。
+ * (先頭の空白を読み飛ばし、数字以降は無視する。integerValueと同じ)
  */
 NS_INLINE int strToInt(NSString* str){
+#ifdef TYABUTA_FAST_NUMBER_H
+    if (nil == str) return 0;
+    char    buf[32];
+    CFIndex length = 0;
+    if (str.length < sizeof(buf) &&
+        str.length == CFStringGetBytes((__bridge CFStringRef)str, CFRangeMake(0, str.length),
+                                       kCFStringEncodingASCII, 0, false,
+                                       (UInt8*)buf, sizeof(buf), &length)) {
+        CFIndex i = 0;
+        while (i < length && isspace((unsigned char)buf[i])) i++;
+        int64_t value = 0;
+        FastParseInt64(buf + i, (size_t)(length - i), &value);
+        return (int)value;
+    }
+#endif
     return (int)[str integerValue];
 }
 
@@ -1495,16 +1930,36 @@ NS_INLINE UIFont* systemFontOfSize(CGFloat size){
 
 /*
  * UUID文字列を生成する
+ * CFUUIDCreateStringと同じ大文字の形式で、作るオブジェクトはNSString一つのみ。
  */
 NS_INLINE NSString* UUIDGenerate(){
-    CFUUIDRef   uuidRef = CFUUIDCreate(kCFAllocatorDefault);
-    CFStringRef uuidStr = CFUUIDCreateString(kCFAllocatorDefault, uuidRef);
-    CFRelease(uuidRef);
+    char str[37];
+#ifdef TYABUTA_UUID_GENERATOR_H
+    UUIDBytes uuid;
+    UUIDGenerateV4Bytes(&uuid, 1);
+    UUIDFormat(&uuid, str);
+#else
+    uuid_t uuid;
+    uuid_generate_random(uuid);
+    uuid_unparse_upper(uuid, str);
+#endif
+    return [[NSString alloc] initWithBytes:str length:36 encoding:NSASCIIStringEncoding];
+}
 
-    NSString* fileName = [NSString stringWithString:(__bridge NSString*)uuidStr];
-    CFRelease(uuidStr);
-    return fileName;
+/*
+ * #import "UUIDGenerator.h"
+ * 時刻順に並ぶUUID(v7)文字列を生成する。
+ * キャッシュのファイル名等に使うと、近い時刻に作った物がまとまって並ぶ。
+ */
+#ifdef TYABUTA_UUID_GENERATOR_H
+NS_INLINE NSString* UUIDGenerateV7(){
+    char      str[UUID_STRING_LENGTH];
+    UUIDBytes uuid;
+    UUIDGenerateV7Bytes(&uuid, 1);
+    UUIDFormat(&uuid, str);
+    return [[NSString alloc] initWithBytes:str length:UUID_STRING_LENGTH encoding:NSASCIIStringEncoding];
 }
+#endif // TYABUTA_UUID_GENERATOR_H
 
 /*
  * 指定のサイズに丁度フィットするCGRectを計算する。
@@ -1612,6 +2067,9 @@ NS_INLINE float UIDeviceBatteryGetLevel(){
  * notification.name プロパティでどの通知が発生したのかがわかる。
  * UIDeviceBatteryLevelDidChangeNotification
  * UIDeviceBatteryStateDidChangeNotification
+ *
+ * 複数のビューで受ける場合はDeviceEvents(EventBus)で購読すると、
+ * 通知の受け取りが一つにまとまり、更新も一フレームに一回になる。
  */
 NS_INLINE void
 UIDeviceBatteryRegisterStateAndLevelDidChangeNotification(id  observer,